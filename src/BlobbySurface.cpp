@@ -7,6 +7,8 @@ void BlobbySurface::init(void)
 	cutoff = DEFAULT_CUTOFF;
 	surfType = MOLECULAR_SURFACE;
 	providesAnalyticalNormals = false;
+	rayMarching = false;
+	density = NULL;
 }
 
 
@@ -17,6 +19,7 @@ void BlobbySurface::init(ConfigFile* cf)
 	// Set up inside value
 	inside = 5;
 	setBlobbyness(blobby_B);
+	setRayMarching(cf->read<bool>( "Blobby_Ray_Marching", false ));
 }
 
 
@@ -47,7 +50,11 @@ BlobbySurface::~BlobbySurface()
 
 void BlobbySurface::clear()
 {
-	;
+	if (density != NULL)
+	{
+		delete density;
+		density = NULL;
+	}
 }
 
 void BlobbySurface::setBlobbyness(double b)
@@ -69,6 +76,8 @@ double BlobbySurface::getBlobbyness()
 
 int BlobbySurface::getNumPatches (void)
 {
+	if (rayMarching && density != NULL)
+		return density->getNumPatches();
 	// to eventually be defined ...
 	return 0;
 }
@@ -92,10 +101,29 @@ bool BlobbySurface::build()
 	
 	cout << endl << INFO << "Using cut-off " << cutoff << " num neighbour grid points " << numgrid;
 
+	if (rayMarching)
+	{
+		// rays and projections are solved directly on the density, no field and no mesh
+		providesAnalyticalNormals = true;
+
+		if (density != NULL)
+			delete density;
+
+		density = new ImplicitSurface<GaussianKernel>(delphi);
+		density->getKernel().B = B;
+		density->getKernel().cutoff = cutoff;
+
+		return density->build();
+	}
+
 	if (scalarField != NULL)
-		deleteMatrix3D<double>(last_nx,last_ny,last_nz,scalarField);
-	
-	scalarField = allocateMatrix3D<double>(delphi->nx,delphi->ny,delphi->nz);
+		deleteVector<float>(scalarField);
+
+	int64_t NX = delphi->nx;
+	int64_t NY = delphi->ny;
+	int64_t NZ = delphi->nz;
+
+	scalarField = allocateVector<float>(NX*NY*NZ);
 
 	if (scalarField == NULL)
 	{
@@ -103,55 +131,55 @@ bool BlobbySurface::build()
 		exit(-1);
 	}
 
-	for (int k=0; k<delphi->nz; k++)
-		for (int j=0; j<delphi->ny; j++)
-			for (int i=0; i<delphi->nx; i++)
-				scalarField[k][j][i] = 0.0;
-
-	// Atom **atoms = delphi->atoms;
 	std::vector<Atom> &atoms = delphi->atoms;
+	int na = (int)atoms.size();
+
+	auto chrono_start = chrono::high_resolution_clock::now();
 
-	printf("\n");
-	// int na = delphi->numAtoms;
-	unsigned na = atoms.size();
+	// the grid is split in z slabs, each one written by a single thread; an atom is
+	// binned into all the slabs its cut-off window overlaps
+	int num_threads = 1;
+	#ifdef ENABLE_BOOST_THREADS
+	num_threads = conf.numThreads;
+	#endif
+
+	int num_slabs = (int)MIN(NZ, (int64_t)num_threads*BLOBBY_SLABS_PER_THREAD);
+	int slab_size = (int)((NZ + num_slabs - 1) / num_slabs);
+	num_slabs = (int)((NZ + slab_size - 1) / slab_size);
+
+	vector<int> *slab_atoms = new vector<int> [num_slabs];
 
-	// fill surface class structures
 	for (int i=0; i<na; i++)
 	{
-		printf("\r%sBlobby %.2f%%        ", INFO, ((float)i+1)/na*100.0);
-		// double *pos = atoms[i]->pos;
-		double *pos = atoms[i].pos;
-		// double r = atoms[i]->radius;
-		double r = atoms[i].radius;
-		double r2 = r*r;
-		// get ref grid point
-		int ix = (int)rintp((pos[0]-delphi->xmin)*delphi->scale);
-		int iy = (int)rintp((pos[1]-delphi->ymin)*delphi->scale);
-		int iz = (int)rintp((pos[2]-delphi->zmin)*delphi->scale);
-
-		int start_x = MAX(0,(ix-numgrid));
-		int start_y = MAX(0,(iy-numgrid));
+		int iz = (int)rintp((atoms[i].pos[2]-delphi->zmin)*delphi->scale);
 		int start_z = MAX(0,(iz-numgrid));
+		int end_z = (int)MIN(NZ,(int64_t)(iz+numgrid));
 
-		int end_x = MIN((delphi->nx),(ix+numgrid));
-		int end_y = MIN((delphi->ny),(iy+numgrid));
-		int end_z = MIN((delphi->nz),(iz+numgrid));
+		if (start_z >= end_z)
+			continue;
 
-		for (int kk=start_z; kk<end_z; kk++)
-			for (int jj=start_y; jj<end_y; jj++)
-				for (int ii=start_x; ii<end_x; ii++)
-				{
-					double dist2 = 0;
-					double p[3];
-					p[0] = delphi->x[ii]-delphi->hside;
-					p[1] = delphi->y[jj]-delphi->hside;
-					p[2] = delphi->z[kk]-delphi->hside;
-					DIST2(dist2,p,pos);
-
-					scalarField[kk][jj][ii] += exp(B*(dist2/r2-1));
-				}
+		for (int sl=start_z/slab_size; sl<=(end_z-1)/slab_size; sl++)
+			slab_atoms[sl].push_back(i);
 	}
-	
+
+	#ifdef ENABLE_BOOST_THREADS
+	boost::thread_group thdGroup;
+
+	for (int j=0; j<num_threads; j++)
+		thdGroup.create_thread(boost::bind(&BlobbySurface::buildScalarFieldSlabs, this, slab_atoms, num_slabs, slab_size, numgrid, j, num_threads));
+
+	thdGroup.join_all();
+	#else
+	buildScalarFieldSlabs(slab_atoms, num_slabs, slab_size, numgrid, 0, 1);
+	#endif
+
+	delete[] slab_atoms;
+
+	auto chrono_end = chrono::high_resolution_clock::now();
+	chrono::duration<double> field_time = chrono_end - chrono_start;
+	cout << endl << INFO << "Blobby scalar field time ";
+	printf("%.4e [s]", field_time.count());
+
 	bool old = accurateTriangulation;
 	bool old_saveMSMS = saveMSMS;
 	bool old_vertexAtomsMapFlag = vertexAtomsMapFlag;	
@@ -207,7 +235,7 @@ bool BlobbySurface::build()
 	
 	cout << "ok!";
 
-	deleteMatrix3D<double>(delphi->nx,delphi->ny,delphi->nz,scalarField);
+	deleteVector<float>(scalarField);
 	
 	sprintf(buff,"%sblobby.off",conf.rootFile.c_str());
 
@@ -228,8 +256,128 @@ bool BlobbySurface::build()
 }
 
 
+void BlobbySurface::buildScalarFieldSlabs(vector<int> *slab_atoms, int num_slabs, int slab_size, int numgrid, int thread_id, int num_threads)
+{
+	int64_t NX = delphi->nx;
+	int64_t NY = delphi->ny;
+	int64_t NZ = delphi->nz;
+
+	std::vector<Atom> &atoms = delphi->atoms;
+
+	// per-axis factors of the gaussian, exp(a*(dx^2+dy^2+dz^2)) = ex*ey*ez
+	float *ex = allocateVector<float>(2*numgrid+1);
+	float *ey = allocateVector<float>(2*numgrid+1);
+	float *ez = allocateVector<float>(2*numgrid+1);
+
+	for (int sl=thread_id; sl<num_slabs; sl+=num_threads)
+	{
+		int slab_start = sl*slab_size;
+		int slab_end = (int)MIN(NZ, (int64_t)(sl+1)*slab_size);
+
+		for (int64_t i=slab_start*NY*NX; i<slab_end*NY*NX; i++)
+			scalarField[i] = 0.f;
+
+		for (unsigned int l=0; l<slab_atoms[sl].size(); l++)
+		{
+			int ia = slab_atoms[sl][l];
+			double *pos = atoms[ia].pos;
+			double r = atoms[ia].radius;
+			double a = B/(r*r);
+
+			// get ref grid point
+			int ix = (int)rintp((pos[0]-delphi->xmin)*delphi->scale);
+			int iy = (int)rintp((pos[1]-delphi->ymin)*delphi->scale);
+			int iz = (int)rintp((pos[2]-delphi->zmin)*delphi->scale);
+
+			int start_x = MAX(0,(ix-numgrid));
+			int start_y = MAX(0,(iy-numgrid));
+			int start_z = MAX(slab_start,(iz-numgrid));
+
+			int end_x = (int)MIN(NX,(int64_t)(ix+numgrid));
+			int end_y = (int)MIN(NY,(int64_t)(iy+numgrid));
+			int end_z = MIN(slab_end,(iz+numgrid));
+
+			if (start_x >= end_x || start_y >= end_y || start_z >= end_z)
+				continue;
+
+			for (int ii=start_x; ii<end_x; ii++)
+			{
+				double d = delphi->x[ii]-delphi->hside-pos[0];
+				ex[ii-start_x] = (float)exp(a*d*d);
+			}
+			for (int jj=start_y; jj<end_y; jj++)
+			{
+				double d = delphi->y[jj]-delphi->hside-pos[1];
+				ey[jj-start_y] = (float)exp(a*d*d);
+			}
+			// the constant factor exp(-B) is folded into the z table
+			for (int kk=start_z; kk<end_z; kk++)
+			{
+				double d = delphi->z[kk]-delphi->hside-pos[2];
+				ez[kk-start_z] = (float)exp(a*d*d-B);
+			}
+
+			int len_x = end_x-start_x;
+
+			for (int kk=start_z; kk<end_z; kk++)
+				for (int jj=start_y; jj<end_y; jj++)
+				{
+					float eyz = ey[jj-start_y]*ez[kk-start_z];
+					float *row = &scalarField[ (kk*NY + jj)*NX + start_x ];
+
+					for (int ii=0; ii<len_x; ii++)
+						row[ii] += eyz*ex[ii];
+				}
+		}
+	}
+
+	deleteVector<float>(ex);
+	deleteVector<float>(ey);
+	deleteVector<float>(ez);
+}
+
+
 void  BlobbySurface::printSummary()
 {
 	cout << endl << INFO << "Blobbyness value " << getBlobbyness();
 	cout << endl << INFO << "Cut-off distance " << cutoff << " [A]";
+	if (rayMarching)
+		cout << endl << INFO << "Ray marching on the blobby density, no mesh is built";
+}
+
+
+void BlobbySurface::preProcessPanel(void)
+{
+	if (!rayMarching)
+		MeshSurface::preProcessPanel();
+}
+
+
+bool BlobbySurface::preBoundaryProjection(void)
+{
+	if (!rayMarching)
+		return MeshSurface::preBoundaryProjection();
+	return true;
+}
+
+
+void BlobbySurface::getRayIntersection(double pa[3], double pb[3], vector<pair<VERTEX_TYPE,VERTEX_TYPE*>> &intersections, bool computeNormals, int thread_id)
+{
+	if (!rayMarching)
+	{
+		MeshSurface::getRayIntersection(pa,pb,intersections,computeNormals,thread_id);
+		return;
+	}
+
+	density->marchRay(pa,pb,intersections,computeNormals,thread_id,normalsBuffers[thread_id]);
+}
+
+
+bool BlobbySurface::getProjection(double p[3], double *proj1, double *proj2,
+								  double *proj3, double *normal1, double *normal2, double *normal3)
+{
+	if (!rayMarching)
+		return MeshSurface::getProjection(p,proj1,proj2,proj3,normal1,normal2,normal3);
+
+	return density->getProjection(p,proj1,proj2,proj3,normal1,normal2,normal3);
 }
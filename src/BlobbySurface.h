@@ -9,6 +9,7 @@
 
 #include "Surface.h"
 #include "MeshSurface.h"
+#include "ImplicitSurface.h"
 
 #ifdef DBGMEM_CRT
 	#define _CRTDBG_MAP_ALLOC
@@ -17,6 +18,9 @@
 
 #define DEFAULT_BLOBBYNESS -2.5
 #define DEFAULT_CUTOFF 6
+/** number of z slabs per thread used to balance the scalar field build-up*/
+#define BLOBBY_SLABS_PER_THREAD 4
+
 /** @brief This class builds the blobby surface, triangulate it and the use mesh surface routines
 for the rest of the work.
 
@@ -32,7 +36,22 @@ private:
 	/** cut-off distance in Angstrom to speed-up computations. It is computed based on B value.
 	The bigger the gaussian the less the cut-off*/
 	double cutoff;
-	
+
+	/** accumulate the gaussians of the atoms in slab_atoms into the z planes of the slabs
+	thread_id, thread_id+num_threads, ... Each slab is slab_size planes thick and it is written by one thread only*/
+	void buildScalarFieldSlabs(vector<int> *slab_atoms, int num_slabs, int slab_size, int numgrid, int thread_id, int num_threads);
+
+	/** if true the blobby is neither sampled on the grid nor triangulated: rays and projections
+	are solved on the fly on the blobby density*/
+	bool rayMarching;
+	/** in ray marching mode the blobby density is the gaussian implicit surface with the blobby
+	blobbyness and cut-off; it provides the atoms cell list, the marching and the projections*/
+	ImplicitSurface<GaussianKernel> *density;
+
+protected:
+	/** in ray marching mode there is no mesh to pre-process*/
+	virtual void preProcessPanel(void);
+
 public:
 	/** Default constructor*/
 	BlobbySurface();
@@ -44,8 +63,17 @@ public:
 	virtual int getNumPatches(void);
 	virtual bool isPatchBasedRayTracingSupported (void);
 
-	/** Compute blobby mesh and run MeshSurface::build(void)*/
+	/** Compute blobby mesh and run MeshSurface::build(void). In ray marching mode only the
+	atoms cell list is built*/
 	virtual bool build(void);
+	/** In ray marching mode nothing is needed beyond the atoms cell list*/
+	virtual bool preBoundaryProjection(void);
+	/** Get a projection of a point on the surface. Return projection and normal*/
+	virtual bool getProjection(double p[3],double *proj1,double *proj2,
+							   double *proj3,double *normal1,double *normal2,double *normal3);
+	/** Get all the intersections of a ray that goes from P1 to P2 over the surface, either
+	on the blobby mesh or, in ray marching mode, on the blobby density itself*/
+	virtual void getRayIntersection(double pa[3], double pb[3], vector<pair<VERTEX_TYPE,VERTEX_TYPE*>> &intersections, bool computeNormals,int thread_id);
 	/** Print number a summary of the blobby*/
 	virtual void printSummary(void);
 	/** function for the constructor without arguments*/
@@ -60,6 +88,16 @@ public:
 	void setBlobbyness(double b);
 	double getBlobbyness(void);
 
+	void setRayMarching(bool m)
+	{
+		rayMarching = m;
+	}
+
+	bool getRayMarching(void)
+	{
+		return rayMarching;
+	}
+
 	virtual ~BlobbySurface();
 };
 
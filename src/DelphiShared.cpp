@@ -2,6 +2,17 @@
 #include "DelphiShared.h"
 #include <cstdlib>
 #include <sstream>
+#include <atomic>
+
+// last atomsVersion given; objects may be built by concurrent threads (see the Python batch)
+static std::atomic<uint64_t> lastAtomsVersion(0);
+
+
+void DelPhiShared::atomsChanged()
+{
+	atomsVersion = ++lastAtomsVersion;
+}
+
 
 void DelPhiShared::init()
 {
@@ -29,6 +40,8 @@ void DelPhiShared::init()
 	maxNumAtoms = -1;
 	domainShrinkage = 0.;
 	optimizeGrids = true;
+	explicitGrid = false;
+	atomsChanged();
 }
 
 
@@ -44,18 +57,20 @@ DelPhiShared::DelPhiShared(double scale, double *coord_min, double *coord_max,
 						   const std::vector<Atom> &ats, int max_num_atoms, double domain_shrinkage, bool optimize_grids, bool eps_flag, bool stat_flag, bool multi,double tol)
 {
 	init();
-	init(scale,coord_min,coord_max,ats,max_num_atoms,domain_shrinkage,optimize_grids,eps_flag,stat_flag,multi,tol);
+	if (!init(scale,coord_min,coord_max,ats,max_num_atoms,domain_shrinkage,optimize_grids,eps_flag,stat_flag,multi,tol))
+		exit(-1);
 }
 
 
 // SD: PB_NEW
 // new constructor for API
-void DelPhiShared::init(double scale, double *coord_min, double *coord_max,
+bool DelPhiShared::init(double scale, double *coord_min, double *coord_max,
 						const std::vector<Atom> &ats, int max_num_atoms, double domain_shrinkage, bool optimize_grids,
 						bool eps_flag, bool stat_flag, bool multi,double tol)
 {
 	cout << endl << INFO << "Starting grid new PB initialization";
 	atoms = ats;
+	atomsChanged();
 	buildEpsMap = eps_flag;
 	buildStatus = stat_flag;
 	multi_diel = multi;
@@ -68,9 +83,10 @@ void DelPhiShared::init(double scale, double *coord_min, double *coord_max,
 	if (!flag)
 	{
 		cout << endl << ERR << "DelPhiShared object initialization failed";
-		exit(-1);
+		return false;
 	}
 	cout << endl << INFO << "Initialization completed";
+	return true;
 }
 
 
@@ -111,6 +127,7 @@ void DelPhiShared::init(double scale, double perfill, const std::vector<Atom> &a
 						bool eps_flag, bool stat_flag, bool multi, bool atinfo)
 {
 	atoms = ats;
+	atomsChanged();
 	buildEpsMap = eps_flag;
 	buildStatus = stat_flag;
 	multi_diel = multi;
@@ -150,6 +167,30 @@ DelPhiShared::DelPhiShared(double scale, double perfill, const std::vector<Atom>
 }
 
 
+DelPhiShared::DelPhiShared(double scale, double perfill, int na, const double *pos, const double *r,
+						   const double *q, const int *d, int max_num_atoms, double domain_shrinkage,
+						   bool optimize_grids, bool eps_flag, bool stat_flag, bool multi)
+{
+	init();
+
+	buildEpsMap = eps_flag;
+	buildStatus = stat_flag;
+	multi_diel = multi;
+	isAvailableAtomInfo = false;
+	maxNumAtoms = max_num_atoms;
+	domainShrinkage = domain_shrinkage;
+	optimizeGrids = optimize_grids;
+	this->scale = scale;
+	this->perfill = perfill;
+
+	if (!setAtoms(na,pos,r,q,d))
+	{
+		cout << endl << ERR << "DelPhiShared object initialization failed";
+		exit(-1);
+	}
+}
+
+
 void DelPhiShared::DelPhiBinding(	double xmin,double ymin,double zmin,
 									double xmax,double ymax,double zmax,
 									double c1,double c2,double c3,double rmax,double perf,
@@ -332,6 +373,7 @@ bool DelPhiShared::loadAtoms(string fn)
 	// Atom *atm;
 	if (atoms.size() != 0)
 		atoms.clear();
+	atomsChanged();
 
 	bool is_pqr_file = false;
 
@@ -679,13 +721,13 @@ bool DelPhiShared::loadAtoms(string fn)
 		cout << endl << ERR << "NanoShaper needs at least 4 atoms to work.";
 		cout << endl << REMARK << "To emulate 4 atoms you can place dummy atoms with null radius";
 		cout << endl << REMARK << "at the same centers of the real atoms";
-		exit(-1);
+		return false;
 	}
 
 	if (max_rad == 0)
 	{
 		cout << endl << ERR << "All null radii? If you are using place holders atoms please set at least one radius > 0";
-		exit(-1);
+		return false;
 	}
 
 	#if !defined(AVOID_MEM_CHECKS)
@@ -714,6 +756,7 @@ bool DelPhiShared::loadAtoms(int na, double *x, double *r, double *q, int *d, ch
 	*/
 	if (atoms.size() != 0)
 		atoms.clear();
+	atomsChanged();
 
 	if (r == NULL || x == NULL)
 	{
@@ -772,6 +815,217 @@ bool DelPhiShared::loadAtoms(int na, double *x, double *r, double *q, int *d, ch
 }
 
 
+bool DelPhiShared::setAtoms(int na, const double *pos, const double *r, const double *q, const int *d)
+{
+	if (pos == NULL || r == NULL || na <= 0)
+	{
+		cout << endl << ERR << "Atoms info not available!";
+		return false;
+	}
+
+	// same checks as loadAtoms, done before touching the current atoms
+	if (na < 4)
+	{
+		cout << endl << ERR << "NanoShaper needs at least 4 atoms to work.";
+		cout << endl << REMARK << "To emulate 4 atoms you can place dummy atoms with null radius";
+		cout << endl << REMARK << "at the same centers of the real atoms";
+		return false;
+	}
+
+	double max_rad = 0;
+	for (int i=0; i<na; i++)
+		max_rad = MAX(max_rad,r[i]);
+
+	if (max_rad == 0)
+	{
+		cout << endl << ERR << "All null radii? If you are using place holders atoms please set at least one radius > 0";
+		return false;
+	}
+
+	if ((int)atoms.size() == na)
+	{
+		// same atoms, possibly moved: update them in place keeping their atom info
+		for (int i=0; i<na; i++)
+		{
+			atoms[i].pos[0] = pos[i*3];
+			atoms[i].pos[1] = pos[i*3+1];
+			atoms[i].pos[2] = pos[i*3+2];
+			atoms[i].radius = r[i];
+			atoms[i].radius2 = r[i]*r[i];
+			atoms[i].charge = (q == NULL) ? 0 : q[i];
+			atoms[i].dielectric = (d == NULL) ? 0 : d[i];
+		}
+	}
+	else
+	{
+		atoms.clear();
+		atoms.reserve(na);
+		isAvailableAtomInfo = false;
+
+		for (int i=0; i<na; i++)
+			atoms.push_back(Atom(pos[i*3],pos[i*3+1],pos[i*3+2],r[i],(q == NULL) ? 0 : q[i],(d == NULL) ? 0 : d[i]));
+	}
+
+	atomsChanged();
+
+	cout << endl << INFO << "Set " << na << " atoms";
+
+	return updateGrid(NULL);
+}
+
+
+bool DelPhiShared::setCoordinates(const double *pos)
+{
+	if (pos == NULL || atoms.size() == 0)
+	{
+		cout << endl << ERR << "Atoms info not available!";
+		return false;
+	}
+
+	unsigned numAtoms = atoms.size();
+
+	for (unsigned i=0; i<numAtoms; i++)
+	{
+		atoms[i].pos[0] = pos[i*3];
+		atoms[i].pos[1] = pos[i*3+1];
+		atoms[i].pos[2] = pos[i*3+2];
+	}
+	atomsChanged();
+	return true;
+}
+
+
+bool DelPhiShared::updateGrid(bool *kept)
+{
+	if (kept != NULL)
+		*kept = false;
+
+	if (x == NULL || y == NULL || z == NULL)
+		return buildGrid(scale,perfill);
+
+	clearBoundaryGridPoints();
+
+	// the grid built by buildGrid(scale,perfill) leaves (100-perfill)% of margin around the atoms;
+	// it is kept as long as the atoms do not eat more than half of that margin
+	double cmin[3],cmax[3];
+	getBounds(cmin,cmax);
+
+	double gmin[3] = {xmin,ymin,zmin};
+	double gmax[3] = {xmax,ymax,zmax};
+	bool fits = true;
+
+	for (int c=0; c<3; c++)
+	{
+		double mid = (gmax[c]+gmin[c])/2.;
+		double half = (gmax[c]-gmin[c])/2.*(100.+perfill)/200.;
+
+		if (cmin[c] < mid-half || cmax[c] > mid+half)
+			fits = false;
+	}
+
+	// a grid given by its bounds is never changed
+	if (!fits && explicitGrid)
+		cout << endl << WARN << "Atoms out of the given grid, keeping it anyway";
+	else if (!fits)
+	{
+		cout << endl << INFO << "Atoms out of the current grid, building a new one";
+		return buildGrid(scale,perfill);
+	}
+	else
+	{
+		cout << endl << INFO << "Atoms fit the current grid, reusing it";
+		// the surfaces size their atom acceleration grids on the baricenter and rmaxdim of the atoms,
+		// which have moved; a grid given by its bounds keeps those of its box
+		if (!explicitGrid)
+			setAtomsBaricenter();
+	}
+
+	resetMaps();
+
+	if (kept != NULL)
+		*kept = true;
+	return true;
+}
+
+
+void DelPhiShared::resetMaps()
+{
+	int64_t tot = nx*ny*nz;
+
+	if (buildEpsMap)
+	{
+		if (epsmap != NULL)
+			clearEpsMaps();
+
+		if (idebmap != NULL)
+			for (int64_t i=0; i<tot; i++)
+				idebmap[i] = true;
+	}
+
+	if (buildStatus)
+	{
+		if (!optimizeGrids)
+		{
+			if (status != NULL)
+				for (int64_t i=0; i<tot; i++)
+					status[i] = STATUS_POINT_TEMPORARY_OUT;
+		}
+		// a bilevel grid without cells reads as temporary outside everywhere
+		else if (bilevel_status != NULL)
+			deleteBilevelGridCells<int>(bilevel_status, nx, ny, nz);
+	}
+
+	clearBoundaryGridPoints();
+}
+
+
+void DelPhiShared::clearBoundaryGridPoints()
+{
+	// boundary grid points are allocated by the surface at each build,
+	// in DelPhi binding mode they belong to DelPhi
+	if (delphiBinding)
+		return;
+
+	if (ibgp != NULL)
+		deleteVector<int>(ibgp);
+	if (scspos != NULL)
+		deleteVector<double>(scspos);
+	if (scsnor != NULL)
+		deleteVector<double>(scsnor);
+	if (scsarea != NULL)
+		deleteVector<double>(scsarea);
+	nbgp = 0;
+}
+
+
+void DelPhiShared::setAtomsBaricenter()
+{
+	double cmin[3],cmax[3];
+
+	getBounds(cmin,cmax);
+
+	baricenter[0] = (cmax[0] + cmin[0])/2.;
+	baricenter[1] = (cmax[1] + cmin[1])/2.;
+	baricenter[2] = (cmax[2] + cmin[2])/2.;
+
+	double v[6];
+	v[0] = fabs(cmax[0] - baricenter[0]);
+	v[1] = fabs(cmin[0] - baricenter[0]);
+	v[2] = fabs(cmax[1] - baricenter[1]);
+	v[3] = fabs(cmin[1] - baricenter[1]);
+	v[4] = fabs(cmax[2] - baricenter[2]);
+	v[5] = fabs(cmin[2] - baricenter[2]);
+
+	rmaxdim = -INFINITY;
+
+	for (int i=0; i<6; i++)
+		if (rmaxdim < v[i])
+			rmaxdim = v[i];
+
+	rmaxdim = 2*rmaxdim;
+}
+
+
 void DelPhiShared::getBounds(double *cmin,double *cmax)
 {
 	cmin[0] = INFINITY;
@@ -815,6 +1069,7 @@ bool DelPhiShared::buildGrid(double scale, double *cmin, double *cmax,double TOL
 
 	this->scale = scale;
 	this->perfill = 100;
+	explicitGrid = true;
 	
 	side = 1./scale;
 
@@ -1058,34 +1313,14 @@ bool DelPhiShared::buildGrid(double scale, double perfill)
 
 	this->scale = scale;
 	this->perfill = perfill;
+	explicitGrid = false;
 
-	double cmin[3],cmax[3],oldmid[3];
+	setAtomsBaricenter();
 
-	getBounds(cmin,cmax);
-
-	oldmid[0] = (cmax[0] + cmin[0])/2.;
-	oldmid[1] = (cmax[1] + cmin[1])/2.;
-	oldmid[2] = (cmax[2] + cmin[2])/2.;
+	double *oldmid = baricenter;
 
 	cout << endl << INFO << "Geometric baricenter ->  " << oldmid[0] << 
 		" " << oldmid[1] << " " << oldmid[2];
-
-	double v[6];
-	v[0] = fabs(cmax[0] - oldmid[0]);
-	v[1] = fabs(cmin[0] - oldmid[0]);
-	v[2] = fabs(cmax[1] - oldmid[1]);
-	v[3] = fabs(cmin[1] - oldmid[1]);
-	v[4] = fabs(cmax[2] - oldmid[2]);
-	v[5] = fabs(cmin[2] - oldmid[2]);
-
-	rmaxdim = -INFINITY;
-
-	for (int i=0; i<6; i++)
-		if (rmaxdim < v[i])
-			rmaxdim = v[i];
-
-	rmaxdim = 2*rmaxdim;
-
 	       
 	unsigned int igrid = (unsigned int)floor(scale*100./perfill*rmaxdim);
 
@@ -1094,10 +1329,6 @@ bool DelPhiShared::buildGrid(double scale, double perfill)
 	
 	cout << endl << INFO << "Grid is " << igrid;
 
-	baricenter[0] = oldmid[0];
-	baricenter[1] = oldmid[1];
-	baricenter[2] = oldmid[2];
-
 	xmin = oldmid[0] - (igrid-1)/(2*scale);
 	ymin = oldmid[1] - (igrid-1)/(2*scale);
 	zmin = oldmid[2] - (igrid-1)/(2*scale);
@@ -1125,6 +1356,13 @@ bool DelPhiShared::buildGrid(double scale, double perfill)
 	y = allocateVector<double>(igrid);
 	z = allocateVector<double>(igrid);
 
+	// the bilevel status map of a previous grid is freed by its sizes
+	if (bilevel_status != NULL)
+	{
+		deleteBilevelGridCells<int>(bilevel_status, nx, ny, nz);
+		deleteVector<int *>(bilevel_status);
+	}
+
 	side = 1./scale;
 	hside = 0.5/scale;
 	A = side*side;
@@ -1187,11 +1425,6 @@ bool DelPhiShared::buildGrid(double scale, double perfill)
 		}
 		else
 		{
-			if (bilevel_status != NULL)
-			{
-				deleteBilevelGridCells<int>(bilevel_status, nx, ny, nz);
-				deleteVector<int *>(bilevel_status);
-			}
 			bilevel_status = allocateBilevelGridCells<int>(nx, ny, nz);
 		}
 	}
@@ -1261,6 +1494,15 @@ void DelPhiShared::saveIdebMap(char *fname)
 	}
 
 	char f1[BUFLEN];
+
+	if (conf.mapsFormat != MAPS_FORMAT_TEXT)
+	{
+		sprintf(f1,"%s%s.idebmap.nsmap",conf.rootFile.c_str(),fname);
+		const int maps[1] = {SAVED_MAP_IDEB};
+		saveMapsContainer(f1,maps,1,conf.mapsFormat == MAPS_FORMAT_RLE);
+		return;
+	}
+
 	// if (debug_stern == -1)
 	sprintf(f1,"%s%s.idebmap.txt",conf.rootFile.c_str(),fname);
 	//else
@@ -1293,6 +1535,15 @@ void DelPhiShared::saveEpsMaps(char *fname)
 	}
 	
 	char f1[BUFLEN],f2[BUFLEN],f3[BUFLEN];
+
+	if (conf.mapsFormat != MAPS_FORMAT_TEXT)
+	{
+		sprintf(f1, "%s%s.epsmap.nsmap", conf.rootFile.c_str(),fname);
+		const int maps[3] = {SAVED_MAP_EPS_X, SAVED_MAP_EPS_Y, SAVED_MAP_EPS_Z};
+		saveMapsContainer(f1,maps,3,conf.mapsFormat == MAPS_FORMAT_RLE);
+		return;
+	}
+
 	sprintf(f1, "%s%s.epsmapx.txt", conf.rootFile.c_str(),fname);
 	sprintf(f2, "%s%s.epsmapy.txt", conf.rootFile.c_str(),fname);
 	sprintf(f3, "%s%s.epsmapz.txt", conf.rootFile.c_str(),fname);
@@ -1392,6 +1643,9 @@ void DelPhiShared::clear()
 	if (idebmap != NULL)
 		deleteVector<bool>(idebmap);
 
+	vector<int>().swap(flatStatus);
+	vector<int>().swap(cavityLabels);
+
     if (atoms.size() != 0)
         atoms.clear();
 
@@ -1427,18 +1681,33 @@ void DelPhiShared::saveBGP(char *fname)
 	}
 
 	char ff[BUFLEN];
-	sprintf(ff, "%s%s.projections.txt", conf.rootFile.c_str(),fname);
-	FILE *fp = fopen(ff, "w");
+	// the projections file follows the maps format, surf.txt (positions and normals only)
+	// is always written as text
+	bool text = conf.mapsFormat == MAPS_FORMAT_TEXT;
+	FILE *fp = NULL;
+
+	if (!text)
+	{
+		sprintf(ff, "%s%s.projections.nsmap", conf.rootFile.c_str(),fname);
+		const int maps[3] = {SAVED_MAP_BGP_INDEXES, SAVED_MAP_BGP_POSITIONS, SAVED_MAP_BGP_NORMALS};
+		saveMapsContainer(ff,maps,3,false);
+	}
+	else
+	{
+		sprintf(ff, "%s%s.projections.txt", conf.rootFile.c_str(),fname);
+		fp = fopen(ff, "w");
+		fprintf(fp, "%d\n", nbgp);
+	}
 	sprintf(ff, "%ssurf.txt", conf.rootFile.c_str());
 	FILE *fp2 = fopen(ff, "w");
-	fprintf(fp, "%d\n", nbgp);
 
 	for (int iibgp=0; iibgp<nbgp; iibgp++)
 	{
-		fprintf(fp,"%d %d %d %lf %lf %lf %lf %lf %lf",
-				ibgp[iibgp*3]+1, ibgp[iibgp*3+1]+1, ibgp[iibgp*3+2]+1,
-				scspos[iibgp*3], scspos[iibgp*3+1], scspos[iibgp*3+2],
-				scsnor[iibgp*3], scsnor[iibgp*3+1], scsnor[iibgp*3+2]);
+		if (text)
+			fprintf(fp,"%d %d %d %lf %lf %lf %lf %lf %lf",
+					ibgp[iibgp*3]+1, ibgp[iibgp*3+1]+1, ibgp[iibgp*3+2]+1,
+					scspos[iibgp*3], scspos[iibgp*3+1], scspos[iibgp*3+2],
+					scsnor[iibgp*3], scsnor[iibgp*3+1], scsnor[iibgp*3+2]);
 
 		fprintf(fp2,"%lf %lf %lf %lf %lf %lf",
 				scspos[iibgp*3], scspos[iibgp*3+1], scspos[iibgp*3+2],
@@ -1446,11 +1715,13 @@ void DelPhiShared::saveBGP(char *fname)
 
 		if (iibgp < nbgp-1)
 		{
-			fprintf(fp, "\n");
+			if (text)
+				fprintf(fp, "\n");
 			fprintf(fp2, "\n");
 		}
 	}
-	fclose(fp);
+	if (text)
+		fclose(fp);
 	fclose(fp2);
 }
 
@@ -1475,6 +1746,16 @@ void DelPhiShared::saveStatus(char *fname)
 	}
 
 	char ff[BUFLEN];
+
+	if (conf.mapsFormat != MAPS_FORMAT_TEXT)
+	{
+		sprintf(ff, "%s%s.status.nsmap", conf.rootFile.c_str(),fname);
+		const int maps[1] = {SAVED_MAP_STATUS};
+		saveMapsContainer(ff,maps,1,conf.mapsFormat == MAPS_FORMAT_RLE);
+		saveCavities(false);
+		return;
+	}
+
 	sprintf(ff, "%s%s.status.txt", conf.rootFile.c_str(),fname);
 	FILE *fp = fopen(ff, "w");
 
@@ -1502,6 +1783,294 @@ void DelPhiShared::saveStatus(char *fname)
 }
 
 
+/** append the values get(first), ..., get(first+count-1) of type T to out, either raw
+or as (uint32 run length, value) records*/
+template<class T,class G> static void encodeMapValues(const G &get,int64_t first,int64_t count,int codec,vector<char> &out)
+{
+	out.clear();
+
+	if (codec == MAP_CODEC_RAW)
+	{
+		out.resize(count*sizeof(T));
+		T *dst = (T*)out.data();
+
+		for (int64_t n=0; n<count; n++)
+			dst[n] = get(first+n);
+		return;
+	}
+
+	int64_t n = 0;
+
+	while (n < count)
+	{
+		T value = get(first+n);
+		uint32_t run = 1;
+
+		while (n+run < count && run < UINT32_MAX && get(first+n+run) == value)
+			run++;
+
+		size_t pos = out.size();
+		out.resize(pos + sizeof(uint32_t) + sizeof(T));
+		memcpy(&out[pos], &run, sizeof(uint32_t));
+		memcpy(&out[pos+sizeof(uint32_t)], &value, sizeof(T));
+		n += run;
+	}
+}
+
+
+static const char *savedMapName(int map)
+{
+	switch (map)
+	{
+		case SAVED_MAP_EPS_X: return "epsmapx";
+		case SAVED_MAP_EPS_Y: return "epsmapy";
+		case SAVED_MAP_EPS_Z: return "epsmapz";
+		case SAVED_MAP_IDEB: return "idebmap";
+		case SAVED_MAP_STATUS: return "status";
+		case SAVED_MAP_BGP_INDEXES: return "bgp_indexes";
+		case SAVED_MAP_BGP_POSITIONS: return "bgp_positions";
+		case SAVED_MAP_BGP_NORMALS: return "bgp_normals";
+	}
+	return "";
+}
+
+
+static int savedMapType(int map)
+{
+	if (map == SAVED_MAP_IDEB)
+		return MAP_TYPE_UINT8;
+	if (map == SAVED_MAP_BGP_POSITIONS || map == SAVED_MAP_BGP_NORMALS)
+		return MAP_TYPE_FLOAT64;
+	return MAP_TYPE_INT32;
+}
+
+
+void DelPhiShared::encodeMapChunks(vector<MapChunk> *chunks, int thread_id, int num_threads)
+{
+	for (size_t c=thread_id; c<chunks->size(); c+=num_threads)
+	{
+		MapChunk &mc = (*chunks)[c];
+
+		switch (mc.map)
+		{
+			case SAVED_MAP_EPS_X:
+			case SAVED_MAP_EPS_Y:
+			case SAVED_MAP_EPS_Z:
+			{
+				// the three faces of a grid point are contiguous in the epsmap
+				const int *eps = epsmap + (mc.map - SAVED_MAP_EPS_X);
+				encodeMapValues<int32_t>([eps](int64_t n) { return (int32_t)eps[3*n]; }, mc.first, mc.count, mc.codec, mc.data);
+				break;
+			}
+			case SAVED_MAP_IDEB:
+			{
+				const bool *ideb = idebmap;
+				encodeMapValues<uint8_t>([ideb](int64_t n) { return (uint8_t)ideb[n]; }, mc.first, mc.count, mc.codec, mc.data);
+				break;
+			}
+			case SAVED_MAP_STATUS:
+			{
+				if (!optimizeGrids)
+				{
+					const int *st = status;
+					encodeMapValues<int32_t>([st](int64_t n) { return (int32_t)st[n]; }, mc.first, mc.count, mc.codec, mc.data);
+				}
+				else
+				{
+					int **bst = bilevel_status;
+					int64_t NX = nx, NY = ny, NZ = nz;
+					encodeMapValues<int32_t>([bst,NX,NY,NZ](int64_t n)
+					{
+						return (int32_t)readBilevelGrid<int>(bst,STATUS_POINT_TEMPORARY_OUT,n%NX,(n/NX)%NY,n/(NX*NY),NX,NY,NZ);
+					}, mc.first, mc.count, mc.codec, mc.data);
+				}
+				break;
+			}
+			case SAVED_MAP_BGP_INDEXES:
+			{
+				// grid indexes start from 1 as in the text format
+				const int *ind = ibgp;
+				encodeMapValues<int32_t>([ind](int64_t n) { return (int32_t)(ind[n]+1); }, mc.first, mc.count, mc.codec, mc.data);
+				break;
+			}
+			case SAVED_MAP_BGP_POSITIONS:
+			{
+				const double *pos = scspos;
+				encodeMapValues<double>([pos](int64_t n) { return pos[n]; }, mc.first, mc.count, mc.codec, mc.data);
+				break;
+			}
+			case SAVED_MAP_BGP_NORMALS:
+			{
+				const double *nor = scsnor;
+				encodeMapValues<double>([nor](int64_t n) { return nor[n]; }, mc.first, mc.count, mc.codec, mc.data);
+				break;
+			}
+		}
+	}
+}
+
+
+bool DelPhiShared::saveMapsContainer(const char *fileName, const int *maps, int num_maps, bool rle)
+{
+	int num_threads = MAX(1, conf.numThreads);
+
+	// every map is split in chunks of whole z planes (boundary grid points triplets for
+	// the bgp arrays) so that they are encoded in parallel and can be decoded independently
+	vector<MapChunk> chunks;
+	vector<int> num_map_chunks(num_maps);
+
+	for (int m=0; m<num_maps; m++)
+	{
+		bool is_bgp = (maps[m] == SAVED_MAP_BGP_INDEXES || maps[m] == SAVED_MAP_BGP_POSITIONS || maps[m] == SAVED_MAP_BGP_NORMALS);
+		int64_t unit = is_bgp ? 3 : nx*ny;
+		int64_t num_units = is_bgp ? nbgp : nz;
+		int64_t num_chunks = MAX((int64_t)1, MIN(num_units, (int64_t)num_threads*MAP_CHUNKS_PER_THREAD));
+
+		num_map_chunks[m] = (int)num_chunks;
+
+		for (int64_t c=0; c<num_chunks; c++)
+		{
+			MapChunk mc;
+			mc.map = maps[m];
+			mc.codec = (rle && !is_bgp) ? MAP_CODEC_RLE : MAP_CODEC_RAW;
+			mc.first = (num_units*c/num_chunks)*unit;
+			mc.count = (num_units*(c+1)/num_chunks)*unit - mc.first;
+			chunks.push_back(mc);
+		}
+	}
+
+	#ifdef ENABLE_BOOST_THREADS
+	num_threads = MIN(num_threads, (int)chunks.size());
+
+	boost::thread_group thdGroup;
+
+	for (int j=0; j<num_threads; j++)
+		thdGroup.create_thread(boost::bind(&DelPhiShared::encodeMapChunks, this, &chunks, j, num_threads));
+
+	thdGroup.join_all();
+	#else
+	encodeMapChunks(&chunks, 0, 1);
+	#endif
+
+	FILE *fp = fopen(fileName, "wb");
+
+	if (fp == NULL)
+	{
+		cout << endl << WARN << "Cannot write file " << fileName;
+		return false;
+	}
+
+	// Container layout (native little endian):
+	// header: magic "NSMAPS" + 2 zero bytes, int32 version, int32 number of maps,
+	//		int64 nx,ny,nz, float64 x,y,z of the grid point (0,0,0) [A], float64 scale [grid points/A]
+	// maps, one 40 bytes record each: char[16] zero padded name, int32 type (0 uint8, 1 int32, 2 float64),
+	//		int32 codec (0 raw, 1 run length), uint64 number of values, int32 number of chunks, int32 reserved
+	// chunk index, in map order, one 32 bytes entry per chunk: uint64 byte offset from the file start,
+	//		uint64 byte size, uint64 index of the first value, uint64 number of values
+	// chunks: the values, raw or as (uint32 run length, value) records.
+	// Grid maps store the value of grid point (i,j,k) at index i+nx*(j+ny*k); epsmapx/y/z are the faces
+	// from (i,j,k) towards +x/+y/+z. The bgp arrays store one triplet per boundary grid point
+	const char magic[8] = {'N','S','M','A','P','S',0,0};
+	int32_t header[3] = {1, num_maps, 0};
+	int64_t dims[3] = {nx, ny, nz};
+	double origin[3] = {x[0], y[0], z[0]};
+
+	fwrite(magic, sizeof(char), 8, fp);
+	fwrite(&header[0], sizeof(int32_t), 2, fp);
+	fwrite(dims, sizeof(int64_t), 3, fp);
+	fwrite(origin, sizeof(double), 3, fp);
+	fwrite(&scale, sizeof(double), 1, fp);
+
+	for (int m=0, c=0; m<num_maps; m++)
+	{
+		char name[16];
+		memset(name, 0, 16);
+		strncpy(name, savedMapName(maps[m]), 15);
+
+		int32_t type = savedMapType(maps[m]);
+		int32_t codec = chunks[c].codec;
+		uint64_t count = 0;
+
+		for (int l=0; l<num_map_chunks[m]; l++)
+			count += chunks[c+l].count;
+
+		fwrite(name, sizeof(char), 16, fp);
+		fwrite(&type, sizeof(int32_t), 1, fp);
+		fwrite(&codec, sizeof(int32_t), 1, fp);
+		fwrite(&count, sizeof(uint64_t), 1, fp);
+		fwrite(&num_map_chunks[m], sizeof(int32_t), 1, fp);
+		fwrite(&header[2], sizeof(int32_t), 1, fp);
+
+		c += num_map_chunks[m];
+	}
+
+	uint64_t offset = 8 + 2*sizeof(int32_t) + 3*sizeof(int64_t) + 4*sizeof(double) + (uint64_t)num_maps*40 + (uint64_t)chunks.size()*32;
+
+	for (size_t c=0; c<chunks.size(); c++)
+	{
+		uint64_t entry[4] = {offset, (uint64_t)chunks[c].data.size(), (uint64_t)chunks[c].first, (uint64_t)chunks[c].count};
+		fwrite(entry, sizeof(uint64_t), 4, fp);
+		offset += chunks[c].data.size();
+	}
+
+	for (size_t c=0; c<chunks.size(); c++)
+	{
+		if (chunks[c].data.size() > 0)
+			fwrite(chunks[c].data.data(), sizeof(char), chunks[c].data.size(), fp);
+	}
+
+	fclose(fp);
+
+	return true;
+}
+
+
+int *DelPhiShared::getStatusMap(void)
+{
+	if (!optimizeGrids)
+		return status;
+
+	if (bilevel_status == NULL)
+		return NULL;
+
+	flatStatus.resize(nx*ny*nz);
+
+	for (int64_t k=0; k<nz; k++)
+		for (int64_t j=0; j<ny; j++)
+			for (int64_t i=0; i<nx; i++)
+				flatStatus[(k*ny + j)*nx + i] = readBilevelGrid<int>(bilevel_status,STATUS_POINT_TEMPORARY_OUT,i,j,k,nx,ny,nz);
+
+	return flatStatus.data();
+}
+
+
+int *DelPhiShared::getCavityLabels(void)
+{
+	if ((!optimizeGrids && status == NULL) || (optimizeGrids && bilevel_status == NULL))
+		return NULL;
+
+	cavityLabels.resize(nx*ny*nz);
+
+	for (int64_t k=0; k<nz; k++)
+		for (int64_t j=0; j<ny; j++)
+			for (int64_t i=0; i<nx; i++)
+			{
+				int64_t n = (k*ny + j)*nx + i;
+				int st = !optimizeGrids ? status[n] : readBilevelGrid<int>(bilevel_status,STATUS_POINT_TEMPORARY_OUT,i,j,k,nx,ny,nz);
+
+				// the points of cavity c are STATUS_FIRST_CAV+c, its support points are -(STATUS_FIRST_CAV+c)
+				if (st >= STATUS_FIRST_CAV)
+					cavityLabels[n] = st - STATUS_FIRST_CAV;
+				else if (st <= STATUS_FIRST_SUPPORT_CAV)
+					cavityLabels[n] = -st - STATUS_FIRST_CAV;
+				else
+					cavityLabels[n] = -1;
+			}
+
+	return cavityLabels.data();
+}
+
+
 void DelPhiShared::initCav2Atoms()
 {
 	int nc = (int)cavitiesVec->size();
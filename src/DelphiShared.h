@@ -32,6 +32,36 @@ using namespace NS;
 // In a generic cavity point probe could not fit.
 #define STATUS_FIRST_SUPPORT_CAV -4
 
+// maps that can be saved in a binary maps container
+#define SAVED_MAP_EPS_X 0
+#define SAVED_MAP_EPS_Y 1
+#define SAVED_MAP_EPS_Z 2
+#define SAVED_MAP_IDEB 3
+#define SAVED_MAP_STATUS 4
+#define SAVED_MAP_BGP_INDEXES 5
+#define SAVED_MAP_BGP_POSITIONS 6
+#define SAVED_MAP_BGP_NORMALS 7
+
+// element types and codecs of the maps in a binary container
+#define MAP_TYPE_UINT8 0
+#define MAP_TYPE_INT32 1
+#define MAP_TYPE_FLOAT64 2
+#define MAP_CODEC_RAW 0
+#define MAP_CODEC_RLE 1
+
+// number of chunks per thread each saved map is split into
+#define MAP_CHUNKS_PER_THREAD 4
+
+/** @brief a range of consecutive values of a saved map, encoded independently of the others*/
+typedef struct MapChunk
+{
+	int map;
+	int codec;
+	int64_t first;
+	int64_t count;
+	vector<char> data;
+} MapChunk;
+
 //extern double debug_stern;
 
 /** @brief This class is the DelPhi Shared variables environment which emulates the DelPhi environment.
@@ -56,12 +86,17 @@ public:
 	DelPhiShared(double scale,double *coord_min,double *coord_max,const std::vector<Atom> &ats,int max_num_atoms,double domain_shrinkage,bool optimize_grids,bool eps_flag=false,bool stat_flag=false,bool multi=false,double tol_on_integer_grid=1e-2);
 
 	// SD: PB_NEW
-	/** constructor for API Usage. Coupled with buildGrid(double scale,double *cmin,double *cmax)*/
-	void init(double scale,double *coord_min,double *coord_max,const std::vector<Atom> &ats,int max_num_atoms,double domain_shrinkage,bool optimize_grids,bool eps_flag,bool stat_flag,bool multi,double tol_on_integer_grid);
+	/** constructor for API Usage. Coupled with buildGrid(double scale,double *cmin,double *cmax).
+	Returns false if the grid cannot be built*/
+	bool init(double scale,double *coord_min,double *coord_max,const std::vector<Atom> &ats,int max_num_atoms,double domain_shrinkage,bool optimize_grids,bool eps_flag,bool stat_flag,bool multi,double tol_on_integer_grid);
 
     /** constructor associated init*/
     void init(double scale,double perfill,const std::vector<Atom> &ats,int max_num_atoms,double domain_shrinkage,bool optimize_grids,bool eps_flag,bool stat_flag,bool multi,bool atinfo);
 
+	/** constructor for API usage from contiguous arrays: na xyz triplets, na radii and optional (NULL)
+	charges and dielectric ids. See setAtoms*/
+	DelPhiShared(double scale,double perfill,int na,const double *pos,const double *r,const double *q,const int *d,int max_num_atoms,double domain_shrinkage,bool optimize_grids,bool map=false,bool status=true,bool multi=false);
+
 	/** init function-constructor*/
 	void init(int max_num_atoms,double domain_shrinkage,bool optimize_grids,double scale,double perfill,string fn,bool eps_flag,bool stat_flag,bool multi,bool atinfo);
 	
@@ -106,10 +141,36 @@ public:
 	static void parseAtomInfo(char *atinfo,string mol,int na,double *xn1,double *rad);
 	/** Save idebmap*/
 	void saveIdebMap(char *fname);
+	/** Save the given maps in the binary container fileName. If rle is true the grid maps are run length
+	encoded, the boundary grid points arrays are always raw. Chunks are encoded in parallel.
+	The regression tests read the container back with ns_test.readMapsContainer*/
+	bool saveMapsContainer(const char *fileName,const int *maps,int num_maps,bool rle);
+	/** encode the chunks thread_id, thread_id+num_threads, ... of a maps container*/
+	void encodeMapChunks(vector<MapChunk> *chunks,int thread_id,int num_threads);
 	bool clearAndAllocEpsMaps();
 	void clearEpsMaps();
+	/** read the atoms from file; returns false if it is missing or corrupt, if it has less than 4 atoms
+	or if all radii are null*/
 	bool loadAtoms(string fn);
 	bool loadAtoms(int na,double *pos,double *r,double *q,int *d,char *atinf);
+	/** Replace the atoms with na xyz triplets in pos, na radii in r and optional (NULL) charges and dielectric ids.
+	If the number of atoms is unchanged they are updated in place and their atom info is kept. The grid is
+	then kept or built again as in updateGrid. As loadAtoms, it returns false leaving the atoms as they are
+	if there are less than 4 atoms or all radii are null*/
+	bool setAtoms(int na,const double *pos,const double *r,const double *q,const int *d);
+	/** Move the atoms to the na xyz triplets in pos, leaving the grid as it is (see updateGrid)*/
+	bool setCoordinates(const double *pos);
+	/** Give a new atomsVersion, unique among all the DelPhiShared objects. To be called whenever the atoms change*/
+	void atomsChanged(void);
+	/** Make the grid ready for a new surface of the current atoms. If a grid is already built and the atoms
+	still leave at least half of its perfill margin free, or if it was given by its bounds, it is kept and its
+	maps are reset (kept is set to true), otherwise it is built again with the current scale and perfill*/
+	bool updateGrid(bool *kept);
+	/** Reset the epsmap, idebmap, status map and boundary grid points of the current grid to their
+	state after buildGrid, so that a new surface can be built on it without allocating them again*/
+	void resetMaps();
+	/** free the boundary grid points of the last surface, if not owned by DelPhi*/
+	void clearBoundaryGridPoints();
 	/** Emulates DelPhi grid construction*/
 	bool buildGrid(double scale,double perfill);
 	
@@ -145,6 +206,18 @@ public:
 
 	// returns the lower and upper bounds of the grid
 	void getBounds(double *cmin, double *cmax);
+	/** set baricenter and rmaxdim from the bounds of the current atoms, as buildGrid(scale,perfill) does*/
+	void setAtomsBaricenter(void);
+
+	/** Status map as nz*ny*nx values with x fastest. If the status map is bilevel (optimized grids) it is
+	expanded at each call in a buffer owned by this object, refilled in place by later calls and valid until
+	the grid changes or clear(). NULL if there is no status map*/
+	int *getStatusMap(void);
+
+	/** Cavity index of each grid point (x fastest), -1 for points that are not in a cavity, computed at each call
+	from the status map in a buffer owned by this object as for getStatusMap(). Support points are labelled as
+	their cavity. NULL if there is no status map*/
+	int *getCavityLabels(void);
 
 	virtual ~DelPhiShared();
 
@@ -154,6 +227,10 @@ public:
 	bool multi_diel;
 	double scale;
 	double perfill;
+	// true if the grid was given by its bounds instead of scale and perfill
+	bool explicitGrid;
+	// changed whenever the atoms are set, loaded or moved; data derived from the atoms are keyed on it
+	uint64_t atomsVersion;
 	bool delphiBinding;
 	bool buildEpsMap;
 	bool buildStatus;
@@ -189,6 +266,9 @@ public:
 	// function
 	int *tempStatus;
 	int **bilevel_tempStatus;
+	// flat copy of the bilevel status map and cavity labels, filled on request
+	vector<int> flatStatus;
+	vector<int> cavityLabels;
 
 	double rmaxdim;
 	double xmin,xmax,ymin,ymax,zmin,zmax;
@@ -65,7 +65,7 @@ inline void ExampleSurface::getRayIntersection(double pa[3],double pb[3], vector
 {
 	// the ray starts from pa, arrives at pb.
 	// if computeNormals is active you should provide normals
-	// thdID is the thread identifier. We will not use it.
+	// thread_id is the thread identifier, it selects the buffer where normals are stored
 	// intersections contains as first value the parameter t of the ray pa+t*(pb-pa) and the second is the normal vector
 	double dir[3];
 	dir[0]=pb[0]-pa[0];
@@ -136,50 +136,31 @@ inline void ExampleSurface::getRayIntersection(double pa[3],double pb[3], vector
 
 	if (hasIntersection)
 	{
-		#if !defined(FLOAT_VERTICES)
-		if (computeNormals)
-		{
-			double *normal1 = allocateVector<double>(3);
-			double *normal2 = allocateVector<double>(3);
-
-			getNormalToSphere(intPoint1,center,radius,normal1);
-			getNormalToSphere(intPoint2,center,radius,normal2);
-
-			intersections.push_back(pair<double,double*>(t1,normal1));
-			intersections.push_back(pair<double,double*>(t2,normal2));
-		}
-		else
-		{
-			intersections.push_back(pair<double,double*>(t1,(double*)NULL));
-			intersections.push_back(pair<double,double*>(t2,(double*)NULL));
-		}
-		#else
 		if (computeNormals)
 		{
+			// normals live in the buffer of this thread, that is owned and recycled by Surface
 			double n1[3], n2[3];
 			getNormalToSphere(intPoint1,center,radius,n1);
 			getNormalToSphere(intPoint2,center,radius,n2);
 
-			float *normal1 = allocateVector<float>(3);
-			float *normal2 = allocateVector<float>(3);
-
-			normal1[0] = n1[0];
-			normal1[1] = n1[1];
-			normal1[2] = n1[2];
+			normalsBuffers[thread_id].push_back(n1[0]);
+			normalsBuffers[thread_id].push_back(n1[1]);
+			normalsBuffers[thread_id].push_back(n1[2]);
+			normalsBuffers[thread_id].push_back(n2[0]);
+			normalsBuffers[thread_id].push_back(n2[1]);
+			normalsBuffers[thread_id].push_back(n2[2]);
 
-			normal2[0] = n2[0];
-			normal2[1] = n2[1];
-			normal2[2] = n2[2];
+			VERTEX_TYPE *normal2 = &normalsBuffers[thread_id][ normalsBuffers[thread_id].size()-3 ];
+			VERTEX_TYPE *normal1 = normal2-3;
 
-			intersections.push_back(pair<float,float*>(t1,normal1));
-			intersections.push_back(pair<float,float*>(t2,normal2));
+			intersections.push_back(pair<VERTEX_TYPE,VERTEX_TYPE*>(t1,normal1));
+			intersections.push_back(pair<VERTEX_TYPE,VERTEX_TYPE*>(t2,normal2));
 		}
 		else
 		{
-			intersections.push_back(pair<float,float*>(t1,(float*)NULL));
-			intersections.push_back(pair<float,float*>(t2,(float*)NULL));
+			intersections.push_back(pair<VERTEX_TYPE,VERTEX_TYPE*>(t1,(VERTEX_TYPE*)NULL));
+			intersections.push_back(pair<VERTEX_TYPE,VERTEX_TYPE*>(t2,(VERTEX_TYPE*)NULL));
 		}
-		#endif
 
 		// we must sort the intersections such that Surface class can deduce in/out info
 		// and do checksum
@@ -0,0 +1,192 @@
+#include "ImplicitSurface.h"
+
+
+ImplicitSurfaceBase::~ImplicitSurfaceBase()
+{
+	clear();
+}
+
+
+void ImplicitSurfaceBase::clear(void)
+{
+	if (atomCellStart != NULL)
+		deleteVector<int>(atomCellStart);
+	if (atomCellIds != NULL)
+		deleteVector<int>(atomCellIds);
+	if (atomSupport != NULL)
+		deleteVector<double>(atomSupport);
+}
+
+
+void ImplicitSurfaceBase::init(void)
+{
+	surfType = MOLECULAR_SURFACE;
+	providesAnalyticalNormals = true;
+	atomCellStart = NULL;
+	atomCellIds = NULL;
+	atomSupport = NULL;
+	cellNx = cellNy = cellNz = 0;
+	cellMin[0] = cellMin[1] = cellMin[2] = 0.;
+	cellSide = 1.;
+}
+
+
+void ImplicitSurfaceBase::init(ConfigFile *cf)
+{
+	// the kernel parameters are read by the kernel itself
+	(void)cf;
+}
+
+
+ImplicitSurfaceBase::ImplicitSurfaceBase():Surface()
+{
+	init();
+}
+
+
+ImplicitSurfaceBase::ImplicitSurfaceBase(DelPhiShared *ds):Surface()
+{
+	init();
+	delphi = ds;
+}
+
+
+ImplicitSurfaceBase::ImplicitSurfaceBase(ConfigFile *cf, DelPhiShared *ds):Surface(cf)
+{
+	init();
+	init(cf);
+	delphi = ds;
+}
+
+
+bool ImplicitSurfaceBase::retarget(DelPhiShared *ds)
+{
+	// nothing built yet
+	if (atomSupport == NULL)
+		return false;
+
+	clearGridData();
+	delphi = ds;
+	return true;
+}
+
+
+int ImplicitSurfaceBase::getNumPatches(void)
+{
+	// there are no patches, but the ray casting buffers are sized on them and the intersections
+	// they point to must never be moved; an atom counts as the patches it brings to an SES
+	if (delphi == NULL)
+		return 0;
+	return 8*(int)delphi->atoms.size();
+}
+
+
+bool ImplicitSurfaceBase::isPatchBasedRayTracingSupported(void)
+{
+	return false;
+}
+
+
+bool ImplicitSurfaceBase::save(char *fileName)
+{
+	(void)fileName;
+	return true;
+}
+
+
+bool ImplicitSurfaceBase::load(char *fileName)
+{
+	(void)fileName;
+	return true;
+}
+
+
+void ImplicitSurfaceBase::preProcessPanel(void)
+{
+}
+
+
+void ImplicitSurfaceBase::postRayCasting(void)
+{
+}
+
+
+bool ImplicitSurfaceBase::preBoundaryProjection(void)
+{
+	return true;
+}
+
+
+void ImplicitSurfaceBase::buildAtomCells(void)
+{
+	if (atomCellStart != NULL)
+		deleteVector<int>(atomCellStart);
+	if (atomCellIds != NULL)
+		deleteVector<int>(atomCellIds);
+
+	std::vector<Atom> &atoms = delphi->atoms;
+	int na = (int)atoms.size();
+
+	double cellMax[3];
+
+	cellMin[0] = cellMin[1] = cellMin[2] = INFINITY;
+	cellMax[0] = cellMax[1] = cellMax[2] = -INFINITY;
+	cellSide = 0.;
+
+	for (int i=0; i<na; i++)
+	{
+		for (int c=0; c<3; c++)
+		{
+			cellMin[c] = MIN(cellMin[c], atoms[i].pos[c]);
+			cellMax[c] = MAX(cellMax[c], atoms[i].pos[c]);
+		}
+		cellSide = MAX(cellSide, atomSupport[i]);
+	}
+
+	if (na == 0)
+	{
+		cellMin[0] = cellMin[1] = cellMin[2] = 0.;
+		cellMax[0] = cellMax[1] = cellMax[2] = 0.;
+	}
+
+	if (cellSide <= 0.)
+		cellSide = 1.;
+
+	cellNx = (int64_t)((cellMax[0]-cellMin[0])/cellSide) + 1;
+	cellNy = (int64_t)((cellMax[1]-cellMin[1])/cellSide) + 1;
+	cellNz = (int64_t)((cellMax[2]-cellMin[2])/cellSide) + 1;
+
+	int64_t num_cells = cellNx*cellNy*cellNz;
+
+	int *cell_of_atom = allocateVector<int>(MAX(1,na));
+	atomCellStart = allocateVector<int>(num_cells+1);
+	atomCellIds = allocateVector<int>(MAX(1,na));
+
+	for (int64_t c=0; c<=num_cells; c++)
+		atomCellStart[c] = 0;
+
+	// counting sort of the atoms by cell
+	for (int i=0; i<na; i++)
+	{
+		int64_t ix = (int64_t)((atoms[i].pos[0]-cellMin[0])/cellSide);
+		int64_t iy = (int64_t)((atoms[i].pos[1]-cellMin[1])/cellSide);
+		int64_t iz = (int64_t)((atoms[i].pos[2]-cellMin[2])/cellSide);
+
+		cell_of_atom[i] = (int)((iz*cellNy + iy)*cellNx + ix);
+		atomCellStart[ cell_of_atom[i]+1 ]++;
+	}
+
+	for (int64_t c=0; c<num_cells; c++)
+		atomCellStart[c+1] += atomCellStart[c];
+
+	int *cursor = allocateVector<int>(num_cells);
+
+	for (int64_t c=0; c<num_cells; c++)
+		cursor[c] = atomCellStart[c];
+
+	for (int i=0; i<na; i++)
+		atomCellIds[ cursor[cell_of_atom[i]]++ ] = i;
+
+	deleteVector<int>(cursor);
+	deleteVector<int>(cell_of_atom);
+}
@@ -0,0 +1,656 @@
+//---------------------------------------------------------
+/**    @file	ImplicitSurface.h
+*     @brief	ImplicitSurface.h is the header for CLASS
+*               ImplicitSurface.cpp								*/
+//---------------------------------------------------------
+
+#ifndef ImplicitSurface_h
+#define ImplicitSurface_h
+
+#include "Surface.h"
+
+#ifdef DBGMEM_CRT
+	#define _CRTDBG_MAP_ALLOC
+	#define _CRTDBG_MAP_ALLOC_NEW
+#endif
+
+/** ray marching step, in grid units, used to bracket the roots of the field along a ray*/
+#define IMPLICIT_MARCH_STEP 0.5
+/** number of samples of a ray evaluated together for each atom*/
+#define IMPLICIT_RAY_BLOCK 32
+/** maximal number of safeguarded Newton steps to refine a bracketed root*/
+#define IMPLICIT_MAX_NEWTON_ITERATIONS 30
+/** maximal number of Newton steps to project a point on the surface*/
+#define IMPLICIT_MAX_PROJECTION_ITERATIONS 50
+/** tolerance in Angstrom on roots and projections*/
+#define IMPLICIT_ROOT_TOLERANCE 1e-8
+/** atom contributions smaller than this value are neglected; it sets the support of each atom*/
+#define IMPLICIT_FIELD_EPS 1e-8
+
+
+/** @brief Common part of the implicit surfaces: atoms cell list, per atom support and the
+Surface interface methods that do not depend on the field. See ImplicitSurface.*/
+class ImplicitSurfaceBase: public Surface
+{
+protected:
+	/** atoms cell list in CSR form, the cell side is the maximal support: the atoms of cell c are
+	atomCellIds[atomCellStart[c]..atomCellStart[c+1])*/
+	int *atomCellStart;
+	int *atomCellIds;
+	int64_t cellNx,cellNy,cellNz;
+	double cellMin[3];
+	double cellSide;
+	/** per atom radius beyond which the atom does not contribute to the field*/
+	double *atomSupport;
+
+	/** build the cell list from atomSupport*/
+	void buildAtomCells(void);
+
+public:
+	ImplicitSurfaceBase();
+	ImplicitSurfaceBase(DelPhiShared *ds);
+	ImplicitSurfaceBase(ConfigFile *cf, DelPhiShared *ds);
+
+	//////////////////////// INTERFACE MANDATORY METHODS /////////////////////////////////
+	virtual int getNumPatches(void);
+	virtual bool isPatchBasedRayTracingSupported(void);
+	/** Implicit surfaces are not saved. It is not implemented*/
+	virtual bool save(char *fileName);
+	/** Implicit surfaces are built from the atoms. It is not implemented*/
+	virtual bool load(char *fileName);
+	/** function for the constructor without arguments*/
+	virtual void init(void);
+	/** functions for the constructor with config file argument*/
+	virtual void init(ConfigFile *cf);
+	/**function for the denstructor*/
+	virtual void clear(void);
+	/** the cell list serves all the panels*/
+	virtual void preProcessPanel(void);
+	virtual void postRayCasting(void);
+	/** the cell list serves projections too*/
+	virtual bool preBoundaryProjection(void);
+	/////////////////////////////////////////////////////////////
+
+	/** the cell list does not depend on the grid, it is kept*/
+	virtual bool retarget(DelPhiShared *ds);
+
+	virtual ~ImplicitSurfaceBase();
+};
+
+
+/** @brief Surface defined as the level set S(p) = K::level() of a sum of radial atomic contributions
+S(p) = sum_a phi_a(|p-c_a|^2); points with S > level are inside.
+
+The kernel K is a plain class that the compiler inlines in the ray marching loops. It must provide:
+	- typename K::Params, the per atom parameters of phi
+	- void init(ConfigFile *cf), to read its parameters
+	- void printSummary(void)
+	- double level(void)
+	- Params getParams(const Atom &a), double getSupport(const Atom &a)
+	- static double value(double d2, const Params &p), phi at squared distance d2
+	- static double derivative(double d2, const Params &p, double phi), dphi/d(d2)
+
+Rays are sampled in blocks of IMPLICIT_RAY_BLOCK points; each atom met by the ray is accumulated
+over a whole block in a single loop. Sign changes are refined by safeguarded Newton, projections
+are Newton steps along the gradient, and normals are analytical.*/
+template<class K> class ImplicitSurface: public ImplicitSurfaceBase
+{
+private:
+	/** an atom met by a ray pa+t*(pb-pa): its support covers [tmin,tmax], o = pa - center*/
+	typedef struct RayAtom
+	{
+		double tmin;
+		double tmax;
+		double o[3];
+		typename K::Params p;
+	} RayAtom;
+
+	K kernel;
+	/** per atom kernel parameters*/
+	vector<typename K::Params> atomParams;
+	/** per thread buffers of the atoms met by a ray*/
+	vector<RayAtom> *rayAtomsBuffers;
+	int numRayAtomsBuffers;
+
+	/** field and its gradient in p, gathering the atoms from the cell list*/
+	inline double getField(const double p[3], double grad[3])
+	{
+		std::vector<Atom> &atoms = delphi->atoms;
+		double f = 0;
+
+		grad[0] = grad[1] = grad[2] = 0.;
+
+		// the cell side is the maximal support, so only the neighbouring cells can contribute
+		int64_t ix = (int64_t)floor((p[0]-cellMin[0])/cellSide);
+		int64_t iy = (int64_t)floor((p[1]-cellMin[1])/cellSide);
+		int64_t iz = (int64_t)floor((p[2]-cellMin[2])/cellSide);
+
+		for (int64_t k=MAX(0,iz-1); k<=MIN(cellNz-1,iz+1); k++)
+			for (int64_t j=MAX(0,iy-1); j<=MIN(cellNy-1,iy+1); j++)
+				for (int64_t i=MAX(0,ix-1); i<=MIN(cellNx-1,ix+1); i++)
+				{
+					int64_t c = (k*cellNy + j)*cellNx + i;
+
+					for (int l=atomCellStart[c]; l<atomCellStart[c+1]; l++)
+					{
+						int id = atomCellIds[l];
+						double d[3];
+						SUB(d,p,atoms[id].pos)
+						double d2 = DOT(d,d);
+
+						if (d2 >= atomSupport[id]*atomSupport[id])
+							continue;
+
+						double phi = K::value(d2,atomParams[id]);
+						double dphi = 2.*K::derivative(d2,atomParams[id],phi);
+
+						f += phi;
+						grad[0] += dphi*d[0];
+						grad[1] += dphi*d[1];
+						grad[2] += dphi*d[2];
+					}
+				}
+		return f;
+	}
+
+	/** outward normal in p*/
+	inline void getNormal(const double p[3], double normal[3])
+	{
+		double grad[3], n;
+		getField(p,grad);
+
+		// the field decreases going outside
+		normal[0] = -grad[0];
+		normal[1] = -grad[1];
+		normal[2] = -grad[2];
+		NORMALIZE_S(normal,n)
+	}
+
+	/** field and its derivative along the ray at t, summing the ray atoms whose support meets [ta,tb]*/
+	inline double getRayField(const RayAtom *ra, int n, const double dir[3], double t, double ta, double tb, double &dfdt)
+	{
+		double f = 0;
+		dfdt = 0;
+
+		for (int l=0; l<n; l++)
+		{
+			if (ra[l].tmax < ta || ra[l].tmin > tb)
+				continue;
+
+			double d[3];
+			ADD_MUL(d,ra[l].o,dir,t)
+			double d2 = DOT(d,d);
+			double phi = K::value(d2,ra[l].p);
+
+			f += phi;
+			dfdt += 2.*K::derivative(d2,ra[l].p,phi)*DOT(d,dir);
+		}
+		return f;
+	}
+
+public:
+	ImplicitSurface():ImplicitSurfaceBase()
+	{
+		rayAtomsBuffers = NULL;
+		numRayAtomsBuffers = 0;
+	}
+
+	ImplicitSurface(DelPhiShared *ds):ImplicitSurfaceBase(ds)
+	{
+		rayAtomsBuffers = NULL;
+		numRayAtomsBuffers = 0;
+	}
+
+	ImplicitSurface(ConfigFile *cf, DelPhiShared *ds):ImplicitSurfaceBase(cf,ds)
+	{
+		rayAtomsBuffers = NULL;
+		numRayAtomsBuffers = 0;
+		kernel.init(cf);
+	}
+
+	virtual void clear(void)
+	{
+		if (rayAtomsBuffers != NULL)
+		{
+			delete[] rayAtomsBuffers;
+			rayAtomsBuffers = NULL;
+		}
+		numRayAtomsBuffers = 0;
+		atomParams.clear();
+		ImplicitSurfaceBase::clear();
+	}
+
+	/** compute the per atom parameters and supports and bin the atoms*/
+	virtual bool build(void)
+	{
+		std::vector<Atom> &atoms = delphi->atoms;
+		int na = (int)atoms.size();
+
+		auto chrono_start = chrono::high_resolution_clock::now();
+
+		if (atomSupport != NULL)
+			deleteVector<double>(atomSupport);
+
+		atomSupport = allocateVector<double>(MAX(1,na));
+		atomParams.resize(na);
+
+		for (int i=0; i<na; i++)
+		{
+			atomParams[i] = kernel.getParams(atoms[i]);
+			atomSupport[i] = kernel.getSupport(atoms[i]);
+		}
+
+		buildAtomCells();
+
+		if (rayAtomsBuffers != NULL)
+			delete[] rayAtomsBuffers;
+		numRayAtomsBuffers = MAX(1, conf.numThreads);
+		rayAtomsBuffers = new vector<RayAtom> [numRayAtomsBuffers];
+
+		auto chrono_end = chrono::high_resolution_clock::now();
+		chrono::duration<double> build_time = chrono_end - chrono_start;
+		cout << endl << INFO << "Implicit surface atoms cell list time ";
+		printf("%.4e [s]", build_time.count());
+
+		return true;
+	}
+
+	virtual void printSummary(void)
+	{
+		cout << endl << INFO << "Implicit surface, maximal atom support " << cellSide << " [A]";
+		kernel.printSummary();
+	}
+
+	/** the kernel, to set its parameters before build() when the surface is not built from a configuration*/
+	K &getKernel(void)
+	{
+		return kernel;
+	}
+
+	virtual void getRayIntersection(double pa[3], double pb[3], vector<pair<VERTEX_TYPE,VERTEX_TYPE*>> &intersections, bool computeNormals, int thread_id)
+	{
+		marchRay(pa,pb,intersections,computeNormals,thread_id,normalsBuffers[thread_id]);
+	}
+
+	/** Ray marching of the field from pa to pb. The analytical normals are appended to normals and the
+	intersections point into it, so a surface that owns this one (e.g. the blobby) can march the field
+	into its own per thread normals buffer*/
+	void marchRay(double pa[3], double pb[3], vector<pair<VERTEX_TYPE,VERTEX_TYPE*>> &intersections, bool computeNormals, int thread_id, vector<VERTEX_TYPE> &normals)
+	{
+		std::vector<Atom> &atoms = delphi->atoms;
+
+		vector<RayAtom> local_ray_atoms;
+		vector<RayAtom> &ray_atoms = (thread_id >= 0 && thread_id < numRayAtomsBuffers) ? rayAtomsBuffers[thread_id] : local_ray_atoms;
+		ray_atoms.clear();
+
+		double dir[3];
+		SUB(dir,pb,pa)
+		double L2 = DOT(dir,dir);
+
+		if (L2 == 0.)
+			return;
+
+		double L = sqrt(L2);
+
+		// gather the atoms whose support meets the segment from the cells
+		// overlapping its bounding box enlarged by the maximal support
+		int64_t cmin[3], cmax[3];
+		int64_t cn[3] = {cellNx, cellNy, cellNz};
+
+		for (int c=0; c<3; c++)
+		{
+			double lo = MIN(pa[c],pb[c]) - cellSide;
+			double hi = MAX(pa[c],pb[c]) + cellSide;
+			cmin[c] = MAX((int64_t)0, (int64_t)floor((lo-cellMin[c])/cellSide));
+			cmax[c] = MIN(cn[c]-1, (int64_t)floor((hi-cellMin[c])/cellSide));
+			if (cmin[c] > cmax[c])
+				return;
+		}
+
+		double t_start = INFINITY, t_end = -INFINITY;
+
+		for (int64_t k=cmin[2]; k<=cmax[2]; k++)
+			for (int64_t j=cmin[1]; j<=cmax[1]; j++)
+				for (int64_t i=cmin[0]; i<=cmax[0]; i++)
+				{
+					int64_t c = (k*cellNy + j)*cellNx + i;
+
+					for (int l=atomCellStart[c]; l<atomCellStart[c+1]; l++)
+					{
+						int id = atomCellIds[l];
+						RayAtom ra;
+						SUB(ra.o,pa,atoms[id].pos)
+
+						double t0 = -DOT(ra.o,dir)/L2;
+						// squared distance of the atom from the ray
+						double q = DOT(ra.o,ra.o) - t0*t0*L2;
+						double s2 = atomSupport[id]*atomSupport[id];
+
+						if (q >= s2)
+							continue;
+
+						double h = sqrt(s2-q)/L;
+						ra.tmin = t0-h;
+						ra.tmax = t0+h;
+
+						if (ra.tmax < 0. || ra.tmin > 1.)
+							continue;
+
+						ra.p = atomParams[id];
+						ray_atoms.push_back(ra);
+
+						t_start = MIN(t_start, ra.tmin);
+						t_end = MAX(t_end, ra.tmax);
+					}
+				}
+
+		if (ray_atoms.empty())
+			return;
+
+		const RayAtom *ra = &ray_atoms[0];
+		int n = (int)ray_atoms.size();
+
+		t_start = MAX(0., t_start);
+		t_end = MIN(1., t_end);
+
+		double dt = IMPLICIT_MARCH_STEP*delphi->side/L;
+		int64_t num_samples = (int64_t)ceil((t_end-t_start)/dt) + 1;
+		double level = kernel.level();
+
+		double t_prev = 0, g_prev = -1.;
+		size_t firstIntersection = intersections.size();
+		size_t firstNormal = normals.size();
+
+		for (int64_t first=0; first<num_samples; first+=IMPLICIT_RAY_BLOCK)
+		{
+			int nb = (int)MIN((int64_t)IMPLICIT_RAY_BLOCK, num_samples-first);
+			double ts[IMPLICIT_RAY_BLOCK], field[IMPLICIT_RAY_BLOCK];
+
+			for (int s=0; s<nb; s++)
+			{
+				ts[s] = MIN(t_end, t_start + (first+s)*dt);
+				field[s] = 0.;
+			}
+
+			double block_start = ts[0], block_end = ts[nb-1];
+
+			for (int l=0; l<n; l++)
+			{
+				if (ra[l].tmax < block_start || ra[l].tmin > block_end)
+					continue;
+
+				const double *o = ra[l].o;
+				const typename K::Params &p = ra[l].p;
+
+				for (int s=0; s<nb; s++)
+				{
+					double dx = o[0] + ts[s]*dir[0];
+					double dy = o[1] + ts[s]*dir[1];
+					double dz = o[2] + ts[s]*dir[2];
+					field[s] += K::value(dx*dx+dy*dy+dz*dz,p);
+				}
+			}
+
+			for (int s=0; s<nb; s++)
+			{
+				double g = field[s] - level;
+
+				if (first+s > 0 && (g_prev < 0) != (g < 0))
+				{
+					// safeguarded Newton on the bracket [a,b]
+					double a = t_prev, b = ts[s], ga = g_prev;
+					double t = 0.5*(a+b);
+
+					for (int it=0; it<IMPLICIT_MAX_NEWTON_ITERATIONS; it++)
+					{
+						double dg;
+						double gt = getRayField(ra,n,dir,t,t_prev,ts[s],dg) - level;
+
+						if ((gt < 0) == (ga < 0))
+						{
+							a = t;
+							ga = gt;
+						}
+						else
+							b = t;
+
+						double t_new = (dg != 0.) ? t - gt/dg : a;
+						if (t_new <= a || t_new >= b)
+							t_new = 0.5*(a+b);
+
+						bool converged = fabs(t_new-t)*L < IMPLICIT_ROOT_TOLERANCE;
+						t = t_new;
+						if (converged)
+							break;
+					}
+
+					if (computeNormals)
+					{
+						double pt[3], nv[3];
+						ADD_MUL(pt,pa,dir,t)
+						getNormal(pt,nv);
+
+						normals.push_back(nv[0]);
+						normals.push_back(nv[1]);
+						normals.push_back(nv[2]);
+
+						VERTEX_TYPE *normal = &normals[ normals.size()-3 ];
+						intersections.push_back(pair<VERTEX_TYPE,VERTEX_TYPE*>(t,normal));
+					}
+					else
+						intersections.push_back(pair<VERTEX_TYPE,VERTEX_TYPE*>(t,(VERTEX_TYPE*)NULL));
+				}
+				t_prev = ts[s];
+				g_prev = g;
+			}
+		}
+		// roots are found in increasing t order, no sorting is needed
+		if (computeNormals)
+			pointRayNormals(intersections,firstIntersection,normals,firstNormal);
+	}
+
+	virtual bool getProjection(double p[3], double *proj1, double *proj2,
+							   double *proj3, double *normal1, double *normal2, double *normal3)
+	{
+		// Newton steps along the gradient toward the level set
+		double x[3], grad[3];
+		ASSIGN(x,p)
+		bool converged = false;
+		double level = kernel.level();
+
+		for (int it=0; it<IMPLICIT_MAX_PROJECTION_ITERATIONS; it++)
+		{
+			double g = getField(x,grad) - level;
+			double gg = DOT(grad,grad);
+
+			if (gg < 1e-20)
+				break;
+
+			double s = g/gg;
+			double step = fabs(s)*sqrt(gg);
+
+			// do not leave the neighbourhood of the starting grid point in a single step
+			if (step > delphi->side)
+				s *= delphi->side/step;
+
+			x[0] -= s*grad[0];
+			x[1] -= s*grad[1];
+			x[2] -= s*grad[2];
+
+			if (step < IMPLICIT_ROOT_TOLERANCE)
+			{
+				converged = true;
+				break;
+			}
+		}
+
+		if (!converged)
+		{
+			// as a safe choice the point itself is its projection
+			(*proj1) = p[0];
+			(*proj2) = p[1];
+			(*proj3) = p[2];
+			(*normal1) = 0;
+			(*normal2) = 0;
+			(*normal3) = 0;
+			return false;
+		}
+
+		double nv[3];
+		getNormal(x,nv);
+
+		(*proj1) = x[0];
+		(*proj2) = x[1];
+		(*proj3) = x[2];
+
+		(*normal1) = nv[0];
+		(*normal2) = nv[1];
+		(*normal3) = nv[2];
+
+		return true;
+	}
+
+	virtual ~ImplicitSurface()
+	{
+		clear();
+	}
+};
+
+
+/** @brief gaussian kernel, phi = exp(B*(d^2/r^2-1)); the level set 1 is the blobby surface*/
+class GaussianKernel
+{
+public:
+	typedef struct Params
+	{
+		double a;
+		double b;
+	} Params;
+
+	double B;
+	/** if positive it replaces the support derived from IMPLICIT_FIELD_EPS, as the blobby cut-off does*/
+	double cutoff;
+
+	GaussianKernel()
+	{
+		B = -2.5;
+		cutoff = 0.;
+	}
+
+	void init(ConfigFile *cf)
+	{
+		B = cf->read<double>( "Blobbyness", -2.5 );
+		if (B >= 0)
+		{
+			cout << endl << WARN << "Blobbyness is always a stricly negative real: setting -2.5";
+			B = -2.5;
+		}
+	}
+
+	void printSummary(void)
+	{
+		cout << endl << INFO << "Gaussian kernel, blobbyness value " << B;
+	}
+
+	double level(void)
+	{
+		return 1.;
+	}
+
+	Params getParams(const Atom &a)
+	{
+		Params p;
+		p.a = B/(a.radius*a.radius);
+		p.b = -B;
+		return p;
+	}
+
+	double getSupport(const Atom &a)
+	{
+		if (cutoff > 0.)
+			return cutoff;
+		return a.radius*sqrt(1. + log(IMPLICIT_FIELD_EPS)/B);
+	}
+
+	static inline double value(double d2, const Params &p)
+	{
+		return exp(p.a*d2 + p.b);
+	}
+
+	static inline double derivative(double d2, const Params &p, double phi)
+	{
+		(void)d2;
+		return p.a*phi;
+	}
+};
+
+
+/** @brief soft-min kernel, phi = exp(-k*(d-r)): the level set 1 is the log-sum-exp smooth union
+of the atoms, -log(sum_a exp(-k*(d_a-r_a)))/k = 0, that tends to the van der Waals surface as k grows*/
+class SoftMinKernel
+{
+public:
+	typedef struct Params
+	{
+		double k;
+		double kr;
+	} Params;
+
+	/** sharpness in 1/Angstrom*/
+	double k;
+
+	SoftMinKernel()
+	{
+		k = 3.0;
+	}
+
+	void init(ConfigFile *cf)
+	{
+		k = cf->read<double>( "Softmin_Sharpness", 3.0 );
+		if (k <= 0)
+		{
+			cout << endl << WARN << "Soft-min sharpness must be positive: setting 3.0";
+			k = 3.0;
+		}
+	}
+
+	void printSummary(void)
+	{
+		cout << endl << INFO << "Soft-min kernel, sharpness " << k << " [1/A]";
+	}
+
+	double level(void)
+	{
+		return 1.;
+	}
+
+	Params getParams(const Atom &a)
+	{
+		Params p;
+		p.k = k;
+		p.kr = k*a.radius;
+		return p;
+	}
+
+	double getSupport(const Atom &a)
+	{
+		return a.radius - log(IMPLICIT_FIELD_EPS)/k;
+	}
+
+	static inline double value(double d2, const Params &p)
+	{
+		return exp(p.kr - p.k*sqrt(d2));
+	}
+
+	static inline double derivative(double d2, const Params &p, double phi)
+	{
+		// d phi / d(d^2) = -k*phi/(2d), bounded away from the centre
+		return -0.5*p.k*phi/sqrt(MAX(d2,1e-20));
+	}
+};
+
+
+static SurfaceRecorder<ImplicitSurface<GaussianKernel>> implicitGaussianRecorder("implicit_gaussian");
+static SurfaceRecorder<ImplicitSurface<SoftMinKernel>> implicitSoftMinRecorder("implicit_softmin");
+
+#endif
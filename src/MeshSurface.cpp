@@ -4,21 +4,7 @@
 
 void MeshSurface::clear()
 {
-	if (faceMatrix != NULL)
-		deleteMatrix2D<int>(numTriangles,3,faceMatrix);
-
-	if (vertMatrix != NULL)
-		deleteMatrix2D<VERTEX_TYPE>(numVertexes,3,vertMatrix);
-
-	if (vertexTrianglesList != NULL)
-	{
-		for (int i=0; i<numVertexes; i++)
-			delete vertexTrianglesList[i];
-		deleteVector<vector<int>*>(vertexTrianglesList);
-	}
-
-	if (vertNormals != NULL)
-		deleteMatrix2D<VERTEX_TYPE>(numVertexes,3,vertNormals);
+	disposeMesh();
 
 	// remove 2d grid for ray casting
 	/* #if !defined(OPTIMIZE_GRIDS)
@@ -70,6 +56,10 @@ void MeshSurface::clear()
 	if (planes != NULL)
 		deleteMatrix2D<double>(numTriangles,4,planes);
 
+	disposeBVH();
+
+	if (triangleStore != NULL)
+		deleteVector<double>(triangleStore);
 
 	if (patchBasedAlgorithm && num_pixel_intersections != NULL)
 	{
@@ -141,8 +131,18 @@ void MeshSurface::init()
 	vertNormals = NULL;
 	gridTriangleMap = NULL;
 	gridTriangleMap2D = NULL;
-	vertexTrianglesList = NULL;
+	vertexTrianglesStart = NULL;
+	vertexTrianglesIds = NULL;
+	meshFileMap = NULL;
+	meshFileMapSize = 0;
+	facesInMeshFileMap = false;
+	verticesInMeshFileMap = false;
 	planes = NULL;
+	useBVH = false;
+	bvhTriangles = NULL;
+	bvhTriangleBounds = NULL;
+	bvhTriangleCentroids = NULL;
+	triangleStore = NULL;
 	providesAnalyticalNormals = false;
 	/* #if !defined(OPTIMIZE_GRIDS)
 	ind = NULL;
@@ -181,9 +181,11 @@ void MeshSurface::init(ConfigFile *cf)
 	unsigned int maxMeshDim2D = cf->read<unsigned int>( "Max_mesh_auxiliary_grid_2d_size", 100 );
 	unsigned int maxMeshPatches2D = cf->read<unsigned int>( "Max_mesh_patches_per_auxiliary_grid_2d_cell", 250 );
 	int numMSMSFiles = cf->read<int>( "Num_MSMS_files", 1 );
+	bool use_bvh = cf->read<bool>( "Mesh_Bounding_Volume_Hierarchy", false );
 
 	setAuxGrid(maxMeshDim,maxMeshPatches);
 	setAuxGrid2D(maxMeshDim2D,maxMeshPatches2D);
+	setBVH(use_bvh);
 	// Set up inside value
 	inside = 5;
 
@@ -198,7 +200,7 @@ void MeshSurface::init(ConfigFile *cf)
 	}
 
 	// get the type of surface
-	if (!ext.compare("off"))
+	if (!ext.compare("off") || !ext.compare("ply") || !ext.compare("bin"))
 	{
 		// Load Surface
 		bool load_f = load((char*)fname.c_str());
@@ -344,6 +346,16 @@ void MeshSurface::preProcessPanel()
 		cout << endl << WARN << "Cannot get surface without a mesh";
 		return;
 	}
+
+	buildTriangleStore();
+
+	// the same hierarchy serves all the panels
+	if (useBVH)
+	{
+		buildBVH();
+		return;
+	}
+
 	// auxiliary bounding box tree to store the patches (useful to ray tracing acceleration) (?)
 	int64_t igrid = delphi->nx;
 
@@ -575,6 +587,12 @@ void MeshSurface::preProcessPanel()
 
 void MeshSurface::preProcessTriangles()
 {
+	// a new mesh has been loaded, the hierarchy and the triangle store of the previous one are stale
+	disposeBVH();
+
+	if (triangleStore != NULL)
+		deleteVector<double>(triangleStore);
+
 	#if !defined(FLOAT_VERTICES)
 	if (planes != NULL)
 		deleteMatrix2D<double>(numTriangles,4,planes);
@@ -631,9 +649,9 @@ void MeshSurface::preProcessTriangles()
 	if (computeNormals)
 	{
 		if (vertNormals != NULL)
-			deleteMatrix2D<VERTEX_TYPE>(numVertexes,3,vertNormals);
+			deleteContiguousMatrix2D<VERTEX_TYPE>(vertNormals);
 
-		vertNormals = allocateMatrix2D<VERTEX_TYPE>(numVertexes,3);
+		vertNormals = allocateContiguousMatrix2D<VERTEX_TYPE>(numVertexes,3);
 
 		for (int iv=0; iv<numVertexes; iv++)
 		{
@@ -642,14 +660,13 @@ void MeshSurface::preProcessTriangles()
 			meanNormal[0] = 0;
 			meanNormal[1] = 0;
 			meanNormal[2] = 0;
-			vector<int>::iterator it;
 
-			for (it = vertexTrianglesList[iv]->begin(); it!=vertexTrianglesList[iv]->end(); it++)
+			for (int k=vertexTrianglesStart[iv]; k<vertexTrianglesStart[iv+1]; k++)
 			{
-				int triangleID = *it;
+				int triangleID = vertexTrianglesIds[k];
 				ADD(meanNormal,meanNormal,planes[triangleID]);
 			}
-			// VERTEX_TYPE vlen = (VERTEX_TYPE)vertexTrianglesList[iv]->size();
+			// VERTEX_TYPE vlen = (VERTEX_TYPE)(vertexTrianglesStart[iv+1]-vertexTrianglesStart[iv]);
 			// vertNormals[iv][0] = meanNormal[0]/vlen;
 			// vertNormals[iv][1] = meanNormal[1]/vlen;
 			// vertNormals[iv][2] = meanNormal[2]/vlen;
@@ -935,6 +952,476 @@ bool MeshSurface::buildAuxiliaryGrid()
 }
 
 
+void MeshSurface::disposeBVH()
+{
+	bvhNodes.clear();
+	bvhNodes.shrink_to_fit();
+
+	if (bvhTriangles != NULL)
+		deleteVector<int>(bvhTriangles);
+	if (bvhTriangleBounds != NULL)
+		deleteVector<double>(bvhTriangleBounds);
+	if (bvhTriangleCentroids != NULL)
+		deleteVector<double>(bvhTriangleCentroids);
+}
+
+
+bool MeshSurface::buildBVH()
+{
+	if (faceMatrix == NULL || vertMatrix == NULL)
+	{
+		cout << endl << WARN << "Cannot get surface without a loaded mesh!";
+		return false;
+	}
+
+	// the hierarchy depends only on the mesh, so it is reused across panels and projections
+	if (!bvhNodes.empty())
+		return true;
+
+	auto chrono_start = chrono::high_resolution_clock::now();
+
+	bvhTriangles = allocateVector<int>(numTriangles);
+	bvhTriangleBounds = allocateVector<double>(6*(int64_t)numTriangles);
+	bvhTriangleCentroids = allocateVector<double>(3*(int64_t)numTriangles);
+
+	for (int it=0; it<numTriangles; it++)
+	{
+		double *bounds = &bvhTriangleBounds[6*(int64_t)it];
+
+		for (int i=0; i<3; i++)
+		{
+			bounds[i] = INFINITY;
+			bounds[3+i] = -INFINITY;
+		}
+		for (unsigned int pind=0; pind<3; pind++)
+		{
+			VERTEX_TYPE *v = vertMatrix[faceMatrix[it][pind]];
+
+			for (int i=0; i<3; i++)
+			{
+				bounds[i] = MIN(bounds[i],v[i]);
+				bounds[3+i] = MAX(bounds[3+i],v[i]);
+			}
+		}
+		for (int i=0; i<3; i++)
+			bvhTriangleCentroids[3*(int64_t)it+i] = 0.5*(bounds[i]+bounds[3+i]);
+
+		bvhTriangles[it] = it;
+	}
+
+	bvhNodes.reserve(2*(numTriangles/BVH_MAX_LEAF_SIZE+1));
+
+	MeshBVHNode root;
+	root.first = 0;
+	root.count = numTriangles;
+	bvhNodes.push_back(root);
+
+	// the top levels are split serially until there are enough independent subtrees
+	// to feed the threads; each subtree is then refined by a thread in its own node buffer
+	int serial_depth = 0;
+
+	#ifdef ENABLE_BOOST_THREADS
+	while ((1 << serial_depth) < 4*conf.numThreads)
+		++serial_depth;
+	#endif
+
+	vector<int> deferred;
+
+	buildBVHNode(bvhNodes, 0, 0, serial_depth, &deferred);
+
+	vector<MeshBVHNode> *subtrees = new vector<MeshBVHNode> [deferred.size()];
+
+	for (unsigned int i=0; i<deferred.size(); i++)
+		subtrees[i].push_back(bvhNodes[ deferred[i] ]);
+
+	#ifdef ENABLE_BOOST_THREADS
+	boost::thread_group thdGroup;
+
+	for (int j=0; j<conf.numThreads; j++)
+		thdGroup.create_thread(boost::bind(&MeshSurface::buildBVHSubtrees, this, subtrees, (int)deferred.size(), j, conf.numThreads, serial_depth));
+
+	thdGroup.join_all();
+	#else
+	buildBVHSubtrees(subtrees, (int)deferred.size(), 0, 1, serial_depth);
+	#endif
+
+	// splice the subtrees: the root of each subtree replaces the deferred node and the
+	// remaining nodes are appended, shifting the children indices
+	for (unsigned int i=0; i<deferred.size(); i++)
+	{
+		int offset = (int)bvhNodes.size() - 1;
+
+		for (unsigned int k=0; k<subtrees[i].size(); k++)
+		{
+			MeshBVHNode node = subtrees[i][k];
+
+			if (node.count == 0)
+				node.first += offset;
+
+			if (k == 0)
+				bvhNodes[ deferred[i] ] = node;
+			else
+				bvhNodes.push_back(node);
+		}
+	}
+	delete[] subtrees;
+
+	deleteVector<double>(bvhTriangleBounds);
+	deleteVector<double>(bvhTriangleCentroids);
+
+	auto chrono_end = chrono::high_resolution_clock::now();
+
+	chrono::duration<double> build_time = chrono_end - chrono_start;
+	cout << endl << INFO << "BVH with " << bvhNodes.size() << " nodes built in ";
+	printf ("%.4e [s]", build_time.count());
+
+	return true;
+}
+
+
+void MeshSurface::buildBVHSubtrees(vector<MeshBVHNode> *subtrees, int num_subtrees, int thread_id, int num_threads, int depth)
+{
+	for (int i=thread_id; i<num_subtrees; i+=num_threads)
+		buildBVHNode(subtrees[i], 0, depth, BVH_MAX_DEPTH, NULL);
+}
+
+
+void MeshSurface::buildBVHNode(vector<MeshBVHNode> &nodes, int node_id, int depth, int max_depth, vector<int> *deferred)
+{
+	int first = nodes[node_id].first;
+	int count = nodes[node_id].count;
+
+	// node and centroids bounds
+	double bmin[3] = {INFINITY, INFINITY, INFINITY};
+	double bmax[3] = {-INFINITY, -INFINITY, -INFINITY};
+	double cmin[3] = {INFINITY, INFINITY, INFINITY};
+	double cmax[3] = {-INFINITY, -INFINITY, -INFINITY};
+
+	for (int k=first; k<first+count; k++)
+	{
+		double *bounds = &bvhTriangleBounds[6*(int64_t)bvhTriangles[k]];
+		double *centroid = &bvhTriangleCentroids[3*(int64_t)bvhTriangles[k]];
+
+		for (int i=0; i<3; i++)
+		{
+			bmin[i] = MIN(bmin[i],bounds[i]);
+			bmax[i] = MAX(bmax[i],bounds[3+i]);
+			cmin[i] = MIN(cmin[i],centroid[i]);
+			cmax[i] = MAX(cmax[i],centroid[i]);
+		}
+	}
+	for (int i=0; i<3; i++)
+	{
+		nodes[node_id].bmin[i] = bmin[i];
+		nodes[node_id].bmax[i] = bmax[i];
+	}
+
+	if (count <= 2 || depth >= BVH_MAX_DEPTH)
+		return;
+
+	// split along the largest extent of the centroids
+	int axis = 0;
+	for (int i=1; i<3; i++)
+		if (cmax[i]-cmin[i] > cmax[axis]-cmin[axis])
+			axis = i;
+
+	double extent = cmax[axis]-cmin[axis];
+
+	if (extent <= 0.)
+		return;
+
+	double bin_scale = BVH_SAH_BINS*(1.-1e-10)/extent;
+
+	int bin_count[BVH_SAH_BINS];
+	double bin_min[BVH_SAH_BINS][3], bin_max[BVH_SAH_BINS][3];
+
+	for (int b=0; b<BVH_SAH_BINS; b++)
+	{
+		bin_count[b] = 0;
+		for (int i=0; i<3; i++)
+		{
+			bin_min[b][i] = INFINITY;
+			bin_max[b][i] = -INFINITY;
+		}
+	}
+	for (int k=first; k<first+count; k++)
+	{
+		int it = bvhTriangles[k];
+		double *bounds = &bvhTriangleBounds[6*(int64_t)it];
+		int b = (int)((bvhTriangleCentroids[3*(int64_t)it+axis]-cmin[axis])*bin_scale);
+
+		++bin_count[b];
+		for (int i=0; i<3; i++)
+		{
+			bin_min[b][i] = MIN(bin_min[b][i],bounds[i]);
+			bin_max[b][i] = MAX(bin_max[b][i],bounds[3+i]);
+		}
+	}
+
+	// sweep the bins from the right to get the areas of the right sides, then from the left
+	// to evaluate the cost of each of the BVH_SAH_BINS-1 candidate planes
+	double right_area[BVH_SAH_BINS];
+	int right_count[BVH_SAH_BINS];
+	double lo[3] = {INFINITY, INFINITY, INFINITY};
+	double hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+	int acc = 0;
+
+	for (int b=BVH_SAH_BINS-1; b>0; b--)
+	{
+		acc += bin_count[b];
+		for (int i=0; i<3; i++)
+		{
+			lo[i] = MIN(lo[i],bin_min[b][i]);
+			hi[i] = MAX(hi[i],bin_max[b][i]);
+		}
+		right_count[b] = acc;
+		right_area[b] = (acc == 0) ? 0. : (hi[0]-lo[0])*(hi[1]-lo[1]) + (hi[0]-lo[0])*(hi[2]-lo[2]) + (hi[1]-lo[1])*(hi[2]-lo[2]);
+	}
+
+	int best_split = -1;
+	double best_cost = INFINITY;
+
+	for (int i=0; i<3; i++)
+	{
+		lo[i] = INFINITY;
+		hi[i] = -INFINITY;
+	}
+	acc = 0;
+
+	for (int b=0; b<BVH_SAH_BINS-1; b++)
+	{
+		acc += bin_count[b];
+		for (int i=0; i<3; i++)
+		{
+			lo[i] = MIN(lo[i],bin_min[b][i]);
+			hi[i] = MAX(hi[i],bin_max[b][i]);
+		}
+		if (acc == 0 || right_count[b+1] == 0)
+			continue;
+
+		double left_area = (hi[0]-lo[0])*(hi[1]-lo[1]) + (hi[0]-lo[0])*(hi[2]-lo[2]) + (hi[1]-lo[1])*(hi[2]-lo[2]);
+		double cost = left_area*acc + right_area[b+1]*right_count[b+1];
+
+		if (cost < best_cost)
+		{
+			best_cost = cost;
+			best_split = b;
+		}
+	}
+
+	if (best_split < 0)
+		return;
+
+	// compare with the cost of a leaf; the traversal of a node is assumed as expensive as
+	// an eighth of a triangle test
+	double node_area = (bmax[0]-bmin[0])*(bmax[1]-bmin[1]) + (bmax[0]-bmin[0])*(bmax[2]-bmin[2]) + (bmax[1]-bmin[1])*(bmax[2]-bmin[2]);
+
+	if (count <= BVH_MAX_LEAF_SIZE && 0.125 + best_cost/node_area >= count)
+		return;
+
+	int *mid = std::partition(bvhTriangles+first, bvhTriangles+first+count, [&](int it)
+	{
+		return (int)((bvhTriangleCentroids[3*(int64_t)it+axis]-cmin[axis])*bin_scale) <= best_split;
+	});
+
+	int left_count = (int)(mid - (bvhTriangles+first));
+
+	MeshBVHNode left, right;
+	left.first = first;
+	left.count = left_count;
+	right.first = first + left_count;
+	right.count = count - left_count;
+
+	int left_id = (int)nodes.size();
+
+	nodes.push_back(left);
+	nodes.push_back(right);
+
+	nodes[node_id].first = left_id;
+	nodes[node_id].count = 0;
+
+	for (int c=0; c<2; c++)
+	{
+		if (deferred != NULL && depth+1 >= max_depth)
+			deferred->push_back(left_id+c);
+		else
+			buildBVHNode(nodes, left_id+c, depth+1, max_depth, deferred);
+	}
+}
+
+
+void MeshSurface::getRayIntersectionBVH(double pa[3], double dir[3], int first_dim, int last__dim, vector<pair<VERTEX_TYPE,VERTEX_TYPE*>> &intersections)
+{
+	if (bvhNodes.empty())
+		return;
+
+	// the triangles of the pierced leaves are collected and tested in batches
+	int batch[TRIANGLE_BATCH];
+	int batch_size = 0;
+
+	// the ray is axis aligned, so a box is pierced iff it contains the ray in the two fixed coordinates
+	int stack[2*BVH_MAX_DEPTH+2];
+	int stack_size = 0;
+
+	stack[stack_size++] = 0;
+
+	while (stack_size > 0 || batch_size > 0)
+	{
+		if (stack_size > 0)
+		{
+			MeshBVHNode &node = bvhNodes[ stack[--stack_size] ];
+
+			if (pa[first_dim] < node.bmin[first_dim] || pa[first_dim] > node.bmax[first_dim] ||
+				pa[last__dim] < node.bmin[last__dim] || pa[last__dim] > node.bmax[last__dim])
+				continue;
+
+			if (node.count == 0)
+			{
+				stack[stack_size++] = node.first;
+				stack[stack_size++] = node.first+1;
+				continue;
+			}
+			// flush the batch if the leaf does not fit into it; the leaf is then visited again
+			if (batch_size + node.count > TRIANGLE_BATCH && batch_size > 0)
+				stack_size++;
+			else
+			{
+				// leaves are small unless the depth limit was hit, in which case they are consumed in chunks
+				int first = node.first;
+				int last = node.first+node.count;
+
+				while (last-first > TRIANGLE_BATCH)
+				{
+					pushBatchIntersections(pa, dir, bvhTriangles+first, TRIANGLE_BATCH, intersections);
+					first += TRIANGLE_BATCH;
+				}
+				for (int k=first; k<last; k++)
+					batch[batch_size++] = bvhTriangles[k];
+				continue;
+			}
+		}
+
+		pushBatchIntersections(pa, dir, batch, batch_size, intersections);
+		batch_size = 0;
+	}
+}
+
+
+bool MeshSurface::getProjectionBVH(double p[3], double *proj1, double *proj2,
+								   double *proj3, double *normal1, double *normal2, double *normal3)
+{
+	#if !defined(FLOAT_VERTICES)
+	double *pp[3];
+	#else
+	double pp[3][3];
+	#endif
+	double dist;
+
+	// nearest triangle search; a node is visited only if its box is nearer than the current best
+	double locProj[3], minDist=INFINITY, locNorm[3];
+	bool ff = false;
+
+	int stack[2*BVH_MAX_DEPTH+2];
+	int stack_size = 0;
+
+	if (!bvhNodes.empty())
+		stack[stack_size++] = 0;
+
+	while (stack_size > 0)
+	{
+		MeshBVHNode &node = bvhNodes[ stack[--stack_size] ];
+
+		double box_dist2 = 0.;
+
+		for (int i=0; i<3; i++)
+		{
+			double d = MAX(0., MAX(node.bmin[i]-p[i], p[i]-node.bmax[i]));
+			box_dist2 += d*d;
+		}
+		if (box_dist2 >= minDist*minDist)
+			continue;
+
+		if (node.count == 0)
+		{
+			// the nearest child is visited first
+			double child_dist2[2] = {0., 0.};
+
+			for (int c=0; c<2; c++)
+			{
+				MeshBVHNode &child = bvhNodes[ node.first+c ];
+
+				for (int i=0; i<3; i++)
+				{
+					double d = MAX(0., MAX(child.bmin[i]-p[i], p[i]-child.bmax[i]));
+					child_dist2[c] += d*d;
+				}
+			}
+			int nearest = (child_dist2[0] <= child_dist2[1]) ? 0 : 1;
+
+			stack[stack_size++] = node.first + 1-nearest;
+			stack[stack_size++] = node.first + nearest;
+			continue;
+		}
+		for (int k=node.first; k<node.first+node.count; k++)
+		{
+			int it = bvhTriangles[k];
+
+			#if !defined(FLOAT_VERTICES)
+			pp[0] = vertMatrix[faceMatrix[it][0]];
+			pp[1] = vertMatrix[faceMatrix[it][1]];
+			pp[2] = vertMatrix[faceMatrix[it][2]];
+
+			bool flag = point2triangle(p,pp[0],pp[1],pp[2],planes[it],locProj,&dist,locNorm,it);
+			#else
+			pp[0][0] = vertMatrix[faceMatrix[it][0]][0];
+			pp[0][1] = vertMatrix[faceMatrix[it][0]][1];
+			pp[0][2] = vertMatrix[faceMatrix[it][0]][2];
+			pp[1][0] = vertMatrix[faceMatrix[it][1]][0];
+			pp[1][1] = vertMatrix[faceMatrix[it][1]][1];
+			pp[1][2] = vertMatrix[faceMatrix[it][1]][2];
+			pp[2][0] = vertMatrix[faceMatrix[it][2]][0];
+			pp[2][1] = vertMatrix[faceMatrix[it][2]][1];
+			pp[2][2] = vertMatrix[faceMatrix[it][2]][2];
+
+			double plane[3];
+			plane[0] = planes[it][0];
+			plane[1] = planes[it][1];
+			plane[2] = planes[it][2];
+
+			bool flag = point2triangle(p,pp[0],pp[1],pp[2],plane,locProj,&dist,locNorm,it);
+			#endif
+
+			if (dist < minDist)
+			{
+				minDist = dist;
+				*proj1 = locProj[0];
+				*proj2 = locProj[1];
+				*proj3 = locProj[2];
+
+				*normal1 = locNorm[0];
+				*normal2 = locNorm[1];
+				*normal3 = locNorm[2];
+
+				ff = flag;
+			}
+		}
+	}
+	if (minDist == INFINITY)
+	{
+		{
+			#ifdef ENABLE_BOOST_THREADS
+			boost::mutex::scoped_lock scopedLock(mutex);
+			#endif
+			(*errorStream) << endl << WARN << "Approximating bgp with grid point";
+		}
+		*proj1 = p[0];
+		*proj2 = p[1];
+		*proj3 = p[2];
+		return true;
+	}
+	return ff;
+}
+
 #if !defined(SINGLE_PASS_RT)
 
 #if !defined(MINIMIZE_MEMORY)
@@ -1483,31 +1970,162 @@ void MeshSurface::getPatchIntersectionData (int64_t nxyz[3], int panels[2],
 }
 
 
-// returns 1 in case of intersection
-int MeshSurface::intersect_triangle(double orig[3], double dir[3],
-									double vert0[3], double vert1[3], double vert2[3], double *t, double *u, double *v)
+void MeshSurface::buildTriangleStore()
 {
-   	double edge1[3], edge2[3], tvec[3], pvec[3], qvec[3];
-	double det, inv_det;
+	if (triangleStore != NULL)
+		return;
 
-	/* find vectors for two edges sharing vert0 */
-	SUB(edge1, vert1, vert0);
-	SUB(edge2, vert2, vert0);
+	// SoA layout: vert0 x,y,z then edge1 x,y,z then edge2 x,y,z, numTriangles values each
+	triangleStore = allocateVector<double>(9*(size_t)numTriangles);
 
-	/* begin calculating determinant - also used to calculate U parameter */
-	CROSS(pvec, dir, edge2);
+	double *v0[3], *e1[3], *e2[3];
 
-	/* if determinant is near zero, ray lies in plane of triangle */
-	det = DOT(edge1, pvec);
+	for (int k=0; k<3; k++)
+	{
+		v0[k] = triangleStore + k*(size_t)numTriangles;
+		e1[k] = triangleStore + (3+k)*(size_t)numTriangles;
+		e2[k] = triangleStore + (6+k)*(size_t)numTriangles;
+	}
 
-	#ifdef TEST_CULL             /* define TEST_CULL if culling is desired */
-	if (det < EPS)
-		return 0;
+	for (int it=0; it<numTriangles; it++)
+	{
+		for (int k=0; k<3; k++)
+		{
+			double a = vertMatrix[faceMatrix[it][0]][k];
+			v0[k][it] = a;
+			e1[k][it] = vertMatrix[faceMatrix[it][1]][k] - a;
+			e2[k][it] = vertMatrix[faceMatrix[it][2]][k] - a;
+		}
+	}
+}
 
-	inv_det = 1.0 / det;
 
-	/* calculate distance from vert0 to ray origin */
-	SUB(tvec, orig, vert0);
+// same arithmetic of intersect_triangle, evaluated for a whole batch of triangles. The triangle data
+// are first gathered into contiguous buffers, so that the test itself is a branch free loop the
+// compiler can vectorise; the pierced triangles are then compacted in place
+int MeshSurface::intersect_triangles(double orig[3], double dir[3], int *ids, int num_ids, double *t, int *hit_ids)
+{
+	double v0x[TRIANGLE_BATCH], v0y[TRIANGLE_BATCH], v0z[TRIANGLE_BATCH];
+	double e1x[TRIANGLE_BATCH], e1y[TRIANGLE_BATCH], e1z[TRIANGLE_BATCH];
+	double e2x[TRIANGLE_BATCH], e2y[TRIANGLE_BATCH], e2z[TRIANGLE_BATCH];
+	double tt[TRIANGLE_BATCH], ok[TRIANGLE_BATCH];
+
+	const double *store = triangleStore;
+	const int64_t n = numTriangles;
+
+	for (int i=0; i<num_ids; i++)
+	{
+		int64_t it = ids[i];
+		v0x[i] = store[it];
+		v0y[i] = store[n+it];
+		v0z[i] = store[2*n+it];
+		e1x[i] = store[3*n+it];
+		e1y[i] = store[4*n+it];
+		e1z[i] = store[5*n+it];
+		e2x[i] = store[6*n+it];
+		e2y[i] = store[7*n+it];
+		e2z[i] = store[8*n+it];
+	}
+
+	const double dx = dir[0], dy = dir[1], dz = dir[2];
+	const double ox = orig[0], oy = orig[1], oz = orig[2];
+
+	for (int i=0; i<num_ids; i++)
+	{
+		// pvec = dir x edge2
+		double px = dy*e2z[i] - dz*e2y[i];
+		double py = dz*e2x[i] - dx*e2z[i];
+		double pz = dx*e2y[i] - dy*e2x[i];
+
+		double det = e1x[i]*px + e1y[i]*py + e1z[i]*pz;
+		double inv_det = 1.0 / det;
+
+		// tvec = orig - vert0
+		double tx = ox - v0x[i];
+		double ty = oy - v0y[i];
+		double tz = oz - v0z[i];
+
+		double u = (tx*px + ty*py + tz*pz) * inv_det;
+
+		// qvec = tvec x edge1
+		double qx = ty*e1z[i] - tz*e1y[i];
+		double qy = tz*e1x[i] - tx*e1z[i];
+		double qz = tx*e1y[i] - ty*e1x[i];
+
+		double v = (dx*qx + dy*qy + dz*qz) * inv_det;
+
+		tt[i] = (e2x[i]*qx + e2y[i]*qy + e2z[i]*qz) * inv_det;
+
+		#ifdef TEST_CULL
+		bool det_ok = !(det < EPS);
+		#else
+		bool det_ok = !(det > -EPS && det < EPS);
+		#endif
+
+		ok[i] = (det_ok && !(u < 0.0 || u > 1.0) && !(v < 0.0 || u + v > 1.0)) ? 1. : 0.;
+	}
+
+	int num_hits = 0;
+
+	for (int i=0; i<num_ids; i++)
+	{
+		t[num_hits] = tt[i];
+		hit_ids[num_hits] = ids[i];
+		num_hits += (int)ok[i];
+	}
+	return num_hits;
+}
+
+
+void MeshSurface::pushBatchIntersections(double orig[3], double dir[3], int *ids, int num_ids, vector<pair<VERTEX_TYPE,VERTEX_TYPE*>> &intersections)
+{
+	double t[TRIANGLE_BATCH];
+	int hit_ids[TRIANGLE_BATCH];
+
+	int num_hits = intersect_triangles(orig, dir, ids, num_ids, t, hit_ids);
+
+	for (int k=0; k<num_hits; k++)
+	{
+		int it = hit_ids[k];
+
+		#if !defined(FLOAT_VERTICES)
+		intersections.push_back(pair<double,double*>(t[k],planes[it]));
+		#else
+		float *p = allocateVector<float>(3);
+		p[0] = planes[it][0];
+		p[1] = planes[it][1];
+		p[2] = planes[it][2];
+		intersections.push_back(pair<float,float*>(t[k],p));
+		#endif
+	}
+}
+
+
+// returns 1 in case of intersection
+int MeshSurface::intersect_triangle(double orig[3], double dir[3],
+									double vert0[3], double vert1[3], double vert2[3], double *t, double *u, double *v)
+{
+   	double edge1[3], edge2[3], tvec[3], pvec[3], qvec[3];
+	double det, inv_det;
+
+	/* find vectors for two edges sharing vert0 */
+	SUB(edge1, vert1, vert0);
+	SUB(edge2, vert2, vert0);
+
+	/* begin calculating determinant - also used to calculate U parameter */
+	CROSS(pvec, dir, edge2);
+
+	/* if determinant is near zero, ray lies in plane of triangle */
+	det = DOT(edge1, pvec);
+
+	#ifdef TEST_CULL             /* define TEST_CULL if culling is desired */
+	if (det < EPS)
+		return 0;
+
+	inv_det = 1.0 / det;
+
+	/* calculate distance from vert0 to ray origin */
+	SUB(tvec, orig, vert0);
 	/* calculate U parameter and test bounds */
 	*u = DOT(tvec, pvec) * inv_det;
 	if (*u < 0.0 || *u > 1.0)
@@ -1777,6 +2395,18 @@ inline void MeshSurface::getRayIntersection(double pa[3], double pb[3], vector<p
 	min_2d[1] = ymin_2d;
 	min_2d[2] = zmin_2d;
 
+	if (useBVH)
+	{
+		double dir[3] = {0., 0., 0.};
+		dir[varying_coord] = pb[varying_coord] - pa[varying_coord];
+
+		getRayIntersectionBVH(pa, dir, first_dim, last__dim, intersections);
+
+		if (intersections.size()>0)
+			sort(intersections.begin(), intersections.end(), compKeepIndex);
+		return;
+	}
+
 	int64_t i1 = (int64_t)rintp((pa[first_dim]-min_2d[first_dim])*scale_2d);
 	int64_t i2 = (int64_t)rintp((pa[last__dim]-min_2d[last__dim])*scale_2d);
 
@@ -1798,55 +2428,16 @@ inline void MeshSurface::getRayIntersection(double pa[3], double pb[3], vector<p
 	if (numTriangles == 0) return;
 
 	double dir[3];
-	#if !defined(FLOAT_VERTICES)
-	double *p[3];
-	#else
-	double p[3][3];
-	#endif
 
 	dir[0] = 0.;
 	dir[1] = 0.;
 	dir[2] = 0.;
 	dir[varying_coord] = pb[varying_coord] - pa[varying_coord];
 
-	for (int iter = 0; iter<numTriangles; iter++)
-	{
-		/* #if !defined(OPTIMIZE_GRIDS)
-		int it = GRID_TRIANGLE_MAP_2D(i1,i2,iter,n_2d_first,n_2d_last);
-		#else */
-		int it = gridTriangleMap2D[i2*n_2d_first+i1][iter];
-		// #endif
-		#if !defined(FLOAT_VERTICES)
-		p[0] = vertMatrix[faceMatrix[it][0]];
-		p[1] = vertMatrix[faceMatrix[it][1]];
-		p[2] = vertMatrix[faceMatrix[it][2]];
-		#else
-		p[0][0] = vertMatrix[faceMatrix[it][0]][0];
-		p[0][1] = vertMatrix[faceMatrix[it][0]][1];
-		p[0][2] = vertMatrix[faceMatrix[it][0]][2];
-		p[1][0] = vertMatrix[faceMatrix[it][1]][0];
-		p[1][1] = vertMatrix[faceMatrix[it][1]][1];
-		p[1][2] = vertMatrix[faceMatrix[it][1]][2];
-		p[2][0] = vertMatrix[faceMatrix[it][2]][0];
-		p[2][1] = vertMatrix[faceMatrix[it][2]][1];
-		p[2][2] = vertMatrix[faceMatrix[it][2]][2];
-		#endif
+	int *cell_triangles = gridTriangleMap2D[i2*n_2d_first+i1].data();
 
-		double t,u,v;
-		// The ray-triangle intersection could be optimised recalling that many components are nil
-		if (intersect_triangle(pa,dir,p[0],p[1],p[2],&t,&u,&v))
-		{
-			#if !defined(FLOAT_VERTICES)
-			intersections.push_back(pair<double,double*>(t,planes[it]));
-			#else
-			float *p = allocateVector<float>(3);
-			p[0] = planes[it][0];
-			p[1] = planes[it][1];
-			p[2] = planes[it][2];
-			intersections.push_back(pair<float,float*>(t,p));
-			#endif
-		}
-	}
+	for (int iter = 0; iter<numTriangles; iter += TRIANGLE_BATCH)
+		pushBatchIntersections(pa, dir, &cell_triangles[iter], MIN(TRIANGLE_BATCH, numTriangles-iter), intersections);
 
 	if (intersections.size()>0)
 		sort(intersections.begin(), intersections.end(), compKeepIndex);
@@ -2018,7 +2609,7 @@ bool MeshSurface::inTriangle(double P[3], double A[3], double B[3], double C[3])
 	dot12 = DOT(v1,v2);
 
 	// Compute barycentric coordinates
-	double invDenom = dot00 * dot11 - dot01 * dot01;
+	double invDenom = 1.0 / (dot00 * dot11 - dot01 * dot01);
 	u = (dot11 * dot02 - dot01 * dot12) * invDenom;
 	v = (dot00 * dot12 - dot01 * dot02) * invDenom;
 
@@ -2045,6 +2636,9 @@ void MeshSurface::point2plane(double p[3], double w[4], double *dist, double pro
 bool MeshSurface::getProjection(double p[3], double *proj1, double *proj2,
 								double *proj3, double *normal1, double *normal2, double *normal3)
 {
+	if (useBVH)
+		return getProjectionBVH(p,proj1,proj2,proj3,normal1,normal2,normal3);
+
 	// get the triangles that are associated to this grid point
 	// by querying the auxiliary grid
 	#if !defined(FLOAT_VERTICES)
@@ -2174,6 +2768,356 @@ bool MeshSurface::save(char *fileName)
 }
 
 
+void MeshSurface::disposeMesh()
+{
+	if (faceMatrix != NULL)
+	{
+		if (facesInMeshFileMap)
+			deleteVector<int*>(faceMatrix);
+		else
+			deleteContiguousMatrix2D<int>(faceMatrix);
+	}
+
+	if (vertMatrix != NULL)
+	{
+		if (verticesInMeshFileMap)
+			deleteVector<VERTEX_TYPE*>(vertMatrix);
+		else
+			deleteContiguousMatrix2D<VERTEX_TYPE>(vertMatrix);
+	}
+
+	if (vertNormals != NULL)
+		deleteContiguousMatrix2D<VERTEX_TYPE>(vertNormals);
+
+	if (vertexTrianglesStart != NULL)
+		deleteVector<int>(vertexTrianglesStart);
+
+	if (vertexTrianglesIds != NULL)
+		deleteVector<int>(vertexTrianglesIds);
+
+	if (meshFileMap != NULL)
+		unmapFile(meshFileMap,meshFileMapSize);
+
+	meshFileMapSize = 0;
+	facesInMeshFileMap = false;
+	verticesInMeshFileMap = false;
+}
+
+
+void MeshSurface::allocateMesh(int num_vertices, int num_triangles)
+{
+	numVertexes = num_vertices;
+	numTriangles = num_triangles;
+
+	faceMatrix = allocateContiguousMatrix2D<int>(numTriangles,3);
+	vertMatrix = allocateContiguousMatrix2D<VERTEX_TYPE>(numVertexes,3);
+}
+
+
+// beginning of the line following p
+static inline const char *nextLine(const char *p, const char *end)
+{
+	const char *q = (const char*)memchr(p, '\n', end-p);
+	return (q == NULL) ? end : q+1;
+}
+
+
+// lines with at most one character (the newline excluded) are skipped by the loaders
+static void countMeshDataLines(const char *begin, const char *end, int64_t *count)
+{
+	int64_t n = 0;
+
+	while (begin < end)
+	{
+		const char *next = nextLine(begin, end);
+		int64_t len = next - begin;
+
+		if (next[-1] == '\n')
+			len--;
+		if (len > 1)
+			n++;
+		begin = next;
+	}
+	*count = n;
+}
+
+
+bool MeshSurface::parseMeshLines(int format, const char *begin, const char *end, int num_vertices, int num_triangles,
+								 int first_vertex, int first_triangle, int aux1, int aux2)
+{
+	int num_chunks = 1;
+
+	#ifdef ENABLE_BOOST_THREADS
+	// below a few MB the threads are not worth it
+	num_chunks = (int)MAX(1, MIN((int64_t)conf.numThreads, (int64_t)(end-begin)/(1<<22)));
+	#endif
+
+	MeshLinesChunk *chunks = allocateVector<MeshLinesChunk>(num_chunks);
+	int64_t *counts = allocateVector<int64_t>(num_chunks);
+
+	// chunks are cut at the beginning of a line
+	for (int k=0; k<num_chunks; k++)
+	{
+		MeshLinesChunk &c = chunks[k];
+
+		c.format = format;
+		c.begin = (k == 0) ? begin : chunks[k-1].end;
+		c.end = end;
+
+		if (k < num_chunks-1)
+		{
+			const char *p = begin + (end-begin)*(k+1)/num_chunks;
+			if (p[-1] != '\n')
+				p = nextLine(p, end);
+			c.end = MAX(p, c.begin);
+		}
+		c.num_vertices = num_vertices;
+		c.num_triangles = num_triangles;
+		c.first_vertex = first_vertex;
+		c.first_triangle = first_triangle;
+		c.aux1 = aux1;
+		c.aux2 = aux2;
+		c.errors[0] = c.errors[1] = c.errors[2] = 0;
+	}
+
+	#ifdef ENABLE_BOOST_THREADS
+	boost::thread_group thdGroup;
+
+	for (int k=0; k<num_chunks; k++)
+		thdGroup.create_thread(boost::bind(&countMeshDataLines, chunks[k].begin, chunks[k].end, &counts[k]));
+
+	thdGroup.join_all();
+	#else
+	countMeshDataLines(chunks[0].begin, chunks[0].end, &counts[0]);
+	#endif
+
+	// the index of the first data line of each chunk
+	int64_t num_lines = 0;
+
+	for (int k=0; k<num_chunks; k++)
+	{
+		chunks[k].first_line = num_lines;
+		num_lines += counts[k];
+	}
+
+	bool ok = true;
+
+	if (num_lines < (int64_t)num_vertices + num_triangles)
+	{
+		cout << endl << WARN << "Unexpected end of file: " << num_vertices << " vertices and " << num_triangles
+			 << " triangles expected, " << num_lines << " lines found";
+		ok = false;
+	}
+	else
+	{
+		#ifdef ENABLE_BOOST_THREADS
+		boost::thread_group thdGroup2;
+
+		for (int k=0; k<num_chunks; k++)
+			thdGroup2.create_thread(boost::bind(&MeshSurface::parseMeshLinesChunk, this, &chunks[k]));
+
+		thdGroup2.join_all();
+		#else
+		parseMeshLinesChunk(&chunks[0]);
+		#endif
+
+		int errors[3] = {0,0,0};
+
+		for (int k=0; k<num_chunks; k++)
+			for (int e=0; e<3; e++)
+				errors[e] += chunks[k].errors[e];
+
+		if (errors[0] > 0)
+		{
+			cout << endl << WARN << "Cannot read " << errors[0] << " lines, or invalid vertex indices found, stop reading";
+			ok = false;
+		}
+		else if (errors[1] > 0)
+		{
+			cout << endl << WARN << "Non triangular mesh, stop reading";
+			ok = false;
+		}
+		else if (errors[2] > 0)
+			cout << endl << WARN << "Coincident indexes in " << errors[2] << " triangles!";
+	}
+
+	deleteVector<MeshLinesChunk>(chunks);
+	deleteVector<int64_t>(counts);
+
+	return ok;
+}
+
+
+void MeshSurface::parseMeshLinesChunk(MeshLinesChunk *chunk)
+{
+	const int format = chunk->format;
+	const int num_vertices = chunk->num_vertices;
+	const int first_vertex = chunk->first_vertex;
+	const int64_t num_lines = (int64_t)num_vertices + chunk->num_triangles;
+	const char *p = chunk->begin;
+	const char *end = chunk->end;
+	int64_t line = chunk->first_line;
+	int *errors = chunk->errors;
+
+	while (p < end && line < num_lines)
+	{
+		const char *next = nextLine(p, end);
+		const char *le = (next[-1] == '\n') ? next-1 : next;
+
+		if (le-p <= 1)
+		{
+			p = next;
+			continue;
+		}
+
+		bool ok = true;
+
+		if (line < num_vertices)
+		{
+			int iv = first_vertex + (int)line;
+			double v[6], dummy;
+
+			// properties preceding the coordinates
+			if (format == MESH_LINES_PLY)
+				for (int k=0; k<chunk->aux1; k++)
+					ok &= parseDouble(p, le, dummy);
+
+			int nv = (format == MESH_LINES_MSMS) ? 6 : 3;
+			for (int k=0; k<nv; k++)
+				ok &= parseDouble(p, le, v[k]);
+
+			// coordinates are single precision in all the supported formats
+			if (ok)
+			{
+				vertMatrix[iv][0] = (float)v[0];
+				vertMatrix[iv][1] = (float)v[1];
+				vertMatrix[iv][2] = (float)v[2];
+
+				if (format == MESH_LINES_MSMS)
+				{
+					vertNormals[iv][0] = (float)v[3];
+					vertNormals[iv][1] = (float)v[4];
+					vertNormals[iv][2] = (float)v[5];
+				}
+			}
+		}
+		else
+		{
+			int it = chunk->first_triangle + (int)(line-num_vertices);
+			int n = 3, id[3] = {-1,-1,-1};
+			double dummy;
+
+			if (format == MESH_LINES_PLY)
+				for (int k=0; k<chunk->aux2; k++)
+					ok &= parseDouble(p, le, dummy);
+
+			// MSMS faces have no vertex count and 1-based indices
+			if (format != MESH_LINES_MSMS)
+				ok &= parseInt(p, le, n);
+
+			for (int k=0; k<3; k++)
+				ok &= parseInt(p, le, id[k]);
+
+			if (ok && n != 3)
+				errors[1]++;
+
+			for (int k=0; k<3; k++)
+			{
+				if (format == MESH_LINES_MSMS)
+					id[k] += first_vertex-1;
+
+				if (id[k] < 0 || id[k] >= numVertexes)
+					ok = false;
+
+				faceMatrix[it][k] = id[k];
+			}
+
+			if (ok && (id[0] == id[1] || id[1] == id[2] || id[2] == id[0]))
+				errors[2]++;
+		}
+
+		if (!ok)
+			errors[0]++;
+
+		line++;
+		p = next;
+	}
+}
+
+
+void MeshSurface::buildVertexTriangles()
+{
+	if (vertexTrianglesStart != NULL)
+		deleteVector<int>(vertexTrianglesStart);
+
+	if (vertexTrianglesIds != NULL)
+		deleteVector<int>(vertexTrianglesIds);
+
+	vertexTrianglesStart = allocateVector<int>(numVertexes+1);
+	vertexTrianglesIds = allocateVector<int>(MAX(3*(int64_t)numTriangles,1));
+
+	for (int i=0; i<=numVertexes; i++)
+		vertexTrianglesStart[i] = 0;
+
+	// counting sort by vertex: every thread owns a range of vertices and scans all the triangles,
+	// so that no synchronization is needed and the triangles of a vertex are stored in increasing order
+	#ifdef ENABLE_BOOST_THREADS
+	int num_threads = (int)MAX(1, MIN((int64_t)conf.numThreads, (int64_t)numTriangles/100000));
+	#endif
+
+	for (int pass=0; pass<2; pass++)
+	{
+		bool scatter = (pass == 1);
+
+		#ifdef ENABLE_BOOST_THREADS
+		boost::thread_group thdGroup;
+
+		for (int j=0; j<num_threads; j++)
+			thdGroup.create_thread(boost::bind(&MeshSurface::buildVertexTrianglesRange, this,
+											   (int)((int64_t)numVertexes*j/num_threads), (int)((int64_t)numVertexes*(j+1)/num_threads), scatter));
+
+		thdGroup.join_all();
+		#else
+		buildVertexTrianglesRange(0, numVertexes, scatter);
+		#endif
+
+		// counts are in [v+1]; after the prefix sum [v] is the beginning of the list of v and it is
+		// used as insertion cursor in the scatter pass, which leaves in [v] the end of the list
+		if (!scatter)
+		{
+			for (int i=0; i<numVertexes; i++)
+				vertexTrianglesStart[i+1] += vertexTrianglesStart[i];
+		}
+		else
+		{
+			for (int i=numVertexes; i>0; i--)
+				vertexTrianglesStart[i] = vertexTrianglesStart[i-1];
+			vertexTrianglesStart[0] = 0;
+		}
+	}
+}
+
+
+void MeshSurface::buildVertexTrianglesRange(int v_begin, int v_end, bool scatter)
+{
+	for (int it=0; it<numTriangles; it++)
+	{
+		for (int k=0; k<3; k++)
+		{
+			int iv = faceMatrix[it][k];
+
+			if (iv < v_begin || iv >= v_end)
+				continue;
+
+			if (scatter)
+				vertexTrianglesIds[ vertexTrianglesStart[iv]++ ] = it;
+			else
+				vertexTrianglesStart[iv+1]++;
+		}
+	}
+}
+
+
 bool MeshSurface::load(char *fileName)
 {
 	if ((int)strlen(fileName) == 0)
@@ -2190,7 +3134,9 @@ bool MeshSurface::load(char *fileName)
 
 	bool exit = true;
 
-	if (found != string::npos)
+	if (ss.find(".off.bin") != string::npos)
+		exit = loadOFFBinary(fileName);
+	else if (found != string::npos)
 		exit = loadOFF(fileName);
 
 	found = ss.find(".ply");
@@ -2206,11 +3152,17 @@ bool MeshSurface::load(char *fileName)
 }
 
 
+static inline void swapBytes4(char *p)
+{
+	char t = p[0]; p[0] = p[3]; p[3] = t;
+	t = p[1]; p[1] = p[2]; p[2] = t;
+}
+
+
 bool MeshSurface::loadPLY(char *fname)
 {
 	int format=0, voh, foh, vph, fph;
-	int nv,nt,i,j,i1,i2,i3,i4;
-	float x,y,z;
+	int nv,nt;
 	// bool triangulate = 0;
 	FILE *in;
 	char keyword[64], formats[24], version[10];
@@ -2267,76 +3219,130 @@ bool MeshSurface::loadPLY(char *fname)
 			return false;
 		}
 
-	if (vertMatrix != NULL)
-		deleteMatrix2D<VERTEX_TYPE>(numVertexes,3,vertMatrix);
+	// the body is read from the mapped file
+	size_t body_offset = (size_t)ftell(in);
+	fclose(in);
+
+	size_t size;
+	char *data = mapFile(fname, size);
 
-	if (vertexTrianglesList != NULL)
+	if (data == NULL || body_offset > size)
 	{
-		for (int i=0; i<numVertexes; i++)
-			delete vertexTrianglesList[i];
-		deleteVector<vector<int>*>(vertexTrianglesList);
+		cout << endl << ERR << "Cannot read ply file body";
+		if (data != NULL)
+			unmapFile(data, size);
+		return false;
 	}
 
-	numVertexes = nv;
+	disposeMesh();
 
-	vertMatrix = allocateMatrix2D<VERTEX_TYPE>(numVertexes,3);
+	const char *body = data + body_offset;
+	const char *end = data + size;
 
-	vertexTrianglesList = allocateVector<vector<int>*>(numVertexes);
+	if (format == PLY_FORMAT_ASCII)
+	{
+		// one element per line; the trailing properties (voh, foh) are ignored
+		allocateMesh(nv,nt);
 
-	for (int i=0; i<numVertexes; i++)
-		vertexTrianglesList[i] = new vector<int>();
+		bool ok = parseMeshLines(MESH_LINES_PLY, body, end, nv, nt, 0, 0, vph, fph);
+		unmapFile(data, size);
 
-	for (i=0; i<nv; i++)
-	{
-		ply_readVCoords(in, format, vph, voh, &x, &y, &z);
-		vertMatrix[i][0] = x;
-		vertMatrix[i][1] = y;
-		vertMatrix[i][2] = z;
+		if (!ok)
+			return false;
 	}
+	else
+	{
+		// binary elements have a fixed size: the face list must be a triangle
+		int64_t vertex_size = vph + 12 + voh;
+		int64_t face_size = fph + 1 + 12 + foh;
 
-	if (faceMatrix != NULL)
-		deleteMatrix2D<int>(numTriangles,3,faceMatrix);
+		if (body + vertex_size*nv + face_size*nt > end)
+		{
+			cout << endl << ERR << "Unexpected end of ply file!";
+			unmapFile(data, size);
+			return false;
+		}
 
-	numTriangles = nt;
-	faceMatrix = allocateMatrix2D<int>(numTriangles,3);
+		numVertexes = nv;
+		numTriangles = nt;
 
-	for (i=0; i<nt; i++)
-	{
-		if (ply_readFIndices(in, format, fph, &i4, &i1, &i2, &i3))
+		#if defined(FLOAT_VERTICES)
+		// little endian single precision vertices are referenced in place if they are aligned
+		if (format == PLY_FORMAT_BIN_L && (body_offset+vph) % sizeof(float) == 0 && vertex_size % sizeof(float) == 0)
+		{
+			vertMatrix = allocateVector<float*>(numVertexes);
+			for (int i=0; i<nv; i++)
+				vertMatrix[i] = (float*)(body + vertex_size*i + vph);
+			verticesInMeshFileMap = true;
+		}
+		#endif
+
+		if (!verticesInMeshFileMap)
 		{
-			if (i1<0 || i2<0 || i3<0 || i4<3 || i4>=4 || i1>(nv-1) || i2>(nv-1) || i3>(nv-1))
+			vertMatrix = allocateContiguousMatrix2D<VERTEX_TYPE>(numVertexes,3);
+
+			for (int i=0; i<nv; i++)
 			{
-				cout << endl << ERR <<("\nloadPLY: Invalid index at face %d!\n",i);
-				return false;
+				float vc[3];
+				memcpy(vc, body + vertex_size*i + vph, 3*sizeof(float));
+
+				if (format == PLY_FORMAT_BIN_B)
+					for (int k=0; k<3; k++)
+						swapBytes4((char*)&vc[k]);
+
+				vertMatrix[i][0] = vc[0];
+				vertMatrix[i][1] = vc[1];
+				vertMatrix[i][2] = vc[2];
 			}
-			for (j=3; j <= i4; j++)
+		}
+
+		faceMatrix = allocateContiguousMatrix2D<int>(numTriangles,3);
+
+		const char *faces = body + vertex_size*nv;
+		int coincident = 0;
+		bool ok = true;
+
+		for (int i=0; i<nt; i++)
+		{
+			const char *f = faces + face_size*i + fph;
+			int id[3];
+
+			memcpy(id, f+1, 3*sizeof(int));
+
+			if (format == PLY_FORMAT_BIN_B)
+				for (int k=0; k<3; k++)
+					swapBytes4((char*)&id[k]);
+
+			if ((unsigned char)f[0] != 3 || id[0]<0 || id[1]<0 || id[2]<0 || id[0]>(nv-1) || id[1]>(nv-1) || id[2]>(nv-1))
 			{
-				if (i1 == i2 || i2 == i3 || i3 == i1) cout << endl << WARN <<("\nloadPLY: Coincident indexes at triangle %d! Skipping.\n",i);
-				else
-				{
-					faceMatrix[i][0] = i1;
-					faceMatrix[i][1] = i2;
-					faceMatrix[i][2] = i3;
-					vertexTrianglesList[i1]->push_back(i);
-					vertexTrianglesList[i2]->push_back(i);
-					vertexTrianglesList[i3]->push_back(i);
-				}
-				i2 = i3;
-				if (j < i4)
-				{
-					if (!ply_readAnotherFIndex(in, format, &i3))
-					{
-						cout << endl << ERR <<("\nloadPLY: Couldn't read indexes for face # %d\n",i);
-						return false;
-					}
-					// else triangulate = 1;
-				}
-				else ply_readOverhead(in, format, foh);
+				cout << endl << ERR << "loadPLY: Invalid index at face " << i << "!";
+				ok = false;
+				break;
 			}
+			if (id[0] == id[1] || id[1] == id[2] || id[2] == id[0])
+				coincident++;
+
+			faceMatrix[i][0] = id[0];
+			faceMatrix[i][1] = id[1];
+			faceMatrix[i][2] = id[2];
 		}
-		else cout << endl << ERR <<("\nloadPLY: Couldn't read indexes for face # %d\n",i);
+
+		if (coincident > 0)
+			cout << endl << WARN << "Coincident indexes in " << coincident << " triangles!";
+
+		if (verticesInMeshFileMap)
+		{
+			meshFileMap = data;
+			meshFileMapSize = size;
+		}
+		else
+			unmapFile(data, size);
+
+		if (!ok)
+			return false;
 	}
-	fclose(in);
+
+	buildVertexTriangles();
 
 	if (checkDuplicatedVertices)
 		checkDuplicates();
@@ -2349,12 +3355,10 @@ bool MeshSurface::loadPLY(char *fname)
 
 bool MeshSurface::loadOFF(char *fileName)
 {
-	ifstream fin;
-	fin.open(fileName,ios::in);
-	int temp;
-	char buffer[BUFLEN];
+	size_t size;
+	char *data = mapFile(fileName, size);
 
-	if (fin.fail())
+	if (data == NULL)
 	{
 		cout << endl << WARN << "Cannot read file " << fileName;
 		return false;
@@ -2362,113 +3366,211 @@ bool MeshSurface::loadOFF(char *fileName)
 
 	int tag = 0;
 	int header = 0;
+	int nv = 0, nt = 0;
 
-	if (faceMatrix != NULL)
-		deleteMatrix2D<int>(numTriangles,3,faceMatrix);
+	disposeMesh();
 
-	if (vertMatrix != NULL)
-		deleteMatrix2D<VERTEX_TYPE>(numVertexes,3,vertMatrix);
+	const char *p = data;
+	const char *end = data + size;
 
-	if (vertexTrianglesList != NULL)
+	while (p < end)
 	{
-		for (int i=0; i<numVertexes; i++)
-			delete vertexTrianglesList[i];
-		deleteVector<vector<int>*>(vertexTrianglesList);
-	}
-
-	while (1)
-	{
-		fin.getline(buffer,BUFLEN);
-
-		if (fin.eof())
-			break;
-
-		//cout << endl << buffer;
+		const char *next = nextLine(p, end);
+		const char *le = (next[-1] == '\n') ? next-1 : next;
 
 		// skip empty lines
-		if (strlen(buffer) <= 1)
+		if (le-p <= 1)
+		{
+			p = next;
 			continue;
+		}
 
-		if (tag == 0 && strncmp(buffer, "OFF", 1) == 0)
+		if (tag == 0 && p[0] == 'O')
 		{
 			tag = 1;
+			p = next;
 			continue;
 		}
 
-		if (buffer[0] == '#')
+		if (p[0] == '#')
 		{
-			cout << endl << INFO << "Mesh comment line: " << buffer;
+			cout << endl << INFO << "Mesh comment line: " << string(p,le-p);
+			p = next;
 			continue;
 		}
 
 		// if OFF is read then the header can be read
 		if (header == 0 && tag == 1)
 		{
-			sscanf(buffer,"%d %d %d",&numVertexes,&numTriangles,&temp);
-			if (numVertexes <=0 || numTriangles <= 0)
+			const char *q = p;
+			parseInt(q,le,nv);
+			parseInt(q,le,nt);
+			p = next;
+
+			if (nv <= 0 || nt <= 0)
 			{
 				cout << endl << WARN << "Number of triangles or vertices <=0 !";
+				unmapFile(data, size);
 				return false;
 			}
-			else
-			{
-				faceMatrix = allocateMatrix2D<int>(numTriangles,3);
-
-				vertMatrix = allocateMatrix2D<VERTEX_TYPE>(numVertexes,3);
-
-				vertexTrianglesList = allocateVector<vector<int>*>(numVertexes);
-				for (int i=0; i<numVertexes; i++)
-					vertexTrianglesList[i] = new vector<int>();
-			}
 			header = 1;
 			break;
 		}
+		p = next;
 	}
 
 	if (header !=1 || tag !=1)
 	{
 		cout << endl << WARN << "Cannot read OFF header or number of vertices/triangles, stop reading";
 		cout << endl << WARN << "Tag " << tag << " Header " << header;
+		unmapFile(data, size);
 		return false;
 	}
-	// read vertices
-	for (int i=0; i<numVertexes; i++)
+
+	allocateMesh(nv,nt);
+
+	bool ok = parseMeshLines(MESH_LINES_OFF, p, end, nv, nt, 0, 0);
+	unmapFile(data, size);
+
+	if (!ok)
+		return false;
+
+	buildVertexTriangles();
+
+	if (checkDuplicatedVertices)
+		checkDuplicates();
+	printSummary();
+	computeNormals = true;
+
+	return true;
+}
+
+
+bool MeshSurface::loadOFFBinary(char *fileName)
+{
+	size_t size;
+	char *data = mapFile(fileName, size);
+
+	if (data == NULL)
 	{
-		fin.getline(buffer,BUFLEN);
-		if (strlen(buffer) <= 1)
-		{
-			i--;
-			continue;
-		}
-		float v1,v2,v3;
-		sscanf(buffer, "%f %f %f", &v1,&v2,&v3);
-		vertMatrix[i][0] = v1;
-		vertMatrix[i][1] = v2;
-		vertMatrix[i][2] = v3;
+		cout << endl << WARN << "Cannot read file " << fileName;
+		return false;
 	}
 
-	for (int i=0; i<numTriangles; i++)
+	disposeMesh();
+
+	// text header as written by Surface::saveMeshBinary: the OFF variant, comment and empty lines, the sizes
+	const char *p = data;
+	const char *end = data + size;
+	int variant = -1;
+	int nv = 0, nt = 0;
+	bool header = false;
+
+	while (p < end && !header)
 	{
-		fin.getline(buffer,BUFLEN);
-		if (strlen(buffer) <= 1)
+		const char *next = nextLine(p, end);
+		const char *le = (next[-1] == '\n') ? next-1 : next;
+		string line(p, le-p);
+
+		if (variant < 0)
 		{
-			i--;
-			continue;
+			if (!line.compare(0,7,"OFF+N+A")) variant = OFF_N_A;
+			else if (!line.compare(0,5,"OFF+N")) variant = OFF_N;
+			else if (!line.compare(0,5,"OFF+A")) variant = OFF_A;
+			else if (!line.compare(0,3,"OFF")) variant = OFF;
+			else break;
+		}
+		else if (line.find_first_not_of(" \t\r") != string::npos && line[0] != '#')
+		{
+			const char *q = p;
+			header = parseInt(q,le,nv) && parseInt(q,le,nt);
 		}
+		p = next;
+	}
 
-		sscanf(buffer, "%d %d %d %d", &temp,&faceMatrix[i][0],&faceMatrix[i][1],&faceMatrix[i][2]);
+	if (!header || nv <= 0 || nt <= 0)
+	{
+		cout << endl << WARN << "Cannot read binary OFF header or number of vertices/triangles, stop reading";
+		unmapFile(data, size);
+		return false;
+	}
 
-		vertexTrianglesList[faceMatrix[i][0]]->push_back(i);
-		vertexTrianglesList[faceMatrix[i][1]]->push_back(i);
-		vertexTrianglesList[faceMatrix[i][2]]->push_back(i);
+	// per vertex: coordinates, then the normal and the nearest atom if present
+	int64_t vertex_size = 3*sizeof(float);
+	if (variant == OFF_N || variant == OFF_N_A)
+		vertex_size += 3*sizeof(float);
+	if (variant == OFF_A || variant == OFF_N_A)
+		vertex_size += sizeof(int);
 
-		if (temp != 3)
+	const char *vertices = p;
+	const char *faces = p + vertex_size*nv;
+
+	if (faces + 3*sizeof(int)*(int64_t)nt > end)
+	{
+		cout << endl << ERR << "Unexpected end of binary OFF file!";
+		unmapFile(data, size);
+		return false;
+	}
+
+	numVertexes = nv;
+	numTriangles = nt;
+
+	// the triangles are stored as an int matrix: if aligned, they are referenced in place
+	if ((faces - data) % sizeof(int) == 0)
+	{
+		faceMatrix = allocateVector<int*>(numTriangles);
+		for (int i=0; i<nt; i++)
+			faceMatrix[i] = (int*)faces + 3*(int64_t)i;
+		facesInMeshFileMap = true;
+	}
+	else
+	{
+		faceMatrix = allocateContiguousMatrix2D<int>(numTriangles,3);
+		memcpy(faceMatrix[0], faces, 3*sizeof(int)*(int64_t)nt);
+	}
+
+	#if defined(FLOAT_VERTICES)
+	if ((vertices - data) % sizeof(float) == 0)
+	{
+		vertMatrix = allocateVector<float*>(numVertexes);
+		for (int i=0; i<nv; i++)
+			vertMatrix[i] = (float*)(vertices + vertex_size*i);
+		verticesInMeshFileMap = true;
+	}
+	#endif
+
+	if (!verticesInMeshFileMap)
+	{
+		vertMatrix = allocateContiguousMatrix2D<VERTEX_TYPE>(numVertexes,3);
+
+		for (int i=0; i<nv; i++)
 		{
-			cout << endl << WARN << "Non triangular mesh, stop reading";
-			return false;
+			float vc[3];
+			memcpy(vc, vertices + vertex_size*i, 3*sizeof(float));
+			vertMatrix[i][0] = vc[0];
+			vertMatrix[i][1] = vc[1];
+			vertMatrix[i][2] = vc[2];
 		}
 	}
 
+	if (facesInMeshFileMap || verticesInMeshFileMap)
+	{
+		meshFileMap = data;
+		meshFileMapSize = size;
+	}
+	else
+		unmapFile(data, size);
+
+	for (int i=0; i<nt; i++)
+		for (int k=0; k<3; k++)
+			if (faceMatrix[i][k] < 0 || faceMatrix[i][k] >= nv)
+			{
+				cout << endl << ERR << "Invalid index at face " << i << "!";
+				return false;
+			}
+
+	buildVertexTriangles();
+
 	if (checkDuplicatedVertices)
 		checkDuplicates();
 	printSummary();
@@ -2480,9 +3582,6 @@ bool MeshSurface::loadOFF(char *fileName)
 
 bool MeshSurface::loadMSMS(char *fileName,int numFiles)
 {
-	ifstream fin,fin2;
-
-	char buffer[BUFLEN];
 	char baseName[BUFLEN];
 
 	char currentFace[2*BUFLEN];
@@ -2490,6 +3589,8 @@ bool MeshSurface::loadMSMS(char *fileName,int numFiles)
 
 	strcpy(baseName,fileName);
 
+	disposeMesh();
+
 	int tempNumVertices = 0;
 	int tempNumTri = 0;
 	numVertexes = 0;
@@ -2498,25 +3599,26 @@ bool MeshSurface::loadMSMS(char *fileName,int numFiles)
 	int lastVert = 0;
 	int lastTri = 0;
 
-	#if !defined(FLOAT_VERTICES)
-	if (vertMatrix != NULL)
-		deleteMatrix2D<double>(numVertexes,3,vertMatrix);
+	char **vertData = allocateVector<char*>(numFiles);
+	char **faceData = allocateVector<char*>(numFiles);
+	size_t *vertSize = allocateVector<size_t>(numFiles);
+	size_t *faceSize = allocateVector<size_t>(numFiles);
+	// beginning of the data lines and their number in each file
+	const char **vertBody = allocateVector<const char*>(numFiles);
+	const char **faceBody = allocateVector<const char*>(numFiles);
+	int *fileVertices = allocateVector<int>(numFiles);
+	int *fileTriangles = allocateVector<int>(numFiles);
 
-	if (vertNormals!=NULL)
-		deleteMatrix2D<double>(numVertexes,3,vertNormals);
-	#else
-	if (vertMatrix != NULL)
-		deleteMatrix2D<float>(numVertexes,3,vertMatrix);
-
-	if (vertNormals!=NULL)
-		deleteMatrix2D<float>(numVertexes,3,vertNormals);
-	#endif
+	for (int i=0; i<numFiles; i++)
+	{
+		vertData[i] = NULL;
+		faceData[i] = NULL;
+	}
 
-	if (faceMatrix!=NULL)
-		deleteMatrix2D<int>(numTriangles,3,faceMatrix);
+	bool ok = true;
 
 	// getting the total number of vertices and triangles
-	for (int i=0; i<numFiles; i++)
+	for (int i=0; i<numFiles && ok; i++)
 	{
 		// main component
 		if (i == 0)
@@ -2531,136 +3633,102 @@ bool MeshSurface::loadMSMS(char *fileName,int numFiles)
 			sprintf(currentVert, "%s_%d.vert", baseName,i);
 		}
 
-		fin.open(currentVert,ios::in);
-		fin2.open(currentFace,ios::in);
 		cout << endl << INFO << "Getting num vertices and triangles in MSMS mesh files " << currentFace << "," << currentVert << "...";
 
-		if (fin.fail() || fin2.fail())
+		vertData[i] = mapFile(currentVert, vertSize[i]);
+		faceData[i] = mapFile(currentFace, faceSize[i]);
+
+		if (vertData[i] == NULL || faceData[i] == NULL)
 		{
 			cout << WARN << "One or both MSMS files don't exist";
-			return false;
+			ok = false;
+			break;
 		}
 
-		// comment or empty
-		bool comment = true;
-		while (comment)
+		for (int f=0; f<2; f++)
 		{
-			fin.getline(buffer,BUFLEN);
-			if (buffer[0] != '#' && buffer[0] != '\0')
-				comment = false;
-		}
-		sscanf(buffer, "%d", &tempNumVertices);
-		numVertexes += tempNumVertices;
-		fin.close();
+			const char *p = (f == 0) ? vertData[i] : faceData[i];
+			const char *end = p + ((f == 0) ? vertSize[i] : faceSize[i]);
+			int num = 0;
 
-		// reads num triangles
-		comment = true;
-		while (comment)
-		{
-			fin2.getline(buffer,BUFLEN);
-			if (buffer[0] != '#' && buffer[0] != '\0')
-				comment = false;
+			// comment or empty
+			while (p < end && (p[0] == '#' || p[0] == '\n'))
+				p = nextLine(p, end);
+
+			const char *le = nextLine(p, end);
+			parseInt(p, le, num);
+
+			if (f == 0)
+			{
+				vertBody[i] = le;
+				fileVertices[i] = num;
+				numVertexes += num;
+			}
+			else
+			{
+				faceBody[i] = le;
+				fileTriangles[i] = num;
+				numTriangles += num;
+			}
 		}
-		sscanf(buffer, "%d", &tempNumTri);
-		numTriangles += tempNumTri;
-		fin2.close();
 	}
 
-	cout << endl << INFO << "Total number of triangles " << numTriangles;
-	cout << endl << INFO << "Total number of vertices " << numVertexes;
+	if (ok)
+	{
+		cout << endl << INFO << "Total number of triangles " << numTriangles;
+		cout << endl << INFO << "Total number of vertices " << numVertexes;
 
-	vertMatrix = allocateMatrix2D<VERTEX_TYPE>(numVertexes,3);
-	vertNormals = allocateMatrix2D<VERTEX_TYPE>(numVertexes,3);
-	faceMatrix = allocateMatrix2D<int>(numTriangles,3);
+		allocateMesh(numVertexes,numTriangles);
+		vertNormals = allocateContiguousMatrix2D<VERTEX_TYPE>(numVertexes,3);
+	}
 
 	// read all
-	for (int i=0; i<numFiles; i++)
+	for (int i=0; i<numFiles && ok; i++)
 	{
-		// main component
 		if (i == 0)
 		{
 			sprintf(currentFace, "%s.face", baseName);
 			sprintf(currentVert, "%s.vert", baseName);
 		}
-		// cavities
 		else
 		{
 			sprintf(currentFace, "%s_%d.face", baseName,i);
 			sprintf(currentVert, "%s_%d.vert", baseName,i);
 		}
-
-		fin.open(currentVert,ios::in);
-		fin2.open(currentFace,ios::in);
 		cout << endl << INFO << "Loading MSMS mesh files " << currentFace << "," << currentVert << "...";
 
-		if (fin.fail() || fin2.fail())
-		{
-			cout << WARN << "One or both MSMS files don't exist";
-			return false;
-		}
+		tempNumVertices = fileVertices[i];
+		tempNumTri = fileTriangles[i];
 
-		bool comment = true;
-		while (comment)
-		{
-			fin.getline(buffer,BUFLEN);
-			if (buffer[0] != '#' && buffer[0] != '\0')
-				comment = false;
-		}
+		ok = parseMeshLines(MESH_LINES_MSMS, vertBody[i], vertData[i]+vertSize[i], tempNumVertices, 0, lastVert, 0) &&
+			 parseMeshLines(MESH_LINES_MSMS, faceBody[i], faceData[i]+faceSize[i], 0, tempNumTri, lastVert, lastTri);
 
-		sscanf(buffer, "%d", &tempNumVertices);
+		lastTri += tempNumTri;
+		lastVert += tempNumVertices;
+	}
 
-		for (int i=lastVert; i < lastVert + tempNumVertices; i++)
-		{
-			fin.getline(buffer,BUFLEN);
-			// skip empty lines
-			if (strlen(buffer) > 1)
-			{
-				float a,b,c,d,e,f;
-				sscanf(buffer, "%f %f %f %f %f %f", &a,&b,&c,&d,&e,&f);
-				vertMatrix[i][0] = a;
-				vertMatrix[i][1] = b;
-				vertMatrix[i][2] = c;
-				vertNormals[i][0] = d;
-				vertNormals[i][1] = e;
-				vertNormals[i][2] = f;
-			}
-			else
-				i--;
-		}
-		fin.close();
+	for (int i=0; i<numFiles; i++)
+	{
+		if (vertData[i] != NULL)
+			unmapFile(vertData[i], vertSize[i]);
+		if (faceData[i] != NULL)
+			unmapFile(faceData[i], faceSize[i]);
+	}
 
-		comment = true;
-		while (comment)
-		{
-			fin2.getline(buffer,BUFLEN);
-			if (buffer[0]!='#' && buffer[0]!='\0')
-				comment = false;
-		}
-		sscanf(buffer,"%d",&tempNumTri);
+	deleteVector<char*>(vertData);
+	deleteVector<char*>(faceData);
+	deleteVector<size_t>(vertSize);
+	deleteVector<size_t>(faceSize);
+	deleteVector<const char*>(vertBody);
+	deleteVector<const char*>(faceBody);
+	deleteVector<int>(fileVertices);
+	deleteVector<int>(fileTriangles);
 
-		for (int i=lastTri; i < lastTri + tempNumTri; i++)
-		{
-			fin2.getline(buffer,BUFLEN);
-			// skip empty lines
-			if (strlen(buffer) > 1)
-			{
-				sscanf(buffer, "%d %d %d",
-					   &(faceMatrix[i][0]),&(faceMatrix[i][1]),&(faceMatrix[i][2]));
-				faceMatrix[i][0]--;
-				faceMatrix[i][1]--;
-				faceMatrix[i][2]--;
-				faceMatrix[i][0] += lastVert;
-				faceMatrix[i][1] += lastVert;
-				faceMatrix[i][2] += lastVert;
-			}
-			else
-				i--;
-		}
-		fin2.close();
+	if (!ok)
+		return false;
+
+	buildVertexTriangles();
 
-		lastTri += tempNumTri;
-		lastVert += tempNumVertices;
-	}
 	if (checkDuplicatedVertices)
 		checkDuplicates();
 	printSummary();
@@ -2677,6 +3745,27 @@ bool MeshSurface::loadMSMS(char *fileName,int numFiles)
 }
 
 
+// indices of the rows of m equal to a preceding row, in increasing order
+template<class T> static void findDuplicatedTriplets(T **m, int n, vector<int> &duplicates)
+{
+	vector<pair<pair<T,pair<T,T>>,int>> keys(n);
+
+	for (int i=0; i<n; i++)
+		keys[i] = make_pair(make_pair(m[i][0], make_pair(m[i][1],m[i][2])), i);
+
+	// equal rows are contiguous and sorted by index: all but the first of each run are duplicates
+	sort(keys.begin(), keys.end());
+
+	duplicates.clear();
+
+	for (int i=1; i<n; i++)
+		if (keys[i].first == keys[i-1].first)
+			duplicates.push_back(keys[i].second);
+
+	sort(duplicates.begin(), duplicates.end());
+}
+
+
 bool MeshSurface::checkDuplicates()
 {
 	if (faceMatrix == NULL || vertMatrix == NULL)
@@ -2688,58 +3777,24 @@ bool MeshSurface::checkDuplicates()
 	bool ret = true;
 
 	// check for duplicated vertices
-	set<pair<VERTEX_TYPE,pair<VERTEX_TYPE,VERTEX_TYPE>>> checkV;
-	set<pair<VERTEX_TYPE,pair<VERTEX_TYPE,VERTEX_TYPE>>>::iterator stv;
+	vector<int> duplicates;
+	findDuplicatedTriplets<VERTEX_TYPE>(vertMatrix, numVertexes, duplicates);
 
-	for (int i=0; i<numVertexes; i++)
+	for (unsigned int k=0; k<duplicates.size(); k++)
 	{
-		pair<VERTEX_TYPE,pair<VERTEX_TYPE,VERTEX_TYPE>> triplet;
-
-		triplet.first = vertMatrix[i][0];
-		triplet.second.first = vertMatrix[i][1];
-		triplet.second.second = vertMatrix[i][2];
-		stv = checkV.find(triplet);
-
-		if (stv == checkV.end())
-		{
-			// ok
-		}
-		// duplicated vertex
-		else
-		{
-			cout << endl << WARN << "Duplicated vertex detected! " << triplet.first << " "
-			<< triplet.second.first << " " << triplet.second.second;
-			ret = false;
-		}
-
-		checkV.insert(triplet);
+		VERTEX_TYPE *v = vertMatrix[ duplicates[k] ];
+		cout << endl << WARN << "Duplicated vertex detected! " << v[0] << " " << v[1] << " " << v[2];
+		ret = false;
 	}
 
 	// check for duplicated triangles
-	set<pair<int,pair<int,int>>> checkT;
-	set<pair<int,pair<int,int>>>::iterator st;
+	findDuplicatedTriplets<int>(faceMatrix, numTriangles, duplicates);
 
-	for (int i=0; i<numTriangles; i++)
+	for (unsigned int k=0; k<duplicates.size(); k++)
 	{
-		pair<int,pair<int,int>> triplet;
-		triplet.first = faceMatrix[i][0];
-		triplet.second.first = faceMatrix[i][1];
-		triplet.second.second = faceMatrix[i][2];
-		st = checkT.find(triplet);
-
-		if (st == checkT.end())
-		{
-			// ok
-		}
-		// duplicated triangle
-		else
-		{
-			cout << endl << WARN << "Duplicated triangle detected! " << triplet.first << " "
-			<< triplet.second.first << " " << triplet.second.second;
-			ret = false;
-		}
-
-		checkT.insert(triplet);
+		int *t = faceMatrix[ duplicates[k] ];
+		cout << endl << WARN << "Duplicated triangle detected! " << t[0] << " " << t[1] << " " << t[2];
+		ret = false;
 	}
 
 	return ret;
@@ -24,6 +24,53 @@
 // #define TEST_CULL
 
 
+/** text formats parsed by MeshSurface::parseMeshLines*/
+#define MESH_LINES_OFF 0
+#define MESH_LINES_PLY 1
+#define MESH_LINES_MSMS 2
+
+/** a thread chunk of a text mesh file: data line l of the file is the vertex first_vertex+l if
+l < num_vertices, the triangle first_triangle+(l-num_vertices) otherwise. aux1 and aux2 are
+the number of properties preceding the vertex coordinates and the face list (PLY only)*/
+typedef struct MeshLinesChunk
+{
+	int format;
+	const char *begin;
+	const char *end;
+	int64_t first_line;
+	int num_vertices;
+	int num_triangles;
+	int first_vertex;
+	int first_triangle;
+	int aux1;
+	int aux2;
+	/** unreadable lines or invalid indices, non triangular faces, faces with coincident indices*/
+	int errors[3];
+} MeshLinesChunk;
+
+/** number of triangles tested against a ray by a single call of the batched kernel*/
+#define TRIANGLE_BATCH 64
+
+/** number of bins used to evaluate the surface area heuristic while building the BVH*/
+#define BVH_SAH_BINS 16
+/** maximal number of triangles in a BVH leaf*/
+#define BVH_MAX_LEAF_SIZE 8
+/** maximal depth of the BVH; deeper nodes are kept as leaves*/
+#define BVH_MAX_DEPTH 64
+
+
+/** @brief node of the bounding volume hierarchy built over the mesh triangles. A leaf (count > 0)
+refers to count triangles of the permutation array starting from first, an inner node (count = 0)
+has its two children stored at first and first+1 */
+typedef struct MeshBVHNode
+{
+	double bmin[3];
+	double bmax[3];
+	int first;
+	int count;
+} MeshBVHNode;
+
+
 /* #if !defined(OPTIMIZE_GRIDS)
 #define GRID_TRIANGLE_MAP_2D(i,j,l,NA,NB) gridTriangleMap2D[ ((j)*(NA) + (j))*MAX_TRIANGLES_2D + (l) ]
 
@@ -86,19 +133,66 @@ private:
 	unsigned int **ind_2d;
 	#endif */
 
-	/** for each vertex the list of connected triangles */
-	vector<int> **vertexTrianglesList;
+	/** if true, ray casting and projections traverse a bounding volume hierarchy built with the
+	surface area heuristic instead of the uniform auxiliary grids*/
+	bool useBVH;
+	/** nodes of the hierarchy, the root is the first one*/
+	vector<MeshBVHNode> bvhNodes;
+	/** permutation of the triangle indices referred by the leaves*/
+	int *bvhTriangles;
+	/** triangles' bounding boxes (6 values per triangle) and centroids, used during the build only*/
+	double *bvhTriangleBounds;
+	double *bvhTriangleCentroids;
+
+	/** SoA copy of the triangles for the batched ray-triangle test: 9 arrays of numTriangles
+	values with the first vertex (x,y,z) and the two edges leaving it (x,y,z each)*/
+	double *triangleStore;
+
+	/** for each vertex the list of connected triangles, in CSR form: the triangles of vertex v are
+	vertexTrianglesIds[vertexTrianglesStart[v]..vertexTrianglesStart[v+1]) in increasing order*/
+	int *vertexTrianglesStart;
+	int *vertexTrianglesIds;
+	/** memory mapped mesh file. Binary formats are loaded without copies where the layout allows it;
+	in that case the rows of faceMatrix and/or vertMatrix point into the mapping*/
+	char *meshFileMap;
+	size_t meshFileMapSize;
+	bool facesInMeshFileMap;
+	bool verticesInMeshFileMap;
 	/** vertexes normals */
 	VERTEX_TYPE **vertNormals;
 	/** if enabled vertex normals are computed. This is true for a usual mesh; false
 	for MSMS files that provide analytical vertex normals.*/
 	//bool computeNormals;
+
+protected:
 	/** pre process ray casting panel*/
 	virtual void preProcessPanel(void);
+
+private:
 	/** pre process triangle normals*/
 	void preProcessTriangles(void);
 	/** build 3d auxiliary grid*/
 	bool buildAuxiliaryGrid(void);
+	/** build the BVH over the loaded mesh, the top levels serially and the remaining subtrees in parallel*/
+	bool buildBVH(void);
+	/** binned SAH split of a node; the node is refined recursively up to max_depth, deeper nodes
+	are appended to deferred (if not NULL) to be refined later*/
+	void buildBVHNode(vector<MeshBVHNode> &nodes,int node_id,int depth,int max_depth,vector<int> *deferred);
+	/** refine the deferred nodes into independent subtrees (thread_id-th out of num_threads share)*/
+	void buildBVHSubtrees(vector<MeshBVHNode> *subtrees,int num_subtrees,int thread_id,int num_threads,int depth);
+	/** remove the BVH*/
+	void disposeBVH(void);
+	/** BVH based versions of getRayIntersection and getProjection*/
+	void getRayIntersectionBVH(double pa[3],double dir[3],int first_dim,int last__dim,vector<pair<VERTEX_TYPE,VERTEX_TYPE*>> &intersections);
+	bool getProjectionBVH(double p[3],double *proj1,double *proj2,double *proj3,double *normal1,double *normal2,double *normal3);
+	/** build the SoA triangle store used by intersect_triangles*/
+	void buildTriangleStore(void);
+	/** batched version of intersect_triangle: the ray is tested against up to TRIANGLE_BATCH triangles
+	whose indices are in ids. The indices of the pierced triangles and the intersection parameters
+	are written in hit_ids and t (in the same order of ids); the number of intersections is returned*/
+	int intersect_triangles(double orig[3], double dir[3], int *ids, int num_ids, double *t, int *hit_ids);
+	/** test a batch of at most TRIANGLE_BATCH triangles and append the intersections to the list*/
+	void pushBatchIntersections(double orig[3], double dir[3], int *ids, int num_ids, vector<pair<VERTEX_TYPE,VERTEX_TYPE*>> &intersections);
 	/** intersect a ray into a triangle*/
 	int intersect_triangle(double orig[3], double dir[3],double vert0[3], double vert1[3], double vert2[3],double *t, double *u, double *v);
 	int intersect_triangle_X(double orig[3], double dir_x, double vert0[3], double vert1[3], double vert2[3], double *t);
@@ -121,8 +215,23 @@ private:
 	bool checkDuplicates(void);
 	/** load a mesh in off format*/
 	bool loadOFF(char *fileName);
+	/** load a mesh in the binary off format written by NanoShaper (.off.bin)*/
+	bool loadOFFBinary(char *fileName);
 	/** load a mesh in ply format*/
 	bool loadPLY(char *fileName);
+	/** free vertices, triangles, normals and adjacency, unmapping the mesh file if needed*/
+	void disposeMesh(void);
+	/** allocate the contiguous vertices and triangles matrices*/
+	void allocateMesh(int num_vertices, int num_triangles);
+	/** parse the data lines of a text mesh file in parallel (see MeshLinesChunk)*/
+	bool parseMeshLines(int format, const char *begin, const char *end, int num_vertices, int num_triangles,
+						int first_vertex, int first_triangle, int aux1=0, int aux2=0);
+	/** parse a thread chunk of parseMeshLines*/
+	void parseMeshLinesChunk(MeshLinesChunk *chunk);
+	/** build the vertex to triangles adjacency (CSR) with a counting sort by vertex ranges*/
+	void buildVertexTriangles(void);
+	/** count and scatter the triangles of the vertices in [v_begin,v_end)*/
+	void buildVertexTrianglesRange(int v_begin, int v_end, bool scatter);
 	
 	#if !defined(SINGLE_PASS_RT)
 	/** Function used in multi-RT mode only; every patch is pierced by rays from multiple directions (piercing
@@ -157,7 +266,11 @@ public:
 	{
 		// 3d grid is necessary only for boundary grid points projection
 		if (projBGP)
+		{
+			if (useBVH)
+				return buildBVH();
 			return buildAuxiliaryGrid();
+		}
 		return false;
 	}
 
@@ -204,6 +317,17 @@ public:
 		MAX_TRIANGLES_2D = (max*dim);
 	}
 
+	/** enable/disable the BVH acceleration of ray casting and projections*/
+	void setBVH(bool use_bvh)
+	{
+		useBVH = use_bvh;
+	}
+
+	bool getBVH(void)
+	{
+		return useBVH;
+	}
+
 	virtual ~MeshSurface();
 };
 
@@ -0,0 +1,360 @@
+#include "SphereUnionSurface.h"
+
+
+SphereUnionSurface::~SphereUnionSurface()
+{
+	clear();
+}
+
+
+void SphereUnionSurface::clear(void)
+{
+	if (rayIntervalsBuffers != NULL)
+	{
+		delete[] rayIntervalsBuffers;
+		rayIntervalsBuffers = NULL;
+	}
+	numRayIntervalsBuffers = 0;
+	ImplicitSurfaceBase::clear();
+}
+
+
+void SphereUnionSurface::init(void)
+{
+	ImplicitSurfaceBase::init();
+	inflation = 0.;
+	rayIntervalsBuffers = NULL;
+	numRayIntervalsBuffers = 0;
+}
+
+
+SphereUnionSurface::SphereUnionSurface():ImplicitSurfaceBase()
+{
+	init();
+}
+
+
+SphereUnionSurface::SphereUnionSurface(DelPhiShared *ds):ImplicitSurfaceBase(ds)
+{
+	init();
+}
+
+
+SphereUnionSurface::SphereUnionSurface(ConfigFile *cf, DelPhiShared *ds, bool sas):ImplicitSurfaceBase(cf,ds)
+{
+	init();
+	if (sas)
+		setInflation(getProbeRadius());
+}
+
+
+bool SphereUnionSurface::build(void)
+{
+	std::vector<Atom> &atoms = delphi->atoms;
+	int na = (int)atoms.size();
+
+	auto chrono_start = chrono::high_resolution_clock::now();
+
+	if (atomSupport != NULL)
+		deleteVector<double>(atomSupport);
+
+	// the support of an atom is its inflated sphere
+	atomSupport = allocateVector<double>(MAX(1,na));
+
+	for (int i=0; i<na; i++)
+		atomSupport[i] = atoms[i].radius + inflation;
+
+	buildAtomCells();
+
+	if (rayIntervalsBuffers != NULL)
+		delete[] rayIntervalsBuffers;
+	numRayIntervalsBuffers = MAX(1, conf.numThreads);
+	rayIntervalsBuffers = new vector<SphereInterval> [numRayIntervalsBuffers];
+
+	auto chrono_end = chrono::high_resolution_clock::now();
+	chrono::duration<double> build_time = chrono_end - chrono_start;
+	cout << endl << INFO << "Spheres union atoms cell list time ";
+	printf("%.4e [s]", build_time.count());
+
+	return true;
+}
+
+
+void SphereUnionSurface::printSummary(void)
+{
+	cout << endl << INFO << "Union of the atoms' spheres inflated by " << inflation << " [A]";
+}
+
+
+void SphereUnionSurface::getRayIntersection(double pa[3], double pb[3], vector<pair<VERTEX_TYPE,VERTEX_TYPE*>> &intersections, bool computeNormals, int thread_id)
+{
+	std::vector<Atom> &atoms = delphi->atoms;
+
+	vector<SphereInterval> local_intervals;
+	vector<SphereInterval> &intervals = (thread_id >= 0 && thread_id < numRayIntervalsBuffers) ? rayIntervalsBuffers[thread_id] : local_intervals;
+	intervals.clear();
+
+	double dir[3];
+	SUB(dir,pb,pa)
+
+	if (DOT(dir,dir) == 0.)
+		return;
+
+	// gather the spheres crossed by the segment from the cells overlapping
+	// its bounding box enlarged by the maximal inflated radius
+	int64_t cmin[3], cmax[3];
+	int64_t cn[3] = {cellNx, cellNy, cellNz};
+
+	for (int c=0; c<3; c++)
+	{
+		double lo = MIN(pa[c],pb[c]) - cellSide;
+		double hi = MAX(pa[c],pb[c]) + cellSide;
+		cmin[c] = MAX((int64_t)0, (int64_t)floor((lo-cellMin[c])/cellSide));
+		cmax[c] = MIN(cn[c]-1, (int64_t)floor((hi-cellMin[c])/cellSide));
+		if (cmin[c] > cmax[c])
+			return;
+	}
+
+	for (int64_t k=cmin[2]; k<=cmax[2]; k++)
+		for (int64_t j=cmin[1]; j<=cmax[1]; j++)
+			for (int64_t i=cmin[0]; i<=cmax[0]; i++)
+			{
+				int64_t c = (k*cellNy + j)*cellNx + i;
+
+				for (int l=atomCellStart[c]; l<atomCellStart[c+1]; l++)
+				{
+					int id = atomCellIds[l];
+					SphereInterval si;
+
+					if (!raySphere(pa,dir,atoms[id].pos,atomSupport[id],&si.t1,&si.t2))
+						continue;
+
+					if (si.t2 < 0. || si.t1 > 1.)
+						continue;
+
+					si.id = id;
+					intervals.push_back(si);
+				}
+			}
+
+	if (intervals.empty())
+		return;
+
+	sort(intervals.begin(), intervals.end(), [](const SphereInterval &a, const SphereInterval &b) { return a.t1 < b.t1; });
+
+	// merge the overlapping intervals; every merged interval gives an entry and an exit point
+	int n = (int)intervals.size();
+	int l = 0;
+	size_t firstIntersection = intersections.size();
+	size_t firstNormal = normalsBuffers[thread_id].size();
+
+	while (l < n)
+	{
+		int entry = l, exit = l;
+		double t2 = intervals[l].t2;
+
+		for (l++; l<n && intervals[l].t1 <= t2; l++)
+		{
+			if (intervals[l].t2 > t2)
+			{
+				t2 = intervals[l].t2;
+				exit = l;
+			}
+		}
+
+		int ids[2] = {intervals[entry].id, intervals[exit].id};
+		double ts[2] = {intervals[entry].t1, t2};
+
+		for (int e=0; e<2; e++)
+		{
+			// a ray that starts or ends inside the union is clipped to the segment: there the
+			// box of the grid closes the surface and the normal is the one of the box face
+			bool clipped = ts[e] < 0. || ts[e] > 1.;
+			ts[e] = MIN(1., MAX(0., ts[e]));
+
+			if (computeNormals)
+			{
+				if (clipped)
+				{
+					double dir_norm = (e == 0) ? -sqrt(DOT(dir,dir)) : sqrt(DOT(dir,dir));
+					normalsBuffers[thread_id].push_back(dir[0]/dir_norm);
+					normalsBuffers[thread_id].push_back(dir[1]/dir_norm);
+					normalsBuffers[thread_id].push_back(dir[2]/dir_norm);
+				}
+				else
+				{
+					double p[3];
+					ADD_MUL(p,pa,dir,ts[e])
+
+					normalsBuffers[thread_id].push_back((p[0]-atoms[ids[e]].pos[0])/atomSupport[ids[e]]);
+					normalsBuffers[thread_id].push_back((p[1]-atoms[ids[e]].pos[1])/atomSupport[ids[e]]);
+					normalsBuffers[thread_id].push_back((p[2]-atoms[ids[e]].pos[2])/atomSupport[ids[e]]);
+				}
+
+				VERTEX_TYPE *normal = &normalsBuffers[thread_id][ normalsBuffers[thread_id].size()-3 ];
+				intersections.push_back(pair<VERTEX_TYPE,VERTEX_TYPE*>(ts[e],normal));
+			}
+			else
+				intersections.push_back(pair<VERTEX_TYPE,VERTEX_TYPE*>(ts[e],(VERTEX_TYPE*)NULL));
+		}
+	}
+	// merged intervals are disjoint and sorted, no sorting is needed
+	if (computeNormals)
+		pointRayNormals(intersections,firstIntersection,normalsBuffers[thread_id],firstNormal);
+}
+
+
+int SphereUnionSurface::getNearestSphere(const double p[3], int ring, double &signed_dist)
+{
+	std::vector<Atom> &atoms = delphi->atoms;
+	int nearest = -1;
+	signed_dist = INFINITY;
+
+	int64_t ix = (int64_t)floor((p[0]-cellMin[0])/cellSide);
+	int64_t iy = (int64_t)floor((p[1]-cellMin[1])/cellSide);
+	int64_t iz = (int64_t)floor((p[2]-cellMin[2])/cellSide);
+
+	for (int64_t k=MAX(0,iz-ring); k<=MIN(cellNz-1,iz+ring); k++)
+		for (int64_t j=MAX(0,iy-ring); j<=MIN(cellNy-1,iy+ring); j++)
+			for (int64_t i=MAX(0,ix-ring); i<=MIN(cellNx-1,ix+ring); i++)
+			{
+				int64_t c = (k*cellNy + j)*cellNx + i;
+
+				for (int l=atomCellStart[c]; l<atomCellStart[c+1]; l++)
+				{
+					int id = atomCellIds[l];
+					double dist;
+					DIST(dist,p,atoms[id].pos)
+					dist -= atomSupport[id];
+
+					if (dist < signed_dist)
+					{
+						signed_dist = dist;
+						nearest = id;
+					}
+				}
+			}
+	return nearest;
+}
+
+
+bool SphereUnionSurface::isBuried(const double q[3], int owner)
+{
+	std::vector<Atom> &atoms = delphi->atoms;
+
+	// the cell side is the maximal inflated radius, so only the neighbouring cells can contain q
+	int64_t ix = (int64_t)floor((q[0]-cellMin[0])/cellSide);
+	int64_t iy = (int64_t)floor((q[1]-cellMin[1])/cellSide);
+	int64_t iz = (int64_t)floor((q[2]-cellMin[2])/cellSide);
+
+	for (int64_t k=MAX(0,iz-1); k<=MIN(cellNz-1,iz+1); k++)
+		for (int64_t j=MAX(0,iy-1); j<=MIN(cellNy-1,iy+1); j++)
+			for (int64_t i=MAX(0,ix-1); i<=MIN(cellNx-1,ix+1); i++)
+			{
+				int64_t c = (k*cellNy + j)*cellNx + i;
+
+				for (int l=atomCellStart[c]; l<atomCellStart[c+1]; l++)
+				{
+					int id = atomCellIds[l];
+					if (id == owner)
+						continue;
+
+					double dist;
+					DIST(dist,q,atoms[id].pos)
+					if (dist < atomSupport[id]-IMPLICIT_ROOT_TOLERANCE)
+						return true;
+				}
+			}
+	return false;
+}
+
+
+bool SphereUnionSurface::getProjection(double p[3], double *proj1, double *proj2,
+									   double *proj3, double *normal1, double *normal2, double *normal3)
+{
+	// outside the union the nearest surface point is the projection on the sphere
+	// with the least signed distance. Centres outside two rings of cells are farther
+	// than twice the cell side, so the search is exact if the distance found is lower than a cell
+	double signed_dist;
+	int nearest = getNearestSphere(p,2,signed_dist);
+
+	if (nearest == -1 || signed_dist >= cellSide)
+		nearest = getNearestSphere(p,(int)MAX(cellNx,MAX(cellNy,cellNz)),signed_dist);
+
+	if (nearest == -1)
+	{
+		(*proj1) = p[0];
+		(*proj2) = p[1];
+		(*proj3) = p[2];
+		(*normal1) = 0;
+		(*normal2) = 0;
+		(*normal3) = 0;
+		return false;
+	}
+
+	double proj[3], norm[3], dist;
+
+	if (signed_dist < 0)
+	{
+		// inside the union the deepest sphere is usually buried by the others: the spheres
+		// containing p are tried from the shallowest one and the first whose projection is not
+		// inside another sphere is taken. They all lie in the neighbouring cells
+		std::vector<Atom> &atoms = delphi->atoms;
+		vector<pair<double,int>> containing;
+
+		int64_t ix = (int64_t)floor((p[0]-cellMin[0])/cellSide);
+		int64_t iy = (int64_t)floor((p[1]-cellMin[1])/cellSide);
+		int64_t iz = (int64_t)floor((p[2]-cellMin[2])/cellSide);
+
+		for (int64_t k=MAX(0,iz-1); k<=MIN(cellNz-1,iz+1); k++)
+			for (int64_t j=MAX(0,iy-1); j<=MIN(cellNy-1,iy+1); j++)
+				for (int64_t i=MAX(0,ix-1); i<=MIN(cellNx-1,ix+1); i++)
+				{
+					int64_t c = (k*cellNy + j)*cellNx + i;
+
+					for (int l=atomCellStart[c]; l<atomCellStart[c+1]; l++)
+					{
+						int id = atomCellIds[l];
+						DIST(dist,p,atoms[id].pos)
+						dist -= atomSupport[id];
+
+						if (dist < 0)
+							containing.push_back(pair<double,int>(dist,id));
+					}
+				}
+
+		sort(containing.begin(), containing.end(), [](const pair<double,int> &a, const pair<double,int> &b) { return a.first > b.first; });
+
+		// if every projection is buried, the shallowest sphere is kept
+		if (!containing.empty())
+			nearest = containing[0].second;
+
+		for (unsigned int l=0; l<containing.size(); l++)
+		{
+			int id = containing[l].second;
+			projectToSphere(p,atoms[id].pos,atomSupport[id],proj,dist);
+
+			if (!isBuried(proj,id))
+			{
+				nearest = id;
+				break;
+			}
+		}
+	}
+
+	double *center = delphi->atoms[nearest].pos;
+	double radius = atomSupport[nearest];
+
+	projectToSphere(p,center,radius,proj,dist);
+	getNormalToSphere(proj,center,radius,norm);
+
+	(*proj1) = proj[0];
+	(*proj2) = proj[1];
+	(*proj3) = proj[2];
+
+	(*normal1) = norm[0];
+	(*normal2) = norm[1];
+	(*normal3) = norm[2];
+
+	return true;
+}
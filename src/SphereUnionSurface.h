@@ -0,0 +1,112 @@
+//---------------------------------------------------------
+/**    @file	SphereUnionSurface.h
+*     @brief	SphereUnionSurface.h is the header for CLASS
+*               SphereUnionSurface.cpp								*/
+//---------------------------------------------------------
+
+#ifndef SphereUnionSurface_h
+#define SphereUnionSurface_h
+
+#include "ImplicitSurface.h"
+
+#ifdef DBGMEM_CRT
+	#define _CRTDBG_MAP_ALLOC
+	#define _CRTDBG_MAP_ALLOC_NEW
+#endif
+
+/** @brief an atom sphere crossed by a ray pa+t*(pb-pa) between t1 and t2*/
+typedef struct SphereInterval
+{
+	double t1;
+	double t2;
+	int id;
+} SphereInterval;
+
+
+/** @brief This class ray casts the union of the atoms' spheres, each one inflated by a fixed amount:
+the van der Waals surface (no inflation, "vdw") or the solvent accessible surface (inflation equal to
+the probe radius, "sas"). No triangulation of the atoms is needed: the spheres crossed by a ray
+are gathered from the atoms cell list and their intervals are merged; normals and projections are
+those of the sphere that owns the surface point.
+*/
+class SphereUnionSurface: public ImplicitSurfaceBase
+{
+private:
+	/** amount in Angstrom added to every atom radius*/
+	double inflation;
+	/** per thread buffers of the intervals of the spheres crossed by a ray*/
+	vector<SphereInterval> *rayIntervalsBuffers;
+	int numRayIntervalsBuffers;
+
+	/** return the index of the atom whose inflated sphere is nearest to p (signed distance), -1 if none*/
+	int getNearestSphere(const double p[3], int ring, double &signed_dist);
+	/** true if q is strictly inside an inflated sphere other than owner*/
+	bool isBuried(const double q[3], int owner);
+
+public:
+	/** Default constructor*/
+	SphereUnionSurface();
+	/** set DelPhi environment*/
+	SphereUnionSurface(DelPhiShared *ds);
+	/** set configuration and DelPhi environment; if sas is true the spheres are inflated by the probe radius*/
+	SphereUnionSurface(ConfigFile *cf, DelPhiShared *ds, bool sas);
+
+	//////////////////////// INTERFACE MANDATORY METHODS /////////////////////////////////
+	/** Compute the inflated radii and the atoms cell list*/
+	virtual bool build(void);
+	/** Print a summary of the surface*/
+	virtual void printSummary(void);
+	/** Project a point on the nearest sphere. The projection is exact for points outside the union; points
+	inside it are projected on the shallowest containing sphere whose projection is not buried by the others*/
+	virtual bool getProjection(double p[3],double *proj1,double *proj2,
+		double *proj3,double *normal1,double *normal2,double *normal3);
+	/** Get all the intersections of a ray that goes from P1 to P2 over the surface.
+	The intersections are returned with increasing distance order.*/
+	virtual void getRayIntersection(double pa[3], double pb[3], vector<pair<VERTEX_TYPE,VERTEX_TYPE*>> &intersections, bool computeNormals, int thread_id);
+	/** function for the constructor without arguments*/
+	virtual void init(void);
+	/**function for the denstructor*/
+	virtual void clear(void);
+	/////////////////////////////////////////////////////////////
+
+	void setInflation(double i)
+	{
+		if (i < 0)
+		{
+			cout << endl << WARN << "Cannot set a negative inflation. Setting 0";
+			inflation = 0.;
+		}
+		else
+			inflation = i;
+	}
+
+	double getInflation(void)
+	{
+		return inflation;
+	}
+
+	virtual ~SphereUnionSurface();
+};
+
+
+// expand it explicitly because Swig is not able to expand it
+static class SphereUnionSurfaceRegister{
+	static Surface *createSAS(ConfigFile *conf, DelPhiShared *ds)
+	{
+		return new SphereUnionSurface(conf,ds,true);
+	}
+
+	static Surface *createVDW(ConfigFile *conf, DelPhiShared *ds)
+	{
+		return new SphereUnionSurface(conf,ds,false);
+	}
+
+public:
+	SphereUnionSurfaceRegister()
+	{
+		surfaceFactory().add("sas", createSAS);
+		surfaceFactory().add("vdw", createVDW);
+	}
+} SphereUnionSurfaceRegisterObject;
+
+#endif
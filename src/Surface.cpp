@@ -61,12 +61,20 @@ void Surface::init()
 	#endif
 
 	bgp_type = NULL;
-	gridMultiMap = NULL;
+	atomsMapStart = NULL;
+	atomsMapIds = NULL;
+	atomsMapX = NULL;
+	atomsMapY = NULL;
+	atomsMapZ = NULL;
+	atomsMapR2 = NULL;
+	atomsMapVersion = 0;
 	#if !defined(USE_COMPRESSED_GRIDS)
 	verticesInsidenessMap = NULL;
 	#endif
 	compressed_verticesInsidenessMap = NULL;
 	sternLayer = -1;
+	sternLayerDistanceTransform = false;
+	sternLayerDTOffset = STERN_DT_OFFSET;
 	isRCbased = true;
 	randDisplacement = RAND_DISPLACEMENT;
 	gridLoad = NULL;
@@ -84,6 +92,13 @@ void Surface::init()
 	compressed_activeCubes = NULL;
 	patchBasedAlgorithm = true;
 	analyticalTorusIntersectionAlgorithm = true;
+	meshDecimation = false;
+	decimationTargetTriangles = -1;
+	decimationMaxError = 0.05;
+	dualContouring = false;
+	bilevel_dualVertices = NULL;
+	dualVerticesOffset = NULL;
+	meshLODLevels = 1;
 	
 	if (patchBasedAlgorithm)
 	{
@@ -107,6 +122,8 @@ void Surface::init(ConfigFile *cf)
 	bool saveMSMS = cf->read<bool>("Save_Mesh_MSMS_Format", false);
 	bool savePLY = cf->read<bool>("Save_Mesh_PLY_Format", false);
 	double sternLayer = cf->read<double>("Stern_layer", -1.);
+	bool sternLayerDT = cf->read<bool>("Stern_Layer_Distance_Transform", false);
+	double sternLayerDTOffset = cf->read<double>("Stern_Layer_Distance_Transform_Offset", STERN_DT_OFFSET);
 	rootFile = cf->read<string>("Root_FileName","");
 	bool patch_based = cf->read<bool>("Patch_Based_Algorithm", true);
 	bool analytical_torus_intersection = cf->read<bool>("Analytical_Ray_Vs_Torus_Intersection", true);
@@ -115,6 +132,11 @@ void Surface::init(ConfigFile *cf)
 	bool serial_build = cf->read<bool>("Force_Serial_Build", false);
 	int max_atoms = cf->read<int>("Max_Num_Atoms", -1);
 	double domain_shrinkage = cf->read<double>("Domain_Shrinkage", 0.);
+	bool decimation = cf->read<bool>("Mesh_Decimation", false);
+	int decimation_target = cf->read<int>("Decimation_Target_Triangles", -1);
+	double decimation_error = cf->read<double>("Decimation_Max_Error", 0.05);
+	bool dual_contouring = cf->read<bool>("Dual_Contouring", false);
+	int lod_levels = cf->read<int>("Mesh_LOD_Levels", 1);
 
 	setProjBGP(projBGP);
 	setAccurateTriangulationFlag(accTri);
@@ -134,10 +156,17 @@ void Surface::init(ConfigFile *cf)
 	setForceSerialBuild (serial_build);
 	setMaxNumAtoms (max_atoms);
 	setDomainShrinkage (domain_shrinkage);
+	setMeshDecimation (decimation);
+	setDecimationTargetTriangles (decimation_target);
+	setDecimationMaxError (decimation_error);
+	setDualContouring (dual_contouring);
+	setMeshLODLevels (lod_levels);
 	
 	// if >0 enable stern layer, else disabled by default
 	if (sternLayer > 0)
 		setSternLayer(sternLayer);
+	setSternLayerDistanceTransform(sternLayerDT);
+	setSternLayerDistanceTransformOffset(sternLayerDTOffset);
 
 	if (parallel_buildup_halo_thickness != 0.0)
 		conf.parallelBuildupHaloThicknessInput = true;
@@ -160,6 +189,13 @@ Surface::Surface(ConfigFile *cf)
 
 
 void Surface::clear()
+{
+	clearGridData();
+	init();
+}
+
+
+void Surface::clearGridData()
 {
 	if (triList.size() > 0)
 	{
@@ -197,7 +233,8 @@ void Surface::clear()
 	}
 
 	if (scalarField != NULL)
-		deleteMatrix3D<double>(delphi->nx,delphi->ny,delphi->nz,scalarField);
+		deleteVector<float>(scalarField);
+	isAvailableScalarField = false;
 
 	if (gridLoad != NULL)
 		deleteVector<int>(gridLoad);
@@ -205,7 +242,13 @@ void Surface::clear()
 	if (vertexAtomsMap != NULL)
 		deleteVector<int>(vertexAtomsMap);
 
-	init();
+	disposeAtomsMap();
+}
+
+
+bool Surface::retarget(DelPhiShared *ds)
+{
+	return false;
 }
 
 
@@ -222,6 +265,20 @@ int Surface::getNumPatches (void)
 }
 
 
+void Surface::pointRayNormals(vector<pair<VERTEX_TYPE,VERTEX_TYPE*>> &intersections, size_t first, vector<VERTEX_TYPE> &normals, size_t firstNormal)
+{
+	size_t next = firstNormal;
+
+	for (size_t i=first; i<intersections.size(); i++)
+	{
+		if (intersections[i].second == NULL)
+			continue;
+		intersections[i].second = &normals[next];
+		next += 3;
+	}
+}
+
+
 bool Surface::isPatchBasedRayTracingSupported (void)
 {
 	cout << endl << ERR << "This surface type does not support patch based ray-tracing";
@@ -546,9 +603,6 @@ bool Surface::getSurf(double *surf_volume, bool optimize_grids, bool fillCav, do
 		
 		int na, nb;
 
-		if (!delphi->getMultiDiel())
-
-
 		threadPanelVolume = allocateMatrix2D<double>(3, num_threads);
 		threadFailedRays = allocateVector<int>(num_threads);
 		threadTotalRays = allocateVector<int>(num_threads);
@@ -1586,59 +1640,48 @@ bool Surface::getSurf(double *surf_volume, bool optimize_grids, bool fillCav, do
 		cout << endl << INFO << "Scaling bgps...";
 
 
-		#if !defined(MULTITHREADED_POCKET_LOOP)
-
-		#ifdef ENABLE_BOOST_THREADS
-		// the overhead of thread creation is quite low, so it is
-		// convenient to dispatch as many threads as possible so as
-		// to saturate all cores and to minimize their unbalancing
-		num_threads = MIN(64, MAX(1, delphi->nbgp));
-		// cout << endl << INFO << "Automatically dispatching " << num_threads << " threads";
-		#endif
-
-		#ifdef ENABLE_BOOST_THREADS
-		boost::thread_group thdGroup;
-		#endif
+		// within a parallel pocket loop every surface is already run by its own thread,
+		// so the bgps are projected serially
+		if (!conf.parallelPocketLoop)
+		{
+			// the bgps are projected in Morton order of their grid indexes: consecutive bgps fall in the
+			// same auxiliary grid cells, whose candidate patches stay in cache, and the threads fetch
+			// batches of them on demand because the cost of a projection varies across the surface
+			int *bgp_order = allocateVector<int>(MAX(1,delphi->nbgp));
+			{
+				vector<pair<uint64_t,int>> keys(delphi->nbgp);
 
-		int chunk = delphi->nbgp/num_threads;
-		int rem = delphi->nbgp%num_threads;
+				for (int i=0; i<delphi->nbgp; i++)
+					keys[i] = pair<uint64_t,int>(getMortonCode(delphi->ibgp[3*i],delphi->ibgp[3*i+1],delphi->ibgp[3*i+2]), i);
 
-		// setup split
-		int start, stop;
+				sort(keys.begin(), keys.end());
 
-		for (int j=0; j<num_threads; j++)
-		{
-			if (j == 0)
-			{
-				start = 0;
-				stop = chunk;
-			}
-			else
-			{
-				start = stop;
-				stop = start+chunk;
+				for (int i=0; i<delphi->nbgp; i++)
+					bgp_order[i] = keys[i].second;
 			}
 
-			if (j < rem)
-				stop++;
+			int next_batch = 0;
 
 			#ifdef ENABLE_BOOST_THREADS
-			thdGroup.create_thread(boost::bind(&Surface::projector, this, start, stop));
-			#else
-			projector(start, stop);
-			#endif
-		}
-		// end setup
-		
-		#ifdef ENABLE_BOOST_THREADS
-		thdGroup.join_all();
-		#endif
+			num_threads = MIN(conf.numThreads, MAX(1, delphi->nbgp/BGP_PROJECTION_BATCH));
+			num_threads = MAX(1, num_threads);
+
+			boost::thread_group thdGroup;
 
-		#else // MULTITHREADED_POCKET_LOOP
+			for (int j=0; j<num_threads; j++)
+				thdGroup.create_thread(boost::bind(&Surface::batchProjector, this, bgp_order, &next_batch));
 
-		projector(0, delphi->nbgp);
+			thdGroup.join_all();
+			#else
+			batchProjector(bgp_order, &next_batch);
+			#endif
 
-		#endif // MULTITHREADED_POCKET_LOOP
+			deleteVector<int>(bgp_order);
+		}
+		else
+		{
+			projector(0, delphi->nbgp);
+		}
 
 		cout << "ok!";
 
@@ -1656,26 +1699,18 @@ bool Surface::getSurf(double *surf_volume, bool optimize_grids, bool fillCav, do
 			if (!delphi->getMultiDiel())
 				buildAtomsMap();
 
-			double *l_scspos = delphi->scspos;
+			nearestAtoms(delphi->nbgp, delphi->scspos, atsurf);
 
 			for (int i=0; i<delphi->nbgp; i++)
 			{
-				int nearestAtom = -1;
-				double *v = &l_scspos[3*i];
-				vdwAccessible(v, nearestAtom);
-
-				if (nearestAtom == -1)
+				if (atsurf[i] == -1)
 					cout << endl << WARN << "Cannot detect nearest atom for bgp index " << i;
-
-				atsurf[i] = nearestAtom;
 			}
 		}
 	}
 	
-	// if multi-dielectric or stern layer was computed then dispose atoms map
-	// in any case if delphi is bound and bgps have been computed we have to drop it
-	if (delphi->getMultiDiel() || (delphi->getDelphiBinding() && delphi->atsurf != NULL && projBGP))
-		disposeAtomsMap();
+	// the atoms map, if built, is kept: it is reused by the vertex and cavity to atom
+	// mappings and released by clear()
 
 	int flag_sum;
 	flag_sum  = panelVolumeFlag[0][0] + panelVolumeFlag[1][0] + panelVolumeFlag[2][0];
@@ -1694,11 +1729,33 @@ bool Surface::getSurf(double *surf_volume, bool optimize_grids, bool fillCav, do
 
 void Surface::buildAtomsMap()
 {
+	int numAtoms = (int)delphi->atoms.size();
+
+	// the map only depends on the atoms, so once built it is shared by the projector,
+	// the multi-dielectric correction and the vertex/cavity to atom mappings until they change.
+	// Some build-ups displace the atoms in place without a new atomsVersion, so the stored
+	// positions and radii are compared too
+	if (atomsMapStart != NULL && atomsMapVersion == delphi->atomsVersion &&
+		atomsMapStart[ggrid*ggrid*ggrid] == numAtoms)
+	{
+		bool same = true;
+		for (int k=0; k<numAtoms && same; k++)
+		{
+			const Atom &a = delphi->atoms[ atomsMapIds[k] ];
+			same = atomsMapX[k] == a.pos[0] && atomsMapY[k] == a.pos[1] && atomsMapZ[k] == a.pos[2] &&
+				   atomsMapR2[k] == a.radius*a.radius;
+		}
+		if (same)
+			return;
+	}
+
+	disposeAtomsMap();
+
 	// Build a 3D accelaration grid for the atoms
 	double rmax = 0;
 	// get the biggest atom 
 	// for (int i=0; i<delphi->numAtoms; i++)
-	for (int i=0; i<delphi->atoms.size(); i++)
+	for (int i=0; i<numAtoms; i++)
 		rmax = MAX((delphi->atoms[i].radius),rmax);
 	
 	gscale = 0.5/rmax;
@@ -1725,42 +1782,233 @@ void Surface::buildAtomsMap()
 	gymin = delphi->baricenter[1] - (ggrid-1)*0.5*gside;
 	gzmin = delphi->baricenter[2] - (ggrid-1)*0.5*gside;
 
-	if (gridMultiMap != NULL)
-	{
-		for (int64_t i=0; i < ggrid*ggrid*ggrid; i++)
-		{
-			gridMultiMap[i].clear();
-		}
-		delete[] gridMultiMap;
-		gridMultiMap = NULL;
-	}
-	gridMultiMap = new vector<int> [ ggrid*ggrid*ggrid ];
+	int64_t numCells = ggrid*ggrid*ggrid;
 
-	// fill 3D acceleration grid with atoms
+	atomsMapStart = allocateVector<int>(numCells+1);
+	atomsMapIds = allocateVector<int>(MAX(numAtoms,1));
+	atomsMapX = allocateVector<double>(MAX(numAtoms,1));
+	atomsMapY = allocateVector<double>(MAX(numAtoms,1));
+	atomsMapZ = allocateVector<double>(MAX(numAtoms,1));
+	atomsMapR2 = allocateVector<double>(MAX(numAtoms,1));
+
+	int *cellOf = allocateVector<int>(MAX(numAtoms,1));
+
+	for (int64_t c=0; c <= numCells; c++)
+		atomsMapStart[c] = 0;
+
+	// counting sort of the atoms into cells: count, prefix sum, scatter.
+	// The scatter is stable, so within a cell atoms keep increasing indices
 	// for (int i=0; i<delphi->numAtoms; i++)
-	for (int i=0; i<delphi->atoms.size(); i++)
+	for (int i=0; i<numAtoms; i++)
 	{
 		int64_t ix = (int64_t)rintp((delphi->atoms[i].pos[0] - gxmin)*gscale);
 		int64_t iy = (int64_t)rintp((delphi->atoms[i].pos[1] - gymin)*gscale);
 		int64_t iz = (int64_t)rintp((delphi->atoms[i].pos[2] - gzmin)*gscale);
 
-		gridMultiMap[ iz*(ggrid*ggrid) + iy*ggrid + ix ].push_back(i);
+		ix = MIN(MAX(ix,(int64_t)0),ggrid-1);
+		iy = MIN(MAX(iy,(int64_t)0),ggrid-1);
+		iz = MIN(MAX(iz,(int64_t)0),ggrid-1);
+
+		cellOf[i] = (int)(iz*(ggrid*ggrid) + iy*ggrid + ix);
+		atomsMapStart[ cellOf[i]+1 ]++;
+	}
+
+	for (int64_t c=0; c < numCells; c++)
+		atomsMapStart[c+1] += atomsMapStart[c];
+
+	int *fill = allocateVector<int>(numCells);
+	for (int64_t c=0; c < numCells; c++)
+		fill[c] = atomsMapStart[c];
+
+	for (int i=0; i<numAtoms; i++)
+	{
+		int pos = fill[ cellOf[i] ]++;
+		atomsMapIds[pos] = i;
+		atomsMapX[pos] = delphi->atoms[i].pos[0];
+		atomsMapY[pos] = delphi->atoms[i].pos[1];
+		atomsMapZ[pos] = delphi->atoms[i].pos[2];
+		atomsMapR2[pos] = delphi->atoms[i].radius*delphi->atoms[i].radius;
 	}
+
+	deleteVector<int>(fill);
+	deleteVector<int>(cellOf);
+
+	atomsMapVersion = delphi->atomsVersion;
 }
 
 
 void Surface::disposeAtomsMap()
 {
 	// remove acceleration grid
-	if (gridMultiMap != NULL)
+	if (atomsMapStart != NULL)
+	{
+		deleteVector<int>(atomsMapStart);
+		deleteVector<int>(atomsMapIds);
+		deleteVector<double>(atomsMapX);
+		deleteVector<double>(atomsMapY);
+		deleteVector<double>(atomsMapZ);
+		deleteVector<double>(atomsMapR2);
+		atomsMapStart = NULL;
+		atomsMapIds = NULL;
+		atomsMapX = NULL;
+		atomsMapY = NULL;
+		atomsMapZ = NULL;
+		atomsMapR2 = NULL;
+	}
+	atomsMapVersion = 0;
+}
+
+
+int Surface::nearestAtomInMap(const double *pos, double &minDist, int *second, double *secondDist)
+{
+	minDist = INFINITY;
+	double minDist2 = INFINITY;
+	int winner = -1, runnerUp = -1;
+
+	int64_t ix = (int64_t)rintp((pos[0]-gxmin)*gscale);
+	int64_t iy = (int64_t)rintp((pos[1]-gymin)*gscale);
+	int64_t iz = (int64_t)rintp((pos[2]-gzmin)*gscale);
+
+	const double px = pos[0], py = pos[1], pz = pos[2];
+
+	// the additively weighted voronoi diagram is used: the signed distance from the point p
+	// is ||p-c||^2-r^2 where c is the center of the atom and r is the radius.
+	// The minimum signed distance wins.
+	for (int k=0; k<SHIFT_MAP; k++)
 	{
-		for (int64_t i=0; i < ggrid*ggrid*ggrid; i++)
+		int64_t cx = ix+shift_map[k][0];
+		int64_t cy = iy+shift_map[k][1];
+		int64_t cz = iz+shift_map[k][2];
+
+		// multidielectric map is square
+		if (cx >= ggrid || cy >= ggrid || cz >= ggrid || cx<0 || cy<0 || cz<0)
+			continue;
+
+		int64_t cell = cz*(ggrid*ggrid) + cy*ggrid + cx;
+		const int first = atomsMapStart[cell];
+		const int last = atomsMapStart[cell+1];
+
+		// contiguous SoA run, no indirection on the atoms array. The run is kept scalar: a cell
+		// holds a few atoms (about 3 on average with side 2*rmax), too short for a vector loop
+		for (int j=first; j<last; j++)
 		{
-			gridMultiMap[i].clear();
+			const double dx = atomsMapX[j]-px;
+			const double dy = atomsMapY[j]-py;
+			const double dz = atomsMapZ[j]-pz;
+			const double signed_dist = dx*dx + dy*dy + dz*dz - atomsMapR2[j];
+
+			if (signed_dist < minDist)
+			{
+				minDist2 = minDist;
+				runnerUp = winner;
+				minDist = signed_dist;
+				winner = atomsMapIds[j];
+			}
+			else if (signed_dist < minDist2)
+			{
+				minDist2 = signed_dist;
+				runnerUp = atomsMapIds[j];
+			}
 		}
-		delete[] gridMultiMap;
-		gridMultiMap = NULL;
 	}
+
+	if (second != NULL)
+		*second = runnerUp;
+	if (secondDist != NULL)
+		*secondDist = minDist2;
+
+	return winner;
+}
+
+
+void Surface::nearestAtomsKernel(int start, int end, const double *points, int *winners)
+{
+	double minDist;
+	for (int i=start; i<end; i++)
+		winners[i] = nearestAtomInMap(&points[3*i], minDist);
+}
+
+
+void Surface::nearestAtoms(int n, const double *points, int *winners)
+{
+	if (n <= 0)
+		return;
+
+	#ifdef ENABLE_BOOST_THREADS
+	int num_threads = MIN(conf.numThreads, MAX(1, n/1024));
+	num_threads = MAX(1, num_threads);
+
+	boost::thread_group thdGroup;
+
+	int chunk = n/num_threads;
+	int rem = n%num_threads;
+	int start = 0, stop = 0;
+
+	for (int j=0; j<num_threads; j++)
+	{
+		start = stop;
+		stop = start+chunk;
+		if (j < rem)
+			stop++;
+		thdGroup.create_thread(boost::bind(&Surface::nearestAtomsKernel, this, start, stop, points, winners));
+	}
+	thdGroup.join_all();
+	#else
+	nearestAtomsKernel(0, n, points, winners);
+	#endif
+}
+
+
+void Surface::vertexAtomsKernel(int start, int end)
+{
+	double minDist;
+
+	for (int i=start; i<end; i++)
+	{
+		double v[3];
+		#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+		v[0] = vertList[i][0];
+		v[1] = vertList[i][1];
+		v[2] = vertList[i][2];
+		#else
+		v[0] = vertList[ i*3+0 ];
+		v[1] = vertList[ i*3+1 ];
+		v[2] = vertList[ i*3+2 ];
+		#endif
+		vertexAtomsMap[i] = nearestAtomInMap(v, minDist);
+	}
+}
+
+
+void Surface::mapVerticesToAtoms(int nv)
+{
+	buildAtomsMap();
+
+	if (nv <= 0)
+		return;
+
+	#ifdef ENABLE_BOOST_THREADS
+	int num_threads = MIN(conf.numThreads, MAX(1, nv/1024));
+	num_threads = MAX(1, num_threads);
+
+	boost::thread_group thdGroup;
+
+	int chunk = nv/num_threads;
+	int rem = nv%num_threads;
+	int start = 0, stop = 0;
+
+	for (int j=0; j<num_threads; j++)
+	{
+		start = stop;
+		stop = start+chunk;
+		if (j < rem)
+			stop++;
+		thdGroup.create_thread(boost::bind(&Surface::vertexAtomsKernel, this, start, stop));
+	}
+	thdGroup.join_all();
+	#else
+	vertexAtomsKernel(0, nv);
+	#endif
 }
 
 
@@ -1769,45 +2017,70 @@ void Surface::applyMultidielectric()
 	// for each internal point in the eps map gets the nearest atom
 	// and fix the epsilon map accordingly.
 
-	if (gridMultiMap == NULL)
+	if (atomsMapStart == NULL)
 	{
 		cout << endl << WARN << "Cannot apply multi-dielectric correction without atoms map";
 		return;
 	}
 
+	// z planes are dealt round robin to the threads: the faces of a plane are written
+	// by its thread only and the inner region, where the queries are, is spread evenly
+	#ifdef ENABLE_BOOST_THREADS
+	int num_threads = (int)MAX((int64_t)1, MIN((int64_t)conf.numThreads, delphi->nz));
+
+	boost::thread_group thdGroup;
+
+	for (int j=0; j<num_threads; j++)
+		thdGroup.create_thread(boost::bind(&Surface::multidielectricKernel, this, j, num_threads));
+
+	thdGroup.join_all();
+	#else
+	multidielectricKernel(0, 1);
+	#endif
+}
+
+
+void Surface::multidielectricKernel(int thread_id, int num_threads)
+{
+	int64_t NX = delphi->nx;
+	int64_t NY = delphi->ny;
+	int64_t NZ = delphi->nz;
+
+	// the 3 faces of the NX points of a (j,k) row are contiguous in the epsmap; the row is
+	// scanned in blocks with a branch free comparison the compiler vectorises, and only the
+	// blocks holding inside faces are visited face by face
+	const int64_t rowLen = NX*3;
+	const int64_t BLOCK = 16;
+
 	// for each internal point get nearest atom and change eps value accordingly
-	for (int64_t k=0; k<delphi->nz; k++)
+	for (int64_t k=thread_id; k<NZ; k+=num_threads)
 	{
-		for (int64_t j=0; j<delphi->ny; j++)
+		for (int64_t j=0; j<NY; j++)
 		{
-			for (int64_t i=0; i<delphi->nx; i++)
+			const int *row = delphi->epsmap + (k*NY + j)*rowLen;
+
+			for (int64_t b=0; b<rowLen; b+=BLOCK)
 			{
-				// for each cube face fix the epsmap value
-				//int value = delphi->EPSMAP(i,j,k,0,delphi->nx,delphi->ny,delphi->nz);
-				int value = read4DVector<int>(delphi->epsmap,i,j,k,0,delphi->nx,delphi->ny,delphi->nz,3);
+				int64_t e = MIN(b+BLOCK,rowLen);
+				int found = 0;
 
-				if (value == inside)
-					swap2multi(gxmin,gymin,gzmin,gside,ggrid,gridMultiMap,i,j,k,0);
+				for (int64_t f=b; f<e; f++)
+					found |= (row[f] == inside);
 
-				//value = delphi->EPSMAPint *(i,j,k,1,(delphi->nx),(delphi->ny),(delphi->nz));
-				value = read4DVector<int>(delphi->epsmap,i,j,k,1,delphi->nx,delphi->ny,delphi->nz,3);
+				if (!found)
+					continue;
 
-				if (value == inside)
-					swap2multi(gxmin,gymin,gzmin,gside,ggrid,gridMultiMap,i,j,k,1);
-				
-				//value = delphi->EPSMAP(i,j,k,2,(delphi->nx),(delphi->ny),(delphi->nz));
-				value = read4DVector<int>(delphi->epsmap,i,j,k,2,delphi->nx,delphi->ny,delphi->nz,3);
-				
-				if (value == inside)
-					swap2multi(gxmin,gymin,gzmin,gside,ggrid,gridMultiMap,i,j,k,2);
+				// for each cube face fix the epsmap value
+				for (int64_t f=b; f<e; f++)
+					if (row[f] == inside)
+						swap2multi((int)(f/3),(int)j,(int)k,(int)(f%3));
 			}
 		}
 	}
 }
 
 
-void Surface::swap2multi(double gxmin, double gymin, double gzmin, double gside, unsigned int ggrid,
-						 vector<int> *gridMultiMap, int i, int j, int k, int l)
+void Surface::swap2multi(int i, int j, int k, int l)
 {
 	// generate point position
 	double pos[3];
@@ -1820,46 +2093,9 @@ void Surface::swap2multi(double gxmin, double gymin, double gzmin, double gside,
 	// position the point on the corrseponding cube side. Pos now is the position of the midpoint
 	pos[l] += delphi->hside;
 
-	// move from midpoint of delphi grid to auxiliary atoms grid
-	int ix = (int)rintp((pos[0] - gxmin)*gscale);
-	int iy = (int)rintp((pos[1] - gymin)*gscale);
-	int iz = (int)rintp((pos[2] - gzmin)*gscale);
-
-	double minDist = INFINITY;
-	int winner = -1;
-	
 	// get the nearest atom to set the dielectric constant
-	// the dielectric constant is mapped according to the additively weighted voronoi diagram
-	// that is the signed distance from the point p is ||p-c||^2-r^2 where c is the center
-	// of the atom and r is the radius. The minimum signed distance wins.
-	for (k=0; k<SHIFT_MAP; k++)
-	{
-		int64_t cx = ix+shift_map[k][0];
-		int64_t cy = iy+shift_map[k][1];
-		int64_t cz = iz+shift_map[k][2];
-
-		if (cx>=ggrid || cy>=ggrid || cz>=ggrid || cx<0 || cy<0 || cz<0)
-			continue;
-
-		int num_atoms = gridMultiMap[ cz*(ggrid*ggrid) + cy*ggrid + cx ].size();
-
-		for (int j=0; j<num_atoms; j++)
-		{
-			int atom_index = gridMultiMap[ cz*(ggrid*ggrid) + cy*ggrid + cx ][j];
-
-			double signed_dist = 0;
-			DIST2(signed_dist,delphi->atoms[atom_index].pos,pos)
-
-			double rad = delphi->atoms[atom_index].radius;
-			signed_dist -= rad*rad;
-
-			if (signed_dist < minDist)
-			{
-				minDist = signed_dist;
-				winner = atom_index;
-			}
-		}
-	}
+	double minDist;
+	int winner = nearestAtomInMap(pos, minDist);
 	
 	if (winner == -1)
 	{
@@ -2156,6 +2392,7 @@ void Surface::getCavitiesAtoms()
 		 it != delphi->cavitiesVec->end(); it++)
 	{
 		vector<int*> *vec = (*it);
+		vector<double> cavityPoints;
 
 		// Get bgps for each cavity. And obtain the nearest atom
 		// in order to avoid using epsmap a slightly changed notion of bgp is employed
@@ -2192,57 +2429,29 @@ void Surface::getCavitiesAtoms()
 				continue;
 			}
 
-			double gridPoint[3];
-
-			gridPoint[0] = delphi->x[ix];
-			gridPoint[1] = delphi->y[iy];
-			gridPoint[2] = delphi->z[iz];
-
-			// move from grid point of delphi grid to auxiliary atoms grid
-			ix = (int64_t)rintp((gridPoint[0]-gxmin)*gscale);
-			iy = (int64_t)rintp((gridPoint[1]-gymin)*gscale);
-			iz = (int64_t)rintp((gridPoint[2]-gzmin)*gscale);
+			cavityPoints.push_back(delphi->x[ix]);
+			cavityPoints.push_back(delphi->y[iy]);
+			cavityPoints.push_back(delphi->z[iz]);
+		}
 
-			double minDist = INFINITY;
-			int first = -1;
+		// get the nearest atom of all the pseudo-bgps of the cavity in one batch
+		int numPoints = (int)(cavityPoints.size()/3);
+		if (numPoints > 0)
+		{
+			int *nearest = allocateVector<int>(numPoints);
+			nearestAtoms(numPoints, &cavityPoints[0], nearest);
 
-			// get the nearest atom
-			for (int k=0; k<SHIFT_MAP; k++)
+			for (int l=0; l<numPoints; l++)
 			{
-				int64_t cx = ix+shift_map[k][0];
-				int64_t cy = iy+shift_map[k][1];
-				int64_t cz = iz+shift_map[k][2];
+				if (nearest[l] == -1)
+					cout << endl << WARN << "No nearest atom in cavity/pocket!";
 
-				if (cx >= ggrid || cy >= ggrid || cz >= ggrid || cx < 0 || cy < 0 || cz < 0)
-					continue;
-
-				int num_atoms = gridMultiMap[ cz*(ggrid*ggrid) + cy*ggrid + cx ].size();
-
-				for (int j=0; j<num_atoms; j++)
-				{
-					int atom_index = gridMultiMap[ cz*(ggrid*ggrid) + cy*ggrid + cx ][j];
-
-					double signed_dist = 0;
-
-					DIST2(signed_dist,delphi->atoms[atom_index].pos,gridPoint)
-					double radius2 = delphi->atoms[atom_index].radius2;
-					signed_dist -= radius2;
-
-					if (signed_dist < minDist)
-					{
-						minDist = signed_dist;
-						first = atom_index;
-					}
-				}
+				cav2atoms[i]->insert(nearest[l]);
 			}
-			if (first == -1)
-				cout << endl << WARN << "No nearest atom in cavity/pocket!";
-
-			cav2atoms[i]->insert(first);
+			deleteVector<int>(nearest);
 		}
 		i++;
 	}
-	disposeAtomsMap();
 }
 
 
@@ -2276,6 +2485,7 @@ void Surface::getCavitiesAtomsWithBilevelStatusMap()
 		  it != delphi->cavitiesVec->end(); it++)
 	{	
 		vector<int*> *vec = (*it);
+		vector<double> cavityPoints;
 		
 		// Get bgps for each cavity. And obtain the nearest atom
 		// in order to avoid using epsmap a slightly changed notion of bgp is employed
@@ -2298,57 +2508,29 @@ void Surface::getCavitiesAtomsWithBilevelStatusMap()
 				continue;
 			}
 
-			double gridPoint[3];
+			cavityPoints.push_back(delphi->x[ix]);
+			cavityPoints.push_back(delphi->y[iy]);
+			cavityPoints.push_back(delphi->z[iz]);
+		}
 
-			gridPoint[0] = delphi->x[ix];
-			gridPoint[1] = delphi->y[iy];
-			gridPoint[2] = delphi->z[iz];
+		// get the nearest atom of all the pseudo-bgps of the cavity in one batch
+		int numPoints = (int)(cavityPoints.size()/3);
+		if (numPoints > 0)
+		{
+			int *nearest = allocateVector<int>(numPoints);
+			nearestAtoms(numPoints, &cavityPoints[0], nearest);
 
-			// move from grid point of delphi grid to auxiliary atoms grid
-			ix = (int64_t)rintp((gridPoint[0]-gxmin)*gscale);
-			iy = (int64_t)rintp((gridPoint[1]-gymin)*gscale);
-			iz = (int64_t)rintp((gridPoint[2]-gzmin)*gscale);
-		
-			double minDist = INFINITY;
-			int first = -1;
-			
-			// get the nearest atom
-			for (int k=0; k<SHIFT_MAP; k++)
+			for (int l=0; l<numPoints; l++)
 			{
-				int64_t cx = ix+shift_map[k][0];
-				int64_t cy = iy+shift_map[k][1];
-				int64_t cz = iz+shift_map[k][2];
+				if (nearest[l] == -1)
+					cout << endl << WARN << "No nearest atom in cavity/pocket!";
 
-				if (cx >= ggrid || cy >= ggrid || cz >= ggrid || cx < 0 || cy < 0 || cz < 0)
-					continue;
-
-				int num_atoms = gridMultiMap[ cz*(ggrid*ggrid) + cy*ggrid + cx ].size();
-
-				for (int j=0; j<num_atoms; j++)
-				{
-					int atom_index = gridMultiMap[ cz*(ggrid*ggrid) + cy*ggrid + cx ][j];
-
-					double signed_dist = 0;
-
-					DIST2(signed_dist,delphi->atoms[atom_index].pos,gridPoint)
-					double radius2 = delphi->atoms[atom_index].radius2;
-					signed_dist -= radius2;
-					
-					if (signed_dist < minDist)
-					{
-						minDist = signed_dist;
-						first = atom_index;
-					}
-				}
+				cav2atoms[i]->insert(nearest[l]);
 			}
-			if (first == -1)
-				cout << endl << WARN << "No nearest atom in cavity/pocket!";
-
-			cav2atoms[i]->insert(first);
+			deleteVector<int>(nearest);
 		}
 		i++;
 	}
-	disposeAtomsMap();
 }
 
 
@@ -2460,15 +2642,15 @@ void Surface::fillCavities(double vol, bool silent)
 				// update the scalar filed consistently with cavity detection
 				if (accurateTriangulation && isAvailableScalarField)
 				{
-					scalarField[v[2]][v[1]][v[0]] = +INFINITY;
-					scalarField[v[2]][v[1]][v[0]+1] = +INFINITY;
-					scalarField[v[2]][v[1]+1][v[0]] = +INFINITY;
-					scalarField[v[2]][v[1]+1][v[0]+1] = +INFINITY;
-
-					scalarField[v[2]+1][v[1]][v[0]] = +INFINITY;
-					scalarField[v[2]+1][v[1]][v[0]+1] = +INFINITY;
-					scalarField[v[2]+1][v[1]+1][v[0]] = +INFINITY;
-					scalarField[v[2]+1][v[1]+1][v[0]+1] = +INFINITY;
+					write3DVector<float>(scalarField,+INFINITY,v[0],v[1],v[2],NX,NY,NZ);
+					write3DVector<float>(scalarField,+INFINITY,v[0]+1,v[1],v[2],NX,NY,NZ);
+					write3DVector<float>(scalarField,+INFINITY,v[0],v[1]+1,v[2],NX,NY,NZ);
+					write3DVector<float>(scalarField,+INFINITY,v[0]+1,v[1]+1,v[2],NX,NY,NZ);
+
+					write3DVector<float>(scalarField,+INFINITY,v[0],v[1],v[2]+1,NX,NY,NZ);
+					write3DVector<float>(scalarField,+INFINITY,v[0]+1,v[1],v[2]+1,NX,NY,NZ);
+					write3DVector<float>(scalarField,+INFINITY,v[0],v[1]+1,v[2]+1,NX,NY,NZ);
+					write3DVector<float>(scalarField,+INFINITY,v[0]+1,v[1]+1,v[2]+1,NX,NY,NZ);
 				}
 			}
 			if (!silent)
@@ -2617,15 +2799,15 @@ void Surface::filterCavities()
 				// update the scalar filed consistently with cavity shape detection
 				if (accurateTriangulation && isAvailableScalarField)
 				{
-					scalarField[v[2]][v[1]][v[0]] = +INFINITY;
-					scalarField[v[2]][v[1]][v[0]+1] = +INFINITY;
-					scalarField[v[2]][v[1]+1][v[0]] = +INFINITY;
-					scalarField[v[2]][v[1]+1][v[0]+1] = +INFINITY;
-
-					scalarField[v[2]+1][v[1]][v[0]] = +INFINITY;
-					scalarField[v[2]+1][v[1]][v[0]+1] = +INFINITY;
-					scalarField[v[2]+1][v[1]+1][v[0]] = +INFINITY;
-					scalarField[v[2]+1][v[1]+1][v[0]+1] = +INFINITY;
+					write3DVector<float>(scalarField,+INFINITY,v[0],v[1],v[2],NX,NY,NZ);
+					write3DVector<float>(scalarField,+INFINITY,v[0]+1,v[1],v[2],NX,NY,NZ);
+					write3DVector<float>(scalarField,+INFINITY,v[0],v[1]+1,v[2],NX,NY,NZ);
+					write3DVector<float>(scalarField,+INFINITY,v[0]+1,v[1]+1,v[2],NX,NY,NZ);
+
+					write3DVector<float>(scalarField,+INFINITY,v[0],v[1],v[2]+1,NX,NY,NZ);
+					write3DVector<float>(scalarField,+INFINITY,v[0]+1,v[1],v[2]+1,NX,NY,NZ);
+					write3DVector<float>(scalarField,+INFINITY,v[0],v[1]+1,v[2]+1,NX,NY,NZ);
+					write3DVector<float>(scalarField,+INFINITY,v[0]+1,v[1]+1,v[2]+1,NX,NY,NZ);
 				}
 			}
 			
@@ -2970,15 +3152,15 @@ void Surface::filterCavities(bool modStatus)
 				// update the scalar filed consistently with cavity shape detection
 				if (accurateTriangulation && isAvailableScalarField)
 				{
-					scalarField[v[2]][v[1]][v[0]] = +INFINITY;
-					scalarField[v[2]][v[1]][v[0]+1] = +INFINITY;
-					scalarField[v[2]][v[1]+1][v[0]] = +INFINITY;
-					scalarField[v[2]][v[1]+1][v[0]+1] = +INFINITY;
-
-					scalarField[v[2]+1][v[1]][v[0]] = +INFINITY;
-					scalarField[v[2]+1][v[1]][v[0]+1] = +INFINITY;
-					scalarField[v[2]+1][v[1]+1][v[0]] = +INFINITY;
-					scalarField[v[2]+1][v[1]+1][v[0]+1] = +INFINITY;
+					write3DVector<float>(scalarField,+INFINITY,v[0],v[1],v[2],NX,NY,NZ);
+					write3DVector<float>(scalarField,+INFINITY,v[0]+1,v[1],v[2],NX,NY,NZ);
+					write3DVector<float>(scalarField,+INFINITY,v[0],v[1]+1,v[2],NX,NY,NZ);
+					write3DVector<float>(scalarField,+INFINITY,v[0]+1,v[1]+1,v[2],NX,NY,NZ);
+
+					write3DVector<float>(scalarField,+INFINITY,v[0],v[1],v[2]+1,NX,NY,NZ);
+					write3DVector<float>(scalarField,+INFINITY,v[0]+1,v[1],v[2]+1,NX,NY,NZ);
+					write3DVector<float>(scalarField,+INFINITY,v[0],v[1]+1,v[2]+1,NX,NY,NZ);
+					write3DVector<float>(scalarField,+INFINITY,v[0]+1,v[1]+1,v[2]+1,NX,NY,NZ);
 				}
 			}
 
@@ -3286,15 +3468,15 @@ void Surface::filterCavitiesWithBilevelStatusMap(bool modStatus)
 				// update the scalar filed consistently with cavity shape detection
 				if (accurateTriangulation && isAvailableScalarField)
 				{
-					scalarField[v[2]][v[1]][v[0]] = +INFINITY;
-					scalarField[v[2]][v[1]][v[0]+1] = +INFINITY;
-					scalarField[v[2]][v[1]+1][v[0]] = +INFINITY;
-					scalarField[v[2]][v[1]+1][v[0]+1] = +INFINITY;
-
-					scalarField[v[2]+1][v[1]][v[0]] = +INFINITY;
-					scalarField[v[2]+1][v[1]][v[0]+1] = +INFINITY;
-					scalarField[v[2]+1][v[1]+1][v[0]] = +INFINITY;
-					scalarField[v[2]+1][v[1]+1][v[0]+1] = +INFINITY;
+					write3DVector<float>(scalarField,+INFINITY,v[0],v[1],v[2],NX,NY,NZ);
+					write3DVector<float>(scalarField,+INFINITY,v[0]+1,v[1],v[2],NX,NY,NZ);
+					write3DVector<float>(scalarField,+INFINITY,v[0],v[1]+1,v[2],NX,NY,NZ);
+					write3DVector<float>(scalarField,+INFINITY,v[0]+1,v[1]+1,v[2],NX,NY,NZ);
+
+					write3DVector<float>(scalarField,+INFINITY,v[0],v[1],v[2]+1,NX,NY,NZ);
+					write3DVector<float>(scalarField,+INFINITY,v[0]+1,v[1],v[2]+1,NX,NY,NZ);
+					write3DVector<float>(scalarField,+INFINITY,v[0],v[1]+1,v[2]+1,NX,NY,NZ);
+					write3DVector<float>(scalarField,+INFINITY,v[0]+1,v[1]+1,v[2]+1,NX,NY,NZ);
 				}
 			}
 
@@ -4556,6 +4738,30 @@ void Surface::floodFillWithBilevelStatusMap2(int i, int j, int k, int idold, int
 
 void Surface::buildSternLayer()
 {
+	if (sternLayerDistanceTransform)
+	{
+		int64_t NX = delphi->nx;
+		int64_t NY = delphi->ny;
+		int64_t NZ = delphi->nz;
+
+		// the molecule (idebmap false) is the seeds set; the layer is the set of points
+		// whose distance from it is lower than sternLayer, widened as the molecule grid
+		// points lie inside the surface
+		float *dist2 = allocateVector<float>(NX*NY*NZ);
+
+		squaredDistanceTransform(delphi->idebmap,false,dist2);
+
+		double layer = sternLayer*delphi->scale + sternLayerDTOffset;
+		float ref = (float)(layer*layer);
+
+		for (int64_t i=0; i<NX*NY*NZ; i++)
+			if (dist2[i] < ref)
+				delphi->idebmap[i] = false;
+
+		deleteVector<float>(dist2);
+		return;
+	}
+
 	// for each atom build a bounding cube
 	// compute in/out info for each atom
 	// for (int i=0; i<delphi->numAtoms; i++)
@@ -4640,10 +4846,151 @@ void Surface::buildSternLayer()
 }
 
 
-bool Surface::getProjection(double p[3], double *proj1, double *proj2,
-							double *proj3, double *normal1, double *normal2, double *normal3)
+void Surface::squaredDistanceTransform(const bool *map, bool seed, float *dist2)
 {
-	cout << endl << WARN << "Projection not supported!";
+	int64_t NX = delphi->nx;
+	int64_t NY = delphi->ny;
+	int64_t NZ = delphi->nz;
+
+	for (int64_t i=0; i<NX*NY*NZ; i++)
+		dist2[i] = (map[i] == seed) ? 0.f : INFINITY;
+
+	// one pass per axis; each pass works on independent lines
+	int64_t num_lines[3] = {NY*NZ, NX*NZ, NX*NY};
+
+	for (int axis=0; axis<3; axis++)
+	{
+		#ifdef ENABLE_BOOST_THREADS
+		int num_threads = (int)MAX((int64_t)1, MIN((int64_t)conf.numThreads, num_lines[axis]/64));
+		int64_t chunk = (num_lines[axis] + num_threads - 1) / num_threads;
+
+		boost::thread_group thdGroup;
+
+		for (int j=0; j<num_threads; j++)
+		{
+			int64_t start = j*chunk;
+			int64_t end = MIN(num_lines[axis], start+chunk);
+
+			if (start >= end)
+				break;
+
+			thdGroup.create_thread(boost::bind(&Surface::distanceTransformLines, this, dist2, axis, start, end));
+		}
+		thdGroup.join_all();
+		#else
+		distanceTransformLines(dist2, axis, 0, num_lines[axis]);
+		#endif
+	}
+}
+
+
+void Surface::distanceTransformLines(float *dist2, int axis, int64_t start, int64_t end)
+{
+	int64_t NX = delphi->nx;
+	int64_t NY = delphi->ny;
+	int64_t NZ = delphi->nz;
+
+	int64_t n, stride;
+
+	if (axis == 0)
+	{
+		n = NX;
+		stride = 1;
+	}
+	else if (axis == 1)
+	{
+		n = NY;
+		stride = NX;
+	}
+	else
+	{
+		n = NZ;
+		stride = NX*NY;
+	}
+
+	double *f = allocateVector<double>(n);
+	double *z = allocateVector<double>(n+1);
+	int64_t *v = allocateVector<int64_t>(n);
+
+	for (int64_t line=start; line<end; line++)
+	{
+		// first grid point of the line; lines are enumerated with x running fastest
+		int64_t base;
+
+		if (axis == 0)
+			base = line*NX;
+		else if (axis == 1)
+			base = (line/NX)*NX*NY + line%NX;
+		else
+			base = line;
+
+		float *d = &dist2[base];
+
+		for (int64_t q=0; q<n; q++)
+			f[q] = d[q*stride];
+
+		// lower envelope of the parabolas rooted at the finite samples
+		int64_t k = -1;
+
+		for (int64_t q=0; q<n; q++)
+		{
+			if (f[q] == INFINITY)
+				continue;
+
+			if (k < 0)
+			{
+				k = 0;
+				v[0] = q;
+				z[0] = -INFINITY;
+				z[1] = INFINITY;
+				continue;
+			}
+
+			double s;
+
+			while (true)
+			{
+				int64_t p = v[k];
+				s = ((f[q] + (double)q*q) - (f[p] + (double)p*p)) / (2.*(q-p));
+
+				if (s <= z[k])
+					k--;
+				else
+					break;
+			}
+
+			k++;
+			v[k] = q;
+			z[k] = s;
+			z[k+1] = INFINITY;
+		}
+
+		// no seeds on this line so far: it stays at infinity
+		if (k < 0)
+			continue;
+
+		k = 0;
+
+		for (int64_t q=0; q<n; q++)
+		{
+			while (z[k+1] < q)
+				k++;
+
+			double dq = (double)(q - v[k]);
+			d[q*stride] = (float)(dq*dq + f[v[k]]);
+		}
+	}
+
+	deleteVector<double>(f);
+	deleteVector<double>(z);
+	deleteVector<int64_t>(v);
+}
+
+
+bool Surface::getProjection(double p[3], double *proj1, double *proj2,
+							double *proj3, double *normal1, double *normal2, double *normal3)
+{
+	cout << endl << WARN << "Projection not supported!";
 	return false;
 }
 
@@ -4655,110 +5002,96 @@ void Surface::getRayIntersection(double p1[3], double p2[3], vector<pair<VERTEX_
 
 
 void Surface::projector(int start, int end)
-{	
+{
 	for (int i=start; i<end; i++)
-	{
-		double gridPoint[3];
-		gridPoint[0] = delphi->x[delphi->ibgp[3*i]];
-		gridPoint[1] = delphi->y[delphi->ibgp[3*i+1]];
-		gridPoint[2] = delphi->z[delphi->ibgp[3*i+2]];
-
-		// project on the surface
-		if (bgp_type[i] == EXTERNAL_BGP)
-		{		
-			getProjection(gridPoint,
-						  &(delphi->scspos[3*i]),
-						  &(delphi->scspos[3*i+1]),
-						  &(delphi->scspos[3*i+2]),
-						  &(delphi->scsnor[3*i]),
-						  &(delphi->scsnor[3*i+1]),
-						  &(delphi->scsnor[3*i+2]));
-		}
-		// apply inner projection routine.
-		// get the nearest two atoms and project on the weighted voronoi plane
-		// this routine is only valid for molecules where one has a notion of atom
-		else
-		{
-			double minDist = INFINITY, secondDist = INFINITY;
-			int first = -1, second = -1;
+		projectBgp(i);
+}
 
-			// move from grid point of delphi grid to auxiliary atoms grid
-			int64_t ix = (int64_t)rintp((gridPoint[0]-gxmin)*gscale);
-			int64_t iy = (int64_t)rintp((gridPoint[1]-gymin)*gscale);
-			int64_t iz = (int64_t)rintp((gridPoint[2]-gzmin)*gscale);
 
-			// get the nearest atoms to set the dielectric constant
-			// the dielectric constant is mapped according to the additively weighted voronoi diagram
-			// that is the signed distance from the point p is ||p-c||^2-r^2 where c is the center
-			// of the atom and r is the radius. The minimum signed distance wins.
-			for (int k=0; k<SHIFT_MAP; k++)
-			{
-				int64_t cx = ix + shift_map[k][0];
-				int64_t cy = iy + shift_map[k][1];
-				int64_t cz = iz + shift_map[k][2];
+void Surface::batchProjector(const int *order, int *next_batch)
+{
+	while (true)
+	{
+		int start;
+		{
+			#ifdef ENABLE_BOOST_THREADS
+			boost::mutex::scoped_lock scopedLock(mutex);
+			#endif
+			start = (*next_batch);
+			(*next_batch) += BGP_PROJECTION_BATCH;
+		}
 
-				if (cx >= ggrid || cy >= ggrid || cz >= ggrid || cx < 0 || cy < 0 || cz < 0)
-					continue;
+		if (start >= delphi->nbgp)
+			break;
 
-				int num_atoms = gridMultiMap[ cz*(ggrid*ggrid) + cy*ggrid + cx ].size();
+		int end = MIN(start+BGP_PROJECTION_BATCH, delphi->nbgp);
 
-				for (int j=0; j<num_atoms; j++)
-				{
-					int atom_index = gridMultiMap[ cz*(ggrid*ggrid) + cy*ggrid + cx ][j];
+		for (int l=start; l<end; l++)
+			projectBgp(order[l]);
+	}
+}
 
-					double signed_dist = 0;
-					DIST2(signed_dist,delphi->atoms[atom_index].pos,gridPoint)
 
-					double radius2 = delphi->atoms[atom_index].radius2;
-					signed_dist -= radius2;
+void Surface::projectBgp(int i)
+{
+	double gridPoint[3];
+	gridPoint[0] = delphi->x[delphi->ibgp[3*i]];
+	gridPoint[1] = delphi->y[delphi->ibgp[3*i+1]];
+	gridPoint[2] = delphi->z[delphi->ibgp[3*i+2]];
+
+	// project on the surface
+	if (bgp_type[i] == EXTERNAL_BGP)
+	{		
+		getProjection(gridPoint,
+					  &(delphi->scspos[3*i]),
+					  &(delphi->scspos[3*i+1]),
+					  &(delphi->scspos[3*i+2]),
+					  &(delphi->scsnor[3*i]),
+					  &(delphi->scsnor[3*i+1]),
+					  &(delphi->scsnor[3*i+2]));
+	}
+	// apply inner projection routine.
+	// get the nearest two atoms and project on the weighted voronoi plane
+	// this routine is only valid for molecules where one has a notion of atom
+	else
+	{
+		double minDist, secondDist;
+		int second = -1;
 
-					if (signed_dist < minDist)
-					{
-						secondDist = minDist;
-						minDist = signed_dist;
-						second = first;
-						first = atom_index;
-					}
-					else
-					{
-						if (signed_dist < secondDist)
-						{
-							secondDist = signed_dist;
-							second = atom_index;
-						}
-					}
-				}
-			}
-			
-			// exit(-1);
-			// compute the voronoi plane using power distance
-			double w[4];
-			double *c1,*c2;
-
-			c1 = delphi->atoms[first].pos;
-			c2 = delphi->atoms[second].pos;
-
-			SUB(w,c2,c1)
-			w[0] = 2*w[0];
-			w[1] = 2*w[1];
-			w[2] = 2*w[2];
-			w[3] = (DOT(c1,c1)) - (DOT(c2,c2)) - delphi->atoms[first].radius*delphi->atoms[first].radius + delphi->atoms[second].radius*delphi->atoms[second].radius;
-
-			// project on the plane
-			double dist, proj[3];
-			point2plane(gridPoint, w, &dist,proj);
-			
-			// fprintf(fp,"%f %f %f\n", gridPoint[0],gridPoint[1],gridPoint[2]);
-			// printf("\n%f %f %f", proj[0],proj[1],proj[2]);
-			
-			delphi->scspos[3*i  ] = proj[0];
-			delphi->scspos[3*i+1] = proj[1];
-			delphi->scspos[3*i+2] = proj[2];
+		// get the nearest two atoms from the auxiliary atoms grid
+		// the dielectric constant is mapped according to the additively weighted voronoi diagram
+		// that is the signed distance from the point p is ||p-c||^2-r^2 where c is the center
+		// of the atom and r is the radius. The minimum signed distance wins.
+		int first = nearestAtomInMap(gridPoint, minDist, &second, &secondDist);
+		
+		// exit(-1);
+		// compute the voronoi plane using power distance
+		double w[4];
+		double *c1,*c2;
+
+		c1 = delphi->atoms[first].pos;
+		c2 = delphi->atoms[second].pos;
+
+		SUB(w,c2,c1)
+		w[0] = 2*w[0];
+		w[1] = 2*w[1];
+		w[2] = 2*w[2];
+		w[3] = (DOT(c1,c1)) - (DOT(c2,c2)) - delphi->atoms[first].radius*delphi->atoms[first].radius + delphi->atoms[second].radius*delphi->atoms[second].radius;
+
+		// project on the plane
+		double dist, proj[3];
+		point2plane(gridPoint, w, &dist,proj);
+		
+		// fprintf(fp,"%f %f %f\n", gridPoint[0],gridPoint[1],gridPoint[2]);
+		// printf("\n%f %f %f", proj[0],proj[1],proj[2]);
+		
+		delphi->scspos[3*i  ] = proj[0];
+		delphi->scspos[3*i+1] = proj[1];
+		delphi->scspos[3*i+2] = proj[2];
 
-			delphi->scsnor[3*i  ] = gridPoint[0] - proj[0];
-			delphi->scsnor[3*i+1] = gridPoint[1] - proj[1];
-			delphi->scsnor[3*i+2] = gridPoint[2] - proj[2];
-		}
+		delphi->scsnor[3*i  ] = gridPoint[0] - proj[0];
+		delphi->scsnor[3*i+1] = gridPoint[1] - proj[1];
+		delphi->scsnor[3*i+2] = gridPoint[2] - proj[2];
 	}
 }
 
@@ -8142,14 +8475,14 @@ inline void Surface::getVertices(double isolevel, int start_z, int end_z, int ju
 				// Classical marching cube interpolating scalar field values
 				else if (accurateTriangulation && isAvailableScalarField)
 				{
-					votes[0] = scalarField[k][j][i];
-					votes[1] = scalarField[k][j][i+1];
-					votes[2] = scalarField[k][j+1][i+1];
-					votes[3] = scalarField[k][j+1][i];
-					votes[4] = scalarField[k+1][j][i];
-					votes[5] = scalarField[k+1][j][i+1];
-					votes[6] = scalarField[k+1][j+1][i+1];
-					votes[7] = scalarField[k+1][j+1][i];
+					votes[0] = read3DVector<float>(scalarField,i,j,k,NX,NY,NZ);
+					votes[1] = read3DVector<float>(scalarField,i+1,j,k,NX,NY,NZ);
+					votes[2] = read3DVector<float>(scalarField,i+1,j+1,k,NX,NY,NZ);
+					votes[3] = read3DVector<float>(scalarField,i,j+1,k,NX,NY,NZ);
+					votes[4] = read3DVector<float>(scalarField,i,j,k+1,NX,NY,NZ);
+					votes[5] = read3DVector<float>(scalarField,i+1,j,k+1,NX,NY,NZ);
+					votes[6] = read3DVector<float>(scalarField,i+1,j+1,k+1,NX,NY,NZ);
+					votes[7] = read3DVector<float>(scalarField,i,j+1,k+1,NX,NY,NZ);
 
 					xg = gx[i];
 					yg = gy[j];
@@ -8885,14 +9218,14 @@ inline void Surface::getVertices(double isolevel, int start_z, int end_z, int ju
 							// Classical marching cube interpolating scalar field values
 							else if (accurateTriangulation && isAvailableScalarField)
 							{
-								votes[0] = scalarField[k][j][i];
-								votes[1] = scalarField[k][j][i+1];
-								votes[2] = scalarField[k][j+1][i+1];
-								votes[3] = scalarField[k][j+1][i];
-								votes[4] = scalarField[k+1][j][i];
-								votes[5] = scalarField[k+1][j][i+1];
-								votes[6] = scalarField[k+1][j+1][i+1];
-								votes[7] = scalarField[k+1][j+1][i];
+								votes[0] = read3DVector<float>(scalarField,i,j,k,NX,NY,NZ);
+								votes[1] = read3DVector<float>(scalarField,i+1,j,k,NX,NY,NZ);
+								votes[2] = read3DVector<float>(scalarField,i+1,j+1,k,NX,NY,NZ);
+								votes[3] = read3DVector<float>(scalarField,i,j+1,k,NX,NY,NZ);
+								votes[4] = read3DVector<float>(scalarField,i,j,k+1,NX,NY,NZ);
+								votes[5] = read3DVector<float>(scalarField,i+1,j,k+1,NX,NY,NZ);
+								votes[6] = read3DVector<float>(scalarField,i+1,j+1,k+1,NX,NY,NZ);
+								votes[7] = read3DVector<float>(scalarField,i,j+1,k+1,NX,NY,NZ);
 
 								xg = gx[i];
 								yg = gy[j];
@@ -9222,14 +9555,14 @@ inline double Surface::triangulationKernel(double isolevel, bool revert, int sta
 				// Classical marching cube interpolating scalar field values
 				else if (accurateTriangulation && isAvailableScalarField)
 				{
-					votes[0] = scalarField[k][j][i];
-					votes[1] = scalarField[k][j][i+1];
-					votes[2] = scalarField[k][j+1][i+1];
-					votes[3] = scalarField[k][j+1][i];
-					votes[4] = scalarField[k+1][j][i];
-					votes[5] = scalarField[k+1][j][i+1];
-					votes[6] = scalarField[k+1][j+1][i+1];
-					votes[7] = scalarField[k+1][j+1][i];
+					votes[0] = read3DVector<float>(scalarField,i,j,k,NX,NY,NZ);
+					votes[1] = read3DVector<float>(scalarField,i+1,j,k,NX,NY,NZ);
+					votes[2] = read3DVector<float>(scalarField,i+1,j+1,k,NX,NY,NZ);
+					votes[3] = read3DVector<float>(scalarField,i,j+1,k,NX,NY,NZ);
+					votes[4] = read3DVector<float>(scalarField,i,j,k+1,NX,NY,NZ);
+					votes[5] = read3DVector<float>(scalarField,i+1,j,k+1,NX,NY,NZ);
+					votes[6] = read3DVector<float>(scalarField,i+1,j+1,k+1,NX,NY,NZ);
+					votes[7] = read3DVector<float>(scalarField,i,j+1,k+1,NX,NY,NZ);
 				}
 				int numTriangles;
 
@@ -9806,14 +10139,14 @@ inline double Surface::triangulationKernel(double isolevel, bool revert, int sta
 							// Classical marching cube interpolating scalar field values
 							else if (accurateTriangulation && isAvailableScalarField)
 							{
-								votes[0] = scalarField[k][j][i];
-								votes[1] = scalarField[k][j][i+1];
-								votes[2] = scalarField[k][j+1][i+1];
-								votes[3] = scalarField[k][j+1][i];
-								votes[4] = scalarField[k+1][j][i];
-								votes[5] = scalarField[k+1][j][i+1];
-								votes[6] = scalarField[k+1][j+1][i+1];
-								votes[7] = scalarField[k+1][j+1][i];
+								votes[0] = read3DVector<float>(scalarField,i,j,k,NX,NY,NZ);
+								votes[1] = read3DVector<float>(scalarField,i+1,j,k,NX,NY,NZ);
+								votes[2] = read3DVector<float>(scalarField,i+1,j+1,k,NX,NY,NZ);
+								votes[3] = read3DVector<float>(scalarField,i,j+1,k,NX,NY,NZ);
+								votes[4] = read3DVector<float>(scalarField,i,j,k+1,NX,NY,NZ);
+								votes[5] = read3DVector<float>(scalarField,i+1,j,k+1,NX,NY,NZ);
+								votes[6] = read3DVector<float>(scalarField,i+1,j+1,k+1,NX,NY,NZ);
+								votes[7] = read3DVector<float>(scalarField,i,j+1,k+1,NX,NY,NZ);
 							}
 							int numTriangles;
 
@@ -9906,832 +10239,2455 @@ inline double Surface::triangulationKernel(double isolevel, bool revert, int sta
 */
 
 
-double Surface::triangulateSurface(bool outputMesh, bool buildAtomsMapHere,
-								   double isolevel, const char *fileName, bool revert)
+/** Vertex index of the surface intersection along a grid edge, or -1 if not available */
+inline int Surface::getEdgeVertexIndex(int dir, int64_t ix, int64_t iy, int64_t iz)
 {
-	int num_threads = conf.numThreads;
-
+	#if !defined(OPTIMIZE_INTERSECTIONS_MANAGEMENT)
+	if (dir == X_DIR)
+		return intersectionsMatrixAlongX->at(ix,iy,iz);
+	else if (dir == Y_DIR)
+		return intersectionsMatrixAlongY->at(ix,iy,iz);
+	else
+		return intersectionsMatrixAlongZ->at(ix,iy,iz);
+	#else
 	int64_t NX = delphi->nx;
 	int64_t NY = delphi->ny;
 	int64_t NZ = delphi->nz;
 
-	auto chrono_start = chrono::high_resolution_clock::now();
+	if (dir == X_DIR)
+		return readBilevelGrid<int>(bilevel_intersectionsMatrixAlongX,-1,ix,iy,iz,NX,NY,NZ);
+	else if (dir == Y_DIR)
+		return readBilevelGrid<int>(bilevel_intersectionsMatrixAlongY,-1,ix,iy,iz,NX,NY,NZ);
+	else
+		return readBilevelGrid<int>(bilevel_intersectionsMatrixAlongZ,-1,ix,iy,iz,NX,NY,NZ);
+	#endif
+}
 
 
+inline bool Surface::getNodeInsideness(int64_t i, int64_t j, int64_t k)
+{
 	#if !defined(USE_COMPRESSED_GRIDS)
 	if (!optimizeGrids)
-	{
-		if (verticesInsidenessMap == NULL && accurateTriangulation && !isAvailableScalarField)
-		{
-			cout << endl << WARN << "Cannot triangulate without inside/out info for grid points";
-			return 0;
-		}
-	}
-	else
+		return verticesInsidenessMap[k][j][i];
 	#endif
-	{
-		if (compressed_verticesInsidenessMap == NULL && accurateTriangulation && !isAvailableScalarField)
-		{
-			cout << endl << WARN << "Cannot triangulate without inside/out info for grid points";
-			return 0;
-		}
-	}
+	return read32xCompressedGrid(compressed_verticesInsidenessMap,i,j,k,delphi->nx,delphi->ny,delphi->nz);
+}
 
-	#ifdef ENABLE_BOOST_THREADS
-	boost::thread_group thdGroup;
-	#endif
-	
-	// in parallel complete missing vertices and mark active cubes to make faster the second pass
-	// in case of classical MC, all vertices are computed on this pass
-	vector<vector<int>*> localTri;
-	vector<vector<coordVec>*> localVert;
-	vector<vector<VERTEX_TYPE*>*> localNormals;
 
-	VERTEX_TYPE *area = allocateVector<VERTEX_TYPE>(num_threads);
+// The 12 edges of a MC cube as (direction, offset of the lower node)
+static const int dcCubeEdges[12][4] =
+{
+	{X_DIR,0,0,0}, {X_DIR,0,1,0}, {X_DIR,0,0,1}, {X_DIR,0,1,1},
+	{Y_DIR,0,0,0}, {Y_DIR,1,0,0}, {Y_DIR,0,0,1}, {Y_DIR,1,0,1},
+	{Z_DIR,0,0,0}, {Z_DIR,1,0,0}, {Z_DIR,0,1,0}, {Z_DIR,1,1,0}
+};
 
-	localTri.reserve(num_threads);
-	localVert.reserve(num_threads);
-	localNormals.reserve(num_threads);
 
-	for (int i=0; i<num_threads; i++)
-	{
-		localTri.push_back(new vector<int>());
-		localVert.push_back(new vector<coordVec>());
-		localNormals.push_back(new vector<VERTEX_TYPE*>());
+void Surface::dualContouringVerticesKernel(int start_z, int end_z, int jump,
+										   vector<VERTEX_TYPE> *localVert, vector<VERTEX_TYPE> *localNormals)
+{
+	int64_t NX = delphi->nx;
+	int64_t NY = delphi->ny;
+	int64_t NZ = delphi->nz;
 
-		localVert[i]->reserve(1000);
-		localNormals[i]->reserve(1000);
-	}
+	double *gx = delphi->x;
+	double *gy = delphi->y;
+	double *gz = delphi->z;
+	double d_hside = delphi->hside;
 
-	// activeCubes = allocateMatrix3D<bool>(NX,NY,NZ);
-	#if !defined(USE_COMPRESSED_GRIDS)
-	if (!optimizeGrids)
-	{
-		if (activeCubes != NULL)
-			deleteVector<bool>(activeCubes);
+	bool hasNormals = computeNormals && providesAnalyticalNormals;
 
-		activeCubes = allocateVector<bool>(NX*NY*NZ);
+	// eigenvalues of the normal equations below this fraction of the largest one are
+	// considered degenerate directions (flat regions or creases) and the vertex is not
+	// moved along them from the mass point
+	const double eigenvalue_threshold = 0.02;
 
-		for (int64_t i=0; i < NX*NY*NZ; i++)
-			activeCubes[i] = 0;
-	}
-	else
-	#endif
+	TNT::Array2D<double> ATA(3,3);
+	TNT::Array1D<double> eigenvalues(3);
+	TNT::Array2D<double> eigenvectors(3,3);
+
+	// each thread owns slabs of 4 z planes, so that different threads never allocate
+	// the same macro-cell of the bilevel grid
+	for (int kk = start_z; kk < end_z; kk += jump)
 	{
-		if (compressed_activeCubes != NULL)
-			deleteVector<unsigned int>(compressed_activeCubes);
+		for (int64_t k = MAX(kk,1); k < MIN(end_z, kk+4); k++)
+		{
+			for (int64_t j = 1; j < NY-1; j++)
+			{
+				for (int64_t i = 1; i < NX-1; i++)
+				{
+					bool inside[2][2][2];
+					int numInside = 0;
 
-		compressed_activeCubes = allocate32xCompressedGrid(0U,NX,NY,NZ);
-	}
+					for (int dz=0; dz<2; dz++)
+						for (int dy=0; dy<2; dy++)
+							for (int dx=0; dx<2; dx++)
+							{
+								inside[dz][dy][dx] = getNodeInsideness(i+dx,j+dy,k+dz);
+								if (inside[dz][dy][dx])
+									numInside++;
+							}
 
-	///////////// starts parallel vertices retrieval ///////////////////////
-	// this is time consuming only if the scalar field is available
-	// differently, in case of analytical intersections, this step will be very fast
-	// and only used to repair variations done by the cavity filling or by rays that missed the target
+					if (numInside == 0 || numInside == 8)
+						continue;
 
-	cout << endl << INFO << "Generating MC vertices...";
-	cout.flush();
+					// hermite data of the sign changing edges: the intersection points and,
+					// where analytically available, the normals of the surface there
+					double points[12][3], planePoints[12][3], normals[12][3];
+					int numPoints = 0, numNormals = 0;
 
+					for (int e=0; e<12; e++)
+					{
+						int dir = dcCubeEdges[e][0];
+						int dx = dcCubeEdges[e][1];
+						int dy = dcCubeEdges[e][2];
+						int dz = dcCubeEdges[e][3];
+						int ex = dx + (dir == X_DIR);
+						int ey = dy + (dir == Y_DIR);
+						int ez = dz + (dir == Z_DIR);
+
+						if (inside[dz][dy][dx] == inside[ez][ey][ex])
+							continue;
 
-	#if !defined(OPTIMIZE_VERTICES_ADDITION)
-	// load balanced and cache friendly thread dispatch
-	for (int j=0; j<num_threads; j++)
-	{
-		// voxels with Z coordinates equal to 0 and NZ-1 are skipped
-		#ifdef ENABLE_BOOST_THREADS
-		thdGroup.create_thread(boost::bind(&Surface::getVertices,this,isolevel,j+1,NZ-1,num_threads,localVert[j],localNormals[j]));
-		#else
-		getVertices(isolevel,1,NZ-1,1,localVert[0],localNormals[0]);
-		#endif
-	}
-	#else
-	getVertices(isolevel,1,NZ-1,1,localVert[0],localNormals[0]);
-	#endif
+						int ind = getEdgeVertexIndex(dir,i+dx,j+dy,k+dz);
 
-	/*
-	int comp_NX = (NX+4)>>2;
-	int comp_NY = (NY+4)>>2;
-	int comp_NZ = (NZ+4)>>2;
-	compressed_activeMacroCubes = allocate32xCompressedGrid(0,comp_NX,comp_NY,comp_NZ);
+						double *p = points[numPoints++];
 
-	// conflict-free cross-thread writes are possible if each thread proceeds launching XY slabs
-	// whose thickness is multiple of 4
-	int fine_grid_size = 4;
-	int jump = num_threads * fine_grid_size;
+						if (ind < 0)
+						{
+							// edge midpoint
+							p[0] = gx[i+dx] - d_hside + ((dir == X_DIR) ? d_hside : 0.);
+							p[1] = gy[j+dy] - d_hside + ((dir == Y_DIR) ? d_hside : 0.);
+							p[2] = gz[k+dz] - d_hside + ((dir == Z_DIR) ? d_hside : 0.);
+							continue;
+						}
 
-	for (int j=0; j<num_threads; j++)
-	{
-		// voxels with Z coordinates equal to 0 and NZ-1 are skipped
+						#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+						VERTEX_TYPE *v = vertList[ind];
+						#else
+						VERTEX_TYPE *v = &vertList[ ind*3 ];
+						#endif
+						p[0] = v[0];
+						p[1] = v[1];
+						p[2] = v[2];
 
-		int start = j*fine_grid_size;
+						if (!hasNormals)
+							continue;
 
-		// voxels with Z coordinates equal to 0 and NZ-1 are skipped
-		#ifdef ENABLE_BOOST_THREADS
-		thdGroup.create_thread(boost::bind(&Surface::getVertices,this,isolevel,start,NZ-1,jump,localVert[j],localNormals[j]));
-		#else
-		getVertices(isolevel,start,NZ-1,jump,localVert[0],localNormals[0]);
-		#endif
-	}
-	*/
-	///////////////////////////////////////////////////////////////////////////////
-		
-	#ifdef ENABLE_BOOST_THREADS
-	// join; final part of the computation of the volume within the surface
-	thdGroup.join_all();
-	#endif
+						#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+						VERTEX_TYPE *vn = normalsList[ind];
+						#else
+						VERTEX_TYPE *vn = &normalsList[ ind*3 ];
+						#endif
+						double norm = sqrt(vn[0]*vn[0] + vn[1]*vn[1] + vn[2]*vn[2]);
 
-	int addedVertices = 0;
-	// int dup = 0;
+						// vertices added by the MC repair have no normal
+						if (norm < 1e-6)
+							continue;
 
-	for (int j=0; j<num_threads; j++)
-	{
-		vector<coordVec> *lv = localVert[j];
-		vector<coordVec>::iterator it2;
+						normals[numNormals][0] = vn[0] / norm;
+						normals[numNormals][1] = vn[1] / norm;
+						normals[numNormals][2] = vn[2] / norm;
+						planePoints[numNormals][0] = p[0];
+						planePoints[numNormals][1] = p[1];
+						planePoints[numNormals][2] = p[2];
+						numNormals++;
+					}
 
-		addedVertices += (int)localVert[j]->size();
+					double massPoint[3] = {0., 0., 0.};
 
-		vector<VERTEX_TYPE*> *ln;
-		vector<VERTEX_TYPE*>::iterator it3;
+					for (int l=0; l<numPoints; l++)
+					{
+						massPoint[0] += points[l][0];
+						massPoint[1] += points[l][1];
+						massPoint[2] += points[l][2];
+					}
+					massPoint[0] /= numPoints;
+					massPoint[1] /= numPoints;
+					massPoint[2] /= numPoints;
 
-		if (computeNormals && providesAnalyticalNormals)
-		{
-			ln = localNormals[j];
-			it3 = ln->begin();
-		}
+					double vertex[3] = {massPoint[0], massPoint[1], massPoint[2]};
+					double vertexNormal[3] = {0., 0., 0.};
 
-		// set<string> brutal;
+					if (numNormals > 0)
+					{
+						// minimize sum_l (n_l . (x - p_l))^2 by the pseudo inverse of A^T A,
+						// solving for the displacement from the mass point
+						double ATb[3] = {0., 0., 0.};
 
-		for (it2 = lv->begin(); it2 != lv->end(); it2++)
-		{
-			coordVec &v = *it2;
+						for (int r=0; r<3; r++)
+							for (int c=0; c<3; c++)
+								ATA[r][c] = 0.;
 
-			#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
-			int ind = (int)vertList.size();
-			vertList.push_back(v.vec);
-			#else
-			int ind = (int)(vertList.size() / 3.);
-			vertList.push_back(v.vec[0]);
-			vertList.push_back(v.vec[1]);
-			vertList.push_back(v.vec[2]);
-			#endif
+						for (int l=0; l<numNormals; l++)
+						{
+							double *n = normals[l];
+							double b = n[0]*(planePoints[l][0] - massPoint[0]) +
+									   n[1]*(planePoints[l][1] - massPoint[1]) +
+									   n[2]*(planePoints[l][2] - massPoint[2]);
 
-			#if !defined(OPTIMIZE_INTERSECTIONS_MANAGEMENT)
-			if (v.dir == X_DIR)
-				intersectionsMatrixAlongX->set(v.ix,v.iy,v.iz,ind);
-			else if (v.dir == Y_DIR)
-				intersectionsMatrixAlongY->set(v.ix,v.iy,v.iz,ind);
-			else
-				intersectionsMatrixAlongZ->set(v.ix,v.iy,v.iz,ind);
-			#else
-			if (v.dir == X_DIR)
-				writeBilevelGrid<int>(bilevel_intersectionsMatrixAlongX,-1,ind,v.ix,v.iy,v.iz,NX,NY,NZ);
-			else if (v.dir == Y_DIR)
-				writeBilevelGrid<int>(bilevel_intersectionsMatrixAlongY,-1,ind,v.ix,v.iy,v.iz,NX,NY,NZ);
-			else
-				writeBilevelGrid<int>(bilevel_intersectionsMatrixAlongZ,-1,ind,v.ix,v.iy,v.iz,NX,NY,NZ);
-			#endif
+							for (int r=0; r<3; r++)
+							{
+								ATb[r] += n[r]*b;
+								for (int c=0; c<3; c++)
+									ATA[r][c] += n[r]*n[c];
+							}
+							vertexNormal[0] += n[0];
+							vertexNormal[1] += n[1];
+							vertexNormal[2] += n[2];
+						}
 
-			// char buff[100];
-			// sprintf(buff, "%d_%d_%d_%d", v.ix,v.iy,v.iz,v.dir);
-			// set<string>::iterator it = brutal.find(string(buff));
-			// if (it != brutal.end())
-			// 	dup++;
-			// else
-			// 	brutal.insert(string(buff));
+						JAMA::Eigenvalue<double> eig(ATA);
+						eig.getRealEigenvalues(eigenvalues);
+						eig.getV(eigenvectors);
 
-			if (computeNormals && providesAnalyticalNormals)
-			{
-				VERTEX_TYPE *vn = *it3;
+						double maxEigenvalue = MAX(eigenvalues[0], MAX(eigenvalues[1], eigenvalues[2]));
 
-				#if !defined(OPTIMIZE_INTERSECTIONS_MANAGEMENT) && !defined(AVOID_NORMALS_MATRICES)
-				if (v.dir == X_DIR)
-					normalsMatrixAlongX->set(v.ix,v.iy,v.iz,ind);
-				else if (v.dir == Y_DIR)
-					normalsMatrixAlongY->set(v.ix,v.iy,v.iz,ind);
-				else
-					normalsMatrixAlongZ->set(v.ix,v.iy,v.iz,ind);
-				#endif
+						for (int c=0; c<3; c++)
+						{
+							if (eigenvalues[c] <= eigenvalue_threshold*maxEigenvalue)
+								continue;
 
-				#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
-				normalsList.push_back(vn);
-				#else
-				normalsList.push_back(vn[0]);
-				normalsList.push_back(vn[1]);
-				normalsList.push_back(vn[2]);
-				#endif
+							double proj = eigenvectors[0][c]*ATb[0] + eigenvectors[1][c]*ATb[1] + eigenvectors[2][c]*ATb[2];
+							proj /= eigenvalues[c];
 
-				it3++;
-			}
-		}
+							vertex[0] += proj*eigenvectors[0][c];
+							vertex[1] += proj*eigenvectors[1][c];
+							vertex[2] += proj*eigenvectors[2][c];
+						}
 
-		#if defined(USE_OPTIMIZED_VERTICES_BUFFERING)
-		verticesBuffers[j].clear();
-		#endif
-		localVert[j]->clear();
-		delete localVert[j];
+						// keep the vertex within its cube
+						vertex[0] = MIN(MAX(vertex[0], gx[i]-d_hside), gx[i]+d_hside);
+						vertex[1] = MIN(MAX(vertex[1], gy[j]-d_hside), gy[j]+d_hside);
+						vertex[2] = MIN(MAX(vertex[2], gz[k]-d_hside), gz[k]+d_hside);
 
-		if (computeNormals && providesAnalyticalNormals)
-		{
-			#if defined(USE_OPTIMIZED_VERTICES_BUFFERING)
-			normalsBuffers[j].clear();
-			#endif
-			localNormals[j]->clear();
-			delete localNormals[j];
+						double norm = sqrt(DOT(vertexNormal,vertexNormal));
+						if (norm > 1e-6)
+						{
+							vertexNormal[0] /= norm;
+							vertexNormal[1] /= norm;
+							vertexNormal[2] /= norm;
+						}
+						else
+						{
+							// left to approximateNormals()
+							vertexNormal[0] = vertexNormal[1] = vertexNormal[2] = 0.;
+						}
+					}
+
+					int local_index = (int)(localVert->size() / 3);
+
+					localVert->push_back((VERTEX_TYPE)vertex[0]);
+					localVert->push_back((VERTEX_TYPE)vertex[1]);
+					localVert->push_back((VERTEX_TYPE)vertex[2]);
+
+					if (hasNormals)
+					{
+						localNormals->push_back((VERTEX_TYPE)vertexNormal[0]);
+						localNormals->push_back((VERTEX_TYPE)vertexNormal[1]);
+						localNormals->push_back((VERTEX_TYPE)vertexNormal[2]);
+					}
+
+					writeBilevelGrid<int>(bilevel_dualVertices,-1,local_index,i,j,k,NX,NY,NZ);
+				}
+			}
 		}
 	}
+}
 
-	// cout << endl << "duplicated "<<dup;
-	cout << "ok!";
-	cout.flush();
 
-	cout << endl << INFO << "MC added "<< addedVertices << " non analytical vertices";
-	/*
-	int orphans2 = 0;
-	int orphans1 = 0;
+// The 4 cubes sharing an edge, as offsets from the cube of the lower node of the edge.
+// They are listed counterclockwise around the edge direction.
+static const int dcEdgeCubes[3][4][3] =
+{
+	{{0,-1,-1}, {0,0,-1}, {0,0,0}, {0,-1,0}},
+	{{-1,0,-1}, {-1,0,0}, {0,0,0}, {0,0,-1}},
+	{{-1,-1,0}, {0,-1,0}, {0,0,0}, {-1,0,0}}
+};
 
-	// search for orphan cubes
-	for (int iz=0; iz<NZ; iz++)
-		for (int iy=0; iy<NY; iy++)
-			for (int ix=0; ix<NX; ix++)
+
+double Surface::dualContouringKernel(int start_z, int end_z, int jump,
+									 vector<int> *localTriList, VERTEX_TYPE *localArea)
+{
+	int64_t NX = delphi->nx;
+	int64_t NY = delphi->ny;
+	int64_t NZ = delphi->nz;
+
+	int num_threads = conf.numThreads;
+
+	(*localArea) = 0;
+
+	for (int64_t k = start_z; k < end_z; k += jump)
+	{
+		for (int64_t j = 1; j < NY-1; j++)
+		{
+			for (int64_t i = 1; i < NX-1; i++)
 			{
-				int count = 0;
+				bool in = getNodeInsideness(i,j,k);
 
-				#if !defined(OPTIMIZE_INTERSECTIONS_MANAGEMENT)
-				if (intersectionsMatrixAlongX->at(ix,iy,iz) != -1) count++;
-				if (intersectionsMatrixAlongY->at(ix+1,iy,iz) != -1) count++;
-				if (intersectionsMatrixAlongX->at(ix,iy+1,iz) != -1) count++;
-				if (intersectionsMatrixAlongY->at(ix,iy,iz) != -1) count++;
-				if (intersectionsMatrixAlongX->at(ix,iy,iz+1) != -1) count++;
-				if (intersectionsMatrixAlongY->at(ix+1,iy,iz+1) != -1) count++;
-				if (intersectionsMatrixAlongX->at(ix,iy+1,iz+1) != -1) count++;
-				if (intersectionsMatrixAlongY->at(ix,iy,iz+1) != -1) count++;
-				if (intersectionsMatrixAlongZ->at(ix,iy,iz) != -1) count++;
-				if (intersectionsMatrixAlongZ->at(ix+1,iy,iz) != -1) count++;
-				if (intersectionsMatrixAlongZ->at(ix+1,iy+1,iz) != -1) count++;
-				if (intersectionsMatrixAlongZ->at(ix,iy+1,iz) != -1) count++;
-				#else
-				if (readBilevelGrid<int>(bilevel_intersectionsMatrixAlongX,-1,ix,iy,iz,NX,NY,NZ) != -1) count++;
-				if (readBilevelGrid<int>(bilevel_intersectionsMatrixAlongY,-1,ix+1,iy,iz,NX,NY,NZ) != -1) count++;
-				if (readBilevelGrid<int>(bilevel_intersectionsMatrixAlongX,-1,ix,iy+1,iz,NX,NY,NZ) != -1) count++;
-				if (readBilevelGrid<int>(bilevel_intersectionsMatrixAlongY,-1,ix,iy,i,NX,NY,NZz) != -1) count++;
-				if (readBilevelGrid<int>(bilevel_intersectionsMatrixAlongX,-1,ix,iy,iz+1,NX,NY,NZ) != -1) count++;
-				if (readBilevelGrid<int>(bilevel_intersectionsMatrixAlongY,-1,ix+1,iy,iz+1,NX,NY,NZ) != -1) count++;
-				if (readBilevelGrid<int>(bilevel_intersectionsMatrixAlongX,-1,ix,iy+1,iz+1,NX,NY,NZ) != -1) count++;
-				if (readBilevelGrid<int>(bilevel_intersectionsMatrixAlongY,-1,ix,iy,iz+1,NX,NY,NZ) != -1) count++;
-				if (readBilevelGrid<int>(bilevel_intersectionsMatrixAlongZ,-1,ix,iy,iz,NX,NY,NZ) != -1) count++;
-				if (readBilevelGrid<int>(bilevel_intersectionsMatrixAlongZ,-1,ix+1,iy,iz,NX,NY,NZ) != -1) count++;
-				if (readBilevelGrid<int>(bilevel_intersectionsMatrixAlongZ,-1,ix+1,iy+1,iz,NX,NY,NZ) != -1) count++;
-				if (readBilevelGrid<int>(bilevel_intersectionsMatrixAlongZ,-1,ix,iy+1,iz,NX,NY,NZ) != -1) count++;
-				#endif
+				for (int dir=0; dir<3; dir++)
+				{
+					bool in2 = getNodeInsideness(i + (dir == X_DIR), j + (dir == Y_DIR), k + (dir == Z_DIR));
 
-				if (count == 2)
-					orphans2++;
+					if (in == in2)
+						continue;
 
-				if (count == 1)
-					orphans1++;
+					int quad[4];
+					bool complete = true;
+
+					for (int c=0; c<4; c++)
+					{
+						int64_t ci = i + dcEdgeCubes[dir][c][0];
+						int64_t cj = j + dcEdgeCubes[dir][c][1];
+						int64_t ck = k + dcEdgeCubes[dir][c][2];
+
+						int local_index = -1;
+
+						if (ci >= 1 && cj >= 1 && ck >= 1)
+							local_index = readBilevelGrid<int>(bilevel_dualVertices,-1,ci,cj,ck,NX,NY,NZ);
+
+						if (local_index == -1)
+						{
+							complete = false;
+							break;
+						}
+						// the vertex was built by the thread owning the 4-thick slab of its cube
+						quad[c] = dualVerticesOffset[ (ck>>2) % num_threads ] + local_index;
+					}
+
+					if (!complete)
+						continue;
+
+					// the counterclockwise order is outward if the lower node is inside;
+					// triangles are stored with the opposite winding, as the MC ones
+					if (in)
+					{
+						int tmp = quad[1];
+						quad[1] = quad[3];
+						quad[3] = tmp;
+					}
+
+					VERTEX_TYPE *v[4];
+					for (int c=0; c<4; c++)
+					{
+						#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+						v[c] = vertList[ quad[c] ];
+						#else
+						v[c] = &vertList[ quad[c]*3 ];
+						#endif
+					}
+
+					// split the quad along its shortest diagonal
+					double d02, d13;
+					DIST2(d02,v[0],v[2]);
+					DIST2(d13,v[1],v[3]);
+
+					int tris[2][3];
+					if (d02 <= d13)
+					{
+						tris[0][0] = 0; tris[0][1] = 1; tris[0][2] = 2;
+						tris[1][0] = 0; tris[1][1] = 2; tris[1][2] = 3;
+					}
+					else
+					{
+						tris[0][0] = 0; tris[0][1] = 1; tris[0][2] = 3;
+						tris[1][0] = 1; tris[1][1] = 2; tris[1][2] = 3;
+					}
+
+					for (int t=0; t<2; t++)
+					{
+						double e1[3], e2[3], n[3];
+						SUB(e1, v[ tris[t][1] ], v[ tris[t][0] ]);
+						SUB(e2, v[ tris[t][2] ], v[ tris[t][0] ]);
+						CROSS(n,e1,e2);
+						(*localArea) += 0.5*sqrt(DOT(n,n));
+
+						localTriList->push_back(quad[ tris[t][0] ]);
+						localTriList->push_back(quad[ tris[t][1] ]);
+						localTriList->push_back(quad[ tris[t][2] ]);
+					}
+				}
 			}
+		}
+	}
+	return (*localArea);
+}
 
-	cout << endl << "orphans1 " << orphans1;
-	cout << endl << "orphans2 " << orphans2;
-	*/
 
-	////////////////////////////// generate triangles /////////////////////////
-	// all vertices are computed, stored and uniquely indexed, now get triangles
+void Surface::buildDualContouringVertices(void)
+{
+	int num_threads = conf.numThreads;
 
-	#if !defined(OPTIMIZE_VERTICES_ADDITION)
-	for (int j=0; j<num_threads; j++)
+	int64_t NX = delphi->nx;
+	int64_t NY = delphi->ny;
+	int64_t NZ = delphi->nz;
+
+	bool hasNormals = computeNormals && providesAnalyticalNormals;
+
+	if (!hasNormals)
 	{
-		// only octrees version;
-		// voxels with Z coordinates equal to 0 and NZ-1 are skipped
-		#ifdef ENABLE_BOOST_THREADS
-		thdGroup.create_thread(boost::bind(&Surface::triangulationKernel,this,isolevel,revert,j+1,NZ-1,num_threads,localTri[j],&area[j]));
-		#else
-		triangulationKernel(isolevel,revert,1,NZ-1,1,localTri[0],&area[0]);
-		#endif
+		cout << endl << WARN << "Dual contouring without analytical normals (enable Compute_Vertex_Normals): vertices are placed at the mass points of the edge intersections";
 	}
-	#else
-	triangulationKernel(isolevel,revert,1,NZ-1,1,localTri[0],&area[0]);
+
+	cout << endl << INFO << "Generating dual contouring vertices...";
+	cout.flush();
+
+	bilevel_dualVertices = allocateBilevelGridCells<int>(NX,NY,NZ);
+	dualVerticesOffset = allocateVector<int>(num_threads);
+
+	vector<VERTEX_TYPE> *localVert = new vector<VERTEX_TYPE> [num_threads];
+	vector<VERTEX_TYPE> *localNormals = new vector<VERTEX_TYPE> [num_threads];
+
+	#ifdef ENABLE_BOOST_THREADS
+	boost::thread_group thdGroup;
 	#endif
 
-	/*
-	// The following was designed so as to use the cache-aware version of triangulationKernel(...);
-	// see the versions of triangulationKernel(...)
-	fine_grid_size = 4;
-	jump = num_threads * fine_grid_size;
+	// conflict-free cross-thread writes are possible if each thread proceeds launching XY slabs
+	// whose thickness is multiple of 4
+	int fine_grid_size = 4;
+	int jump = num_threads * fine_grid_size;
 
 	for (int j=0; j<num_threads; j++)
 	{
-		// voxels with Z coordinates equal to 0 and NZ-1 are skipped
-
 		int start = j*fine_grid_size;
 
 		// voxels with Z coordinates equal to 0 and NZ-1 are skipped
 		#ifdef ENABLE_BOOST_THREADS
-		thdGroup.create_thread(boost::bind(&Surface::triangulationKernel,this,isolevel,revert,start,NZ-1,jump,localTri[j],&area[j]));
+		thdGroup.create_thread(boost::bind(&Surface::dualContouringVerticesKernel,this,start,NZ-1,jump,&localVert[j],&localNormals[j]));
 		#else
-		triangulationKernel(isolevel,revert,start,NZ-1,jump,localTri[0],&area[0]);
+		dualContouringVerticesKernel(start,NZ-1,jump,&localVert[j],&localNormals[j]);
 		#endif
 	}
-	// deleteVector<unsigned int>(compressed_activeMacroCubes);
-	*/
 
 	#ifdef ENABLE_BOOST_THREADS
-	// join; final part of the computation of the volume within the surface
 	thdGroup.join_all();
 	#endif
 
+	// the MC vertices are replaced by the dual ones
+	vertList.clear();
+	normalsList.clear();
 
-	// deleteMatrix3D<bool>(delphi->nx,delphi->ny,delphi->nz,activeCubes);
-	#if !defined(USE_COMPRESSED_GRIDS)
-	if (!optimizeGrids)
-		deleteVector<bool>(activeCubes);
-	else
-	#endif
+	int numVertices = 0;
+
+	for (int j=0; j<num_threads; j++)
 	{
-		if (compressed_activeCubes != NULL)
-			deleteVector<unsigned int>(compressed_activeCubes);
+		dualVerticesOffset[j] = numVertices;
+		numVertices += (int)(localVert[j].size() / 3);
 	}
 
-	double surf_area = 0;
+	#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+	vertList.reserve(numVertices);
+	if (hasNormals)
+		normalsList.reserve(numVertices);
 
-	int total_num_triangle_data = 0;
+	// the thread buffers own the coordinates the lists point to
+	for (int j=0; j<num_threads; j++)
+	{
+		verticesBuffers[j].swap(localVert[j]);
+		normalsBuffers[j].swap(localNormals[j]);
+
+		for (size_t l=0; l<verticesBuffers[j].size(); l+=3)
+		{
+			vertList.push_back(&verticesBuffers[j][l]);
+			if (hasNormals)
+				normalsList.push_back(&normalsBuffers[j][l]);
+		}
+	}
+	#else
+	vertList.reserve(numVertices*3);
+	if (hasNormals)
+		normalsList.reserve(numVertices*3);
 
 	for (int j=0; j<num_threads; j++)
 	{
-		total_num_triangle_data += localTri[j]->size();
+		vertList.insert(vertList.end(), localVert[j].begin(), localVert[j].end());
+		if (hasNormals)
+			normalsList.insert(normalsList.end(), localNormals[j].begin(), localNormals[j].end());
 	}
-	triList.reserve(total_num_triangle_data);
+	#endif
 
-	#ifdef ENABLE_BOOST_THREADS
+	delete[] localVert;
+	delete[] localNormals;
 
-	// Reduction copies
-	for (int j=0; j<num_threads; j++)
+	cout << "ok!";
+	cout << endl << INFO << "Dual contouring placed " << numVertices << " vertices";
+	cout.flush();
+}
+
+
+void Surface::disposeDualContouringVertices(void)
+{
+	if (bilevel_dualVertices != NULL)
 	{
-		surf_area += area[j];
+		deleteBilevelGridCells<int>(bilevel_dualVertices, delphi->nx, delphi->ny, delphi->nz);
+		deleteVector<int *>(bilevel_dualVertices);
+	}
+	if (dualVerticesOffset != NULL)
+		deleteVector<int>(dualVerticesOffset);
+}
 
-		vector<int> *lt = localTri[j];
+double Surface::triangulateSurface(bool outputMesh, bool buildAtomsMapHere,
+								   double isolevel, const char *fileName, bool revert)
+{
+	int num_threads = conf.numThreads;
 
-		for (vector<int>::iterator it = lt->begin(); it != lt->end(); it++)
+	int64_t NX = delphi->nx;
+	int64_t NY = delphi->ny;
+	int64_t NZ = delphi->nz;
+
+	auto chrono_start = chrono::high_resolution_clock::now();
+
+
+	#if !defined(USE_COMPRESSED_GRIDS)
+	if (!optimizeGrids)
+	{
+		if (verticesInsidenessMap == NULL && accurateTriangulation && !isAvailableScalarField)
 		{
-			triList.push_back(*it);
+			cout << endl << WARN << "Cannot triangulate without inside/out info for grid points";
+			return 0;
 		}
-		delete localTri[j];
+	}
+	else
+	#endif
+	{
+		if (compressed_verticesInsidenessMap == NULL && accurateTriangulation && !isAvailableScalarField)
+		{
+			cout << endl << WARN << "Cannot triangulate without inside/out info for grid points";
+			return 0;
+		}
+	}
+
+	#ifdef ENABLE_BOOST_THREADS
+	boost::thread_group thdGroup;
+	#endif
+	
+	// in parallel complete missing vertices and mark active cubes to make faster the second pass
+	// in case of classical MC, all vertices are computed on this pass
+	vector<vector<int>*> localTri;
+	vector<vector<coordVec>*> localVert;
+	vector<vector<VERTEX_TYPE*>*> localNormals;
+
+	VERTEX_TYPE *area = allocateVector<VERTEX_TYPE>(num_threads);
+
+	localTri.reserve(num_threads);
+	localVert.reserve(num_threads);
+	localNormals.reserve(num_threads);
+
+	for (int i=0; i<num_threads; i++)
+	{
+		localTri.push_back(new vector<int>());
+		localVert.push_back(new vector<coordVec>());
+		localNormals.push_back(new vector<VERTEX_TYPE*>());
+
+		localVert[i]->reserve(1000);
+		localNormals[i]->reserve(1000);
+	}
+
+	// activeCubes = allocateMatrix3D<bool>(NX,NY,NZ);
+	#if !defined(USE_COMPRESSED_GRIDS)
+	if (!optimizeGrids)
+	{
+		if (activeCubes != NULL)
+			deleteVector<bool>(activeCubes);
+
+		activeCubes = allocateVector<bool>(NX*NY*NZ);
+
+		for (int64_t i=0; i < NX*NY*NZ; i++)
+			activeCubes[i] = 0;
+	}
+	else
+	#endif
+	{
+		if (compressed_activeCubes != NULL)
+			deleteVector<unsigned int>(compressed_activeCubes);
+
+		compressed_activeCubes = allocate32xCompressedGrid(0U,NX,NY,NZ);
+	}
+
+	///////////// starts parallel vertices retrieval ///////////////////////
+	// this is time consuming only if the scalar field is available
+	// differently, in case of analytical intersections, this step will be very fast
+	// and only used to repair variations done by the cavity filling or by rays that missed the target
+
+	cout << endl << INFO << "Generating MC vertices...";
+	cout.flush();
+
+	// each new vertex (and normal) is appended to the buffer of its thread; the buffers may grow
+	// meanwhile, thus the vertices are pointed to their final place once all of them are added
+	vector<size_t> verticesBase(num_threads), normalsBase(num_threads);
+	for (int j=0; j<num_threads; j++)
+	{
+		verticesBase[j] = verticesBuffers[j].size();
+		normalsBase[j] = normalsBuffers[j].size();
+	}
+
+
+	#if !defined(OPTIMIZE_VERTICES_ADDITION)
+	// load balanced and cache friendly thread dispatch
+	for (int j=0; j<num_threads; j++)
+	{
+		// voxels with Z coordinates equal to 0 and NZ-1 are skipped
+		#ifdef ENABLE_BOOST_THREADS
+		thdGroup.create_thread(boost::bind(&Surface::getVertices,this,isolevel,j+1,NZ-1,num_threads,localVert[j],localNormals[j]));
+		#else
+		getVertices(isolevel,1,NZ-1,1,localVert[0],localNormals[0]);
+		#endif
 	}
 	#else
-	surf_area = area[0];
+	getVertices(isolevel,1,NZ-1,1,localVert[0],localNormals[0]);
+	#endif
 
-	vector<int> *lt = localTri[0];
+	/*
+	int comp_NX = (NX+4)>>2;
+	int comp_NY = (NY+4)>>2;
+	int comp_NZ = (NZ+4)>>2;
+	compressed_activeMacroCubes = allocate32xCompressedGrid(0,comp_NX,comp_NY,comp_NZ);
 
-	// Copies
-	for (vector<int>::iterator it = lt->begin(); it != lt->end(); it++)
+	// conflict-free cross-thread writes are possible if each thread proceeds launching XY slabs
+	// whose thickness is multiple of 4
+	int fine_grid_size = 4;
+	int jump = num_threads * fine_grid_size;
+
+	for (int j=0; j<num_threads; j++)
 	{
-		triList.push_back(*it);
+		// voxels with Z coordinates equal to 0 and NZ-1 are skipped
+
+		int start = j*fine_grid_size;
+
+		// voxels with Z coordinates equal to 0 and NZ-1 are skipped
+		#ifdef ENABLE_BOOST_THREADS
+		thdGroup.create_thread(boost::bind(&Surface::getVertices,this,isolevel,start,NZ-1,jump,localVert[j],localNormals[j]));
+		#else
+		getVertices(isolevel,start,NZ-1,jump,localVert[0],localNormals[0]);
+		#endif
 	}
-	delete localTri[0];
+	*/
+	///////////////////////////////////////////////////////////////////////////////
+		
+	#ifdef ENABLE_BOOST_THREADS
+	// join; final part of the computation of the volume within the surface
+	thdGroup.join_all();
 	#endif
 
-	localTri.clear();
-	localVert.clear();
-	localNormals.clear();
+	for (int j=0; j<num_threads; j++)
+	{
+		for (size_t l=0; l<localVert[j]->size(); l++)
+			(*localVert[j])[l].vec = &verticesBuffers[j][ verticesBase[j]+3*l ];
+
+		if (computeNormals && providesAnalyticalNormals)
+			for (size_t l=0; l<localNormals[j]->size(); l++)
+				(*localNormals[j])[l] = &normalsBuffers[j][ normalsBase[j]+3*l ];
+	}
+
+	int addedVertices = 0;
+	// int dup = 0;
+
+	for (int j=0; j<num_threads; j++)
+	{
+		vector<coordVec> *lv = localVert[j];
+		vector<coordVec>::iterator it2;
+
+		addedVertices += (int)localVert[j]->size();
+
+		vector<VERTEX_TYPE*> *ln;
+		vector<VERTEX_TYPE*>::iterator it3;
+
+		if (computeNormals && providesAnalyticalNormals)
+		{
+			ln = localNormals[j];
+			it3 = ln->begin();
+		}
+
+		// set<string> brutal;
+
+		for (it2 = lv->begin(); it2 != lv->end(); it2++)
+		{
+			coordVec &v = *it2;
+
+			#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+			int ind = (int)vertList.size();
+			vertList.push_back(v.vec);
+			#else
+			int ind = (int)(vertList.size() / 3.);
+			vertList.push_back(v.vec[0]);
+			vertList.push_back(v.vec[1]);
+			vertList.push_back(v.vec[2]);
+			#endif
+
+			#if !defined(OPTIMIZE_INTERSECTIONS_MANAGEMENT)
+			if (v.dir == X_DIR)
+				intersectionsMatrixAlongX->set(v.ix,v.iy,v.iz,ind);
+			else if (v.dir == Y_DIR)
+				intersectionsMatrixAlongY->set(v.ix,v.iy,v.iz,ind);
+			else
+				intersectionsMatrixAlongZ->set(v.ix,v.iy,v.iz,ind);
+			#else
+			if (v.dir == X_DIR)
+				writeBilevelGrid<int>(bilevel_intersectionsMatrixAlongX,-1,ind,v.ix,v.iy,v.iz,NX,NY,NZ);
+			else if (v.dir == Y_DIR)
+				writeBilevelGrid<int>(bilevel_intersectionsMatrixAlongY,-1,ind,v.ix,v.iy,v.iz,NX,NY,NZ);
+			else
+				writeBilevelGrid<int>(bilevel_intersectionsMatrixAlongZ,-1,ind,v.ix,v.iy,v.iz,NX,NY,NZ);
+			#endif
+
+			// char buff[100];
+			// sprintf(buff, "%d_%d_%d_%d", v.ix,v.iy,v.iz,v.dir);
+			// set<string>::iterator it = brutal.find(string(buff));
+			// if (it != brutal.end())
+			// 	dup++;
+			// else
+			// 	brutal.insert(string(buff));
+
+			if (computeNormals && providesAnalyticalNormals)
+			{
+				VERTEX_TYPE *vn = *it3;
+
+				#if !defined(OPTIMIZE_INTERSECTIONS_MANAGEMENT) && !defined(AVOID_NORMALS_MATRICES)
+				if (v.dir == X_DIR)
+					normalsMatrixAlongX->set(v.ix,v.iy,v.iz,ind);
+				else if (v.dir == Y_DIR)
+					normalsMatrixAlongY->set(v.ix,v.iy,v.iz,ind);
+				else
+					normalsMatrixAlongZ->set(v.ix,v.iy,v.iz,ind);
+				#endif
+
+				#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+				normalsList.push_back(vn);
+				#else
+				normalsList.push_back(vn[0]);
+				normalsList.push_back(vn[1]);
+				normalsList.push_back(vn[2]);
+				#endif
+
+				it3++;
+			}
+		}
+
+		#if defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+		verticesBuffers[j].clear();
+		#endif
+		localVert[j]->clear();
+		delete localVert[j];
+
+		if (computeNormals && providesAnalyticalNormals)
+		{
+			#if defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+			normalsBuffers[j].clear();
+			#endif
+			localNormals[j]->clear();
+			delete localNormals[j];
+		}
+	}
+
+	// cout << endl << "duplicated "<<dup;
+	cout << "ok!";
+	cout.flush();
+
+	cout << endl << INFO << "MC added "<< addedVertices << " non analytical vertices";
+	/*
+	int orphans2 = 0;
+	int orphans1 = 0;
+
+	// search for orphan cubes
+	for (int iz=0; iz<NZ; iz++)
+		for (int iy=0; iy<NY; iy++)
+			for (int ix=0; ix<NX; ix++)
+			{
+				int count = 0;
+
+				#if !defined(OPTIMIZE_INTERSECTIONS_MANAGEMENT)
+				if (intersectionsMatrixAlongX->at(ix,iy,iz) != -1) count++;
+				if (intersectionsMatrixAlongY->at(ix+1,iy,iz) != -1) count++;
+				if (intersectionsMatrixAlongX->at(ix,iy+1,iz) != -1) count++;
+				if (intersectionsMatrixAlongY->at(ix,iy,iz) != -1) count++;
+				if (intersectionsMatrixAlongX->at(ix,iy,iz+1) != -1) count++;
+				if (intersectionsMatrixAlongY->at(ix+1,iy,iz+1) != -1) count++;
+				if (intersectionsMatrixAlongX->at(ix,iy+1,iz+1) != -1) count++;
+				if (intersectionsMatrixAlongY->at(ix,iy,iz+1) != -1) count++;
+				if (intersectionsMatrixAlongZ->at(ix,iy,iz) != -1) count++;
+				if (intersectionsMatrixAlongZ->at(ix+1,iy,iz) != -1) count++;
+				if (intersectionsMatrixAlongZ->at(ix+1,iy+1,iz) != -1) count++;
+				if (intersectionsMatrixAlongZ->at(ix,iy+1,iz) != -1) count++;
+				#else
+				if (readBilevelGrid<int>(bilevel_intersectionsMatrixAlongX,-1,ix,iy,iz,NX,NY,NZ) != -1) count++;
+				if (readBilevelGrid<int>(bilevel_intersectionsMatrixAlongY,-1,ix+1,iy,iz,NX,NY,NZ) != -1) count++;
+				if (readBilevelGrid<int>(bilevel_intersectionsMatrixAlongX,-1,ix,iy+1,iz,NX,NY,NZ) != -1) count++;
+				if (readBilevelGrid<int>(bilevel_intersectionsMatrixAlongY,-1,ix,iy,i,NX,NY,NZz) != -1) count++;
+				if (readBilevelGrid<int>(bilevel_intersectionsMatrixAlongX,-1,ix,iy,iz+1,NX,NY,NZ) != -1) count++;
+				if (readBilevelGrid<int>(bilevel_intersectionsMatrixAlongY,-1,ix+1,iy,iz+1,NX,NY,NZ) != -1) count++;
+				if (readBilevelGrid<int>(bilevel_intersectionsMatrixAlongX,-1,ix,iy+1,iz+1,NX,NY,NZ) != -1) count++;
+				if (readBilevelGrid<int>(bilevel_intersectionsMatrixAlongY,-1,ix,iy,iz+1,NX,NY,NZ) != -1) count++;
+				if (readBilevelGrid<int>(bilevel_intersectionsMatrixAlongZ,-1,ix,iy,iz,NX,NY,NZ) != -1) count++;
+				if (readBilevelGrid<int>(bilevel_intersectionsMatrixAlongZ,-1,ix+1,iy,iz,NX,NY,NZ) != -1) count++;
+				if (readBilevelGrid<int>(bilevel_intersectionsMatrixAlongZ,-1,ix+1,iy+1,iz,NX,NY,NZ) != -1) count++;
+				if (readBilevelGrid<int>(bilevel_intersectionsMatrixAlongZ,-1,ix,iy+1,iz,NX,NY,NZ) != -1) count++;
+				#endif
+
+				if (count == 2)
+					orphans2++;
+
+				if (count == 1)
+					orphans1++;
+			}
+
+	cout << endl << "orphans1 " << orphans1;
+	cout << endl << "orphans2 " << orphans2;
+	*/
+
+	// dual contouring replaces the MC vertices with one vertex per active cube,
+	// placed by using the analytical intersections and normals as hermite data
+	bool dualContour = dualContouring && accurateTriangulation && !isAvailableScalarField;
+
+	if (dualContour)
+		buildDualContouringVertices();
+
+	////////////////////////////// generate triangles /////////////////////////
+	// all vertices are computed, stored and uniquely indexed, now get triangles
+
+	#if !defined(OPTIMIZE_VERTICES_ADDITION)
+	for (int j=0; j<num_threads; j++)
+	{
+		// only octrees version;
+		// voxels with Z coordinates equal to 0 and NZ-1 are skipped
+		#ifdef ENABLE_BOOST_THREADS
+		if (dualContour)
+			thdGroup.create_thread(boost::bind(&Surface::dualContouringKernel,this,j+1,NZ-1,num_threads,localTri[j],&area[j]));
+		else
+			thdGroup.create_thread(boost::bind(&Surface::triangulationKernel,this,isolevel,revert,j+1,NZ-1,num_threads,localTri[j],&area[j]));
+		#else
+		if (dualContour)
+			dualContouringKernel(1,NZ-1,1,localTri[0],&area[0]);
+		else
+			triangulationKernel(isolevel,revert,1,NZ-1,1,localTri[0],&area[0]);
+		#endif
+	}
+	#else
+	if (dualContour)
+		dualContouringKernel(1,NZ-1,1,localTri[0],&area[0]);
+	else
+		triangulationKernel(isolevel,revert,1,NZ-1,1,localTri[0],&area[0]);
+	#endif
+
+	/*
+	// The following was designed so as to use the cache-aware version of triangulationKernel(...);
+	// see the versions of triangulationKernel(...)
+	fine_grid_size = 4;
+	jump = num_threads * fine_grid_size;
+
+	for (int j=0; j<num_threads; j++)
+	{
+		// voxels with Z coordinates equal to 0 and NZ-1 are skipped
+
+		int start = j*fine_grid_size;
+
+		// voxels with Z coordinates equal to 0 and NZ-1 are skipped
+		#ifdef ENABLE_BOOST_THREADS
+		thdGroup.create_thread(boost::bind(&Surface::triangulationKernel,this,isolevel,revert,start,NZ-1,jump,localTri[j],&area[j]));
+		#else
+		triangulationKernel(isolevel,revert,start,NZ-1,jump,localTri[0],&area[0]);
+		#endif
+	}
+	// deleteVector<unsigned int>(compressed_activeMacroCubes);
+	*/
+
+	#ifdef ENABLE_BOOST_THREADS
+	// join; final part of the computation of the volume within the surface
+	thdGroup.join_all();
+	#endif
+
+	if (dualContour)
+		disposeDualContouringVertices();
+
+	// deleteMatrix3D<bool>(delphi->nx,delphi->ny,delphi->nz,activeCubes);
+	#if !defined(USE_COMPRESSED_GRIDS)
+	if (!optimizeGrids)
+		deleteVector<bool>(activeCubes);
+	else
+	#endif
+	{
+		if (compressed_activeCubes != NULL)
+			deleteVector<unsigned int>(compressed_activeCubes);
+	}
+
+	double surf_area = 0;
+
+	int total_num_triangle_data = 0;
+
+	for (int j=0; j<num_threads; j++)
+	{
+		total_num_triangle_data += localTri[j]->size();
+	}
+	triList.reserve(total_num_triangle_data);
+
+	#ifdef ENABLE_BOOST_THREADS
+
+	// Reduction copies
+	for (int j=0; j<num_threads; j++)
+	{
+		surf_area += area[j];
+
+		vector<int> *lt = localTri[j];
+
+		for (vector<int>::iterator it = lt->begin(); it != lt->end(); it++)
+		{
+			triList.push_back(*it);
+		}
+		delete localTri[j];
+	}
+	#else
+	surf_area = area[0];
+
+	vector<int> *lt = localTri[0];
+
+	// Copies
+	for (vector<int>::iterator it = lt->begin(); it != lt->end(); it++)
+	{
+		triList.push_back(*it);
+	}
+	delete localTri[0];
+	#endif
+
+	localTri.clear();
+	localVert.clear();
+	localNormals.clear();
+
+	deleteVector<VERTEX_TYPE>(area);
+
+	auto chrono_end = chrono::high_resolution_clock::now();
+
+	chrono::duration<double> MC_time = chrono_end - chrono_start;
+	cout << endl << INFO << "MC time is ";
+	printf ("%.4e [s]", MC_time.count());
+
+	#if !defined(AVOID_MEM_CHECKS)
+	if (!conf.parallelPocketLoop)
+	{
+		double current_mem_in_MB, peak_mem_in_MB;
+		getMemSpace (current_mem_in_MB, peak_mem_in_MB);
+		cout << endl << INFO << "Memory required after MC is " << current_mem_in_MB << " MB";
+	}
+	#endif
+	cout << endl << INFO << "Total, grid conformant, surface area is " << setprecision(10) << surf_area << " [A^2]";
+
+
+	#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+	int numVertices = (int)vertList.size();
+	#else
+	int numVertices = (int)(vertList.size() / 3.);
+	#endif
+	int numTriangles = (int)(triList.size() / 3.);
+
+	// DEBUG
+	/*
+	int dang = 0;
+	for (int jj=0; jj<numVertices; jj++)
+	{
+		bool found = false;
+		for (int tt=0; tt<numTriangles; tt++)
+		{
+			if (triList[ tt*3+0 ] == jj || triList[ tt*3+1 ] == jj || triList[ tt*3+2 ] == jj)
+			{
+				found = true;
+				break;
+			}
+		}
+
+		if (!found)
+			dang++;
+	}
+
+	cout << endl << "dangling " << dang;
+	*/
+
+	cout << endl << INFO << "Number of vertices " << numVertices << " number of triangles " << numTriangles;
+
+	if (meshDecimation && numTriangles > 0)
+	{
+		// the area of the saved mesh is returned
+		decimateMesh(decimationTargetTriangles, decimationMaxError, &surf_area);
+
+		#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+		numVertices = (int)vertList.size();
+		#else
+		numVertices = (int)(vertList.size() / 3.);
+		#endif
+		numTriangles = (int)(triList.size() / 3.);
+	}
+
+	// check atoms flag
+	if (buildAtomsMapHere && vertexAtomsMapFlag)
+	{
+		auto chrono_start = chrono::high_resolution_clock::now();
+
+		if (vertexAtomsMap != NULL)
+			deleteVector<int>(vertexAtomsMap);
+
+		vertexAtomsMap = allocateVector<int>(numVertices);
+
+		cout << endl << INFO << "Connecting vertices to atoms...";
+		cout.flush();
+
+		mapVerticesToAtoms(numVertices);
+
+		for (int i=0; i<numVertices; i++)
+		{
+			if (vertexAtomsMap[i] == -1)
+			{
+				cout << endl << WARN << "Cannot detect nearest atom for vertex " << i;
+			}
+		}
+		cout << "ok!";
+		cout.flush();
+
+		chrono_end = chrono::high_resolution_clock::now();
+		chrono::duration<double> other_time = chrono_end - chrono_start;
+		cout << endl << INFO << "Vertex atom mapping time is ";
+		printf ("%.4e [s]", other_time.count());
+
+		#if !defined(AVOID_MEM_CHECKS)
+		if (!conf.parallelPocketLoop)
+		{
+			double current_mem_in_MB, peak_mem_in_MB;
+			getMemSpace (current_mem_in_MB, peak_mem_in_MB);
+			cout << endl << INFO << "Memory required after vertex atom mapping is " << current_mem_in_MB << " MB";
+		}
+		#endif
+	}
+
+	// Some more deallocations before the below triList.reserve()
+	deleteIntersectionsMatrices();
+	#if !defined(OPTIMIZE_INTERSECTIONS_MANAGEMENT) && !defined(AVOID_NORMALS_MATRICES)
+	deleteNormalsMatrices();
+	#endif
+
+	chrono_start = chrono::high_resolution_clock::now();
+
+	vector<int> appNormals;
+
+	appNormals.reserve(1000);
+
+	// check if it has to approximate normals or they are already available
+	if (computeNormals && providesAnalyticalNormals)
+	{
+		// search for normals to be approximated
+		if (normalsList.size() != 0)
+		{
+			int ind = 0;
+
+			#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+			for (vector<VERTEX_TYPE*>::iterator it = normalsList.begin(); it != normalsList.end(); it++)
+			{
+				VERTEX_TYPE *p = *it;
+				if (p[0] == 0 && p[1] == 0 && p[2] == 0)
+					appNormals.push_back(ind);
+				++ind;
+			}
+			#else
+			for (vector<VERTEX_TYPE>::iterator it = normalsList.begin(); it != normalsList.end(); it += 3)
+			{
+				VERTEX_TYPE *p = &(*it);
+				if (p[0] == 0 && p[1] == 0 && p[2] == 0)
+					appNormals.push_back(ind);
+				++ind;
+			}
+			#endif
+		}
+	}
+
+	if (computeNormals && providesAnalyticalNormals)
+	{
+		// cout << endl << appNormals.size();
+		if (appNormals.size() != 0)
+		{
+			cout << endl << INFO << "Some analytical normals will be approximated...";
+			approximateNormals(appNormals, true);
+		}
+	}
+	else if (computeNormals && !providesAnalyticalNormals)
+	{
+		cout << endl << INFO << "Approximating vertices normals by triangulation...";
+		approximateNormals(appNormals, false);
+	}
+
+	chrono_end = chrono::high_resolution_clock::now();
+	chrono::duration<double> other_time = chrono_end - chrono_start;
+	cout << endl << INFO << "Normals' approximations time is ";
+	printf ("%.4e [s]", other_time.count());
+
+	#if !defined(AVOID_MEM_CHECKS)
+	if (!conf.parallelPocketLoop)
+	{
+		double current_mem_in_MB, peak_mem_in_MB;
+		getMemSpace (current_mem_in_MB, peak_mem_in_MB);
+		cout << endl << INFO << "Memory required after normals' approximations is " << current_mem_in_MB << " MB";
+	}
+	#endif
+
+	#if !defined(AVOID_SAVING_MESH)
+	if (outputMesh)
+	{
+		chrono_start = chrono::high_resolution_clock::now();
+
+		int format = deduceFormat();
+		bool f = saveMesh(format, revert, fileName, vertList, triList, normalsList);
+
+		if (!f)
+		{
+			cout << endl << ERR << "Errors in saving the mesh!";
+		}
+		else
+		{
+			auto chrono_end = chrono::high_resolution_clock::now();
+			chrono::duration<double> saveMesh_time = chrono_end - chrono_start;
+			cout << endl << INFO << "Outputting mesh time (in triangulateSurface()) ";
+			printf ("%.4e [s]", saveMesh_time.count());
+		}
+
+		if (meshLODLevels > 1)
+			saveMeshLOD(meshLODLevels, revert, fileName);
+
+		/*
+		// Code usable for outputting mesh data in binary format
+
+		chrono_start = chrono::high_resolution_clock::now();
+
+		f = saveMeshBinary(format, revert, fileName, vertList, triList, normalsList);
+
+		if (!f)
+		{
+			cout << endl << ERR << "Errors in saving the mesh in binary format!";
+		}
+		else
+		{
+			auto chrono_end = chrono::high_resolution_clock::now();
+			chrono::duration<double> saveMesh_time = chrono_end - chrono_start;
+			cout << endl << INFO << "Outputting mesh time in binary format (in triangulateSurface()) ";
+			printf ("%.4e [s]", saveMesh_time.count());
+		}
+		*/
+	}
+	#endif
+
+	return surf_area;
+}
+
+
+void Surface::updateVertexTrianglesLists (int **vertexTrianglesList, double **planes, unsigned int vertex_flag[], bool doOnlyList)
+{
+	#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+	int nv = (int)vertList.size();
+	#else
+	int nv = (int)(vertList.size() / 3.);
+	#endif
+	int nt = (int)(triList.size() / 3.);
+
+	if (!doOnlyList)
+	{
+		double w[4], *p1, *p2, *p3;
+
+		for (int i=0; i<nt; i++)
+		{
+			int v1 = triList[ i*3+0 ];
+			int v2 = triList[ i*3+1 ];
+			int v3 = triList[ i*3+2 ];
+
+			#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+			p1 = vertList[v1];
+			p2 = vertList[v2];
+			p3 = vertList[v3];
+			#else
+			p1 = &vertList[v1*3];
+			p2 = &vertList[v2*3];
+			p3 = &vertList[v3*3];
+			#endif
+
+			vertexTrianglesList[v1][ ++vertexTrianglesList[v1][0] ] = i;
+			vertexTrianglesList[v2][ ++vertexTrianglesList[v2][0] ] = i;
+			vertexTrianglesList[v3][ ++vertexTrianglesList[v3][0] ] = i;
+
+			// compute plane normal from triangles
+			plane3points(p1,p2,p3,w,false);
+			planes[i][0] = w[0];
+			planes[i][1] = w[1];
+			planes[i][2] = w[2];
+		}
+	}
+	else
+	{
+		for (int i=0; i<nt; i++)
+		{
+			int v1 = triList[ i*3+0 ];
+			int v2 = triList[ i*3+1 ];
+			int v3 = triList[ i*3+2 ];
+
+			// read the proper bit
+			if (read32xCompressedVector (vertex_flag, v1, nv))
+				vertexTrianglesList[v1][ ++vertexTrianglesList[v1][0] ] = i;
+
+			if (read32xCompressedVector (vertex_flag, v2, nv))
+				vertexTrianglesList[v2][ ++vertexTrianglesList[v2][0] ] = i;
+
+			if (read32xCompressedVector (vertex_flag, v3, nv))
+				vertexTrianglesList[v3][ ++vertexTrianglesList[v3][0] ] = i;
+		}
+	}
+}
+
+
+void Surface::approximateNormals(vector<int> &appNormals, bool doOnlyList)
+{
+	#define MAX_NEIGHBOURS 20
+
+	#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+	int nv = (int)vertList.size();
+	#else
+	int nv = (int)(vertList.size() / 3.);
+	#endif
+	int nt = (int)(triList.size() / 3.);
+
+	// MC gives at most MAX_NEIGHBOURS triangles per vertex, a decimated mesh can give more
+	int maxNeighbours = MAX_NEIGHBOURS;
+
+	if (meshDecimation)
+	{
+		int *valence = allocateVector<int>(MAX(nv,1));
+
+		for (int i=0; i<nv; i++)
+			valence[i] = 0;
+		for (int i=0; i<nt*3; i++)
+			valence[ triList[i] ]++;
+		for (int i=0; i<nv; i++)
+			maxNeighbours = MAX(maxNeighbours, valence[i]);
+
+		deleteVector<int>(valence);
+	}
+
+	if (!doOnlyList)
+	{
+		// the most optimised version resides in the other IF body
+		int **vertexTrianglesList = allocateVector<int*>(nv);
+
+		for (int i=0; i<nv; i++)
+		{
+			vertexTrianglesList[i] = allocateVector<int>(maxNeighbours + 1);
+
+			// use the first element to update/read length
+			vertexTrianglesList[i][0] = 0;
+		}
+
+		double **planes = allocateMatrix2D<double>(nt,3);
+
+		unsigned int *vertex_flag;
+
+		updateVertexTrianglesLists (vertexTrianglesList, planes, vertex_flag, doOnlyList);
+
+		for (int iv=0; iv<nv; iv++)
+		{
+			VERTEX_TYPE norm;
+
+			#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+			normalsBuffers[0].push_back(0.);
+			normalsBuffers[0].push_back(0.);
+			normalsBuffers[0].push_back(0.);
+
+			VERTEX_TYPE *meanNormal = &normalsBuffers[0][ normalsBuffers[0].size()-3 ];
+
+			normalsList.push_back(meanNormal);
+			#else
+			VERTEX_TYPE meanNormal[3];
+			#endif
+
+			for (int j=0; j < vertexTrianglesList[iv][0]; j++)
+			{
+				int triangleID = vertexTrianglesList[iv][ j+1 ];
+				ADD(meanNormal,meanNormal,planes[triangleID]);
+			}
+			NORMALIZE(meanNormal,norm);
+
+			#if defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+			normalsList.push_back(meanNormal[0]);
+			normalsList.push_back(meanNormal[1]);
+			normalsList.push_back(meanNormal[2]);
+			#endif
+		}
+
+		for (int i = 0; i < nv; i++)
+			deleteVector<int>(vertexTrianglesList[i]);
+		deleteVector<int*>(vertexTrianglesList);
+
+		deleteMatrix2D<double>(nt,3,planes);
+	}
+	else
+	{
+		if (appNormals.size() == 0)
+			return;
+
+		// Most optimised version with vertex flagging and memory-saving techniques:
+		// Many vertexTrianglesList[*] are not allocated and vertex_flag[] is compressed
+		int **vertexTrianglesList = allocateVector<int*>(nv);
+
+		// compressed mask buffer in which each unsigned int stores 32 flags
+		unsigned int *vertex_flag = allocate32xCompressedVector(0, nv);
+
+		for (vector<int>::iterator it = appNormals.begin(); it != appNormals.end(); it++)
+		{
+			unsigned int iv = (*it);
+
+			// switch on the proper bit
+			write32xCompressedVector(vertex_flag, 1, iv, nv);
+
+			vertexTrianglesList[iv] = allocateVector<int>(maxNeighbours + 1);
+
+			// use the first element to update/read length
+			vertexTrianglesList[iv][0] = 0;
+		}
+
+		double **planes;
+
+		updateVertexTrianglesLists(vertexTrianglesList, planes, vertex_flag, doOnlyList);
+
+
+		double w[4], *p1, *p2, *p3;
+
+		for (vector<int>::iterator it = appNormals.begin(); it != appNormals.end(); it++)
+		{
+			unsigned int iv = (*it);
+
+			VERTEX_TYPE norm;
+
+			#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+			VERTEX_TYPE *meanNormal = normalsList[iv];
+			#else
+			VERTEX_TYPE meanNormal[3];
+			#endif
+			meanNormal[0] = 0;
+			meanNormal[1] = 0;
+			meanNormal[2] = 0;
+
+			for (int j=0; j < vertexTrianglesList[iv][0]; j++)
+			{
+				int triangleID = vertexTrianglesList[iv][ j+1 ];
+
+				#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+				p1 = vertList[ triList[triangleID*3+0] ];
+				p2 = vertList[ triList[triangleID*3+1] ];
+				p3 = vertList[ triList[triangleID*3+2] ];
+				#else
+				p1 = &vertList[ triList[triangleID*3+0]*3 ];
+				p2 = &vertList[ triList[triangleID*3+1]*3 ];
+				p3 = &vertList[ triList[triangleID*3+2]*3 ];
+				#endif
+
+				// compute plane normal from triangles;
+				// some normals are recalculated, but we avoid pre-calculating
+				// and storing them in an nt*(3 doubles)-sized buffer
+				plane3points(p1,p2,p3,w,false);
+				ADD(meanNormal,meanNormal,w);
+			}
+			NORMALIZE(meanNormal,norm);
+
+			#if defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+			normalsList[ iv*3+0 ] = meanNormal[0];
+			normalsList[ iv*3+1 ] = meanNormal[1];
+			normalsList[ iv*3+2 ] = meanNormal[2];
+			#endif
+
+			deleteVector<int>(vertexTrianglesList[iv]);
+		}
+		deleteVector<int*>(vertexTrianglesList);
+
+		deleteVector<unsigned int>(vertex_flag);
+	}
+}
+
+
+/** entry of the edge collapse priority queue of the decimation; the smallest cost is on top */
+class collapseCandidate
+{
+public:
+	double cost;
+	double pos[3];
+	int from, to;
+	int fromStamp, toStamp;
+
+	bool operator < (const collapseCandidate &c) const
+	{
+		return cost > c.cost;
+	}
+};
+
+
+/** error of the quadric q (a00,a01,a02,a03,a11,a12,a13,a22,a23,a33) evaluated at v */
+static inline double evalQuadric(const double *q, const double *v)
+{
+	return q[0]*v[0]*v[0] + 2*q[1]*v[0]*v[1] + 2*q[2]*v[0]*v[2] + 2*q[3]*v[0] +
+		   q[4]*v[1]*v[1] + 2*q[5]*v[1]*v[2] + 2*q[6]*v[1] +
+		   q[7]*v[2]*v[2] + 2*q[8]*v[2] + q[9];
+}
+
+
+void Surface::decimationKernel(int slab, DecimationData *dd)
+{
+	double *V = dd->vertices;
+	int *T = dd->triangles;
+	bool *locked = dd->lockedVertex;
+
+	int first = dd->slabTrianglesStart[slab];
+	int last = dd->slabTrianglesStart[slab+1];
+
+	dd->removedTriangles[slab] = 0;
+
+	if (first == last || dd->budget[slab] == 0)
+		return;
+
+	// slab local vertex indexing
+	map<int,int> g2l;
+	vector<int> l2g;
+	vector<vector<int>> vertexTriangles;
+
+	for (int it=first; it<last; it++)
+	{
+		int t = dd->slabTriangles[it];
+
+		for (int k=0; k<3; k++)
+		{
+			int g = T[ t*3+k ];
+			map<int,int>::iterator mi = g2l.find(g);
+
+			if (mi == g2l.end())
+			{
+				g2l.insert(pair<int,int>(g, (int)l2g.size()));
+				l2g.push_back(g);
+				vertexTriangles.push_back(vector<int>());
+				vertexTriangles.back().push_back(t);
+			}
+			else
+				vertexTriangles[mi->second].push_back(t);
+		}
+	}
+
+	int nl = (int)l2g.size();
+
+	// edges which do not have exactly two incident triangles are boundary or
+	// non manifold edges: their vertices cannot move
+	vector<int64_t> edges;
+	edges.reserve((last-first)*3);
+
+	for (int it=first; it<last; it++)
+	{
+		int t = dd->slabTriangles[it];
+
+		for (int k=0; k<3; k++)
+		{
+			int64_t a = T[ t*3+k ];
+			int64_t b = T[ t*3+(k+1)%3 ];
+
+			if (a > b)
+				swap(a,b);
+			edges.push_back(a*dd->nv + b);
+		}
+	}
+	sort(edges.begin(), edges.end());
+
+	vector<int64_t> uniqueEdges;
+	uniqueEdges.reserve(edges.size()/2+1);
+
+	for (size_t i=0; i<edges.size(); )
+	{
+		size_t j = i;
+		while (j < edges.size() && edges[j] == edges[i])
+			j++;
+
+		int a = (int)(edges[i] / dd->nv);
+		int b = (int)(edges[i] % dd->nv);
+
+		// vertices of this slab only, the others are already locked
+		if (j-i != 2)
+		{
+			locked[a] = true;
+			locked[b] = true;
+		}
+		uniqueEdges.push_back(edges[i]);
+		i = j;
+	}
+	edges.clear();
+
+	// area weighted plane quadrics
+	vector<double> Q(nl*10, 0.);
+	vector<double> Qarea(nl, 0.);
+
+	for (int it=first; it<last; it++)
+	{
+		int t = dd->slabTriangles[it];
+		double *p0 = &V[ T[t*3+0]*3 ];
+		double *p1 = &V[ T[t*3+1]*3 ];
+		double *p2 = &V[ T[t*3+2]*3 ];
+
+		double e1[3], e2[3], n[3], len;
+		SUB(e1,p1,p0);
+		SUB(e2,p2,p0);
+		CROSS(n,e1,e2);
+		len = sqrt(DOT(n,n));
+
+		if (len < 1e-20)
+			continue;
+
+		double area = 0.5*len;
+		n[0] /= len;
+		n[1] /= len;
+		n[2] /= len;
+		double d = -DOT(n,p0);
+
+		double q[10] = {n[0]*n[0], n[0]*n[1], n[0]*n[2], n[0]*d,
+						n[1]*n[1], n[1]*n[2], n[1]*d,
+						n[2]*n[2], n[2]*d, d*d};
+
+		for (int k=0; k<3; k++)
+		{
+			int l = g2l[ T[t*3+k] ];
+			for (int h=0; h<10; h++)
+				Q[ l*10+h ] += area*q[h];
+			Qarea[l] += area;
+		}
+	}
+
+	vector<int> stamp(nl, 0);
+	vector<bool> removed(nl, false);
+
+	priority_queue<collapseCandidate> heap;
+
+	// evaluate the collapse of the edge (la,lb) and push it in the heap
+	auto pushCandidate = [&](int la, int lb)
+	{
+		int ga = l2g[la];
+		int gb = l2g[lb];
+
+		if (locked[ga] && locked[gb])
+			return;
+
+		collapseCandidate c;
+		double q[10];
+
+		for (int h=0; h<10; h++)
+			q[h] = Q[ la*10+h ] + Q[ lb*10+h ];
+
+		double weight = Qarea[la] + Qarea[lb];
+		if (weight <= 0.)
+			weight = 1.;
+
+		if (locked[ga])
+		{
+			c.from = lb;
+			c.to = la;
+			ASSIGN(c.pos, (&V[ga*3]));
+		}
+		else if (locked[gb])
+		{
+			c.from = la;
+			c.to = lb;
+			ASSIGN(c.pos, (&V[gb*3]));
+		}
+		else
+		{
+			c.from = la;
+			c.to = lb;
+
+			double *pa = &V[ga*3];
+			double *pb = &V[gb*3];
+			double mid[3], A[3][3], Ainv[3][3], det;
+			MID(mid,pa,pb);
+
+			A[0][0] = q[0]; A[0][1] = q[1]; A[0][2] = q[2];
+			A[1][0] = q[1]; A[1][1] = q[4]; A[1][2] = q[5];
+			A[2][0] = q[2]; A[2][1] = q[5]; A[2][2] = q[7];
+
+			DETERMINANT_3X3(det,A);
+
+			bool optimal = false;
+			double scale = q[0]+q[4]+q[7];
+
+			if (fabs(det) > 1e-10*scale*scale*scale)
+			{
+				INVERT_3X3(Ainv,det,A);
+
+				double v[3], l2, d2;
+				v[0] = -(Ainv[0][0]*q[3] + Ainv[0][1]*q[6] + Ainv[0][2]*q[8]);
+				v[1] = -(Ainv[1][0]*q[3] + Ainv[1][1]*q[6] + Ainv[1][2]*q[8]);
+				v[2] = -(Ainv[2][0]*q[3] + Ainv[2][1]*q[6] + Ainv[2][2]*q[8]);
+
+				// the optimal point must stay close to the edge
+				DIST2(l2,pa,pb);
+				DIST2(d2,v,mid);
+
+				if (d2 <= l2)
+				{
+					ASSIGN(c.pos,v);
+					optimal = true;
+				}
+			}
+
+			if (!optimal)
+			{
+				double ea = evalQuadric(q,pa);
+				double eb = evalQuadric(q,pb);
+				double em = evalQuadric(q,mid);
+
+				if (ea <= eb && ea <= em)
+				{
+					// keep the position of a, so b is the one removed
+					c.from = lb;
+					c.to = la;
+					ASSIGN(c.pos,pa);
+				}
+				else if (eb <= em)
+				{
+					ASSIGN(c.pos,pb);
+				}
+				else
+				{
+					ASSIGN(c.pos,mid);
+				}
+			}
+		}
+
+		c.cost = MAX(0.,evalQuadric(q,c.pos)) / weight;
+
+		if (dd->maxError2 >= 0 && c.cost > dd->maxError2)
+			return;
+
+		c.fromStamp = stamp[c.from];
+		c.toStamp = stamp[c.to];
+		heap.push(c);
+	};
+
+	for (size_t i=0; i<uniqueEdges.size(); i++)
+	{
+		int a = (int)(uniqueEdges[i] / dd->nv);
+		int b = (int)(uniqueEdges[i] % dd->nv);
+		pushCandidate(g2l[a], g2l[b]);
+	}
+	uniqueEdges.clear();
+
+	vector<int> ringFrom, ringTo;
+
+	// collect the (global) one-ring of a vertex: a locked vertex has triangles
+	// across slabs too, which are frozen for the whole pass
+	auto getRing = [&](int l, vector<int> &ring)
+	{
+		ring.clear();
+		int g = l2g[l];
+
+		for (size_t i=0; i<vertexTriangles[l].size(); i++)
+		{
+			int t = vertexTriangles[l][i];
+			for (int k=0; k<3; k++)
+				if (T[ t*3+k ] != g)
+					ring.push_back(T[ t*3+k ]);
+		}
+		for (int i=dd->frozenTrianglesStart[g]; i<dd->frozenTrianglesStart[g+1]; i++)
+		{
+			int t = dd->frozenTriangles[i];
+			for (int k=0; k<3; k++)
+				if (T[ t*3+k ] != g)
+					ring.push_back(T[ t*3+k ]);
+		}
+		sort(ring.begin(), ring.end());
+		ring.erase(unique(ring.begin(), ring.end()), ring.end());
+	};
+
+	int removedTriangles = 0;
+	int budget = dd->budget[slab];
+
+	while (!heap.empty())
+	{
+		if (budget >= 0 && removedTriangles >= budget)
+			break;
+
+		collapseCandidate c = heap.top();
+		heap.pop();
+
+		if (removed[c.from] || removed[c.to] || stamp[c.from] != c.fromStamp || stamp[c.to] != c.toStamp)
+			continue;
+
+		int gf = l2g[c.from];
+		int gt = l2g[c.to];
+
+		// link condition: the common neighbours must be the apexes of the collapsing triangles
+		getRing(c.from, ringFrom);
+		getRing(c.to, ringTo);
+
+		int common = 0;
+		for (size_t i=0, j=0; i<ringFrom.size() && j<ringTo.size(); )
+		{
+			if (ringFrom[i] < ringTo[j])
+				i++;
+			else if (ringFrom[i] > ringTo[j])
+				j++;
+			else
+			{
+				common++;
+				i++;
+				j++;
+			}
+		}
+
+		int shared = 0;
+		for (size_t i=0; i<vertexTriangles[c.from].size(); i++)
+		{
+			int t = vertexTriangles[c.from][i];
+			if (T[ t*3+0 ] == gt || T[ t*3+1 ] == gt || T[ t*3+2 ] == gt)
+				shared++;
+		}
+
+		if (shared != 2 || common != 2 || ringFrom.size() <= 3 || ringTo.size() <= 3)
+			continue;
+
+		// reject collapses which flip or degenerate the surviving triangles
+		bool flip = false;
+
+		for (int side=0; side<2 && !flip; side++)
+		{
+			int l = (side == 0) ? c.from : c.to;
+			int g = l2g[l];
+
+			for (size_t i=0; i<vertexTriangles[l].size(); i++)
+			{
+				int t = vertexTriangles[l][i];
+
+				if (side == 0 && (T[ t*3+0 ] == gt || T[ t*3+1 ] == gt || T[ t*3+2 ] == gt))
+					continue;
+				if (side == 1 && (T[ t*3+0 ] == gf || T[ t*3+1 ] == gf || T[ t*3+2 ] == gf))
+					continue;
+
+				double p[3][3], q[3][3];
+
+				for (int k=0; k<3; k++)
+				{
+					ASSIGN(p[k], (&V[ T[t*3+k]*3 ]));
+					if (T[ t*3+k ] == g)
+					{
+						ASSIGN(q[k], c.pos);
+					}
+					else
+					{
+						ASSIGN(q[k], p[k]);
+					}
+				}
+
+				double e1[3], e2[3], n0[3], n1[3];
+				SUB(e1,p[1],p[0]);
+				SUB(e2,p[2],p[0]);
+				CROSS(n0,e1,e2);
+				SUB(e1,q[1],q[0]);
+				SUB(e2,q[2],q[0]);
+				CROSS(n1,e1,e2);
+
+				double l0 = sqrt(DOT(n0,n0));
+				double l1 = sqrt(DOT(n1,n1));
+
+				if (l1 < 1e-12 || DOT(n0,n1) < 0.2*l0*l1)
+				{
+					flip = true;
+					break;
+				}
+			}
+		}
+
+		if (flip)
+			continue;
+
+		// collapse from -> to
+		vector<int> &fromTriangles = vertexTriangles[c.from];
+		vector<int> &toTriangles = vertexTriangles[c.to];
+
+		for (size_t i=0; i<fromTriangles.size(); i++)
+		{
+			int t = fromTriangles[i];
+
+			if (T[ t*3+0 ] == gt || T[ t*3+1 ] == gt || T[ t*3+2 ] == gt)
+			{
+				// dead triangle: remove it from the lists of its other vertices
+				for (int k=0; k<3; k++)
+				{
+					int g = T[ t*3+k ];
+					if (g == gf)
+						continue;
+					vector<int> &vt = vertexTriangles[ g2l[g] ];
+					vt.erase(std::remove(vt.begin(), vt.end(), t), vt.end());
+				}
+				T[ t*3+0 ] = -1;
+				T[ t*3+1 ] = -1;
+				T[ t*3+2 ] = -1;
+				removedTriangles++;
+			}
+			else
+			{
+				for (int k=0; k<3; k++)
+					if (T[ t*3+k ] == gf)
+						T[ t*3+k ] = gt;
+				toTriangles.push_back(t);
+			}
+		}
+		fromTriangles.clear();
+
+		if (V[gt*3+0] != c.pos[0] || V[gt*3+1] != c.pos[1] || V[gt*3+2] != c.pos[2])
+			dd->movedVertex[gt] = true;
+
+		ASSIGN((&V[gt*3]), c.pos);
+
+		for (int h=0; h<10; h++)
+			Q[ c.to*10+h ] += Q[ c.from*10+h ];
+		Qarea[c.to] += Qarea[c.from];
+
+		removed[c.from] = true;
+		stamp[c.from]++;
+		stamp[c.to]++;
+
+		getRing(c.to, ringTo);
+
+		for (size_t i=0; i<ringTo.size(); i++)
+		{
+			map<int,int>::iterator mi = g2l.find(ringTo[i]);
+			if (mi != g2l.end())
+				pushCandidate(c.to, mi->second);
+		}
+	}
+
+	dd->removedTriangles[slab] = removedTriangles;
+}
+
+
+int Surface::decimateMesh(int target_triangles, double max_error, double *decimated_area)
+{
+	auto chrono_start = chrono::high_resolution_clock::now();
+
+	#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+	int nv = (int)vertList.size();
+	#else
+	int nv = (int)(vertList.size() / 3.);
+	#endif
+	int nt = (int)(triList.size() / 3.);
+
+	if (nt == 0)
+		return 0;
+
+	if (target_triangles <= 0 && max_error < 0)
+	{
+		cout << endl << WARN << "Mesh decimation needs a target number of triangles or an error bound; skipping it";
+		return 0;
+	}
+
+	if (target_triangles > 0 && target_triangles >= nt)
+		return 0;
+
+	bool hasNormals = (normalsList.size() != 0);
+
+	cout << endl << INFO << "Decimating mesh...";
+	cout.flush();
+
+	DecimationData dd;
+	dd.nv = nv;
+	dd.nt = nt;
+	dd.maxError2 = (max_error >= 0) ? max_error*max_error : -1.;
+	dd.vertices = allocateVector<double>(nv*3);
+	dd.triangles = &triList[0];
+	dd.lockedVertex = allocateVector<bool>(nv);
+	dd.movedVertex = allocateVector<bool>(nv);
+	dd.frozenTrianglesStart = allocateVector<int>(nv+1);
+
+	for (int i=0; i<nv; i++)
+	{
+		dd.movedVertex[i] = false;
+
+		#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+		dd.vertices[ i*3+0 ] = vertList[i][0];
+		dd.vertices[ i*3+1 ] = vertList[i][1];
+		dd.vertices[ i*3+2 ] = vertList[i][2];
+		#else
+		dd.vertices[ i*3+0 ] = vertList[ i*3+0 ];
+		dd.vertices[ i*3+1 ] = vertList[ i*3+1 ];
+		dd.vertices[ i*3+2 ] = vertList[ i*3+2 ];
+		#endif
+	}
+
+	int num_threads = conf.numThreads;
+	int num_slabs = MAX(1, num_threads);
 
-	deleteVector<VERTEX_TYPE>(area);
+	// few triangles per slab would lock most of the vertices
+	while (num_slabs > 1 && nt / num_slabs < 1000)
+		num_slabs--;
 
-	auto chrono_end = chrono::high_resolution_clock::now();
+	// slab boundaries are Z quantiles of the vertices, so that slabs are balanced
+	vector<double> sortedZ(nv);
+	for (int i=0; i<nv; i++)
+		sortedZ[i] = dd.vertices[ i*3+2 ];
+	sort(sortedZ.begin(), sortedZ.end());
 
-	chrono::duration<double> MC_time = chrono_end - chrono_start;
-	cout << endl << INFO << "MC time is ";
-	printf ("%.4e [s]", MC_time.count());
+	int totalBudget = (target_triangles > 0) ? (nt - target_triangles) : -1;
+	int totalRemoved = 0;
 
-	#if !defined(AVOID_MEM_CHECKS)
-	if (!conf.parallelPocketLoop)
+	int *vertexSlab = allocateVector<int>(nv);
+	int *triangleSlab = allocateVector<int>(nt);
+
+	// the second pass shifts the slab boundaries by half a slab: the vertices locked
+	// on the seams of the first pass are interior in the second one
+	for (int pass=0; pass<2; pass++)
 	{
-		double current_mem_in_MB, peak_mem_in_MB;
-		getMemSpace (current_mem_in_MB, peak_mem_in_MB);
-		cout << endl << INFO << "Memory required after MC is " << current_mem_in_MB << " MB";
-	}
-	#endif
-	cout << endl << INFO << "Total, grid conformant, surface area is " << setprecision(10) << surf_area << " [A^2]";
+		if (totalBudget >= 0 && totalRemoved >= totalBudget)
+			break;
 
+		if (pass == 1 && num_slabs == 1)
+			break;
 
-	#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
-	int numVertices = (int)vertList.size();
-	#else
-	int numVertices = (int)(vertList.size() / 3.);
-	#endif
-	int numTriangles = (int)(triList.size() / 3.);
+		vector<double> bounds;
+		double shift = (pass == 0) ? 0. : 0.5;
 
-	// DEBUG
-	/*
-	int dang = 0;
-	for (int jj=0; jj<numVertices; jj++)
-	{
-		bool found = false;
-		for (int tt=0; tt<numTriangles; tt++)
+		for (int s=1; s<num_slabs+pass; s++)
+			bounds.push_back(sortedZ[ MIN(nv-1, (int)((s-shift)*nv/num_slabs)) ]);
+
+		int slabs = (int)bounds.size()+1;
+
+		for (int i=0; i<nv; i++)
 		{
-			if (triList[ tt*3+0 ] == jj || triList[ tt*3+1 ] == jj || triList[ tt*3+2 ] == jj)
-			{
-				found = true;
-				break;
-			}
+			vertexSlab[i] = (int)(upper_bound(bounds.begin(), bounds.end(), dd.vertices[ i*3+2 ]) - bounds.begin());
+			dd.lockedVertex[i] = false;
 		}
 
-		if (!found)
-			dang++;
-	}
-
-	cout << endl << "dangling " << dang;
-	*/
+		dd.slabTrianglesStart = allocateVector<int>(slabs+1);
+		dd.budget = allocateVector<int>(slabs);
+		dd.removedTriangles = allocateVector<int>(slabs);
 
-	cout << endl << INFO << "Number of vertices " << numVertices << " number of triangles " << numTriangles;
+		for (int s=0; s<=slabs; s++)
+			dd.slabTrianglesStart[s] = 0;
 
-	// check atoms flag
-	if (buildAtomsMapHere && vertexAtomsMapFlag)
-	{
-		auto chrono_start = chrono::high_resolution_clock::now();
+		int liveTriangles = 0;
 
-		if (vertexAtomsMap != NULL)
-			deleteVector<int>(vertexAtomsMap);
+		// triangles across slabs are frozen and lock their vertices
+		for (int t=0; t<nt; t++)
+		{
+			triangleSlab[t] = -1;
 
-		vertexAtomsMap = allocateVector<int>(numVertices);
-		buildAtomsMap();
+			if (triList[ t*3 ] == -1)
+				continue;
 
-		cout << endl << INFO << "Connecting vertices to atoms...";
-		cout.flush();
+			liveTriangles++;
 
-		for (int i=0; i<numVertices; i++)
-		{
-			#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
-			#if !defined(FLOAT_VERTICES)
-			vdwAccessible(vertList[i], vertexAtomsMap[i]);
-			#else
-			double v[3];
-			v[0] = vertList[i][0];
-			v[1] = vertList[i][1];
-			v[2] = vertList[i][2];
-			vdwAccessible(v, vertexAtomsMap[i]);
-			#endif
-			#else
-			#if !defined(FLOAT_VERTICES)
-			vdwAccessible(&vertList[i*3], vertexAtomsMap[i]);
-			#else
-			double v[3];
-			v[0] = vertList[ i*3+0 ];
-			v[1] = vertList[ i*3+1 ];
-			v[2] = vertList[ i*3+2 ];
-			vdwAccessible(v, vertexAtomsMap[i]);
-			#endif
-			#endif
+			int s0 = vertexSlab[ triList[t*3+0] ];
+			int s1 = vertexSlab[ triList[t*3+1] ];
+			int s2 = vertexSlab[ triList[t*3+2] ];
 
-			if (vertexAtomsMap[i] == -1)
+			if (s0 == s1 && s1 == s2)
 			{
-				cout << endl << WARN << "Cannot detect nearest atom for vertex " << i;
+				triangleSlab[t] = s0;
+				dd.slabTrianglesStart[s0+1]++;
+			}
+			else
+			{
+				dd.lockedVertex[ triList[t*3+0] ] = true;
+				dd.lockedVertex[ triList[t*3+1] ] = true;
+				dd.lockedVertex[ triList[t*3+2] ] = true;
 			}
 		}
-		cout << "ok!";
-		cout.flush();
 
-		chrono_end = chrono::high_resolution_clock::now();
-		chrono::duration<double> other_time = chrono_end - chrono_start;
-		cout << endl << INFO << "Vertex atom mapping time is ";
-		printf ("%.4e [s]", other_time.count());
+		for (int s=0; s<slabs; s++)
+			dd.slabTrianglesStart[s+1] += dd.slabTrianglesStart[s];
 
-		#if !defined(AVOID_MEM_CHECKS)
-		if (!conf.parallelPocketLoop)
-		{
-			double current_mem_in_MB, peak_mem_in_MB;
-			getMemSpace (current_mem_in_MB, peak_mem_in_MB);
-			cout << endl << INFO << "Memory required after vertex atom mapping is " << current_mem_in_MB << " MB";
-		}
-		#endif
-	}
+		// frozen triangles of each vertex, for the link condition on locked vertices
+		for (int i=0; i<=nv; i++)
+			dd.frozenTrianglesStart[i] = 0;
 
-	// Some more deallocations before the below triList.reserve()
-	deleteIntersectionsMatrices();
-	#if !defined(OPTIMIZE_INTERSECTIONS_MANAGEMENT) && !defined(AVOID_NORMALS_MATRICES)
-	deleteNormalsMatrices();
-	#endif
+		for (int t=0; t<nt; t++)
+			if (triList[ t*3 ] != -1 && triangleSlab[t] == -1)
+				for (int k=0; k<3; k++)
+					dd.frozenTrianglesStart[ triList[t*3+k]+1 ]++;
 
-	chrono_start = chrono::high_resolution_clock::now();
+		for (int i=0; i<nv; i++)
+			dd.frozenTrianglesStart[i+1] += dd.frozenTrianglesStart[i];
 
-	vector<int> appNormals;
+		dd.frozenTriangles = allocateVector<int>(MAX(1,dd.frozenTrianglesStart[nv]));
 
-	appNormals.reserve(1000);
+		vector<int> frozenFill(dd.frozenTrianglesStart, dd.frozenTrianglesStart+nv);
+		for (int t=0; t<nt; t++)
+			if (triList[ t*3 ] != -1 && triangleSlab[t] == -1)
+				for (int k=0; k<3; k++)
+					dd.frozenTriangles[ frozenFill[ triList[t*3+k] ]++ ] = t;
 
-	// check if it has to approximate normals or they are already available
-	if (computeNormals && providesAnalyticalNormals)
-	{
-		// search for normals to be approximated
-		if (normalsList.size() != 0)
-		{
-			int ind = 0;
+		dd.slabTriangles = allocateVector<int>(MAX(1,dd.slabTrianglesStart[slabs]));
 
-			#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
-			for (vector<VERTEX_TYPE*>::iterator it = normalsList.begin(); it != normalsList.end(); it++)
-			{
-				VERTEX_TYPE *p = *it;
-				if (p[0] == 0 && p[1] == 0 && p[2] == 0)
-					appNormals.push_back(ind);
-				++ind;
-			}
-			#else
-			for (vector<VERTEX_TYPE>::iterator it = normalsList.begin(); it != normalsList.end(); it += 3)
+		vector<int> fill(dd.slabTrianglesStart, dd.slabTrianglesStart+slabs);
+		for (int t=0; t<nt; t++)
+			if (triangleSlab[t] != -1)
+				dd.slabTriangles[ fill[triangleSlab[t]]++ ] = t;
+
+		for (int s=0; s<slabs; s++)
+		{
+			if (totalBudget < 0)
+				dd.budget[s] = -1;
+			else
 			{
-				VERTEX_TYPE *p = &(*it);
-				if (p[0] == 0 && p[1] == 0 && p[2] == 0)
-					appNormals.push_back(ind);
-				++ind;
+				int64_t slab_triangles = dd.slabTrianglesStart[s+1] - dd.slabTrianglesStart[s];
+				dd.budget[s] = (int)((int64_t)(totalBudget - totalRemoved) * slab_triangles / MAX(1,liveTriangles));
 			}
-			#endif
 		}
+
+		#ifdef ENABLE_BOOST_THREADS
+		boost::thread_group thdGroup;
+
+		for (int s=0; s<slabs; s++)
+			thdGroup.create_thread(boost::bind(&Surface::decimationKernel, this, s, &dd));
+
+		thdGroup.join_all();
+		#else
+		for (int s=0; s<slabs; s++)
+			decimationKernel(s, &dd);
+		#endif
+
+		for (int s=0; s<slabs; s++)
+			totalRemoved += dd.removedTriangles[s];
+
+		deleteVector<int>(dd.slabTriangles);
+		deleteVector<int>(dd.slabTrianglesStart);
+		deleteVector<int>(dd.frozenTriangles);
+		deleteVector<int>(dd.budget);
+		deleteVector<int>(dd.removedTriangles);
 	}
 
-	if (computeNormals && providesAnalyticalNormals)
+	deleteVector<int>(triangleSlab);
+	deleteVector<int>(dd.frozenTrianglesStart);
+
+	// compact vertices and triangles
+	int *newIndex = vertexSlab;
+	for (int i=0; i<nv; i++)
+		newIndex[i] = -1;
+
+	int newNV = 0;
+	int newNT = 0;
+
+	for (int t=0; t<nt; t++)
 	{
-		// cout << endl << appNormals.size();
-		if (appNormals.size() != 0)
+		if (triList[ t*3 ] == -1)
+			continue;
+
+		for (int k=0; k<3; k++)
 		{
-			cout << endl << INFO << "Some analytical normals will be approximated...";
-			approximateNormals(appNormals, true);
+			int v = triList[ t*3+k ];
+			if (newIndex[v] == -1)
+				newIndex[v] = newNV++;
+			triList[ newNT*3+k ] = newIndex[v];
 		}
+		newNT++;
 	}
-	else if (computeNormals && !providesAnalyticalNormals)
-	{
-		cout << endl << INFO << "Approximating vertices normals by triangulation...";
-		approximateNormals(appNormals, false);
-	}
+	triList.resize(newNT*3);
 
-	chrono_end = chrono::high_resolution_clock::now();
-	chrono::duration<double> other_time = chrono_end - chrono_start;
-	cout << endl << INFO << "Normals' approximations time is ";
-	printf ("%.4e [s]", other_time.count());
+	vector<bool> movedVertex(newNV, false);
 
-	#if !defined(AVOID_MEM_CHECKS)
-	if (!conf.parallelPocketLoop)
-	{
-		double current_mem_in_MB, peak_mem_in_MB;
-		getMemSpace (current_mem_in_MB, peak_mem_in_MB);
-		cout << endl << INFO << "Memory required after normals' approximations is " << current_mem_in_MB << " MB";
-	}
-	#endif
+	#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+	vector<VERTEX_TYPE*> newVertList(newNV);
+	vector<VERTEX_TYPE*> newNormalsList(hasNormals ? newNV : 0);
 
-	#if !defined(AVOID_SAVING_MESH)
-	if (outputMesh)
+	for (int i=0; i<nv; i++)
 	{
-		chrono_start = chrono::high_resolution_clock::now();
+		if (newIndex[i] == -1)
+			continue;
 
-		int format = deduceFormat();
-		bool f = saveMesh(format, revert, fileName, vertList, triList, normalsList);
+		vertList[i][0] = (VERTEX_TYPE)dd.vertices[ i*3+0 ];
+		vertList[i][1] = (VERTEX_TYPE)dd.vertices[ i*3+1 ];
+		vertList[i][2] = (VERTEX_TYPE)dd.vertices[ i*3+2 ];
+		newVertList[ newIndex[i] ] = vertList[i];
 
-		if (!f)
-		{
-			cout << endl << ERR << "Errors in saving the mesh!";
-		}
-		else
-		{
-			auto chrono_end = chrono::high_resolution_clock::now();
-			chrono::duration<double> saveMesh_time = chrono_end - chrono_start;
-			cout << endl << INFO << "Outputting mesh time (in triangulateSurface()) ";
-			printf ("%.4e [s]", saveMesh_time.count());
-		}
+		if (hasNormals)
+			newNormalsList[ newIndex[i] ] = normalsList[i];
+		movedVertex[ newIndex[i] ] = dd.movedVertex[i];
+	}
+	#else
+	vector<VERTEX_TYPE> newVertList(newNV*3);
+	vector<VERTEX_TYPE> newNormalsList(hasNormals ? newNV*3 : 0);
 
-		/*
-		// Code usable for outputting mesh data in binary format
+	for (int i=0; i<nv; i++)
+	{
+		int j = newIndex[i];
 
-		chrono_start = chrono::high_resolution_clock::now();
+		if (j == -1)
+			continue;
 
-		f = saveMeshBinary(format, revert, fileName, vertList, triList, normalsList);
+		newVertList[ j*3+0 ] = (VERTEX_TYPE)dd.vertices[ i*3+0 ];
+		newVertList[ j*3+1 ] = (VERTEX_TYPE)dd.vertices[ i*3+1 ];
+		newVertList[ j*3+2 ] = (VERTEX_TYPE)dd.vertices[ i*3+2 ];
 
-		if (!f)
-		{
-			cout << endl << ERR << "Errors in saving the mesh in binary format!";
-		}
-		else
+		if (hasNormals)
 		{
-			auto chrono_end = chrono::high_resolution_clock::now();
-			chrono::duration<double> saveMesh_time = chrono_end - chrono_start;
-			cout << endl << INFO << "Outputting mesh time in binary format (in triangulateSurface()) ";
-			printf ("%.4e [s]", saveMesh_time.count());
+			newNormalsList[ j*3+0 ] = normalsList[ i*3+0 ];
+			newNormalsList[ j*3+1 ] = normalsList[ i*3+1 ];
+			newNormalsList[ j*3+2 ] = normalsList[ i*3+2 ];
 		}
-		*/
+		movedVertex[j] = dd.movedVertex[i];
 	}
 	#endif
 
-	if (buildAtomsMapHere && vertexAtomsMapFlag)
-		disposeAtomsMap();
-
-	return surf_area;
-}
+	vertList.swap(newVertList);
+	normalsList.swap(newNormalsList);
 
+	deleteVector<int>(vertexSlab);
+	deleteVector<bool>(dd.lockedVertex);
+	deleteVector<bool>(dd.movedVertex);
+	deleteVector<double>(dd.vertices);
 
-void Surface::updateVertexTrianglesLists (int **vertexTrianglesList, double **planes, unsigned int vertex_flag[], bool doOnlyList)
-{
-	#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
-	int nv = (int)vertList.size();
-	#else
-	int nv = (int)(vertList.size() / 3.);
-	#endif
-	int nt = (int)(triList.size() / 3.);
+	cout << "ok!";
 
-	if (!doOnlyList)
+	// the normal of a moved vertex is no longer the one of the surface there: it is
+	// recomputed as the mean of the planes of its triangles, as in approximateNormals()
+	if (hasNormals)
 	{
-		double w[4], *p1, *p2, *p3;
-
-		for (int i=0; i<nt; i++)
+		for (int i=0; i<newNV; i++)
 		{
-			int v1 = triList[ i*3+0 ];
-			int v2 = triList[ i*3+1 ];
-			int v3 = triList[ i*3+2 ];
+			if (!movedVertex[i])
+				continue;
 
 			#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
-			p1 = vertList[v1];
-			p2 = vertList[v2];
-			p3 = vertList[v3];
+			VERTEX_TYPE *n = normalsList[i];
 			#else
-			p1 = &vertList[v1*3];
-			p2 = &vertList[v2*3];
-			p3 = &vertList[v3*3];
+			VERTEX_TYPE *n = &normalsList[ i*3 ];
 			#endif
-
-			vertexTrianglesList[v1][ ++vertexTrianglesList[v1][0] ] = i;
-			vertexTrianglesList[v2][ ++vertexTrianglesList[v2][0] ] = i;
-			vertexTrianglesList[v3][ ++vertexTrianglesList[v3][0] ] = i;
-
-			// compute plane normal from triangles
-			plane3points(p1,p2,p3,w,false);
-			planes[i][0] = w[0];
-			planes[i][1] = w[1];
-			planes[i][2] = w[2];
+			n[0] = 0;
+			n[1] = 0;
+			n[2] = 0;
 		}
 	}
-	else
+
+	double area = 0;
+
+	for (int t=0; t<newNT; t++)
 	{
-		for (int i=0; i<nt; i++)
+		#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+		VERTEX_TYPE *v0 = vertList[ triList[t*3+0] ];
+		VERTEX_TYPE *v1 = vertList[ triList[t*3+1] ];
+		VERTEX_TYPE *v2 = vertList[ triList[t*3+2] ];
+		#else
+		VERTEX_TYPE *v0 = &vertList[ triList[t*3+0]*3 ];
+		VERTEX_TYPE *v1 = &vertList[ triList[t*3+1]*3 ];
+		VERTEX_TYPE *v2 = &vertList[ triList[t*3+2]*3 ];
+		#endif
+		double e1[3], e2[3], n[3];
+		SUB(e1,v1,v0);
+		SUB(e2,v2,v0);
+		CROSS(n,e1,e2);
+		area += 0.5*sqrt(DOT(n,n));
+
+		if (!hasNormals)
+			continue;
+
+		double p1[3], p2[3], p3[3], w[4];
+		ASSIGN(p1,v0);
+		ASSIGN(p2,v1);
+		ASSIGN(p3,v2);
+		plane3points(p1,p2,p3,w,false);
+
+		for (int k=0; k<3; k++)
 		{
-			int v1 = triList[ i*3+0 ];
-			int v2 = triList[ i*3+1 ];
-			int v3 = triList[ i*3+2 ];
+			int v = triList[ t*3+k ];
+
+			if (!movedVertex[v])
+				continue;
 
-			// read the proper bit
-			if (read32xCompressedVector (vertex_flag, v1, nv))
-				vertexTrianglesList[v1][ ++vertexTrianglesList[v1][0] ] = i;
+			#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+			VERTEX_TYPE *mn = normalsList[v];
+			#else
+			VERTEX_TYPE *mn = &normalsList[ v*3 ];
+			#endif
+			ADD(mn,mn,w);
+		}
+	}
 
-			if (read32xCompressedVector (vertex_flag, v2, nv))
-				vertexTrianglesList[v2][ ++vertexTrianglesList[v2][0] ] = i;
+	if (hasNormals)
+	{
+		for (int i=0; i<newNV; i++)
+		{
+			if (!movedVertex[i])
+				continue;
 
-			if (read32xCompressedVector (vertex_flag, v3, nv))
-				vertexTrianglesList[v3][ ++vertexTrianglesList[v3][0] ] = i;
+			#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+			VERTEX_TYPE *mn = normalsList[i];
+			#else
+			VERTEX_TYPE *mn = &normalsList[ i*3 ];
+			#endif
+			VERTEX_TYPE norm;
+			NORMALIZE(mn,norm);
 		}
 	}
+
+	auto chrono_end = chrono::high_resolution_clock::now();
+	chrono::duration<double> decimation_time = chrono_end - chrono_start;
+
+	cout << endl << INFO << "Decimation removed " << totalRemoved << " triangles: " << newNV << " vertices and " << newNT << " triangles left";
+	cout << endl << INFO << "Decimated surface area is " << setprecision(10) << area << " [A^2]";
+
+	if (decimated_area != NULL)
+		*decimated_area = area;
+	cout << endl << INFO << "Decimation time is ";
+	printf ("%.4e [s]", decimation_time.count());
+
+	return totalRemoved;
 }
 
 
-void Surface::approximateNormals(vector<int> &appNormals, bool doOnlyList)
+// MC edges as (lower cube vertex, upper cube vertex, direction) in the convention of classifyCube()/triTable
+static const int lodEdgeVertex[12] = {0,1,3,0, 4,5,7,4, 0,1,2,3};
+static const int lodEdgeVertex2[12] = {1,2,2,3, 5,6,6,7, 4,5,6,7};
+static const int lodEdgeDir[12] = {X_DIR,Y_DIR,X_DIR,Y_DIR, X_DIR,Y_DIR,X_DIR,Y_DIR, Z_DIR,Z_DIR,Z_DIR,Z_DIR};
+static const int lodCubeVertex[8][3] = {{0,0,0},{1,0,0},{1,1,0},{0,1,0},{0,0,1},{1,0,1},{1,1,1},{0,1,1}};
+
+
+void Surface::buildLODLevel(int level, vector<float> *lodVertices, vector<int> *lodTriangles)
 {
-	#define MAX_NEIGHBOURS 20
+	int64_t NX = delphi->nx;
+	int64_t NY = delphi->ny;
+	int64_t NZ = delphi->nz;
 
-	#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
-	int nv = (int)vertList.size();
-	#else
-	int nv = (int)(vertList.size() / 3.);
-	#endif
-	int nt = (int)(triList.size() / 3.);
+	// coarse grid points are taken every f grid points; each one is given the fraction
+	// of inside grid points in the surrounding f^3 block, and the 0.5 isosurface
+	// of this field is extracted by interpolating MC
+	int64_t f = ((int64_t)1) << level;
+	int64_t cNX = (NX-1)/f + 1;
+	int64_t cNY = (NY-1)/f + 1;
+	int64_t cNZ = (NZ-1)/f + 1;
 
-	if (!doOnlyList)
-	{
-		// the most optimised version resides in the other IF body
-		int **vertexTrianglesList = allocateVector<int*>(nv);
+	double coarse_side = delphi->side * f;
+	double x0 = delphi->x[0] - delphi->hside;
+	double y0 = delphi->y[0] - delphi->hside;
+	double z0 = delphi->z[0] - delphi->hside;
 
-		for (int i=0; i<nv; i++)
-		{
-			vertexTrianglesList[i] = allocateVector<int>(MAX_NEIGHBOURS + 1);
+	float *field = allocateVector<float>(cNX*cNY*cNZ);
 
-			// use the first element to update/read length
-			vertexTrianglesList[i][0] = 0;
-		}
+	for (int64_t K=0; K<cNZ; K++)
+		for (int64_t J=0; J<cNY; J++)
+			for (int64_t I=0; I<cNX; I++)
+			{
+				int count = 0, tot = 0;
 
-		double **planes = allocateMatrix2D<double>(nt,3);
+				for (int64_t k = MAX(0,K*f-f/2); k < MIN(NZ,K*f-f/2+f); k++)
+					for (int64_t j = MAX(0,J*f-f/2); j < MIN(NY,J*f-f/2+f); j++)
+						for (int64_t i = MAX(0,I*f-f/2); i < MIN(NX,I*f-f/2+f); i++)
+						{
+							if (getNodeInsideness(i,j,k))
+								count++;
+							tot++;
+						}
+				field[ (K*cNY + J)*cNX + I ] = (tot > 0) ? (float)count / tot : 0.f;
+			}
 
-		unsigned int *vertex_flag;
+	// vertex index of each coarse edge, 3 edges per coarse grid point
+	vector<int> edgeVertex(cNX*cNY*cNZ*3, -1);
 
-		updateVertexTrianglesLists (vertexTrianglesList, planes, vertex_flag, doOnlyList);
+	for (int64_t K=0; K<cNZ-1; K++)
+		for (int64_t J=0; J<cNY-1; J++)
+			for (int64_t I=0; I<cNX-1; I++)
+			{
+				double votes[8];
 
-		for (int iv=0; iv<nv; iv++)
-		{
-			VERTEX_TYPE norm;
+				// inside is positive as in the analytical MC
+				for (int v=0; v<8; v++)
+					votes[v] = field[ ((K+lodCubeVertex[v][2])*cNY + J+lodCubeVertex[v][1])*cNX + I+lodCubeVertex[v][0] ] - 0.5;
 
-			#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
-			normalsBuffers[0].push_back(0.);
-			normalsBuffers[0].push_back(0.);
-			normalsBuffers[0].push_back(0.);
+				int cubeindex = classifyCube(votes,0.0);
 
-			VERTEX_TYPE *meanNormal = &normalsBuffers[0][ normalsBuffers[0].size()-3 ];
+				if (cubeindex == -1)
+					continue;
 
-			normalsList.push_back(meanNormal);
-			#else
-			VERTEX_TYPE meanNormal[3];
-			#endif
+				int edgeIndex[12];
 
-			for (int j=0; j < vertexTrianglesList[iv][0]; j++)
-			{
-				int triangleID = vertexTrianglesList[iv][ j+1 ];
-				ADD(meanNormal,meanNormal,planes[triangleID]);
+				for (int e=0; e<12; e++)
+				{
+					if (!(edgeTable[cubeindex] & (1<<e)))
+						continue;
+
+					int v1 = lodEdgeVertex[e];
+					int dir = lodEdgeDir[e];
+					int64_t ii = I+lodCubeVertex[v1][0];
+					int64_t jj = J+lodCubeVertex[v1][1];
+					int64_t kk = K+lodCubeVertex[v1][2];
+					int64_t key = ((kk*cNY + jj)*cNX + ii)*3 + dir;
+
+					if (edgeVertex[key] == -1)
+					{
+						double val1 = votes[v1];
+						double val2 = votes[ lodEdgeVertex2[e] ];
+						double t = (fabs(val2-val1) > 1e-12) ? val1/(val1-val2) : 0.5;
+
+						double p[3];
+						p[0] = x0 + ii*coarse_side;
+						p[1] = y0 + jj*coarse_side;
+						p[2] = z0 + kk*coarse_side;
+						p[dir] += t*coarse_side;
+
+						edgeVertex[key] = (int)(lodVertices->size()/3);
+						lodVertices->push_back((float)p[0]);
+						lodVertices->push_back((float)p[1]);
+						lodVertices->push_back((float)p[2]);
+					}
+					edgeIndex[e] = edgeVertex[key];
+				}
+
+				// same winding of the analytical MC triangles
+				for (int t=0; triTable[cubeindex][t] != -1; t+=3)
+				{
+					lodTriangles->push_back(edgeIndex[ triTable[cubeindex][t+2] ]);
+					lodTriangles->push_back(edgeIndex[ triTable[cubeindex][t+1] ]);
+					lodTriangles->push_back(edgeIndex[ triTable[cubeindex][t+0] ]);
+				}
 			}
-			NORMALIZE(meanNormal,norm);
 
-			#if defined(USE_OPTIMIZED_VERTICES_BUFFERING)
-			normalsList.push_back(meanNormal[0]);
-			normalsList.push_back(meanNormal[1]);
-			normalsList.push_back(meanNormal[2]);
-			#endif
-		}
+	deleteVector<float>(field);
+}
 
-		for (int i = 0; i < nv; i++)
-			deleteVector<int>(vertexTrianglesList[i]);
-		deleteVector<int*>(vertexTrianglesList);
 
-		deleteMatrix2D<double>(nt,3,planes);
+bool Surface::saveMeshLOD(int num_levels, bool revert, const char *fileName)
+{
+	#if !defined(USE_COMPRESSED_GRIDS)
+	if (!optimizeGrids)
+	{
+		if (verticesInsidenessMap == NULL)
+		{
+			cout << endl << WARN << "Cannot build the LOD pyramid without inside/out info for grid points";
+			return false;
+		}
 	}
 	else
+	#endif
 	{
-		if (appNormals.size() == 0)
-			return;
+		if (compressed_verticesInsidenessMap == NULL)
+		{
+			cout << endl << WARN << "Cannot build the LOD pyramid without inside/out info for grid points";
+			return false;
+		}
+	}
 
-		// Most optimised version with vertex flagging and memory-saving techniques:
-		// Many vertexTrianglesList[*] are not allocated and vertex_flag[] is compressed
-		int **vertexTrianglesList = allocateVector<int*>(nv);
+	auto chrono_start = chrono::high_resolution_clock::now();
 
-		// compressed mask buffer in which each unsigned int stores 32 flags
-		unsigned int *vertex_flag = allocate32xCompressedVector(0, nv);
+	vector<float> *lodVertices = new vector<float> [num_levels];
+	vector<int> *lodTriangles = new vector<int> [num_levels];
 
-		for (vector<int>::iterator it = appNormals.begin(); it != appNormals.end(); it++)
-		{
-			unsigned int iv = (*it);
+	// level 0 is the mesh as saved in the main output file
+	#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+	int numVertices = (int)vertList.size();
+	#else
+	int numVertices = (int)(vertList.size() / 3.);
+	#endif
 
-			// switch on the proper bit
-			write32xCompressedVector(vertex_flag, 1, iv, nv);
+	lodVertices[0].reserve(numVertices*3);
+
+	for (int i=0; i<numVertices; i++)
+	{
+		#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+		lodVertices[0].push_back((float)vertList[i][0]);
+		lodVertices[0].push_back((float)vertList[i][1]);
+		lodVertices[0].push_back((float)vertList[i][2]);
+		#else
+		lodVertices[0].push_back((float)vertList[ i*3+0 ]);
+		lodVertices[0].push_back((float)vertList[ i*3+1 ]);
+		lodVertices[0].push_back((float)vertList[ i*3+2 ]);
+		#endif
+	}
+	lodTriangles[0] = triList;
 
-			vertexTrianglesList[iv] = allocateVector<int>(MAX_NEIGHBOURS + 1);
+	// coarser levels are independent, one thread each in waves of at most conf.numThreads levels
+	#ifdef ENABLE_BOOST_THREADS
+	int num_threads = MAX(1, conf.numThreads);
 
-			// use the first element to update/read length
-			vertexTrianglesList[iv][0] = 0;
-		}
+	for (int first=1; first<num_levels; first+=num_threads)
+	{
+		boost::thread_group thdGroup;
 
-		double **planes;
+		for (int l=first; l<MIN(num_levels,first+num_threads); l++)
+			thdGroup.create_thread(boost::bind(&Surface::buildLODLevel,this,l,&lodVertices[l],&lodTriangles[l]));
 
-		updateVertexTrianglesLists(vertexTrianglesList, planes, vertex_flag, doOnlyList);
+		thdGroup.join_all();
+	}
+	#else
+	for (int l=1; l<num_levels; l++)
+		buildLODLevel(l,&lodVertices[l],&lodTriangles[l]);
+	#endif
 
+	char fullName[BUFLEN];
+	sprintf(fullName, "%s%s.lod", rootFile.c_str(), fileName);
 
-		double w[4], *p1, *p2, *p3;
+	FILE *fp = fopen(fullName, "wb");
 
-		for (vector<int>::iterator it = appNormals.begin(); it != appNormals.end(); it++)
-		{
-			unsigned int iv = (*it);
+	if (fp == NULL)
+	{
+		cout << endl << WARN << "Cannot write file " << fullName;
+		delete[] lodVertices;
+		delete[] lodTriangles;
+		return false;
+	}
 
-			VERTEX_TYPE norm;
+	cout << endl << INFO << "Writing " << num_levels << " levels of detail in " << fullName << "...";
+	cout.flush();
 
-			#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
-			VERTEX_TYPE *meanNormal = normalsList[iv];
-			#else
-			VERTEX_TYPE meanNormal[3];
-			#endif
-			meanNormal[0] = 0;
-			meanNormal[1] = 0;
-			meanNormal[2] = 0;
+	// Container layout (native little endian):
+	// header: magic "NSLOD" + 3 zero bytes, int32 version, int32 number of levels, int32 reserved
+	// index, one 32 bytes entry per level, from the finest to the coarsest:
+	//		uint64 byte offset of the level from the file start, uint64 byte size of the level,
+	//		int32 number of vertices, int32 number of triangles, float32 grid side [A], int32 reserved
+	// levels: float32 x,y,z of each vertex followed by int32 v1,v2,v3 of each triangle
+	const char magic[8] = {'N','S','L','O','D',0,0,0};
+	int32_t header[4] = {1, num_levels, 0, 0};
 
-			for (int j=0; j < vertexTrianglesList[iv][0]; j++)
-			{
-				int triangleID = vertexTrianglesList[iv][ j+1 ];
+	fwrite(magic, sizeof(char), 8, fp);
+	fwrite(&header[0], sizeof(int32_t), 3, fp);
 
-				#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
-				p1 = vertList[ triList[triangleID*3+0] ];
-				p2 = vertList[ triList[triangleID*3+1] ];
-				p3 = vertList[ triList[triangleID*3+2] ];
-				#else
-				p1 = &vertList[ triList[triangleID*3+0]*3 ];
-				p2 = &vertList[ triList[triangleID*3+1]*3 ];
-				p3 = &vertList[ triList[triangleID*3+2]*3 ];
-				#endif
+	uint64_t offset = 8 + 3*sizeof(int32_t) + (uint64_t)num_levels*32;
 
-				// compute plane normal from triangles;
-				// some normals are recalculated, but we avoid pre-calculating
-				// and storing them in an nt*(3 doubles)-sized buffer
-				plane3points(p1,p2,p3,w,false);
-				ADD(meanNormal,meanNormal,w);
-			}
-			NORMALIZE(meanNormal,norm);
+	for (int l=0; l<num_levels; l++)
+	{
+		int32_t nv = (int32_t)(lodVertices[l].size()/3);
+		int32_t nt = (int32_t)(lodTriangles[l].size()/3);
+		uint64_t size = (uint64_t)nv*3*sizeof(float) + (uint64_t)nt*3*sizeof(int32_t);
+		float side = (float)(delphi->side * (1 << l));
 
-			#if defined(USE_OPTIMIZED_VERTICES_BUFFERING)
-			normalsList[ iv*3+0 ] = meanNormal[0];
-			normalsList[ iv*3+1 ] = meanNormal[1];
-			normalsList[ iv*3+2 ] = meanNormal[2];
-			#endif
+		fwrite(&offset, sizeof(uint64_t), 1, fp);
+		fwrite(&size, sizeof(uint64_t), 1, fp);
+		fwrite(&nv, sizeof(int32_t), 1, fp);
+		fwrite(&nt, sizeof(int32_t), 1, fp);
+		fwrite(&side, sizeof(float), 1, fp);
+		fwrite(&header[3], sizeof(int32_t), 1, fp);
 
-			deleteVector<int>(vertexTrianglesList[iv]);
+		offset += size;
+	}
+
+	for (int l=0; l<num_levels; l++)
+	{
+		vector<int> &tri = lodTriangles[l];
+
+		if (lodVertices[l].size() > 0)
+			fwrite(&lodVertices[l][0], sizeof(float), lodVertices[l].size(), fp);
+
+		if (revert)
+		{
+			for (size_t t=0; t<tri.size(); t+=3)
+				swap(tri[t], tri[t+2]);
 		}
-		deleteVector<int*>(vertexTrianglesList);
+		if (tri.size() > 0)
+			fwrite(&tri[0], sizeof(int32_t), tri.size(), fp);
+	}
 
-		deleteVector<unsigned int>(vertex_flag);
+	fclose(fp);
+
+	cout << "ok!";
+
+	for (int l=0; l<num_levels; l++)
+	{
+		cout << endl << INFO << "LOD level " << l << ": " << lodVertices[l].size()/3 << " vertices and " << lodTriangles[l].size()/3 << " triangles";
 	}
+
+	delete[] lodVertices;
+	delete[] lodTriangles;
+
+	auto chrono_end = chrono::high_resolution_clock::now();
+	chrono::duration<double> lod_time = chrono_end - chrono_start;
+	cout << endl << INFO << "LOD pyramid time is ";
+	printf ("%.4e [s]", lod_time.count());
+
+	return true;
 }
 
 
@@ -11153,7 +13109,12 @@ bool Surface::saveMeshBinary(int format, bool revert, const char *fileName,
 		time(&pt);
 
 		fprintf(fp, "# File created by %s version %s date %s\n", PROGNAME, VERSION, ctime(&pt));
-		fprintf(fp, "%d %d 0\n", numVertices, numTriangles);
+
+		// leading blanks on the sizes line align the binary data to 4 bytes, so that a reader can use them in place
+		char sizes[64];
+		sprintf(sizes, "%d %d 0\n", numVertices, numTriangles);
+		long data_offset = ftell(fp) + (long)strlen(sizes);
+		fprintf(fp, "%*s%s", (int)((4 - data_offset % 4) % 4), "", sizes);
 
 		/*
 		// Fastest version, but more memory costly due to the copy of data into arrays with other formats
@@ -12589,19 +14550,14 @@ void Surface::smoothSurface(bool outputMesh, bool buildAtomsMapHere, char *fn, b
 			deleteVector<int>(vertexAtomsMap);
 
 		vertexAtomsMap = allocateVector<int>(nv);
-		buildAtomsMap();
 
 		cout << endl << INFO << "Connecting vertices to atoms...";
 		cout.flush();
 
+		mapVerticesToAtoms(nv);
+
 		for (int i=0; i<nv; i++)
 		{
-			#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
-			vdwAccessible(vertList[i], vertexAtomsMap[i]);
-			#else
-			vdwAccessible(&vertList[i*3], vertexAtomsMap[i]);
-			#endif
-
 			if (vertexAtomsMap[i] == -1)
 			{
 				cout << endl << WARN << "Cannot detect nearest atom for vertex " << i;
@@ -12994,35 +14950,14 @@ void Surface::smoothSurface(bool outputMesh, bool buildAtomsMapHere,
 			deleteVector<int>(vertexAtomsMap);
 
 		vertexAtomsMap = allocateVector<int>(nv);
-		buildAtomsMap();
 
 		cout << endl << INFO << "Connecting vertices to atoms...";
 		cout.flush();
 
+		mapVerticesToAtoms(nv);
+
 		for (int i=0; i<nv; i++)
 		{
-			#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
-			#if !defined(FLOAT_VERTICES)
-			vdwAccessible(vertList[i], vertexAtomsMap[i]);
-			#else
-			double v[3];
-			v[0] = vertList[i][0];
-			v[1] = vertList[i][1];
-			v[2] = vertList[i][2];
-			vdwAccessible(v, vertexAtomsMap[i]);
-			#endif
-			#else
-			#if !defined(FLOAT_VERTICES)
-			vdwAccessible(&vertList[i*3], vertexAtomsMap[i]);
-			#else
-			double v[3];
-			v[0] = vertList[ i*3+0 ];
-			v[1] = vertList[ i*3+1 ];
-			v[2] = vertList[ i*3+2 ];
-			vdwAccessible(v, vertexAtomsMap[i]);
-			#endif
-			#endif
-
 			if (vertexAtomsMap[i] == -1)
 			{
 				cout << endl << WARN << "Cannot detect nearest atom for vertex " << i;
@@ -13263,35 +15198,14 @@ void Surface::smoothSurface(bool outputMesh, bool buildAtomsMapHere,
 			deleteVector<int>(vertexAtomsMap);
 
 		vertexAtomsMap = allocateVector<int>(nv);
-		buildAtomsMap();
 
 		cout << endl << INFO << "Connecting vertices to atoms...";
 		cout.flush();
 
+		mapVerticesToAtoms(nv);
+
 		for (int i=0; i<nv; i++)
 		{
-				#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
-				#if !defined(FLOAT_VERTICES)
-				vdwAccessible(vertList[i], vertexAtomsMap[i]);
-				#else
-				double v[3];
-				v[0] = vertList[i][0];
-				v[1] = vertList[i][1];
-				v[2] = vertList[i][2];
-				vdwAccessible(v, vertexAtomsMap[i]);
-				#endif
-				#else
-				#if !defined(FLOAT_VERTICES)
-				vdwAccessible(&vertList[i*3], vertexAtomsMap[i]);
-				#else
-				double v[3];
-				v[0] = vertList[ i*3+0 ];
-				v[1] = vertList[ i*3+1 ];
-				v[2] = vertList[ i*3+2 ];
-				vdwAccessible(v, vertexAtomsMap[i]);
-				#endif
-				#endif
-
 			if (vertexAtomsMap[i] == -1)
 			{
 				cout << endl << WARN << "Cannot detect nearest atom for vertex " << i;
@@ -16662,47 +18576,13 @@ void Surface::saveSelectedPoints(vector<bool> &selection, const char *file, cons
 
 bool Surface::vdwAccessible(double *pos, int &winner)
 {
-	double minDist = INFINITY;
-	winner = -1;
-	
-	int64_t ix = (int64_t)rintp((pos[0]-gxmin)*gscale);
-	int64_t iy = (int64_t)rintp((pos[1]-gymin)*gscale);
-	int64_t iz = (int64_t)rintp((pos[2]-gzmin)*gscale);
+	double minDist;
 
 	// get the nearest atom and says if it is in or out
 	// the signed distance from the point p is ||p-c||^2-r^2 where c is the center
 	// of the atom and r is the radius. The minimum signed distance wins and if this
 	// negative we are inside (false) and if it is positive we are outside (true)
-	for (int k=0; k<SHIFT_MAP; k++)
-	{
-		int64_t cx = ix+shift_map[k][0];
-		int64_t cy = iy+shift_map[k][1];
-		int64_t cz = iz+shift_map[k][2];
-
-		// multidielectric map is square 
-		if (cx >= ggrid || cy >= ggrid || cz >= ggrid || cx<0 || cy<0 || cz<0)
-			continue;
-
-		int num_atoms = gridMultiMap[ cz*(ggrid*ggrid) + cy*ggrid + cx ].size();
-
-		for (int j=0; j<num_atoms; j++)
-		{
-			int atom_index = gridMultiMap[ cz*(ggrid*ggrid) + cy*ggrid + cx ][j];
-
-			double signed_dist = 0;
-			// DIST2(signed_dist,delphi->atoms[atom_index]->pos,pos)
-			// double rad = delphi->atoms[atom_index]->radius;
-			DIST2(signed_dist,delphi->atoms[atom_index].pos,pos)
-			double rad = delphi->atoms[atom_index].radius;
-			signed_dist -= rad*rad;
-			
-			if (signed_dist < minDist)
-			{
-				minDist = signed_dist;
-				winner = atom_index;
-			}
-		}	
-	}
+	winner = nearestAtomInMap(pos, minDist);
 	
 	if (winner == -1)
 	{
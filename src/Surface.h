@@ -263,6 +263,54 @@ public:
 };
 
 
+/** Shared buffers of the slab-parallel quadric error metric decimation. Each thread owns
+the vertices and triangles of one slab; vertices shared by triangles of different slabs are locked. */
+class DecimationData
+{
+public:
+
+	DecimationData()
+	{
+		vertices = NULL;
+		triangles = NULL;
+		nv = 0;
+		nt = 0;
+		lockedVertex = NULL;
+		movedVertex = NULL;
+		slabTriangles = NULL;
+		frozenTriangles = NULL;
+		frozenTrianglesStart = NULL;
+		slabTrianglesStart = NULL;
+		budget = NULL;
+		removedTriangles = NULL;
+		maxError2 = -1.;
+	}
+
+	/** vertex coordinates (nv*3), moved in place */
+	double *vertices;
+	/** triangle indices (nt*3), rewritten in place; a removed triangle is marked with -1 */
+	int *triangles;
+	int nv, nt;
+	/** vertices which cannot be removed or moved */
+	bool *lockedVertex;
+	/** vertices moved by a collapse, whose normal is no longer valid */
+	bool *movedVertex;
+	/** triangles of each slab in CSR format */
+	int *slabTriangles;
+	int *slabTrianglesStart;
+	/** triangles across slabs of each vertex in CSR format; they are not touched during a pass,
+	so together with the slab triangles they give the full one-ring of a locked vertex */
+	int *frozenTriangles;
+	int *frozenTrianglesStart;
+	/** max number of triangles each slab can remove (-1 means unbounded) */
+	int *budget;
+	/** number of triangles removed by each slab */
+	int *removedTriangles;
+	/** squared error bound in [A^2] (-1 means unbounded) */
+	double maxError2;
+};
+
+
 #ifdef DBGMEM_CRT
 	#define _CRTDBG_MAP_ALLOC
 	#define _CRTDBG_MAP_ALLOC_NEW
@@ -289,10 +337,17 @@ public:
 
 #define DELTA 1e-10
 #define RAND_DISPLACEMENT 1e-4
+/** default of Stern_Layer_Distance_Transform_Offset. The surface lies between the molecule grid points
+and their outer neighbours: when the Stern layer thresholds the distance from the molecule grid points
+the threshold is widened by this fraction of the grid side, which balances the points lost and gained
+with respect to the inflated atoms*/
+#define STERN_DT_OFFSET 0.25
 
 // boundary grid point codes
 #define INTERNAL_BGP 0
 #define EXTERNAL_BGP 1
+/** number of Morton ordered boundary grid points fetched at once by a projector thread*/
+#define BGP_PROJECTION_BATCH 64
 
 // molecular surface
 #define MOLECULAR_SURFACE 0
@@ -530,6 +585,12 @@ protected:
 	/////////////////////////////////// flags/settings ////////////////////////////////////
 	bool projBGP;
 	double sternLayer;
+	/** if enabled the Stern layer is the set of grid points closer than sternLayer to the molecule grid
+	points, thresholding an exact distance transform of the in/out map instead of inflating each atom.
+	The distance is measured from the grid points, not from the atoms, so the layer is an approximation
+	of the inflated atoms one: its thickness is widened by sternLayerDTOffset grid sides*/
+	bool sternLayerDistanceTransform;
+	double sternLayerDTOffset;
 	bool accurateTriangulation;
 	bool doTriangulation;
 	bool fillCavitiesFlag;
@@ -559,6 +620,25 @@ protected:
 	/** This allows to force the bulding phase to be serial */
 	bool forceSerialBuild;
 
+	/** Quadric error metric decimation of the triangulation before it is saved */
+	bool meshDecimation;
+	/** Target number of triangles of the decimated mesh (-1 means no target) */
+	int decimationTargetTriangles;
+	/** Max allowed (area weighted, RMS) displacement from the original mesh in [A] (-1 means no bound) */
+	double decimationMaxError;
+
+	/** Dual contouring triangulation: one vertex per active cube, placed by minimizing the
+	quadratic error function of the hermite data (analytical intersections and normals) */
+	bool dualContouring;
+	/** thread local index of the dual contouring vertex of each active cube */
+	int **bilevel_dualVertices;
+	/** offset in vertList of the dual contouring vertices of each thread */
+	int *dualVerticesOffset;
+
+	/** Number of levels of the LOD pyramid saved with the mesh (1 means no pyramid). Each level
+	has about 1/4 of the triangles of the previous one */
+	int meshLODLevels;
+
 	/** Flag used for optimizing grids to reduce memory consumption, e.g. with bilevel
 	hierarchical grids (instead of full flat uniform grids), or not */
 	bool optimizeGrids;
@@ -619,7 +699,8 @@ protected:
 	// in each 32-bit word there are 32 1-bit values
 	unsigned int *compressed_verticesInsidenessMap;
 
-	double ***scalarField;
+	/** scalar field sampled on the grid (contiguous, x fastest), see read3DVector*/
+	float *scalarField;
 	
 	// when a scalar field is available scalarField is used instead of verticesInsidenessMap for vertex interpolation
 	bool isAvailableScalarField;
@@ -650,8 +731,15 @@ protected:
 	/** type of bgp for each detected bgp **/
 	int *bgp_type;
 	
-	/** grid multi-dielectric map */
-	vector<int> *gridMultiMap;
+	/** grid multi-dielectric map. It is a compact uniform grid (cell list) in CSR form:
+	the atoms of cell c are atomsMapIds[atomsMapStart[c]..atomsMapStart[c+1]). Centers and
+	squared radii are replicated in the same cell order (SoA) such that the distance loop
+	of a query runs over contiguous memory. */
+	int *atomsMapStart;
+	int *atomsMapIds;
+	double *atomsMapX,*atomsMapY,*atomsMapZ,*atomsMapR2;
+	/** DelPhiShared::atomsVersion of the atoms the map was built for; with the stored positions and radii it is used to reuse the map */
+	uint64_t atomsMapVersion;
 	double gxmin,gymin,gzmin,gside,gscale;
 	int64_t ggrid;
 	
@@ -703,6 +791,17 @@ protected:
 	
 	/** This gives true if the point is outside vdw surface*/
 	bool vdwAccessible(double *p,int &nearest);
+
+	/** Nearest atom according to the power distance ||p-c||^2-r^2 using the atoms map.
+	Returns -1 if no atom is found in the 27 neighbouring cells. If second is not NULL
+	the second nearest atom is also returned. */
+	int nearestAtomInMap(const double *pos,double &minDist,int *second=NULL,double *secondDist=NULL);
+
+	/** Nearest atom for a batch of n points stored as xyz triplets. Run by multiple threads. */
+	void nearestAtomsKernel(int start,int end,const double *points,int *winners);
+
+	/** Fill vertexAtomsMap for the first nv vertices of the mesh. Run by multiple threads. */
+	void vertexAtomsKernel(int start,int end);
 	
 	/** Ray tracing routine employed to perform partial or full intersections used
 	 together with boost threading routines. In order to get a 'robust' ray tracer a
@@ -736,6 +835,13 @@ protected:
 	/** Projector routine, used to perform partial or full intersections with boost
 	threading routines. */
 	void projector(int start,int end);
+
+	/** Project the boundary grid point of index i on the surface*/
+	void projectBgp(int i);
+
+	/** Projector routine that fetches batches of BGP_PROJECTION_BATCH boundary grid points, in the given
+	order, until all of them are projected. next_batch is the first not yet fetched position in the order*/
+	void batchProjector(const int *order,int *next_batch);
 	
 	/** return +1 if outside and -1 if inside for the vertex indexed by vertInd belonging
 	to the grid cube given by i,j,k indexes. */
@@ -761,7 +867,32 @@ protected:
 	/** Multi-threaded triangulator. */
 	double triangulationKernel(double isolevel,bool revert,int start_z,int end_z,int jump,vector<int> *localTriList,VERTEX_TYPE *localArea);
 	
-	/** Builds a 3D grid for accelerating nearest atom queries. */
+	/** Edge collapse decimation of the triangles of a single slab. Run by multiple threads. */
+	void decimationKernel(int slab, DecimationData *dd);
+
+	/** Vertex index of the intersection along a grid edge (-1 if missing). */
+	int getEdgeVertexIndex(int dir, int64_t ix, int64_t iy, int64_t iz);
+
+	/** Inside/outside flag of a grid point. */
+	bool getNodeInsideness(int64_t i, int64_t j, int64_t k);
+
+	/** Replace the MC vertices with the dual contouring ones, computed in parallel. */
+	void buildDualContouringVertices(void);
+
+	/** Deallocate the dual contouring cube to vertex map. */
+	void disposeDualContouringVertices(void);
+
+	/** Place the dual contouring vertices of the cubes of a set of 4-thick z slabs. Run by multiple threads. */
+	void dualContouringVerticesKernel(int start_z,int end_z,int jump,vector<VERTEX_TYPE> *localVert,vector<VERTEX_TYPE> *localNormals);
+
+	/** Build the dual contouring quads around the sign changing edges of a set of z planes. Run by multiple threads. */
+	double dualContouringKernel(int start_z,int end_z,int jump,vector<int> *localTriList,VERTEX_TYPE *localArea);
+
+	/** Triangulate a downsampled version of the inside/out grid with 2^level coarser spacing. */
+	void buildLODLevel(int level,vector<float> *lodVertices,vector<int> *lodTriangles);
+
+	/** Builds a 3D grid for accelerating nearest atom queries. If the map is
+	already available for the current atoms it is reused. */
 	void buildAtomsMap(void);
 	
 	/** Deallocate the memory of the 3D nearest atom query */
@@ -770,12 +901,25 @@ protected:
 	/** Apply multidielectric correction after grid building. For each internal
 	grid point detect the nearest atom and apply its dielectric constant.*/
 	void applyMultidielectric(void);
+
+	/** multidielectric correction of the z planes thread_id, thread_id+num_threads, ...*/
+	void multidielectricKernel(int thread_id,int num_threads);
 	
 	/** swap the state of a point in the epsmap from internal to the nearest atom dielectric*/
-	void swap2multi(double gxmin,double gymin,double gzmin,double gside,unsigned int ggrid,vector<int> *gridMultiMap,int i,int j,int k,int l);
+	void swap2multi(int i,int j,int k,int l);
+
+	/** Get the nearest atom of n points (xyz triplets) in parallel. The atoms map must be available. */
+	void nearestAtoms(int n,const double *points,int *winners);
+
+	/** Build the atoms map if needed and fill vertexAtomsMap for the current mesh vertices in parallel. */
+	void mapVerticesToAtoms(int nv);
 	
 	/** Build stern layer. */
 	void buildSternLayer(void);
+
+	/** 1D squared distance transform of the lines [start,end) of the grid along the given axis (0,1,2 = x,y,z),
+	in place; a pass of squaredDistanceTransform*/
+	void distanceTransformLines(float *dist2, int axis, int64_t start, int64_t end);
 	
 	/** Clean and alloc intersections. */
 	void allocIntersectionsMatrices(int octree_side_size=0);
@@ -823,6 +967,12 @@ protected:
 	Surface();
 	Surface(ConfigFile *cf);
 
+	/** The normals of the intersections from the first one on are pointed again to the consecutive
+	triplets of normals from firstNormal on. A ray takes the pointer when it appends a normal and
+	the following appends of the same ray can move the buffer, so the pointers are set once all
+	the normals of the ray are in*/
+	void pointRayNormals(vector<pair<VERTEX_TYPE,VERTEX_TYPE*>> &intersections, size_t first, vector<VERTEX_TYPE> &normals, size_t firstNormal);
+
 public:
 
 	// In order to use the set of default surface methods, the following
@@ -875,6 +1025,15 @@ public:
 	virtual void clear(void);
 	/////////////////////////////////////////////////////////////
 
+	/** Free the grid colouring and triangulation data, which are sized on the current DelPhi grid.
+	The surface build-up is kept. */
+	void clearGridData(void);
+
+	/** Ray cast the built surface on the grid of ds from now on, without building it again. The data of
+	the current grid are freed, so it must be still alive. ds must hold the same atoms. Returns false, leaving
+	the surface as it is, if the build-up depends on the grid: then a new surface has to be built on ds. */
+	virtual bool retarget(DelPhiShared *ds);
+
 	//////////////////////// PROVIDED DEFAULT METHODS /////////////////////////////////
 	/** Build DelPhi Surface by a specific method. If the defined surface
 	 provides at least projection and intersection routines then don't overload
@@ -944,6 +1103,18 @@ public:
 	virtual void smoothSurface(bool outputMesh,bool buildAtomsMapHere,
 							   const char *fn="triangulatedSurf",bool revert=false);
 
+	/** Simplify the current triangulation (vertList/triList/normalsList) by quadric error metric edge collapses.
+	The mesh is partitioned in Z slabs decimated in parallel; a second pass with shifted slabs removes the seams.
+	Stops when the target number of triangles is reached or the next collapse exceeds the error bound in [A].
+	Returns the number of removed triangles and, if area is not NULL, the area of the decimated mesh.
+	The normals of the moved vertices are recomputed from their triangles. */
+	virtual int decimateMesh(int target_triangles, double max_error, double *area=NULL);
+
+	/** Save a multi-resolution pyramid of the surface in a single indexed binary file
+	(fileName + ".lod"). Level 0 is the current mesh; level l triangulates the inside/out grid
+	downsampled by 2^l, with no further ray casting. Levels are built in parallel. */
+	virtual bool saveMeshLOD(int num_levels, bool revert, const char *fileName);
+
 	/** This function is called before the ray tracing of the panel. It can be useful if a
 	per panel pre-processing step is needed. By default this function does nothing. */
 	virtual void preProcessPanel(void)
@@ -1077,6 +1248,32 @@ public:
 			sternLayer = l;
 	}
 
+	void setSternLayerDistanceTransform(bool f)
+	{
+		sternLayerDistanceTransform = f;
+	}
+
+	bool getSternLayerDistanceTransform(void)
+	{
+		return sternLayerDistanceTransform;
+	}
+
+	void setSternLayerDistanceTransformOffset(double o)
+	{
+		sternLayerDTOffset = o;
+	}
+
+	double getSternLayerDistanceTransformOffset(void)
+	{
+		return sternLayerDTOffset;
+	}
+
+	/** Exact squared euclidean distance transform of a NX*NY*NZ map (x fastest) whose seeds are the grid points
+	where the map is equal to seed: for every grid point dist2 gets the squared distance, in grid units, from
+	the nearest seed (INFINITY if there are no seeds).
+	Separable lower envelope of parabolas algorithm (Felzenszwalb and Huttenlocher), parallel over the grid lines*/
+	void squaredDistanceTransform(const bool *map, bool seed, float *dist2);
+
 	void setSaveMSMS(bool m)
 	{
 		saveMSMS = m;
@@ -1197,6 +1394,100 @@ public:
 		return (int)vertList.size();
 	}
 
+	/** Number of vertices of the triangulation whatever their storage, that is the number of triplets
+	of getVerticesData() and getNormalsData() and the length of getVertexAtomsMapData()*/
+	int getNumMeshVertices(void)
+	{
+		#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+		return (int)vertList.size();
+		#else
+		return (int)(vertList.size() / 3);
+		#endif
+	}
+
+	/** Vertices of the triangulation as getNumMeshVertices() x,y,z triplets, in place (no copy). The pointer is
+	valid until the surface is triangulated again or cleared; NULL if there is no triangulation or if the
+	vertices are not stored contiguously (USE_OPTIMIZED_VERTICES_BUFFERING not defined)*/
+	VERTEX_TYPE *getVerticesData(void)
+	{
+		#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+		return NULL;
+		#else
+		return vertList.empty() ? NULL : vertList.data();
+		#endif
+	}
+
+	/** Vertex normals, one x,y,z triplet per vertex, in place. NULL if they are not available*/
+	VERTEX_TYPE *getNormalsData(void)
+	{
+		#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+		return NULL;
+		#else
+		return (normalsList.empty() || normalsList.size() != vertList.size()) ? NULL : normalsList.data();
+		#endif
+	}
+
+	/** Triangles as getNumTriangles() triplets of vertex indexes, in place. NULL if there is no triangulation*/
+	int *getTrianglesData(void)
+	{
+		return triList.empty() ? NULL : triList.data();
+	}
+
+	/** Nearest atom of each vertex, in place. NULL if it is not computed*/
+	int *getVertexAtomsMapData(void)
+	{
+		return vertexAtomsMap;
+	}
+
+	/** Copy of the triangles as a flat list of vertex indexes, three per triangle*/
+	vector<int> gettriList(void)
+	{
+		return triList;
+	}
+
+	/** Copy of the vertices as a flat list of coordinates, three per vertex*/
+	vector<VERTEX_TYPE> getvertList(void)
+	{
+		#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+		vector<VERTEX_TYPE> v;
+		v.reserve(3*vertList.size());
+		for (unsigned int i=0; i<vertList.size(); i++)
+			v.insert(v.end(), vertList[i], vertList[i]+3);
+		return v;
+		#else
+		return vertList;
+		#endif
+	}
+
+	/** Copy of the vertex normals as a flat list, three values per vertex. Empty if they are not computed*/
+	vector<VERTEX_TYPE> getnormalsList(void)
+	{
+		#if !defined(USE_OPTIMIZED_VERTICES_BUFFERING)
+		vector<VERTEX_TYPE> n;
+		n.reserve(3*normalsList.size());
+		for (unsigned int i=0; i<normalsList.size(); i++)
+			n.insert(n.end(), normalsList[i], normalsList[i]+3);
+		return n;
+		#else
+		return normalsList;
+		#endif
+	}
+
+	/** Copy of the nearest atom of each vertex. Empty if it is not computed*/
+	vector<int> getvertexAromsMap(void)
+	{
+		if (vertexAtomsMap == NULL)
+			return vector<int>();
+		return vector<int>(vertexAtomsMap, vertexAtomsMap+getNumMeshVertices());
+	}
+
+	/** Per thread buffer the analytical normals of getRayIntersection point into. Rays cast outside
+	the build-up must copy those normals before the buffer grows again*/
+	vector<VERTEX_TYPE> &getNormalsBuffer(int thread_id)
+	{
+		return normalsBuffers[thread_id];
+	}
+
 	virtual void setInsideCode(int i)
 	{
 		inside = i;
@@ -1238,6 +1529,51 @@ public:
 		optimizeGrids = optimize_grids;
 	}
 
+	void setMeshDecimation (bool decimation)
+	{
+		meshDecimation = decimation;
+	}
+
+	bool getMeshDecimation (void)
+	{
+		return meshDecimation;
+	}
+
+	void setDecimationTargetTriangles (int target_triangles)
+	{
+		decimationTargetTriangles = target_triangles;
+	}
+
+	void setDecimationMaxError (double max_error)
+	{
+		decimationMaxError = max_error;
+	}
+
+	void setDualContouring (bool dual_contouring)
+	{
+		dualContouring = dual_contouring;
+	}
+
+	bool getDualContouring (void)
+	{
+		return dualContouring;
+	}
+
+	void setMeshLODLevels (int levels)
+	{
+		if (levels < 1 || levels > 8)
+		{
+			cout << endl << WARN << "The number of LOD levels must be in [1,8]; setting 1";
+			levels = 1;
+		}
+		meshLODLevels = levels;
+	}
+
+	int getMeshLODLevels (void)
+	{
+		return meshLODLevels;
+	}
+
 	void setMaxNumAtoms (int max_atoms)
 	{
 		maxNumAtoms = max_atoms;
@@ -398,6 +398,11 @@ is available*/
 extern fstream *errorStream;
 extern fstream *internals;
 
+// file formats of the saved epsmap, idebmap, status map and boundary grid points
+#define MAPS_FORMAT_TEXT 0
+#define MAPS_FORMAT_BINARY 1
+#define MAPS_FORMAT_RLE 2
+
 class Configuration
 {
 	public:
@@ -440,6 +445,7 @@ class Configuration
 		bool saveBgps;
 		bool saveStatusMap;
 		bool saveCavities;
+		int mapsFormat;
 
 		// global parameters
 		string operativeMode;
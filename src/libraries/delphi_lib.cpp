@@ -1,127 +1,262 @@
-// #ifdef DELPHI_BIND
-#include <DelphiShared.h>
-#include <SurfaceFactory.h>
-#include <logging.h>
-#include <main_functions.h>
-#include <memory>
-
-/** This is the DelPhi Fortran-C binding. Returns the number of bgp */
+#ifdef DELPHI_BIND
+
+#include "globals.h"
+#include "SurfaceFactory.h"
+#include "Surface.h"
+#include "DelphiShared.h"
+#include "ConfigFile.h"
+#include "main_functions.h"
+
 // check visual, borland c++, xlc, watcom, for windows
-#if (defined _WIN32) || (defined __WIN32__) || (defined __TOS_WIN__) || \
-    (defined __WINDOWS__)
-extern "C" __declspec(dllexport)
+#if  (defined _WIN32) || (defined __WIN32__) || (defined __TOS_WIN__) || (defined __WINDOWS__)
+	#define DELPHI_EXPORT extern "C" __declspec(dllexport)
 // linux,unix,apple,android
-#elif (defined __linux) || (defined __unix) || (defined macintosh) || \
-    (defined Macintosh) || (defined __APPLE__ && defined __MACH__) || \
-    (defined __ANDROID__)
-extern "C"
+#elif (defined __linux) || (defined __unix) || (defined macintosh) || (defined Macintosh) || (defined __APPLE__ && defined __MACH__) || (defined __ANDROID__)
+	#define DELPHI_EXPORT extern "C"
+#else
+	#define DELPHI_EXPORT
 #endif
 
-    void epsmakemodule(double xmin, double ymin, double zmin, double xmax,
-                       double ymax, double zmax, double c1, double c2,
-                       double c3, double rmax, double perf, int* i_epsmap,
-                       int igrid, double scale, double* i_scspos,
-                       double* i_scsnor, bool* i_idebmap, int* i_ibgp,
-                       int inside, int* ibnum, int natom, double* xn1,
-                       double* rad, int* d, int maxbgp, double probe,
-                       double exrad, char* atinf, int* atsurf) {
-
-  // check configuration consistency, init error stream and get configuration
-  ConfigFileOP cf = load(string("surfaceConfiguration.prm"));
-  ConfigurationOP conf = parse(cf);
-
-  // override settings coming from conf with that coming from DelPhi
-  // if (cf->keyExists("Grid_scale"))
-  //   cf->remove("Grid_scale");
-  // cf->add<double>("Grid_scale", scale);
-  // conf->scale = scale;
-
-  // if (cf->keyExists("Grid_perfil"))
-  //   cf->remove("Grid_perfil");
-  // cf->add<double>("Grid_perfil", perf);
-  // conf->perfill = perf;
-
-  conf->scale = scale;
-  conf->perfill = perf;
-
-  ConfigFile* cf2;
-  // get data from custom configuration file
-  try {
-    cf2 = new ConfigFile("custom.prm");
-  } catch (...) {
-    logging::log<logging::level::err>("Cannot read custom.prm");
-    exit(-1);
-  }
-  string mode = cf2->read<string>("Surface", "ses");
-  delete cf2;
-
-  if (cf->keyExists("Surface"))
-    cf->remove("Surface");
-
-  cf->add<string>("Surface", mode);
-  conf->surfName = mode;
-
-  if (conf->operativeMode == "normal") {
-    logging::log<logging::level::info>("Binding with DelPhi..");
-
-    // Set up delphi environment
-    // DelPhiShared *dg = new DelPhiShared();
-    DelPhiSharedOP dg = std::make_shared<DelPhiShared>();
-    dg->DelPhiBinding(xmin, ymin, zmin, xmax, ymax, zmax, c1, c2, c3, rmax,
-                      perf, i_epsmap, igrid, scale, i_scspos, i_scsnor,
-                      i_idebmap, i_ibgp, maxbgp, conf->buildStatus, atsurf);
-
-    // load atoms info if present
-    dg->loadAtoms(natom, xn1, rad, NULL, NULL, atinf);
-
-    // here only means populate epsilon map
-    dg->buildEpsmap(true);
-
-    logging::log<logging::level::info>("DelPhi grid is {}", igrid);
-
-    SurfaceOP surf = SurfaceFactory::getInstance().create(conf, dg);
-    surf->setProjBGP(true);
-    surf->setInsideCode(inside);
-
-    if (exrad > 0) {
-      logging::log<logging::level::info>("Setting Stern Layer -> {} Angstrom",
-                                         exrad);
-      surf->setSternLayer(exrad);
-    }
-
-    // normal protocol
-    normalMode(surf, dg, conf);
-
-    // avoid to destroy things that now belong to DelPhi
-    dg->finalizeBinding(ibnum);
-
-    logging::log<logging::level::info>("Cleaning memory...");
-
-    // delete surf;
-    // delete dg;
-
-    logging::log<logging::level::info>("ok!");
-    return;
-  }
-
-  // In this mode use the difference on grid operator to infer pockets and
-  // cavities (if requested)
-  else if (!conf->operativeMode.compare("pockets")) {
-    DelPhiShared::parseAtomInfo(atinf, conf->molFile, natom, xn1, rad);
-
-    pocketMode(true, conf, conf);
-
-    logging::log<logging::level::info>(
-        "Brute force exiting to avoid DelPhi solver");
-    logging::log<logging::level::info>("Closing {}", PROGNAME);
-    exit(-1);
-  } else {
-    logging::log<logging::level::info>("Unknown operative mode: {}",
-                                       conf->operativeMode);
-    exit(-1);
-  }
-
-  cite();
+
+/** @brief State kept by the DelPhi binding between the calls of a run. The configuration is parsed
+once. In focusing runs DelPhi asks for the surface of the same atoms on several grids: the last surface
+is kept and, if its build-up does not depend on the grid, it is only ray cast on the new one*/
+class EpsmakeContext
+{
+public:
+	ConfigFile *cf;
+	/** surface of the last call*/
+	Surface *surf;
+	/** grid of the last call. Its maps belong to DelPhi after finalizeBinding, it is kept only
+	because its sizes are needed to free the grid data of surf*/
+	DelPhiShared *dg;
+	/** atoms the surface was built on*/
+	vector<double> pos;
+	vector<double> radii;
+
+	EpsmakeContext()
+	{
+		cf = NULL;
+		surf = NULL;
+		dg = NULL;
+	}
+};
+
+static EpsmakeContext *defaultContext = NULL;
+
+
+static bool sameAtoms(EpsmakeContext *ctx,int natom,double *xn1,double *rad)
+{
+	if ((int)ctx->radii.size() != natom)
+		return false;
+
+	for (int i=0; i<natom; i++)
+		if (ctx->radii[i] != rad[i])
+			return false;
+
+	for (int i=0; i<3*natom; i++)
+		if (ctx->pos[i] != xn1[i])
+			return false;
+
+	return true;
+}
+
+
+/** Parse the configuration file and the surface type of custom.prm and return the context that
+has to be passed to epsmakemodule_context. The configuration is global, so only one context can be alive*/
+DELPHI_EXPORT void *epsmakemodule_context_create(const char *conf_file)
+{
+	EpsmakeContext *ctx = new EpsmakeContext();
+
+	// check configuration consistency, init error stream and get configuration
+	ctx->cf = init(string(conf_file));
+
+	ConfigFile *cf2;
+	// get data from custom configuration file
+	try
+	{
+		cf2 = new ConfigFile("custom.prm");
+	}
+	catch (...)
+	{
+		cout << endl << ERR << "Cannot read custom.prm";
+		cout.flush();
+		exit(-1);
+	}
+	string mode = cf2->read<string>("Surface", "ses");
+	delete cf2;
+
+	if (ctx->cf->keyExists("Surface"))
+		ctx->cf->remove("Surface");
+
+	ctx->cf->add<string>("Surface",mode);
+
+	return ctx;
+}
+
+
+DELPHI_EXPORT void epsmakemodule_context_destroy(void *context)
+{
+	EpsmakeContext *ctx = (EpsmakeContext*)context;
+
+	if (ctx == NULL)
+		return;
+
+	// the surface frees its grid data by the sizes of its grid
+	if (ctx->surf != NULL)
+		delete ctx->surf;
+	if (ctx->dg != NULL)
+		delete ctx->dg;
+
+	dispose(ctx->cf);
+	delete ctx;
+}
+
+
+/** This is the DelPhi Fortran-C binding on a context given by epsmakemodule_context_create.
+The number of bgp is returned in ibnum*/
+DELPHI_EXPORT void epsmakemodule_context(void *context,
+				   double xmin,double ymin,double zmin,
+				   double xmax,double ymax,double zmax,
+				   double c1,double c2,double c3, double rmax,double perf,
+				   int *i_epsmap,int igrid,double scale,double *i_scspos,
+				   double *i_scsnor,bool *i_idebmap,int *i_ibgp,int inside,int *ibnum,int natom,
+				   double *xn1,double *rad, int *d,int maxbgp,double probe,double exrad,char *atinf,int *atsurf)
+{
+	EpsmakeContext *ctx = (EpsmakeContext*)context;
+	ConfigFile *cf = ctx->cf;
+
+	// override settings coming from conf with that coming from DelPhi
+	if (cf->keyExists("Grid_scale"))
+		cf->remove("Grid_scale");
+	cf->add<double>("Grid_scale",scale);
+
+	if (cf->keyExists("Grid_perfil"))
+		cf->remove("Grid_perfil");
+	cf->add<double>("Grid_perfil",perf);
+
+	conf.scale = scale;
+	conf.perfill = perf;
+
+	if (conf.operativeMode == "normal")
+	{
+		cout << endl << INFO << "Binding with DelPhi...";
+
+		// Set up delphi environment
+		DelPhiShared *dg = new DelPhiShared();
+		dg->DelPhiBinding(	xmin,ymin,zmin,xmax,ymax,zmax,
+							c1,c2,c3,rmax,perf,
+							i_epsmap,igrid,scale,
+							i_scspos,i_scsnor,
+							i_idebmap,i_ibgp,
+							maxbgp,conf.buildStatus,atsurf);
+
+		// load atoms info if present
+		dg->loadAtoms(natom,xn1,rad,NULL,NULL,atinf);
+
+		// here only means populate epsilon map
+		dg->buildEpsmap(true);
+
+		cout << endl << INFO << "DelPhi grid is " << igrid;
+
+		// a focusing step on the same atoms keeps the build-up, if it does not depend on the grid
+		bool reuse = false;
+
+		if (ctx->surf != NULL && sameAtoms(ctx,natom,xn1,rad))
+		{
+			reuse = ctx->surf->retarget(dg);
+			if (!reuse)
+				cout << endl << INFO << "The surface build-up depends on the grid, building it again";
+		}
+
+		if (!reuse)
+		{
+			if (ctx->surf != NULL)
+				delete ctx->surf;
+
+			ctx->surf = surfaceFactory().create(cf, dg);
+			ctx->pos.assign(xn1,xn1+3*natom);
+			ctx->radii.assign(rad,rad+natom);
+		}
+
+		if (ctx->dg != NULL)
+			delete ctx->dg;
+		ctx->dg = dg;
+
+		Surface *surf = ctx->surf;
+		// projection of boundary grid points
+		surf->setProjBGP(true);
+		surf->setInsideCode(inside);
+
+		if (exrad > 0)
+		{
+			cout << endl << INFO << "Setting Stern Layer -> " << exrad << " Angstrom";
+			surf->setSternLayer(exrad);
+		}
+
+		// normal protocol
+		normalMode(surf, dg, !reuse);
+
+		// avoid to destroy things that now belong to DelPhi
+		dg->finalizeBinding(ibnum);
+
+		cout << endl << endl;
+		return;
+	}
+	// In this mode use the difference on grid operator to infer pockets and cavities (if requested)
+	else if (!conf.operativeMode.compare("pockets"))
+	{
+		DelPhiShared::parseAtomInfo(atinf,conf.molFile,natom,xn1,rad);
+
+		pocketMode(true, cf);
+
+		if (ctx == defaultContext)
+			defaultContext = NULL;
+		epsmakemodule_context_destroy(ctx);
+
+		cout << endl << INFO << "Brute force exiting to avoid DelPhi solver";
+		cout << endl << INFO << "Closing " << PROGNAME << "\n";
+		exit(-1);
+	}
+	else
+	{
+		cout << endl << INFO << "Unknown operative mode: " << conf.operativeMode;
+		exit(-1);
+	}
+}
+
+
+static void disposeDefaultContext(void)
+{
+	epsmakemodule_context_destroy(defaultContext);
+	defaultContext = NULL;
+}
+
+
+/** This is the DelPhi Fortran-C binding. Returns the number of bgp in ibnum.
+surfaceConfiguration.prm is parsed at the first call; the context lasts until the process exits*/
+DELPHI_EXPORT void epsmakemodule(double xmin,double ymin,double zmin,
+				   double xmax,double ymax,double zmax,
+				   double c1,double c2,double c3, double rmax,double perf,
+				   int *i_epsmap,int igrid,double scale,double *i_scspos,
+				   double *i_scsnor,bool *i_idebmap,int *i_ibgp,int inside,int *ibnum,int natom,
+				   double *xn1,double *rad, int *d,int maxbgp,double probe,double exrad,char *atinf,int *atsurf)
+// epsmap: per wise dielectric value
+// i_scspos: projected points on the n cells which are cut from the surface (unset, in this version)
+// i_scsnor: surface normals
+// i_idebmap: inside/outside map on inflated surface (screening out ions)
+// xn1: atoms' coords
+// probe: size of ball-like probe (water molecule)
+{
+	if (defaultContext == NULL)
+	{
+		defaultContext = (EpsmakeContext*)epsmakemodule_context_create("surfaceConfiguration.prm");
+		atexit(disposeDefaultContext);
+	}
+
+	epsmakemodule_context(defaultContext,xmin,ymin,zmin,xmax,ymax,zmax,c1,c2,c3,rmax,perf,
+						  i_epsmap,igrid,scale,i_scspos,i_scsnor,i_idebmap,i_ibgp,inside,ibnum,natom,
+						  xn1,rad,d,maxbgp,probe,exrad,atinf,atsurf);
 }
 
-// #endif
+#endif // DELPHI_BIND
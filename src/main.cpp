@@ -31,6 +31,7 @@
 #include "tools.h"
 #include "DelphiShared.h"
 #include "ConfigFile.h"
+#include "main_functions.h"
 
 #ifdef NS_TEST
 	#include "SkinSurface.h"
@@ -53,14 +54,6 @@ Vis vis;
 	boost::filesystem::path initialPath;
 #endif
 
-ConfigFile *init(string argv);
-void dispose(ConfigFile *cf);
-void stopDebug();
-void restartDebug();
-void cite();
-void normalMode(Surface *surf,DelPhiShared *dg);
-void membfitMode(Surface *surf,DelPhiShared *dg);
-void pocketMode(bool hasAtomInfo,ConfigFile *cf);
 
 
 class pocketWrapper
@@ -892,142 +885,6 @@ int main(int argc, char *argv[])
 #endif // DELPHI_BIND
 
 
-#ifdef DELPHI_BIND
-	
-	/** This is the DelPhi Fortran-C binding. Returns the number of bgp */
-	// check visual, borland c++, xlc, watcom, for windows
-	#if  (defined _WIN32) || (defined __WIN32__) || (defined __TOS_WIN__) || (defined __WINDOWS__)
-			extern "C" __declspec(dllexport)
-	// linux,unix,apple,android
-	#elif (defined __linux) || (defined __unix) || (defined macintosh) || (defined Macintosh) || (defined __APPLE__ && defined __MACH__) || (defined __ANDROID__)
-			extern "C"
-	#endif
-
-
-void epsmakemodule(double xmin,double ymin,double zmin,
-				   double xmax,double ymax,double zmax,
-				   double c1,double c2,double c3, double rmax,double perf,
-				   int *i_epsmap,int igrid,double scale,double *i_scspos,
-				   double *i_scsnor,bool *i_idebmap,int *i_ibgp,int inside,int *ibnum,int natom,
-				   double *xn1,double *rad, int *d,int maxbgp,double probe,double exrad,char *atinf,int *atsurf)
-// epsmap: per wise dielectric value
-// i_scspos: projected points on the n cells which are cut from the surface (unset, in this version)
-// i_scsnor: surface normals
-// i_idebmap: inside/outside map on inflated surface (screening out ions)
-// xn1: atoms' coords
-// probe: size of ball-like probe (water molecule)
-{
-	// check configuration consistency, init error stream and get configuration
-	ConfigFile *cf = init(string("surfaceConfiguration.prm"));
-
-	// override settings coming from conf with that coming from DelPhi
-	if (cf->keyExists("Grid_scale"))
-		cf->remove("Grid_scale");
-	cf->add<double>("Grid_scale",scale);
-
-	if (cf->keyExists("Grid_perfil"))
-		cf->remove("Grid_perfil");
-	cf->add<double>("Grid_perfil",perf);
-
-	conf.scale = scale;
-	conf.perfill = perf;
-
-	ConfigFile *cf2;
-	// get data from custom configuration file
-	try
-	{
-		cf2 = new ConfigFile("custom.prm");
-	}
-	catch (...)
-	{
-		cout << endl << ERR << "Cannot read custom.prm";
-		cout.flush();
-		exit(-1);
-	}
-	string mode = cf2->read<string>("Surface", "ses");
-	delete cf2;
-
-	if (cf->keyExists("Surface"))
-		cf->remove("Surface");
-
-	cf->add<string>("Surface",mode);
-
-	if (conf.operativeMode == "normal")
-	{
-		cout << endl << INFO << "Binding with DelPhi...";
-
-		// Set up delphi environment
-		DelPhiShared *dg = new DelPhiShared();
-		dg->DelPhiBinding(	xmin,ymin,zmin,xmax,ymax,zmax,
-							c1,c2,c3,rmax,perf,
-							i_epsmap,igrid,scale,
-							i_scspos,i_scsnor,
-							i_idebmap,i_ibgp,
-							maxbgp,conf.buildStatus,atsurf);
-
-		// load atoms info if present
-		dg->loadAtoms(natom,xn1,rad,NULL,NULL,atinf);
-
-		// here only means populate epsilon map
-		dg->buildEpsmap(true);
-
-		cout << endl << INFO << "DelPhi grid is " << igrid;
-
-		Surface *surf = surfaceFactory().create(cf, dg);
-		// projection of boundary grid points
-		surf->setProjBGP(true);
-		surf->setInsideCode(inside);
-
-		if (exrad > 0)
-		{
-			cout << endl << INFO << "Setting Stern Layer -> " << exrad << " Angstrom";
-			surf->setSternLayer(exrad);
-		}
-
-		// normal protocol
-		normalMode(surf, dg);
-
-		// avoid to destroy things that now belong to DelPhi
-		dg->finalizeBinding(ibnum);
-
-		cout << endl << INFO << "Cleaning memory...";
-		cout.flush();
-
-		delete surf;
-		delete dg;
-		
-		dispose(cf);
-
-		cout << "ok!";
-		cout << endl << endl;
-		return;
-	}
-	// In this mode use the difference on grid operator to infer pockets and cavities (if requested)
-	else if (!conf.operativeMode.compare("pockets"))
-	{
-		DelPhiShared::parseAtomInfo(conf.maxNumAtoms,atinf,conf.molFile,natom,xn1,rad);
-
-		pocketMode(true, cf);
-
-		dispose(cf);
-
-		cout << endl << INFO << "Brute force exiting to avoid DelPhi solver";
-		cout << endl << INFO << "Closing " << PROGNAME << "\n";
-		exit(-1);
-	}
-	else
-	{
-		cout << endl << INFO << "Unknown operative mode: " << conf.operativeMode;
-		exit(-1);
-	}
-
-	cite();
-	dispose(cf);
-	cout << endl << endl;
-}
-
-#endif // DELPHI_BIND
-
 // init streams, check configuration file for errors and read variables
 ConfigFile *init(string confFile)
 {
@@ -1180,6 +1037,18 @@ ConfigFile *init(string confFile)
 	conf.saveBgps = cf->read<bool>("Save_bgps", false);
 	conf.saveCavities = cf->read<bool>("Save_Cavities", false);
 
+	string maps_format = cf->read<string>("Save_Maps_Format", "text");
+	if (!maps_format.compare("binary"))
+		conf.mapsFormat = MAPS_FORMAT_BINARY;
+	else if (!maps_format.compare("rle"))
+		conf.mapsFormat = MAPS_FORMAT_RLE;
+	else
+	{
+		if (maps_format.compare("text"))
+			cout << endl << WARN << "Unknown Save_Maps_Format " << maps_format << ", saving maps as text";
+		conf.mapsFormat = MAPS_FORMAT_TEXT;
+	}
+
 	// globals
 	conf.sysName = cf->read<string>("Sys_Name","mol");
 	conf.numThreads = cf->read<int>("Number_thread", -1);
@@ -1250,7 +1119,7 @@ void cite()
 /** the set of operations in the usual mode of usage. This function is not responsible for
 Surface or grid memory. The caller is the responsible.*/
 // surface computation (?)
-void normalMode(Surface *surf, DelPhiShared *dg)
+void normalMode(Surface *surf, DelPhiShared *dg, bool build)
 {
 	if (conf.printAvailSurf)
 		surfaceFactory().print();
@@ -1267,13 +1136,18 @@ void normalMode(Surface *surf, DelPhiShared *dg)
 	// cout << endl << "Compute normals surf " << surf->getComputeNormals();
 
 	// Pre-process surface
-	bool outsurf = surf->build();
+	if (build)
+	{
+		bool outsurf = surf->build();
 
-	if (!outsurf)
-	{	
-		cout << endl << ERR << "Surface construction failed!" << endl;
-		exit(-1);
+		if (!outsurf)
+		{	
+			cout << endl << ERR << "Surface construction failed!" << endl;
+			exit(-1);
+		}
 	}
+	else
+		cout << endl << INFO << "Reusing the surface build-up";
 
 	// Build DelPhi stuff
 	surf->getSurf(&surf_volume, conf.optimizeGrids, conf.fillCavities, conf.cavVol);
@@ -0,0 +1,25 @@
+//---------------------------------------------------------
+/**    @file	main_functions.h
+*     @brief	main_functions.h declares the set up and the operative modes
+*               of main.cpp, shared by the executable and the DelPhi binding	*/
+//---------------------------------------------------------
+
+#ifndef main_functions_h
+#define main_functions_h
+
+#include "Surface.h"
+#include "DelphiShared.h"
+#include "ConfigFile.h"
+
+/** init streams, check the configuration file for errors and read the global configuration*/
+ConfigFile *init(string argv);
+void dispose(ConfigFile *cf);
+void stopDebug();
+void restartDebug();
+void cite();
+/** if build is false the surface is assumed to be already built on the atoms of dg*/
+void normalMode(Surface *surf,DelPhiShared *dg,bool build=true);
+void membfitMode(Surface *surf,DelPhiShared *dg);
+void pocketMode(bool hasAtomInfo,ConfigFile *cf);
+
+#endif
@@ -9,6 +9,9 @@ using namespace NS;
 #define CONFIG (static_cast<ConfigFile*>(cf))
 #define DS (static_cast<DelPhiShared*>(ds))
 
+// number of chunks of rays per thread in castAxisOrientedRays, for load balancing
+#define RAYS_CHUNKS_PER_THREAD 8
+
 #ifdef ENABLE_CGAL 
 	#ifdef CGAL_LINKED_WITH_TBB
 		# include <tbb/global_control.h>
@@ -40,6 +43,9 @@ void NanoShaper::initConstructor( const std::vector<Atom> &ats,
     collectGridRays = false;
     optimizeGrids = true;
     grid_tol = 1e-2;
+    randDisplacement = -1;
+    batchOrigins = nullptr;
+    batchEnds = nullptr;
     
     initConfig(configFile);
     // copy the atoms internally
@@ -262,7 +268,7 @@ short NanoShaper::castAxisOrientedRay(double *pa, double coord, std::vector<std:
 
     std::vector<std::pair<VERTEX_TYPE,VERTEX_TYPE*>> intersecs;
 
-	SURF->getRayIntersection(pa,pb,intersecs,computeNormals,0);
+	size_t used = intersectSurface(pa,pb,intersecs,computeNormals,0);
 
     if (intersecs.size() == 0)
 		return -1;
@@ -281,19 +287,262 @@ short NanoShaper::castAxisOrientedRay(double *pa, double coord, std::vector<std:
             std::pair<VERTEX_TYPE,VERTEX_TYPE*> pp;
             // put the intersection coordinate
             pp.first = a;
-            pp.second = itt->second;
+            pp.second = NULL;
+            // the normal points into the surface buffer: the caller gets its own copy
+            if (itt->second != NULL)
+            {
+                pp.second = allocateVector<VERTEX_TYPE>(3);
+                pp.second[0] = itt->second[0];
+                pp.second[1] = itt->second[1];
+                pp.second[2] = itt->second[2];
+            }
             // keep the intersection
             intersections.push_back(pp);
             lastValid = a;
         }
-        else
+    }
+    SURF->getNormalsBuffer(0).resize(used);
+    return 1;
+}
+
+
+size_t NanoShaper::intersectSurface(double *pa, double *pb, std::vector<std::pair<VERTEX_TYPE,VERTEX_TYPE*>> &intersections, bool computeNormals, int thread_id)
+{
+    // the surface appends the normals to its buffer and returns pointers into it.
+    // If the buffer had to grow while casting, the first ones got stale: cast again, it does not grow twice.
+    // The caller copies the normals and gives the buffer back by resizing it to the returned size
+    std::vector<VERTEX_TYPE> &normalsBuffer = SURF->getNormalsBuffer(thread_id);
+    size_t used = normalsBuffer.size(), capacity;
+    do
+    {
+        capacity = normalsBuffer.capacity();
+        normalsBuffer.resize(used);
+        intersections.clear();
+        SURF->getRayIntersection(pa,pb,intersections,computeNormals,thread_id);
+    }
+    while (normalsBuffer.capacity() != capacity);
+
+    return used;
+}
+
+
+int64_t NanoShaper::castAxisOrientedRays(unsigned direction, const double *origins, const double *ends, int64_t num_rays,
+                                         int64_t *offsets, double *hits, double *normals, int64_t capacity)
+{
+    if (origins == nullptr || ends == nullptr)
+    {
+        std::cout << ERR << "Rays origins and ends are needed";
+        return -1;
+    }
+
+    batchOrigins = origins;
+    batchEnds = ends;
+
+    int64_t total = castRays(direction,num_rays,offsets,hits,normals,capacity);
+
+    batchOrigins = nullptr;
+    batchEnds = nullptr;
+
+    return total;
+}
+
+
+int64_t NanoShaper::castPanelRays(unsigned direction, int64_t *offsets, double *hits, double *normals, int64_t capacity)
+{
+    if (ds == nullptr || DS->x == nullptr)
+    {
+        std::cout << ERR << "Please compute a surface before casting rays";
+        return -1;
+    }
+
+    int64_t num_rays;
+
+    if (direction == 0)
+        num_rays = (int64_t)DS->ny*DS->nz;
+    else if (direction == 1)
+        num_rays = (int64_t)DS->nx*DS->nz;
+    else
+        num_rays = (int64_t)DS->nx*DS->ny;
+
+    batchOrigins = nullptr;
+    batchEnds = nullptr;
+
+    return castRays(direction,num_rays,offsets,hits,normals,capacity);
+}
+
+
+void NanoShaper::getBatchRay(int64_t r, double *pa, double *coord)
+{
+    if (batchOrigins != nullptr)
+    {
+        pa[0] = batchOrigins[3*r];
+        pa[1] = batchOrigins[3*r+1];
+        pa[2] = batchOrigins[3*r+2];
+        *coord = batchEnds[r];
+        return;
+    }
+
+    // ray of the grid panel
+    if (batchDirection == 0)
+    {
+        pa[0] = DS->x[0];
+        pa[1] = DS->y[r % DS->ny];
+        pa[2] = DS->z[r / DS->ny];
+        *coord = DS->x[DS->nx-1];
+    }
+    else if (batchDirection == 1)
+    {
+        pa[0] = DS->x[r % DS->nx];
+        pa[1] = DS->y[0];
+        pa[2] = DS->z[r / DS->nx];
+        *coord = DS->y[DS->ny-1];
+    }
+    else
+    {
+        pa[0] = DS->x[r % DS->nx];
+        pa[1] = DS->y[r / DS->nx];
+        pa[2] = DS->z[0];
+        *coord = DS->z[DS->nz-1];
+    }
+}
+
+
+int64_t NanoShaper::castRays(unsigned direction, int64_t num_rays, int64_t *offsets, double *hits, double *normals, int64_t capacity)
+{
+    if (panelResolver(direction) < 0)
+        return -1;
+
+    if (surf == nullptr)
+    {
+        std::cout << ERR << "Please compute a surface before casting rays";
+        return -1;
+    }
+
+    if (offsets == nullptr || num_rays < 0)
+    {
+        std::cout << ERR << "Rays offsets are needed";
+        return -1;
+    }
+
+    // panel data structures are built once per direction
+    if (currentPanel != panelResolver(direction))
+        setDirection(direction);
+
+    batchDirection = direction;
+    batchNormals = (normals != nullptr);
+
+    // the surfaces have per thread ray casting buffers for conf.numThreads threads
+    int num_threads = MAX(1, conf.numThreads);
+    int64_t num_chunks = MIN(num_rays, (int64_t)num_threads*RAYS_CHUNKS_PER_THREAD);
+
+    std::vector<RaysChunk> chunks(num_chunks);
+
+    for (int64_t c=0; c<num_chunks; c++)
+    {
+        chunks[c].first = num_rays*c/num_chunks;
+        chunks[c].last = num_rays*(c+1)/num_chunks;
+    }
+
+    offsets[0] = 0;
+
+    #ifdef ENABLE_BOOST_THREADS
+    boost::thread_group thdGroup;
+    for (int j=0; j<num_threads; j++)
+        thdGroup.create_thread(boost::bind(&NanoShaper::castRaysChunks, this, &chunks, offsets, j, num_threads));
+    thdGroup.join_all();
+    #else
+    castRaysChunks(&chunks, offsets, 0, 1);
+    #endif
+
+    // each ray wrote its number of hits, turn them into offsets
+    for (int64_t r=0; r<num_rays; r++)
+        offsets[r+1] += offsets[r];
+
+    int64_t total = offsets[num_rays];
+
+    if (total > capacity || (hits == nullptr && total > 0))
+        return total;
+
+    #ifdef ENABLE_BOOST_THREADS
+    boost::thread_group thdGroup2;
+    for (int j=0; j<num_threads; j++)
+        thdGroup2.create_thread(boost::bind(&NanoShaper::copyRaysChunks, this, &chunks, offsets, hits, normals, j, num_threads));
+    thdGroup2.join_all();
+    #else
+    copyRaysChunks(&chunks, offsets, hits, normals, 0, 1);
+    #endif
+
+    return total;
+}
+
+
+void NanoShaper::castRaysChunks(std::vector<RaysChunk> *chunks, int64_t *offsets, int thread_id, int num_threads)
+{
+    std::vector<std::pair<VERTEX_TYPE,VERTEX_TYPE*>> intersections;
+    unsigned dir = batchDirection;
+    double pa[3], pb[3], coord;
+
+    for (int64_t c=thread_id; c<(int64_t)chunks->size(); c+=num_threads)
+    {
+        RaysChunk &chunk = (*chunks)[c];
+
+        for (int64_t r=chunk.first; r<chunk.last; r++)
         {
-            // discard the intersection and delete the normal if present
-            if (computeNormals)
-                delete itt->second;
+            int64_t count = 0;
+
+            getBatchRay(r,pa,&coord);
+
+            // rays not going forward have no hits
+            if (pa[dir] < coord)
+            {
+                pb[0] = pa[0];
+                pb[1] = pa[1];
+                pb[2] = pa[2];
+                pb[dir] = coord;
+
+                size_t used = intersectSurface(pa,pb,intersections,batchNormals,thread_id);
+
+                double lastValid = INFINITY;
+
+                // same clean up of castAxisOrientedRay: too near intersections are removed
+                for (unsigned int l=0; l<intersections.size(); l++)
+                {
+                    double a = pa[dir] + (coord-pa[dir])*intersections[l].first;
+                    VERTEX_TYPE *n = intersections[l].second;
+
+                    if (fabs(a-lastValid) >= EPS_INT)
+                    {
+                        chunk.hits.push_back(a);
+                        if (batchNormals)
+                        {
+                            chunk.normals.push_back(n != NULL ? n[0] : 0.);
+                            chunk.normals.push_back(n != NULL ? n[1] : 0.);
+                            chunk.normals.push_back(n != NULL ? n[2] : 0.);
+                        }
+                        lastValid = a;
+                        count++;
+                    }
+                }
+                SURF->getNormalsBuffer(thread_id).resize(used);
+            }
+            offsets[r+1] = count;
         }
     }
-    return 1;
+}
+
+
+void NanoShaper::copyRaysChunks(std::vector<RaysChunk> *chunks, const int64_t *offsets, double *hits, double *normals, int thread_id, int num_threads)
+{
+    for (int64_t c=thread_id; c<(int64_t)chunks->size(); c+=num_threads)
+    {
+        RaysChunk &chunk = (*chunks)[c];
+        int64_t first = offsets[chunk.first];
+
+        if (!chunk.hits.empty())
+            memcpy(hits+first, chunk.hits.data(), chunk.hits.size()*sizeof(double));
+        if (normals != nullptr && !chunk.normals.empty())
+            memcpy(normals+3*first, chunk.normals.data(), chunk.normals.size()*sizeof(double));
+    }
 }
 
 
@@ -364,10 +613,167 @@ bool NanoShaper::buildAnalyticalSurface(double randDisplacement)
     if (randDisplacement >= 0)
         ss->setRandDisplacement(randDisplacement);
 
+    this->randDisplacement = randDisplacement;
+    currentPanel = -1;
+
     return ss->build();
 }
 
 
+bool NanoShaper::updateCoordinates(const double *pos)
+{
+    if (pos == nullptr || atoms.size() == 0)
+    {
+        std::cout << ERR << "No atoms to move";
+        return false;
+    }
+
+    for (unsigned i=0; i<atoms.size(); i++)
+    {
+        atoms[i].pos[0] = pos[3*i];
+        atoms[i].pos[1] = pos[3*i+1];
+        atoms[i].pos[2] = pos[3*i+2];
+    }
+
+    if (ds != nullptr)
+        return DS->setCoordinates(pos);
+
+    return true;
+}
+
+
+bool NanoShaper::rebuild(bool colour, double *surf_volume)
+{
+    rebuildTimes = RebuildTimes();
+
+    auto chrono_start = chrono::high_resolution_clock::now();
+
+    bool ok;
+
+    // nothing to keep yet
+    if (ds == nullptr)
+        ok = buildAnalyticalSurface(randDisplacement);
+    else
+    {
+        // the colouring and triangulation data are sized by the current grid, free them before it changes
+        if (surf != nullptr)
+            SURF->clearGridData();
+
+        // the SES and skin build-ups cannot be built again on the same object, those surfaces are
+        // created again; the others are kept and build() replaces their build-up
+        string surfaceName = CONFIG->read<string>("Surface");
+        if (surf != nullptr && (surfaceName == "ses" || surfaceName == "skin"))
+        {
+            delete SURF;
+            surf = nullptr;
+        }
+
+        ok = DS->updateGrid(&rebuildTimes.gridKept);
+
+        auto chrono_grid = chrono::high_resolution_clock::now();
+        rebuildTimes.grid = chrono::duration<double>(chrono_grid - chrono_start).count();
+
+        if (!ok)
+            return false;
+
+        if (surf == nullptr)
+        {
+            Surface *ss = surfaceFactory().create(CONFIG,DS);
+            surf = ss;
+
+            if (randDisplacement >= 0)
+                ss->setRandDisplacement(randDisplacement);
+        }
+        currentPanel = -1;
+
+        ok = SURF->build();
+    }
+
+    auto chrono_surface = chrono::high_resolution_clock::now();
+    rebuildTimes.surface = chrono::duration<double>(chrono_surface - chrono_start).count() - rebuildTimes.grid;
+
+    if (!ok || !colour)
+        return ok;
+
+    double volume;
+    ok = colourGrid(&volume);
+
+    if (surf_volume != nullptr)
+        *surf_volume = volume;
+
+    auto chrono_end = chrono::high_resolution_clock::now();
+    rebuildTimes.colouring = chrono::duration<double>(chrono_end - chrono_surface).count();
+
+    return ok;
+}
+
+
+bool NanoShaper::focus(double scale, const double *coord_min, const double *coord_max, bool colour, double *surf_volume)
+{
+    if (surf == nullptr || ds == nullptr)
+    {
+        std::cout << ERR << "Build the surface before focusing";
+        return false;
+    }
+
+    double cmin[3] = {coord_min[0],coord_min[1],coord_min[2]};
+    double cmax[3] = {coord_max[0],coord_max[1],coord_max[2]};
+
+    // the grid of the box is built without exiting on failure, the current one is kept then
+    DelPhiShared *dsl = new DelPhiShared();
+    if (!dsl->init(scale,
+                   cmin,cmax,
+                   atoms,
+                   CONFIG->read<int>("Max_Num_Atoms"),
+                   CONFIG->read<double>("Domain_Shrinkage"),
+                   CONFIG->read<bool>("Optimize_Grids"),
+                   CONFIG->read<bool>("Build_epsilon_maps"),
+                   CONFIG->read<bool>("Build_status_map"),
+                   CONFIG->read<bool>("Multi_Dielectric"),this->grid_tol))
+    {
+        delete dsl;
+        return false;
+    }
+
+    // the surface frees its data on the old grid, so it is deleted afterwards
+    bool ok = SURF->retarget(dsl);
+
+    if (!ok)
+    {
+        std::cout << INFO << "The surface build-up depends on the grid, building it again";
+        delete SURF;
+        surf = nullptr;
+    }
+
+    delete DS;
+    ds = dsl;
+    currentPanel = -1;
+
+    if (!ok)
+    {
+        Surface *ss = surfaceFactory().create(CONFIG,DS);
+        surf = ss;
+
+        if (randDisplacement >= 0)
+            ss->setRandDisplacement(randDisplacement);
+
+        if (!ss->build())
+            return false;
+    }
+
+    if (!colour)
+        return true;
+
+    double volume;
+    ok = colourGrid(&volume);
+
+    if (surf_volume != nullptr)
+        *surf_volume = volume;
+
+    return ok;
+}
+
+
 bool NanoShaper::triangulate(double *surf_area)
 {
     if (surf != nullptr && ds != nullptr)
@@ -693,14 +1099,19 @@ bool NanoShaper::colourGrid(double *surf_volume)
 
 void NanoShaper::clean()
 {
-    if (CONFIG != nullptr)
-        delete CONFIG;
+    // the surface releases its grids by the DelPhi sizes, delete it first
+    if (SURF != nullptr)
+        delete SURF;
 
     if (DS != nullptr)
         delete DS;
 
-    if (SURF != nullptr)
-        delete SURF;
+    if (CONFIG != nullptr)
+        delete CONFIG;
+
+    surf = nullptr;
+    ds = nullptr;
+    cf = nullptr;
 }
 
 
@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <string>
 #include <math.h>
+#include <stdint.h>
 #include "raytracer_datatype.h"
 
 
@@ -291,6 +292,39 @@ public:
 
 };
 
+/**@brief Hits of a contiguous range of rays cast by NanoShaper::castAxisOrientedRays, staged
+by the thread that casts them before being copied in the caller buffers*/
+class RaysChunk
+{
+public:
+    int64_t first;
+    int64_t last;
+    std::vector<double> hits;
+    std::vector<double> normals;
+};
+
+/**@brief Wall clock times in seconds of the steps of the last NanoShaper::rebuild*/
+class RebuildTimes
+{
+public:
+    /** grid update: maps reset or new grid*/
+    double grid;
+    /** analytical surface build*/
+    double surface;
+    /** grid colouring, 0 if not requested*/
+    double colouring;
+    /** true if the grid and its maps were kept*/
+    bool gridKept;
+
+    RebuildTimes()
+    {
+        grid = 0.;
+        surface = 0.;
+        colouring = 0.;
+        gridKept = false;
+    }
+};
+
 class NanoShaper
 {
 private:
@@ -312,6 +346,24 @@ private:
     bool optimizeGrids;
     /* tolerance on the NextGenPB grid check*/
     double grid_tol;
+    /** random displacement of the last buildAnalyticalSurface, applied again by rebuild*/
+    double randDisplacement;
+    RebuildTimes rebuildTimes;
+    /** rays of the current batch: origins (or NULL for the grid panel) and end coordinates */
+    const double *batchOrigins;
+    const double *batchEnds;
+    unsigned batchDirection;
+    bool batchNormals;
+    /** cast a ray on the surface. Its normals point into the surface buffer of thread_id, which
+    must be brought back to the returned size once they have been copied */
+    size_t intersectSurface(double *pa,double *pb,std::vector<std::pair<VERTEX_TYPE,VERTEX_TYPE*> > &intersections,bool computeNormals,int thread_id);
+    /** origin and end coordinate of the ray r of the current batch */
+    void getBatchRay(int64_t r,double *pa,double *coord);
+    /** cast the rays of the chunks thread_id, thread_id+num_threads, ... */
+    void castRaysChunks(std::vector<RaysChunk> *chunks,int64_t *offsets,int thread_id,int num_threads);
+    /** copy the hits of the chunks thread_id, thread_id+num_threads, ... at their offsets */
+    void copyRaysChunks(std::vector<RaysChunk> *chunks,const int64_t *offsets,double *hits,double *normals,int thread_id,int num_threads);
+    int64_t castRays(unsigned direction,int64_t num_rays,int64_t *offsets,double *hits,double *normals,int64_t capacity);
     
     
 public :
@@ -349,12 +401,56 @@ public :
     +1 intersections are returned, possibly 0.
     Please consider that no parity check is done here; the only clean-up done is that pathologically near
     intersections are removed as done internally by nanoshaper. No assumptions is made on the parity, is up
-    to the caller to perfoms consistency checks where needed. */
+    to the caller to perfoms consistency checks where needed.
+    If computeNormals is true the normal of each kept intersection, if any, is a copy owned by the caller,
+    to be freed with deleteVector. */
     short castAxisOrientedRay(double *pa,double coord,std::vector<std::pair<VERTEX_TYPE,VERTEX_TYPE*> > &inters,unsigned direction,bool computeNormals=false);
 
+    /**Cast num_rays rays along the positive direction (0=x,1=y,2=z) in parallel. Ray r starts at
+    origins[3*r],origins[3*r+1],origins[3*r+2] and ends where its direction coordinate is ends[r].
+    The hits of ray r, cleaned up as in castAxisOrientedRay, are hits[offsets[r]] ... hits[offsets[r+1]-1]
+    (coordinate along the direction) and, if normals is not NULL, the corresponding triplets of normals.
+    offsets must hold num_rays+1 values. The current direction is set if needed, thus calls in the same
+    direction should be grouped. It returns the total number of hits, -1 on errors. If it is larger than
+    capacity only offsets are written: call it again with larger buffers. No memory is allocated per hit:
+    the normals computed by the surface are copied out of its per thread buffers*/
+    int64_t castAxisOrientedRays(unsigned direction,const double *origins,const double *ends,int64_t num_rays,
+                                 int64_t *offsets,double *hits,double *normals,int64_t capacity);
+
+    /**Cast all the grid rays along direction as castAxisOrientedRays, from the first to the last grid
+    point. The rays are ordered as the grid points of the panel, with the lower index axis fastest:
+    y,z for x rays, x,z for y rays and x,y for z rays. offsets must hold n1*n2+1 values*/
+    int64_t castPanelRays(unsigned direction,int64_t *offsets,double *hits,double *normals,int64_t capacity);
+
     /**Computes the analytical rapresentation of the surface without performing grid colouring, nor triangulation*/
     bool buildAnalyticalSurface(double randDisplacement=-1);  
     
+    /**Move the atoms to the xyz triplets in pos (one per atom, in the order of the constructor).
+    Call rebuild to get the surface of the moved atoms*/
+    bool updateCoordinates(const double *pos);
+
+    /**Build the surface of the current atoms again keeping the configuration and, if the atoms
+    still fit in it, the grid and its maps, which are reset instead of allocated again.
+    The surface object is kept and built again on the moved atoms, except the SES and skin ones,
+    which are created again.
+    If colour is true the grid is coloured too and the volume is returned in surf_volume if not null.
+    The direction of ray casting has to be set again. Timings are given by getRebuildTimes*/
+    bool rebuild(bool colour=true,double *surf_volume=nullptr);
+
+    /**Move to a finer (or just different) grid of the given scale on the box [coord_min,coord_max],
+    as in DelPhi focusing. The atoms are the same, so if the surface allows it (see Surface::retarget)
+    its build-up is kept and only ray cast on the new grid; otherwise it is built again. Only the implicit
+    surfaces keep it, the SES and skin surfaces are built again from scratch.
+    If the new grid cannot be built false is returned and the current grid and surface are kept.
+    If colour is true the new grid is coloured and the volume returned in surf_volume*/
+    bool focus(double scale,const double *coord_min,const double *coord_max,bool colour=true,double *surf_volume=nullptr);
+
+    /** times of the last rebuild*/
+    const RebuildTimes &getRebuildTimes()
+    {
+        return rebuildTimes;
+    }
+
     /**Colour the NS internal grids with the in/out information*/
     bool colourGrid(void);
 	bool colourGrid(double *surf_volume);
@@ -418,6 +514,9 @@ public :
     NanoShaper()
     {
         currentPanel = -1;        
+        randDisplacement = -1;
+        batchOrigins = nullptr;
+        batchEnds = nullptr;
     }    
     ~NanoShaper () = default;
 
@@ -1,6 +1,14 @@
 
 #include "tools.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define USE_MMAP
+#endif
+
 
 /**@brief ascending on first VERTEX_TYPE of pair<VERTEX_TYPE,VERTEX_TYPE*> comparator*/
 bool compKeepIndex(pair<VERTEX_TYPE,VERTEX_TYPE*> a, pair<VERTEX_TYPE,VERTEX_TYPE*> b)
@@ -1189,6 +1197,213 @@ void getMemSpace (double &current_mem_in_MB, double &peak_mem_in_MB)
 }
 
 
+char *mapFile(const char *fileName, size_t &size)
+{
+	size = 0;
+
+	#if defined(USE_MMAP)
+	int fd = open(fileName, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0)
+	{
+		close(fd);
+		return NULL;
+	}
+	void *data = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	// the mapping stays valid after closing the descriptor
+	close(fd);
+
+	if (data == MAP_FAILED)
+		return NULL;
+
+	madvise(data, (size_t)st.st_size, MADV_WILLNEED);
+
+	size = (size_t)st.st_size;
+	return (char*)data;
+	#else
+	FILE *fp = fopen(fileName, "rb");
+	if (fp == NULL)
+		return NULL;
+
+	fseek(fp, 0, SEEK_END);
+	long len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	if (len <= 0)
+	{
+		fclose(fp);
+		return NULL;
+	}
+	char *data = allocateVector<char>(len);
+	if (data == NULL || fread(data, 1, len, fp) != (size_t)len)
+	{
+		if (data != NULL)
+			deleteVector<char>(data);
+		fclose(fp);
+		return NULL;
+	}
+	fclose(fp);
+
+	size = (size_t)len;
+	return data;
+	#endif
+}
+
+
+void unmapFile(char *&data, size_t size)
+{
+	if (data == NULL)
+		return;
+
+	#if defined(USE_MMAP)
+	munmap(data, size);
+	data = NULL;
+	#else
+	deleteVector<char>(data);
+	#endif
+}
+
+
+bool parseDouble(const char *&p, const char *end, double &val)
+{
+	// powers of ten exactly representable in double
+	static const double pow10[23] = {1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,1e11,
+									 1e12,1e13,1e14,1e15,1e16,1e17,1e18,1e19,1e20,1e21,1e22};
+
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+		p++;
+	if (p >= end)
+		return false;
+
+	const char *start = p;
+	bool negative = false;
+
+	if (*p == '-' || *p == '+')
+	{
+		negative = (*p == '-');
+		p++;
+	}
+
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0;
+	bool found = false;
+
+	while (p < end && *p >= '0' && *p <= '9')
+	{
+		if (digits < 19)
+		{
+			mantissa = mantissa*10 + (*p-'0');
+			if (mantissa != 0)
+				digits++;
+		}
+		else
+			exponent++;
+		found = true;
+		p++;
+	}
+	if (p < end && *p == '.')
+	{
+		p++;
+		while (p < end && *p >= '0' && *p <= '9')
+		{
+			if (digits < 19)
+			{
+				mantissa = mantissa*10 + (*p-'0');
+				if (mantissa != 0)
+					digits++;
+				exponent--;
+			}
+			found = true;
+			p++;
+		}
+	}
+	if (found && p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char *q = p+1;
+		bool neg_exp = false;
+
+		if (q < end && (*q == '-' || *q == '+'))
+		{
+			neg_exp = (*q == '-');
+			q++;
+		}
+		if (q < end && *q >= '0' && *q <= '9')
+		{
+			int e = 0;
+			while (q < end && *q >= '0' && *q <= '9')
+			{
+				if (e < 10000)
+					e = e*10 + (*q-'0');
+				q++;
+			}
+			exponent += neg_exp ? -e : e;
+			p = q;
+		}
+	}
+
+	// a product or quotient of two exact values is correctly rounded; anything else
+	// (long mantissas, large exponents, inf/nan) goes through strtod
+	if (found && mantissa < ((uint64_t)1 << 53) && exponent >= -22 && exponent <= 22)
+	{
+		double v = (double)mantissa;
+		v = (exponent < 0) ? v / pow10[-exponent] : v * pow10[exponent];
+		val = negative ? -v : v;
+		return true;
+	}
+
+	char buffer[128];
+	const char *q = start;
+	int len = 0;
+
+	while (q < end && len < 127 && *q != ' ' && *q != '\t' && *q != '\r' && *q != '\n')
+		buffer[len++] = *q++;
+	buffer[len] = '\0';
+
+	char *stop;
+	val = strtod(buffer, &stop);
+	if (stop == buffer)
+	{
+		p = start;
+		return false;
+	}
+	p = start + (stop - buffer);
+	return true;
+}
+
+
+bool parseInt(const char *&p, const char *end, int &val)
+{
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+		p++;
+
+	const char *start = p;
+	bool negative = false;
+
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = (*p == '-');
+		p++;
+	}
+	if (p >= end || *p < '0' || *p > '9')
+	{
+		p = start;
+		return false;
+	}
+
+	int64_t v = 0;
+	while (p < end && *p >= '0' && *p <= '9')
+	{
+		v = v*10 + (*p-'0');
+		p++;
+	}
+	val = (int)(negative ? -v : v);
+	return true;
+}
+
+
 void initTBB (int num_threads)
 {
 	// auto mp = tbb::global_control::max_allowed_parallelism;
@@ -601,6 +601,25 @@ inline int getUnrolledFineID(const int64_t fine_x, const int64_t fine_y, const i
 	return (fine_z<<4) | (fine_y<<2) | fine_x;
 }
 
+/** This function spreads the lowest 21 bits of v so that two zero bits separate consecutive bits */
+inline uint64_t spreadBits3(uint64_t v)
+{
+	v &= 0x1fffff;
+	v = (v | (v << 32)) & 0x1f00000000ffffULL;
+	v = (v | (v << 16)) & 0x1f0000ff0000ffULL;
+	v = (v | (v << 8))  & 0x100f00f00f00f00fULL;
+	v = (v | (v << 4))  & 0x10c30c30c30c30c3ULL;
+	v = (v | (v << 2))  & 0x1249249249249249ULL;
+	return v;
+}
+
+/** This function returns the Morton (Z-order) code of the grid indexes i,j,k (up to 2^21 per axis):
+points that are near along the code are near in space */
+inline uint64_t getMortonCode(const int64_t i, const int64_t j, const int64_t k)
+{
+	return spreadBits3((uint64_t)i) | (spreadBits3((uint64_t)j) << 1) | (spreadBits3((uint64_t)k) << 2);
+}
+
 /** This function allocates data of bilevel grids in which each large coarse cell is comprised of
 4^3 mini-cells. */
 template<class T> T **allocateBilevelGridCells(const int64_t nx,const int64_t ny,const int64_t nz,const int64_t nl)
@@ -1559,6 +1578,29 @@ template<class T>  T **allocateMatrix2D(int64_t nrows,int64_t ncols)
 	return t;
 }
 
+/** allocate a 2D matrix whose rows are stored in a single contiguous block. It is indexed as the
+matrices of allocateMatrix2D but must be freed with deleteContiguousMatrix2D*/
+template<class T>  T **allocateContiguousMatrix2D(int64_t nrows,int64_t ncols)
+{
+	T **t = (T **)malloc(sizeof(T *)*MAX(nrows,1));
+	if (t == NULL)
+	{
+		cout << endl << ERR << "Not enough memory to allocate 2D matrix ";
+		return NULL;
+	}
+	t[0] = (T *)malloc(sizeof(T)*MAX(nrows*ncols,1));
+	if (t[0] == NULL)
+	{
+		free(t);
+		cout << endl << ERR << "Not enough memory to allocate 2D matrix ";
+		return NULL;
+	}
+	for (int64_t i=1; i<nrows; i++)
+		t[i] = t[0] + i*ncols;
+
+	return t;
+}
+
 template<class T>  T ***allocateMatrix3D(int64_t nx,int64_t ny,int64_t nz)
 {
 	T ***t = (T***)malloc(sizeof(T **)*nz);
@@ -1617,6 +1659,20 @@ template<class T> void deleteMatrix2D(int64_t nrows,int64_t ncols,T **&t)
 	}
 }
 
+template<class T> void deleteContiguousMatrix2D(T **&t)
+{
+	if (t != NULL)
+	{
+		free(t[0]);
+		free(t);
+		t = NULL;
+	}
+	else
+	{
+		cout << endl << WARN << "Attempting to de-allocate a null vector!";
+	}
+}
+
 template<class T> void deleteMatrix3D(int64_t nx,int64_t ny,int64_t nz,T ***&t)
 {
 	if (t != NULL)
@@ -1858,6 +1914,17 @@ void projectToSphere(const double *const y,const double *const center,const doub
 
 void getMemSpace (double &current_mem_in_MB, double &peak_mem_in_MB);
 
+/** map a whole file in memory as a private, copy on write, region. Where memory mapping is not
+available the file is read into a buffer. Returns NULL if the file cannot be read or is empty*/
+char *mapFile(const char *fileName, size_t &size);
+/** release a region obtained by mapFile*/
+void unmapFile(char *&data, size_t size);
+/** parse a decimal number starting at p, skipping leading blanks, and advance p after it.
+The common case is resolved exactly without strtod; returns false if no number is found before end*/
+bool parseDouble(const char *&p, const char *end, double &val);
+/** integer counterpart of parseDouble*/
+bool parseInt(const char *&p, const char *end, int &val);
+
 #if defined(ENABLE_CGAL) && defined(CGAL_LINKED_WITH_TBB)
 void initTBB (int num_threads);
 #endif
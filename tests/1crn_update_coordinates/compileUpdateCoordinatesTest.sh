@@ -0,0 +1,3 @@
+# example for compiling, after building the NanoShaper library with CMakeLists_so.txt in ../../build_so/
+ g++ -L../../build_so/ -I../../src/ -o update_coordinates_test update_coordinates_test.cpp -lNanoShaper
+# then run with LD_LIBRARY_PATH=../../build_so/ ./update_coordinates_test [surface]
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define TEST_INFO " <<UPDATE COORDINATES TEST>>"
+
+#include "../../src/nanoshaper.h"
+
+// usage: update_coordinates_test [surface] [xyzr file]
+// Builds the surface of 1crn, moves the atoms by less than half of the grid margin and gets the new
+// surface by updateCoordinates + rebuild, which keeps the grid. A fresh NanoShaper is then built on
+// the moved atoms and on the same grid, given by its bounds. The test fails if the grid was not kept
+// or if the status of any grid point, the volume or the area of the two differ.
+
+static const double scale = 2.0;
+static const double perfil = 50.0;
+static const double probe = 1.4;
+static const double stern_layer = 2.0;
+
+static bool readXYZR(const std::string &fileName,std::vector<NS::Atom> &atoms)
+{
+	std::ifstream fin(fileName.c_str());
+	if (!fin.is_open())
+		return false;
+
+	double x,y,z,r;
+	while (fin >> x >> y >> z >> r)
+		atoms.push_back(NS::Atom(x,y,z,r,0,0));
+
+	return atoms.size() > 0;
+}
+
+static void configure(NS::NanoShaper &ns,const std::string &surface)
+{
+	ns.setConfig<std::string>("Surface",surface);
+	ns.setConfig<double>("Grid_scale",scale);
+	ns.setConfig<double>("Grid_perfil",perfil);
+	ns.setConfig<bool>("Build_epsilon_maps",true);
+	ns.setConfig<bool>("Build_status_map",true);
+	ns.setConfig<bool>("Patch_Based_Algorithm",false);
+	ns.setConfig<bool>("Blobby_Ray_Marching",true);
+}
+
+int main(int argc, char* argv[])
+{
+	std::string surface = (argc > 1) ? argv[1] : "ses";
+	std::string fileName = (argc > 2) ? argv[2] : "../1crn_ses/1crn.xyzr";
+
+	std::vector<NS::Atom> atoms;
+	if (!readXYZR(fileName,atoms))
+	{
+		std::cout << std::endl << TEST_INFO << " Cannot read " << fileName << std::endl;
+		return 1;
+	}
+
+	NS::NanoShaper kept(atoms,NS::ses,probe,stern_layer,1);
+	configure(kept,surface);
+
+	double volume = 0, area = 0;
+	kept.buildAnalyticalSurface();
+	kept.colourGrid(&volume);
+	std::cout << std::endl << TEST_INFO << " Volume before moving " << volume;
+
+	// a shift of the whole molecule plus a small, different displacement of each atom
+	std::vector<double> pos(3*atoms.size());
+	for (unsigned i=0; i<atoms.size(); i++)
+	{
+		pos[3*i]   = atoms[i].pos[0] + 4.0 + 0.2*sin(1.3*i);
+		pos[3*i+1] = atoms[i].pos[1] - 0.4 + 0.2*cos(0.7*i);
+		pos[3*i+2] = atoms[i].pos[2] + 0.3 + 0.2*sin(2.1*i);
+		atoms[i].pos[0] = pos[3*i];
+		atoms[i].pos[1] = pos[3*i+1];
+		atoms[i].pos[2] = pos[3*i+2];
+	}
+
+	double keptVolume = 0, keptArea = 0;
+	if (!kept.updateCoordinates(&pos[0]) || !kept.rebuild(true,&keptVolume) || !kept.triangulate(&keptArea))
+	{
+		std::cout << std::endl << TEST_INFO << " Rebuild failed" << std::endl;
+		return 1;
+	}
+
+	if (!kept.getRebuildTimes().gridKept)
+	{
+		std::cout << std::endl << TEST_INFO << " The grid was not kept" << std::endl;
+		return 1;
+	}
+
+	std::vector<unsigned> size;
+	std::vector<double> cmin, cmax;
+	kept.getGridSize(size);
+	kept.getGridPointCoordinates(0,0,0,cmin);
+	kept.getGridPointCoordinates(size[0]-1,size[1]-1,size[2]-1,cmax);
+
+	NS::NanoShaper fresh(atoms,NS::ses,probe,stern_layer,1);
+	configure(fresh,surface);
+	fresh.setConfig<bool>("PB_grid_mode",true);
+	fresh.setConfig<double>("xmin",cmin[0]);
+	fresh.setConfig<double>("ymin",cmin[1]);
+	fresh.setConfig<double>("zmin",cmin[2]);
+	fresh.setConfig<double>("xmax",cmax[0]);
+	fresh.setConfig<double>("ymax",cmax[1]);
+	fresh.setConfig<double>("zmax",cmax[2]);
+
+	double freshVolume = 0, freshArea = 0;
+	fresh.buildAnalyticalSurface();
+	fresh.colourGrid(&freshVolume);
+	fresh.triangulate(&freshArea);
+
+	std::vector<unsigned> freshSize;
+	fresh.getGridSize(freshSize);
+	if (freshSize != size)
+	{
+		std::cout << std::endl << TEST_INFO << " Grid sizes differ" << std::endl;
+		return 1;
+	}
+
+	int64_t diffs = 0;
+	for (unsigned iz=0; iz<size[2]; iz++)
+		for (unsigned iy=0; iy<size[1]; iy++)
+			for (unsigned ix=0; ix<size[0]; ix++)
+				diffs += kept.getGridPointStatus(ix,iy,iz) != fresh.getGridPointStatus(ix,iy,iz);
+
+	std::cout.precision(12);
+	std::cout << std::endl << TEST_INFO << " Status differences " << diffs;
+	std::cout << std::endl << TEST_INFO << " Volume " << keptVolume << " kept grid, " << freshVolume << " fresh";
+	std::cout << std::endl << TEST_INFO << " Area " << keptArea << " kept grid, " << freshArea << " fresh";
+
+	// the bounds of the fresh grid are read back from the kept one, up to rounding
+	bool ok = diffs == 0 && fabs(keptVolume-freshVolume) <= 1e-9*freshVolume && fabs(keptArea-freshArea) <= 1e-9*freshArea;
+	std::cout << std::endl << TEST_INFO << (ok ? " Passed" : " Failed") << std::endl;
+
+	kept.clean();
+	fresh.clean();
+
+	return ok ? 0 : 1;
+}
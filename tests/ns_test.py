@@ -6,6 +6,7 @@ import json
 import time
 import tarfile
 import shutil
+import struct
     
 
 class ns_test:
@@ -58,6 +59,12 @@ class ns_test:
             return False
         return True
 
+    def isMapFile(self, p_file):
+        name, ext = os.path.splitext(p_file)
+        if ext != '.txt' or os.path.splitext(name)[1] not in ['.epsmapx', '.epsmapy', '.epsmapz', '.idebmap', '.status']:
+            return False
+        return True
+
     def isAreasFile(self, p_file):
         name, ext = os.path.splitext(p_file)
         if ext != '.txt':
@@ -128,6 +135,111 @@ class ns_test:
         return verts, faces
 
 
+    def readLogValues(self, p_file):
+        
+        """
+        read the estimated volume and the surface area printed in a log file
+
+        """
+
+        values = {}
+        keys = {'volume': 'Estimated volume', 'area': 'surface area is'}
+
+        file = open(p_file, 'r')
+
+        for row in file:
+            for key, label in keys.items():
+                location = row.find(label)
+                if location != -1:
+                    values[key] = float(row[location+len(label):].split()[0])
+
+        file.close()
+        return values
+
+
+    def readMap(self, p_file):
+        
+        """
+        read the values of a grid map saved as text (e.g. the idebmap)
+
+        """
+
+        file = open(p_file, 'r')
+        values = np.array(file.read().split(), dtype=int)
+        file.close()
+        return values
+
+
+    def readMapsContainer(self, p_file):
+
+        """
+        read a binary maps container (.nsmap), see DelPhiShared::saveMapsContainer for the layout
+
+        :return the grid size (nx, ny, nz) and the decoded maps by name, in file order (x fastest)
+
+        """
+
+        file = open(p_file, 'rb')
+        data = file.read()
+        file.close()
+
+        if data[0:6] != b'NSMAPS':
+            raise ValueError("{} is not a maps container".format(p_file))
+
+        version, num_maps = struct.unpack_from('<2i', data, 8)
+        if version != 1:
+            raise ValueError("{} has unknown version {}".format(p_file, version))
+
+        dims = struct.unpack_from('<3q', data, 16)
+        types = {0: '<u1', 1: '<i4', 2: '<f8'}
+
+        # header 72 bytes, 40 bytes per map record, then 32 bytes per chunk index entry
+        records = [struct.unpack_from('<16s2iQi', data, 72 + 40*m) for m in range(num_maps)]
+        entry = 72 + 40*num_maps
+
+        maps = {}
+        for name, type, codec, count, num_chunks in records:
+            dtype = np.dtype(types[type])
+            values = np.zeros(count, dtype)
+
+            for c in range(num_chunks):
+                offset, size, first, n = struct.unpack_from('<4Q', data, entry)
+                entry = entry + 32
+
+                if codec == 0:
+                    values[first:first+n] = np.frombuffer(data, dtype, n, offset)
+                else:
+                    runs = np.frombuffer(data, np.dtype([('run', '<u4'), ('value', dtype)]), size // (4 + dtype.itemsize), offset)
+                    values[first:first+n] = np.repeat(runs['value'], runs['run'])
+
+            maps[name.rstrip(b'\0').decode()] = values
+
+        return dims, maps
+
+
+    def readMapFromContainer(self, p_file):
+
+        """
+        read the values of the text map p_file from the maps container saved in its place
+        (e.g. mol.epsmapx.txt from mol.epsmap.nsmap), in the order of the text file
+
+        :return None if no container holds the map
+
+        """
+
+        prefix, name = os.path.splitext(os.path.splitext(p_file)[0])
+
+        for container in glob.glob(prefix + '.*.nsmap'):
+            dims, maps = self.readMapsContainer(container)
+
+            if name[1:] in maps:
+                # the text file runs over i, j, k with k fastest
+                nx, ny, nz = dims
+                return maps[name[1:]].reshape(nz, ny, nx).transpose(2, 1, 0).ravel().astype(int)
+
+        return None
+
+
     def readAreas(self, p_file):
         
         """
@@ -218,6 +330,26 @@ class ns_test:
                         self.valuemsg = "{} {}".format(self.valuemsg, p_file)
                         self.failed = True
 
+            elif self.isMapFile(p_file):
+                ref_map = self.readMap(ref_file)
+
+                # a binary or rle run saves the map in a container instead of the text file
+                if os.path.isfile(test_file):
+                    test_map = self.readMap(test_file)
+                else:
+                    test_map = self.readMapFromContainer(test_file)
+
+                # grid maps are compared point by point
+                if test_map is None:
+                    self.outmsg = "{} {}".format(self.outmsg, p_file)
+                    self.failed = True
+                elif test_map.shape != ref_map.shape:
+                    self.shapemsg = "{} {}".format(self.shapemsg, p_file)
+                    self.failed = True
+                elif not np.array_equal(ref_map, test_map):
+                    self.valuemsg = "{} {}({} points)".format(self.valuemsg, p_file, np.count_nonzero(ref_map != test_map))
+                    self.failed = True
+
             elif self.isAreasFile(p_file):
                 ref_areas = self.readAreas(ref_file)
                 test_areas = self.readAreas(test_file)
@@ -250,6 +382,20 @@ class ns_test:
                 test_lines = t_file.readlines()
                 ref_lines = r_file.readlines()
 
+                t_file.close()
+                r_file.close()
+
+                ref_values = self.readLogValues(ref_file)
+                test_values = self.readLogValues(test_file)
+
+                # tolerances in volume and area values
+                rel_tol = 1.e-2
+                abs_tol = 1.e-3
+                for key in ref_values:
+                    if key not in test_values or not np.isclose(test_values[key], ref_values[key], rel_tol, abs_tol):
+                        self.valuemsg = "{} {}({})".format(self.valuemsg, p_file, key)
+                        self.failed = True
+
                 for test_row in test_lines:
 
                     # pocket = 'Pocket'
@@ -324,7 +470,7 @@ class ns_test:
             for ref_file in ref_files:
                 ref_path = (os.path.join(self.test_dir, ref_file))
 
-                if os.path.isfile(ref_path):
+                if os.path.isfile(ref_path) or self.isMapFile(ref_file):
                     self.compareShapesAndValues(ref_file)
                     
                 else:
@@ -386,6 +532,8 @@ class ns_test:
                     os.remove(outfile)
                 for outfile in glob.iglob(os.path.join(self.test_dir, '*.off')):
                     os.remove(outfile)
+                for outfile in glob.iglob(os.path.join(self.test_dir, '*.nsmap')):
+                    os.remove(outfile)
 
         except Exception as err:
             self.genmsg = "{} Cleanup - {}".format(self.genmsg, self.name,err)
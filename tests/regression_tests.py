@@ -8,7 +8,7 @@ import numpy as np
 def argsParser():
     parser = argparse.ArgumentParser(prog='nanoshaper_regression_tests', description='Manage regression tests for nanoshaper')
     parser.add_argument('--testname', help='specific regression test to run', default='all')
-    parser.add_argument('--refdir', help='path of the reference output files/directories', default='./')
+    parser.add_argument('--refdir', help='path of the reference output files/directories, e.g. reference', default='./')
     parser.add_argument('--testdir', help='path of the output files/directories of the tested exec', default='./')
     parser.add_argument('--execdir', help='path of the executable file', default='../build/')
     parser.add_argument('--testtype', help='light test or full test', default='light')
@@ -63,7 +63,7 @@ if __name__ == "__main__":
     try:
         if args.testname == 'all':
             for test in os.listdir(ref_dir):
-                if test == '__pycache__':
+                if test == '__pycache__' or test == 'reference':
                     continue
                 test_dir = os.path.join(mother_test_dir, test)
                 local_ref_dir = os.path.join(ref_dir, test)